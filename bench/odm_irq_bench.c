@@ -0,0 +1,250 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+/*
+ * Interrupt delivery benchmark.
+ *
+ * Compares the epoll and io_uring backends of the reactor. A writer thread
+ * signals bursts of eventfds, as the MSI-X vectors of the device would, and
+ * waits for the reactor to call back for all of them. Reports the write to
+ * callback latency, the reactor thread wakeups and the CPU time of the
+ * process per interrupt. The writer sleeps while it waits, so the CPU time is
+ * mostly the one of the reactor.
+ */
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "odm_pf.h"
+#include "reactor.h"
+
+#define BENCH_DEF_BURSTS	20000
+#define BENCH_DEF_VECTORS	8
+#define BENCH_MAX_VECTORS	64
+
+struct bench_vec {
+	int efd;
+	uint64_t write_ns;
+};
+
+struct bench_result {
+	const char *backend;
+	uint64_t p50_ns;
+	uint64_t p99_ns;
+	double wakeups_per_irq;
+	double cpu_ns_per_irq;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* Callbacks left in the current burst */
+	int left;
+	uint64_t *lat_ns;
+	uint64_t nb_lat;
+} bench = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void
+bench_irq_cb(void *cb_arg)
+{
+	struct bench_vec *vec = cb_arg;
+	uint64_t now = odm_now_ns();
+
+	pthread_mutex_lock(&bench.lock);
+	bench.lat_ns[bench.nb_lat++] = now - vec->write_ns;
+	if (--bench.left == 0)
+		pthread_cond_signal(&bench.cond);
+	pthread_mutex_unlock(&bench.lock);
+}
+
+static int
+bench_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t
+bench_cpu_ns(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL +
+	       (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL;
+}
+
+static int
+bench_run(enum reactor_backend backend, struct bench_vec *vecs, int nb_vecs, int bursts,
+	  struct bench_result *res)
+{
+	uint64_t one = 1, wakeups = 0, cpu_ns, nb_irqs = (uint64_t)bursts * nb_vecs;
+	int i, v, b, rc = -1;
+
+	bench.nb_lat = 0;
+	reactor_backend_set(backend);
+	reactor_wakeup_counter_set(&wakeups);
+	for (i = 0; i < nb_vecs; i++) {
+		if (reactor_efd_add(vecs[i].efd, bench_irq_cb, &vecs[i]))
+			goto del_vecs;
+	}
+	res->backend = reactor_backend_name();
+
+	cpu_ns = bench_cpu_ns();
+	for (b = 0; b < bursts; b++) {
+		pthread_mutex_lock(&bench.lock);
+		bench.left = nb_vecs;
+		pthread_mutex_unlock(&bench.lock);
+
+		for (v = 0; v < nb_vecs; v++) {
+			vecs[v].write_ns = odm_now_ns();
+			if (write(vecs[v].efd, &one, sizeof(one)) != sizeof(one)) {
+				log_write(LOG_ERR, "Failed to write eventfd\n");
+				goto del_vecs;
+			}
+		}
+
+		pthread_mutex_lock(&bench.lock);
+		while (bench.left)
+			pthread_cond_wait(&bench.cond, &bench.lock);
+		pthread_mutex_unlock(&bench.lock);
+	}
+	cpu_ns = bench_cpu_ns() - cpu_ns;
+	rc = 0;
+
+del_vecs:
+	while (i-- > 0)
+		reactor_fd_del(vecs[i].efd);
+	reactor_fini();
+	reactor_wakeup_counter_set(NULL);
+	if (rc)
+		return rc;
+
+	qsort(bench.lat_ns, bench.nb_lat, sizeof(uint64_t), bench_cmp_u64);
+	res->p50_ns = bench.lat_ns[bench.nb_lat / 2];
+	res->p99_ns = bench.lat_ns[bench.nb_lat * 99 / 100];
+	res->wakeups_per_irq = (double)wakeups / nb_irqs;
+	res->cpu_ns_per_irq = (double)cpu_ns / nb_irqs;
+
+	return 0;
+}
+
+static void
+bench_print(const struct bench_result *res, int nb_res, int nb_vecs, int bursts, bool json)
+{
+	int i;
+
+	if (json) {
+		printf("{\n  \"benchmark\": \"odm_irq_bench\",\n  \"bursts\": %d,\n"
+		       "  \"vectors\": %d,\n", bursts, nb_vecs);
+		printf("  \"results\": [");
+		for (i = 0; i < nb_res; i++)
+			printf("%s\n    {\"backend\": \"%s\", \"p50_ns\": %lu, \"p99_ns\": %lu, "
+			       "\"wakeups_per_irq\": %.3f, \"cpu_ns_per_irq\": %.1f}",
+			       i ? "," : "", res[i].backend, res[i].p50_ns, res[i].p99_ns,
+			       res[i].wakeups_per_irq, res[i].cpu_ns_per_irq);
+		printf("\n  ]\n}\n");
+		return;
+	}
+
+	printf("%-10s %10s %10s %14s %14s\n", "Backend", "p50 ns", "p99 ns", "wakeups/irq",
+	       "cpu ns/irq");
+	for (i = 0; i < nb_res; i++)
+		printf("%-10s %10lu %10lu %14.3f %14.1f\n", res[i].backend, res[i].p50_ns,
+		       res[i].p99_ns, res[i].wakeups_per_irq, res[i].cpu_ns_per_irq);
+}
+
+static void
+print_usage(const char *prog_name)
+{
+	fprintf(stderr, "Usage: %s [-c] [-l log_level] [-n bursts] [-v vectors] [-j]\n",
+		prog_name);
+	fprintf(stderr, "  -c             Enable console logging\n");
+	fprintf(stderr, "  -l log_level   Log level (default %d)\n", LOG_WARNING);
+	fprintf(stderr, "  -n bursts      Interrupt bursts per backend (default %d)\n",
+		BENCH_DEF_BURSTS);
+	fprintf(stderr, "  -v vectors     Vectors signalled in each burst, 1-%d (default %d)\n",
+		BENCH_MAX_VECTORS, BENCH_DEF_VECTORS);
+	fprintf(stderr, "  -j             Print results as JSON\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int bursts = BENCH_DEF_BURSTS, nb_vecs = BENCH_DEF_VECTORS, log_level = LOG_WARNING;
+	bool console_logging_enabled = false, json = false;
+	struct bench_vec vecs[BENCH_MAX_VECTORS];
+	struct bench_result res[REACTOR_BACKEND_MAX];
+	int i, v, opt, rc = 0;
+
+	while ((opt = getopt(argc, argv, "cl:n:v:j")) != EOF) {
+		switch (opt) {
+		case 'c':
+			console_logging_enabled = true;
+			break;
+		case 'l':
+			log_level = atoi(optarg);
+			break;
+		case 'n':
+			bursts = atoi(optarg);
+			if (bursts <= 0)
+				print_usage(argv[0]);
+			break;
+		case 'v':
+			nb_vecs = atoi(optarg);
+			if (nb_vecs <= 0 || nb_vecs > BENCH_MAX_VECTORS)
+				print_usage(argv[0]);
+			break;
+		case 'j':
+			json = true;
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+
+	log_init("odm_irq_bench", log_level, console_logging_enabled);
+
+	bench.lat_ns = calloc((size_t)bursts * nb_vecs, sizeof(uint64_t));
+	if (!bench.lat_ns) {
+		rc = -1;
+		goto exit;
+	}
+
+	for (v = 0; v < nb_vecs; v++) {
+		vecs[v].efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (vecs[v].efd < 0) {
+			log_write(LOG_ERR, "Failed to create eventfd\n");
+			rc = -1;
+			goto close_vecs;
+		}
+	}
+
+	for (i = 0; i < REACTOR_BACKEND_MAX; i++) {
+		rc = bench_run(i, vecs, nb_vecs, bursts, &res[i]);
+		if (rc)
+			goto close_vecs;
+	}
+	bench_print(res, REACTOR_BACKEND_MAX, nb_vecs, bursts, json);
+
+close_vecs:
+	while (v-- > 0)
+		close(vecs[v].efd);
+	free(bench.lat_ns);
+exit:
+	log_fini();
+
+	return rc;
+}
@@ -0,0 +1,375 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+/*
+ * Mailbox round-trip benchmark.
+ *
+ * Drives ODM_DEV_INIT/ODM_QUEUE_OPEN/ODM_DEV_CLOSE from 1 up to 16 concurrent
+ * simulated VFs against the PF driver running on the sim backend. Each VF
+ * thread sends a command, waits for the PF response and records the
+ * round-trip latency. Latency percentiles and commands/sec are reported per
+ * command type and per VF count.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "odm_pf.h"
+#include "odm_pf_sim.h"
+#include "reactor.h"
+
+#define BENCH_DEF_ITERATIONS	10000
+#define BENCH_DEF_TIMEOUT_MS	1000
+
+enum bench_cmd {
+	BENCH_CMD_DEV_INIT,
+	BENCH_CMD_QUEUE_OPEN,
+	BENCH_CMD_DEV_CLOSE,
+	BENCH_CMD_MAX
+};
+
+static const struct {
+	const char *name;
+	uint8_t cmd;
+} bench_cmds[BENCH_CMD_MAX] = {
+	[BENCH_CMD_DEV_INIT] = {"DEV_INIT", ODM_DEV_INIT},
+	[BENCH_CMD_QUEUE_OPEN] = {"QUEUE_OPEN", ODM_QUEUE_OPEN},
+	[BENCH_CMD_DEV_CLOSE] = {"DEV_CLOSE", ODM_DEV_CLOSE},
+};
+
+struct bench_samples {
+	uint64_t *lat_ns;
+	uint64_t count;
+	uint64_t timeouts;
+};
+
+struct bench_vf {
+	pthread_t thread;
+	struct odm_dev *odm_pf;
+	uint8_t vf_id;
+	int iterations;
+	int timeout_ms;
+	int maxq;
+	struct bench_samples samples[BENCH_CMD_MAX];
+};
+
+struct bench_result {
+	int nb_vfs;
+	double elapsed_s;
+	struct bench_samples samples[BENCH_CMD_MAX];
+};
+
+static inline uint64_t
+bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+bench_send(struct bench_vf *vf, enum bench_cmd type, uint8_t q_idx)
+{
+	struct bench_samples *s = &vf->samples[type];
+	union odm_mbox_msg_t msg;
+	uint64_t start;
+
+	msg.u[0] = 0;
+	msg.u[1] = 0;
+	msg.q.vf_id = vf->vf_id;
+	msg.q.q_idx = q_idx;
+	msg.q.cmd = bench_cmds[type].cmd;
+
+	start = bench_now_ns();
+	if (odm_sim_vf_mbox_send(vf->odm_pf, vf->vf_id, &msg, vf->timeout_ms) ||
+	    msg.d.rsp != bench_cmds[type].cmd) {
+		s->timeouts++;
+		return;
+	}
+	s->lat_ns[s->count++] = bench_now_ns() - start;
+}
+
+static void *
+bench_vf_thread(void *arg)
+{
+	struct bench_vf *vf = arg;
+	int i, q;
+
+	/* One iteration is the VF lifecycle of a DPDK application restart */
+	for (i = 0; i < vf->iterations; i++) {
+		bench_send(vf, BENCH_CMD_DEV_INIT, 0);
+		for (q = 0; q < vf->maxq; q++)
+			bench_send(vf, BENCH_CMD_QUEUE_OPEN, q);
+		bench_send(vf, BENCH_CMD_DEV_CLOSE, 0);
+	}
+
+	return NULL;
+}
+
+static int
+bench_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static uint64_t
+bench_percentile(const struct bench_samples *s, double pct)
+{
+	uint64_t idx;
+
+	if (!s->count)
+		return 0;
+
+	idx = (uint64_t)(pct / 100.0 * s->count + 0.5);
+	if (idx > 0)
+		idx--;
+	if (idx >= s->count)
+		idx = s->count - 1;
+
+	return s->lat_ns[idx];
+}
+
+static int
+bench_run(struct odm_dev *odm_pf, int nb_vfs, int iterations, int timeout_ms,
+	  struct bench_result *res)
+{
+	struct bench_vf *vfs;
+	uint64_t start, n;
+	int i, t, rc = 0;
+
+	vfs = calloc(nb_vfs, sizeof(*vfs));
+	if (!vfs)
+		return -ENOMEM;
+
+	memset(res, 0, sizeof(*res));
+	res->nb_vfs = nb_vfs;
+
+	for (i = 0; i < nb_vfs; i++) {
+		vfs[i].odm_pf = odm_pf;
+		vfs[i].vf_id = i;
+		vfs[i].iterations = iterations;
+		vfs[i].timeout_ms = timeout_ms;
+		vfs[i].maxq = odm_pf->pmem->maxq_per_vf;
+		for (t = 0; t < BENCH_CMD_MAX; t++) {
+			n = iterations;
+			if (t == BENCH_CMD_QUEUE_OPEN)
+				n *= vfs[i].maxq;
+			vfs[i].samples[t].lat_ns = calloc(n, sizeof(uint64_t));
+			if (!vfs[i].samples[t].lat_ns) {
+				rc = -ENOMEM;
+				goto free_vfs;
+			}
+		}
+	}
+
+	start = bench_now_ns();
+	for (i = 0; i < nb_vfs; i++)
+		pthread_create(&vfs[i].thread, NULL, bench_vf_thread, &vfs[i]);
+	for (i = 0; i < nb_vfs; i++)
+		pthread_join(vfs[i].thread, NULL);
+	res->elapsed_s = (bench_now_ns() - start) / 1e9;
+
+	/* Merge the per-VF samples of each command type */
+	for (t = 0; t < BENCH_CMD_MAX; t++) {
+		struct bench_samples *s = &res->samples[t];
+
+		for (i = 0; i < nb_vfs; i++)
+			s->count += vfs[i].samples[t].count;
+
+		s->lat_ns = calloc(s->count ? s->count : 1, sizeof(uint64_t));
+		if (!s->lat_ns) {
+			rc = -ENOMEM;
+			goto free_vfs;
+		}
+
+		n = 0;
+		for (i = 0; i < nb_vfs; i++) {
+			memcpy(&s->lat_ns[n], vfs[i].samples[t].lat_ns,
+			       vfs[i].samples[t].count * sizeof(uint64_t));
+			n += vfs[i].samples[t].count;
+			s->timeouts += vfs[i].samples[t].timeouts;
+		}
+		qsort(s->lat_ns, s->count, sizeof(uint64_t), bench_cmp_u64);
+	}
+
+free_vfs:
+	for (i = 0; i < nb_vfs; i++) {
+		for (t = 0; t < BENCH_CMD_MAX; t++)
+			free(vfs[i].samples[t].lat_ns);
+	}
+	free(vfs);
+	return rc;
+}
+
+static void
+bench_print(const struct bench_result *res, int nb_res, int nb_workers, const char *mode,
+	    bool json)
+{
+	const struct bench_samples *s;
+	int r, t;
+
+	if (json) {
+		printf("{\n  \"benchmark\": \"odm_mbox_bench\",\n  \"backend\": \"sim\",\n");
+		printf("  \"mbox_mode\": \"%s\",\n  \"mbox_workers\": %d,\n", mode, nb_workers);
+		printf("  \"results\": [");
+		for (r = 0; r < nb_res; r++) {
+			for (t = 0; t < BENCH_CMD_MAX; t++) {
+				s = &res[r].samples[t];
+				printf("%s\n    {\"vfs\": %d, \"cmd\": \"%s\", \"count\": %lu, "
+				       "\"timeouts\": %lu, \"p50_ns\": %lu, \"p99_ns\": %lu, "
+				       "\"p999_ns\": %lu, \"max_ns\": %lu, \"cmds_per_sec\": %.1f}",
+				       (r || t) ? "," : "", res[r].nb_vfs, bench_cmds[t].name,
+				       s->count, s->timeouts, bench_percentile(s, 50),
+				       bench_percentile(s, 99), bench_percentile(s, 99.9),
+				       s->count ? s->lat_ns[s->count - 1] : 0,
+				       s->count / res[r].elapsed_s);
+			}
+		}
+		printf("\n  ]\n}\n");
+		return;
+	}
+
+	printf("%-4s %-11s %10s %8s %10s %10s %10s %10s %12s\n", "VFs", "Command", "Count",
+	       "Timeout", "p50(ns)", "p99(ns)", "p99.9(ns)", "max(ns)", "cmds/sec");
+	for (r = 0; r < nb_res; r++) {
+		for (t = 0; t < BENCH_CMD_MAX; t++) {
+			s = &res[r].samples[t];
+			printf("%-4d %-11s %10lu %8lu %10lu %10lu %10lu %10lu %12.1f\n",
+			       res[r].nb_vfs, bench_cmds[t].name, s->count, s->timeouts,
+			       bench_percentile(s, 50), bench_percentile(s, 99),
+			       bench_percentile(s, 99.9), s->count ? s->lat_ns[s->count - 1] : 0,
+			       s->count / res[r].elapsed_s);
+		}
+	}
+}
+
+static void
+print_usage(const char *prog_name)
+{
+	fprintf(stderr, "Usage: %s [-c] [-l log_level] [-n iterations] [-v max_vfs] [-t ms]"
+		" [-w workers] [-p cpu] [-j]\n", prog_name);
+	fprintf(stderr, "  -c             Enable console logging (default disabled)\n");
+	fprintf(stderr, "  -l log_level   Set global log level (0-7) (default LOG_WARNING)\n");
+	fprintf(stderr, "  -n iterations  VF lifecycles per VF (default %d)\n",
+		BENCH_DEF_ITERATIONS);
+	fprintf(stderr, "  -v max_vfs     Run with 1,2,4,.. up to max_vfs VFs (default %d)\n",
+		ODM_MAX_VFS);
+	fprintf(stderr, "  -t ms          Response timeout per command (default %d)\n",
+		BENCH_DEF_TIMEOUT_MS);
+	fprintf(stderr, "  -w workers     Number of PF mailbox workers (default %d)\n",
+		ODM_MBOX_DEF_WORKERS);
+	fprintf(stderr, "  -p cpu         Poll the mailbox from a thread pinned to cpu, -1 for"
+		" unpinned\n");
+	fprintf(stderr, "  -j             Print results as JSON\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int iterations = BENCH_DEF_ITERATIONS, max_vfs = ODM_MAX_VFS;
+	int timeout_ms = BENCH_DEF_TIMEOUT_MS, nb_workers = ODM_MBOX_DEF_WORKERS;
+	bool console_logging_enabled = false, json = false;
+	struct odm_dev_config dev_cfg = {0};
+	struct bench_result res[5];
+	int log_lvl = LOG_WARNING;
+	struct odm_dev *odm_pf;
+	int opt, nb_vfs, nb_res = 0, rc = 0, r, t;
+	int poll_cpu = -1;
+	bool poll = false;
+
+	while ((opt = getopt(argc, argv, "cl:n:v:t:w:p:j")) != EOF) {
+		switch (opt) {
+		case 'c':
+			console_logging_enabled = true;
+			break;
+		case 'l':
+			log_lvl = atoi(optarg);
+			if (log_lvl < 0 || log_lvl > 7)
+				print_usage(argv[0]);
+			break;
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0)
+				print_usage(argv[0]);
+			break;
+		case 'v':
+			max_vfs = atoi(optarg);
+			if (max_vfs <= 0 || max_vfs > ODM_MAX_VFS)
+				print_usage(argv[0]);
+			break;
+		case 't':
+			timeout_ms = atoi(optarg);
+			if (timeout_ms <= 0)
+				print_usage(argv[0]);
+			break;
+		case 'w':
+			nb_workers = atoi(optarg);
+			if (nb_workers <= 0 || nb_workers > ODM_MAX_VFS)
+				print_usage(argv[0]);
+			break;
+		case 'p':
+			poll = true;
+			poll_cpu = atoi(optarg);
+			if (poll_cpu < -1)
+				print_usage(argv[0]);
+			break;
+		case 'j':
+			json = true;
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+
+	log_init("odm_mbox_bench", log_lvl, console_logging_enabled);
+
+	/* Create all VFs so that any number of them can be driven concurrently */
+	dev_cfg.backend = &odm_pf_sim_backend;
+	dev_cfg.eng_sel = 0xCCCCCCCC;
+	dev_cfg.num_vfs = ODM_MAX_VFS;
+	dev_cfg.mbox_workers = nb_workers;
+	dev_cfg.mbox_mode = poll ? ODM_MBOX_MODE_POLL : ODM_MBOX_MODE_IRQ;
+	dev_cfg.mbox_poll_cpu = poll_cpu;
+
+	odm_pf = odm_pf_probe(&dev_cfg);
+	if (!odm_pf) {
+		fprintf(stderr, "Failed to probe simulated ODM PF\n");
+		rc = -1;
+		goto exit;
+	}
+
+	for (nb_vfs = 1; nb_vfs <= max_vfs; nb_vfs *= 2) {
+		rc = bench_run(odm_pf, nb_vfs, iterations, timeout_ms, &res[nb_res]);
+		if (rc) {
+			fprintf(stderr, "Benchmark with %d VFs failed, %s\n", nb_vfs,
+				strerror(-rc));
+			break;
+		}
+		nb_res++;
+	}
+
+	bench_print(res, nb_res, nb_workers, poll ? "poll" : "irq", json);
+
+	for (r = 0; r < nb_res; r++) {
+		for (t = 0; t < BENCH_CMD_MAX; t++)
+			free(res[r].samples[t].lat_ns);
+	}
+
+	odm_pf_release(odm_pf);
+exit:
+	reactor_fini();
+	log_fini();
+
+	return rc;
+}
@@ -0,0 +1,183 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+/*
+ * Register accessor microbenchmark.
+ *
+ * Measures the cost of the ordered and relaxed register accessors, shadowed
+ * config register reads and the 64 REQQ interrupt enable writes done one by
+ * one and as a batch. The accessors run against a BAR in normal memory, so
+ * the numbers show the overhead of the accessors and their barriers rather
+ * than the device latency of a real MMIO access.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "odm_pf.h"
+
+#define BENCH_DEF_ITERATIONS	1000000
+
+enum bench_case {
+	BENCH_WRITE,
+	BENCH_WRITE_RELAXED,
+	BENCH_READ,
+	BENCH_READ_RELAXED,
+	BENCH_READ_SHADOW,
+	BENCH_REQQ_ENA,
+	BENCH_REQQ_ENA_BATCH,
+	BENCH_CASE_MAX
+};
+
+static const char *const bench_case_names[BENCH_CASE_MAX] = {
+	[BENCH_WRITE] = "write",
+	[BENCH_WRITE_RELAXED] = "write_relaxed",
+	[BENCH_READ] = "read",
+	[BENCH_READ_RELAXED] = "read_relaxed",
+	[BENCH_READ_SHADOW] = "read_shadow",
+	[BENCH_REQQ_ENA] = "reqq_ena_x64",
+	[BENCH_REQQ_ENA_BATCH] = "reqq_ena_batch_x64",
+};
+
+/* Registers are accessed through the BAR mapping, no backend hooks */
+static const struct odm_pf_backend bench_mem_backend = {
+	.name = "mem",
+};
+
+static volatile uint64_t bench_sink;
+
+static uint64_t
+bench_case_run(struct odm_dev *odm_pf, enum bench_case bc, int iterations)
+{
+	struct odm_reg_op ops[2 * ODM_MAX_REQQ_INT];
+	uint64_t start, sum = 0;
+	int i, q;
+
+	for (q = 0; q < ODM_MAX_REQQ_INT; q++) {
+		ops[2 * q].offset = ODM_REQQX_INT(q);
+		ops[2 * q].val = ODM_REQQ_INT;
+		ops[2 * q + 1].offset = ODM_REQQX_INT_ENA_W1S(q);
+		ops[2 * q + 1].val = ODM_REQQ_INT;
+	}
+
+	start = odm_now_ns();
+	for (i = 0; i < iterations; i++) {
+		q = i & (ODM_MAX_REQQ_INT - 1);
+		switch (bc) {
+		case BENCH_WRITE:
+			odm_reg_write(odm_pf, ODM_REQQX_INT_ENA_W1S(q), i);
+			break;
+		case BENCH_WRITE_RELAXED:
+			odm_reg_write_relaxed(odm_pf, ODM_REQQX_INT_ENA_W1S(q), i);
+			break;
+		case BENCH_READ:
+			sum += odm_reg_read(odm_pf, ODM_REQQX_INT(q));
+			break;
+		case BENCH_READ_RELAXED:
+			sum += odm_reg_read_relaxed(odm_pf, ODM_REQQX_INT(q));
+			break;
+		case BENCH_READ_SHADOW:
+			sum += odm_reg_read(odm_pf, ODM_DMA_INTL_SEL);
+			break;
+		case BENCH_REQQ_ENA:
+			for (q = 0; q < ODM_MAX_REQQ_INT; q++) {
+				odm_reg_write(odm_pf, ODM_REQQX_INT(q), ODM_REQQ_INT);
+				odm_reg_write(odm_pf, ODM_REQQX_INT_ENA_W1S(q), ODM_REQQ_INT);
+			}
+			break;
+		case BENCH_REQQ_ENA_BATCH:
+			odm_reg_write_batch(odm_pf, ops, 2 * ODM_MAX_REQQ_INT);
+			break;
+		default:
+			break;
+		}
+	}
+	bench_sink = sum;
+
+	return odm_now_ns() - start;
+}
+
+static void
+print_usage(const char *prog_name)
+{
+	fprintf(stderr, "Usage: %s [-n iterations] [-j]\n", prog_name);
+	fprintf(stderr, "  -n iterations  Accesses per case (default %d)\n", BENCH_DEF_ITERATIONS);
+	fprintf(stderr, "  -j             Print results as JSON\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int iterations = BENCH_DEF_ITERATIONS, opt, bc;
+	struct vfio_pci_mem_resouce bar0 = {0};
+	uint64_t ns[BENCH_CASE_MAX];
+	struct odm_dev *odm_pf;
+	bool json = false;
+	int rc = 0;
+
+	while ((opt = getopt(argc, argv, "n:j")) != EOF) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			if (iterations <= 0)
+				print_usage(argv[0]);
+			break;
+		case 'j':
+			json = true;
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+
+	log_init("odm_reg_bench", LOG_WARNING, true);
+
+	odm_pf = calloc(1, sizeof(*odm_pf));
+	if (!odm_pf) {
+		rc = -1;
+		goto exit;
+	}
+
+	bar0.len = ODM_REG_SPACE_LEN;
+	bar0.addr = aligned_alloc(4096, (ODM_REG_SPACE_LEN + 4095) & ~4095ULL);
+	if (!bar0.addr) {
+		rc = -1;
+		goto free_pf;
+	}
+	memset(bar0.addr, 0, ODM_REG_SPACE_LEN);
+	odm_pf->backend = &bench_mem_backend;
+	odm_pf->pdev.mem = &bar0;
+
+	/* Warm up, and fill the shadow */
+	bench_case_run(odm_pf, BENCH_READ_SHADOW, 1000);
+
+	for (bc = 0; bc < BENCH_CASE_MAX; bc++)
+		ns[bc] = bench_case_run(odm_pf, bc, iterations);
+
+	if (json) {
+		printf("{\n  \"benchmark\": \"odm_reg_bench\",\n  \"iterations\": %d,\n",
+		       iterations);
+		printf("  \"results\": [");
+		for (bc = 0; bc < BENCH_CASE_MAX; bc++)
+			printf("%s\n    {\"case\": \"%s\", \"ns_per_op\": %.2f}", bc ? "," : "",
+			       bench_case_names[bc], (double)ns[bc] / iterations);
+		printf("\n  ]\n}\n");
+	} else {
+		printf("%-20s %12s\n", "Case", "ns/op");
+		for (bc = 0; bc < BENCH_CASE_MAX; bc++)
+			printf("%-20s %12.2f\n", bench_case_names[bc], (double)ns[bc] / iterations);
+	}
+
+	free(bar0.addr);
+free_pf:
+	free(odm_pf);
+exit:
+	log_fini();
+
+	return rc;
+}
@@ -30,6 +30,14 @@ if [ ! -f "$FLAG_FILE" ]; then
     touch "$FLAG_FILE"
 fi
 
+# A warm restart resumes the device as the last run left it, with the VFs in
+# place, so the device must not be rebound
+if grep -q '^WARM_RESTART="\?1' "$CFG_FILE" && [ -e /dev/shm/odm_pmem ] &&
+   [ "$(basename "$(readlink /sys/bus/pci/devices/$PCI_DEVICE/driver)")" = "$DRIVER" ]; then
+    echo "Warm restart, keeping PCI device $PCI_DEVICE bound to $DRIVER"
+    exit 0
+fi
+
 echo "Unbinding PCI device $PCI_DEVICE"
 echo $PCI_DEVICE > /sys/bus/pci/devices/$PCI_DEVICE/driver/unbind
 echo "Binding PCI device $PCI_DEVICE to driver $DRIVER"
@@ -2,20 +2,582 @@
  * Copyright (c) 2024 Marvell.
  */
 
+#include <poll.h>
+#include <pthread.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
 #include <syslog.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "log.h"
 
+/*
+ * Asynchronous logging. log_write() does not format the message: it stores
+ * the format pointer, the arguments and a timestamp in a ring of the calling
+ * thread, and a flusher thread formats the records and passes them to
+ * syslog. Each ring has a single producer, its thread, and a single consumer,
+ * the flusher, so neither side takes a lock. A full ring drops the message
+ * and counts it, the caller never waits for syslog.
+ *
+ * The arguments are taken from the format, as printf would. Strings are
+ * copied into the record, as they may not outlive the call. A message the
+ * record cannot hold, with too many arguments or a conversion not known, is
+ * formatted by the caller instead, into the record if it fits, else into a
+ * buffer the flusher frees. A message cut for want of memory is marked so.
+ *
+ * Before log_init() and after log_fini() the messages are written to syslog
+ * right away.
+ */
+
+/* Records per thread, a power of 2 */
+#define LOG_RING_SIZE		512
+#define LOG_MAX_RINGS		64
+#define LOG_MAX_ARGS		12
+#define LOG_STR_SIZE		128
+#define LOG_MSG_SIZE		1024
+#define LOG_SPEC_SIZE		32
+/* Wait of the idle flusher, in case a wakeup was missed */
+#define LOG_FLUSH_IDLE_MS	100
+
+enum log_arg_class {
+	LOG_ARG_NONE,
+	LOG_ARG_INT,
+	LOG_ARG_LONG,
+	LOG_ARG_LLONG,
+	LOG_ARG_UINT,
+	LOG_ARG_ULONG,
+	LOG_ARG_ULLONG,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_PTR,
+	LOG_ARG_STR,
+	LOG_ARG_INVALID,
+};
+
+struct log_record {
+	uint64_t ts_ns;
+	/* NULL if the message was formatted by the caller, into msg or str */
+	const char *format;
+	/* Message formatted by the caller which str could not hold, freed by the flusher */
+	char *msg;
+	int level;
+	uint8_t nargs;
+	uint8_t str_len;
+	/* str holds the start of a longer message */
+	bool truncated;
+	uint64_t args[LOG_MAX_ARGS];
+	char str[LOG_STR_SIZE];
+};
+
+struct log_ring {
+	/* Written by the owner thread */
+	uint32_t head __attribute__((aligned(64)));
+	uint64_t dropped;
+	/* Written by the flusher */
+	uint32_t tail __attribute__((aligned(64)));
+	uint64_t dropped_seen;
+	bool owned;
+	struct log_record rec[LOG_RING_SIZE];
+};
+
+static int log_level = LOG_INFO;
+static bool log_async;
+static bool log_stop;
+static bool log_idle;
+static int log_efd = -1;
+static pthread_t log_flusher;
+static pthread_key_t log_key;
+static pthread_mutex_t log_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct log_ring *log_rings[LOG_MAX_RINGS];
+/* Messages of threads which found no free ring */
+static uint64_t log_lost;
+static __thread struct log_ring *log_ring_self;
+
+static uint64_t
+log_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Parse the conversion at fmt, just after the '%'. The specification is
+ * copied to spec with the '*' width and precision left in place, and the
+ * class of each argument it takes is returned in classes.
+ */
+static const char *
+log_parse_spec(const char *fmt, char *spec, enum log_arg_class classes[3], int *nclasses)
+{
+	const char *start = fmt - 1;
+	int lng = 0, n = 0;
+	size_t len;
+
+	while (*fmt && strchr("-+ #0'", *fmt))
+		fmt++;
+	if (*fmt == '*') {
+		classes[n++] = LOG_ARG_INT;
+		fmt++;
+	}
+	while (*fmt >= '0' && *fmt <= '9')
+		fmt++;
+	if (*fmt == '.') {
+		fmt++;
+		if (*fmt == '*') {
+			classes[n++] = LOG_ARG_INT;
+			fmt++;
+		}
+		while (*fmt >= '0' && *fmt <= '9')
+			fmt++;
+	}
+
+	/* h and hh are promoted to int, z, j and t are long on LP64 */
+	while (*fmt && strchr("hlzjt", *fmt)) {
+		if (*fmt == 'l')
+			lng++;
+		else if (*fmt != 'h')
+			lng = 1;
+		fmt++;
+	}
+
+	switch (*fmt) {
+	case 'd':
+	case 'i':
+		classes[n++] = lng == 0 ? LOG_ARG_INT : lng == 1 ? LOG_ARG_LONG : LOG_ARG_LLONG;
+		break;
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X':
+		classes[n++] = lng == 0 ? LOG_ARG_UINT : lng == 1 ? LOG_ARG_ULONG : LOG_ARG_ULLONG;
+		break;
+	case 'c':
+		classes[n++] = LOG_ARG_INT;
+		break;
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		classes[n++] = LOG_ARG_DOUBLE;
+		break;
+	case 'p':
+		classes[n++] = LOG_ARG_PTR;
+		break;
+	case 's':
+		classes[n++] = lng ? LOG_ARG_INVALID : LOG_ARG_STR;
+		break;
+	case '%':
+		break;
+	default:
+		classes[n++] = LOG_ARG_INVALID;
+		break;
+	}
+	if (*fmt)
+		fmt++;
+
+	len = fmt - start;
+	if (len >= LOG_SPEC_SIZE) {
+		classes[n++] = LOG_ARG_INVALID;
+		len = 0;
+	}
+	memcpy(spec, start, len);
+	spec[len] = '\0';
+	*nclasses = n;
+
+	return fmt;
+}
+
+/* Take the arguments of the format, 0 if the record cannot hold them */
+static bool
+log_capture(struct log_record *rec, const char *format, va_list args)
+{
+	enum log_arg_class classes[3];
+	char spec[LOG_SPEC_SIZE];
+	const char *fmt = format;
+	int i, nclasses;
+	double dbl;
+	size_t len;
+	char *str;
+
+	rec->nargs = 0;
+	rec->str_len = 0;
+	while ((fmt = strchr(fmt, '%'))) {
+		fmt = log_parse_spec(fmt + 1, spec, classes, &nclasses);
+		for (i = 0; i < nclasses; i++) {
+			if (rec->nargs == LOG_MAX_ARGS)
+				return false;
+
+			switch (classes[i]) {
+			case LOG_ARG_INT:
+				rec->args[rec->nargs++] = va_arg(args, int);
+				break;
+			case LOG_ARG_UINT:
+				rec->args[rec->nargs++] = va_arg(args, unsigned int);
+				break;
+			case LOG_ARG_LONG:
+			case LOG_ARG_ULONG:
+				rec->args[rec->nargs++] = va_arg(args, unsigned long);
+				break;
+			case LOG_ARG_LLONG:
+			case LOG_ARG_ULLONG:
+				rec->args[rec->nargs++] = va_arg(args, unsigned long long);
+				break;
+			case LOG_ARG_DOUBLE:
+				dbl = va_arg(args, double);
+				memcpy(&rec->args[rec->nargs++], &dbl, sizeof(dbl));
+				break;
+			case LOG_ARG_PTR:
+				rec->args[rec->nargs++] = (uintptr_t)va_arg(args, void *);
+				break;
+			case LOG_ARG_STR:
+				/* Copied, the offset in str is kept */
+				str = va_arg(args, char *);
+				if (!str)
+					str = "(null)";
+				len = strlen(str);
+				if (len >= (size_t)(LOG_STR_SIZE - rec->str_len))
+					return false;
+				memcpy(rec->str + rec->str_len, str, len + 1);
+				rec->args[rec->nargs++] = rec->str_len;
+				rec->str_len += len + 1;
+				break;
+			default:
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/* Put the captured '*' width and precision in the specification */
+static void
+log_expand_stars(char *spec, const int *star)
+{
+	char buf[LOG_SPEC_SIZE];
+	char *p, *out = buf;
+	int i = 0;
+
+	for (p = spec; *p && out < buf + sizeof(buf) - 12; p++) {
+		if (*p == '*')
+			out += sprintf(out, "%d", star[i++]);
+		else
+			*out++ = *p;
+	}
+	*out = '\0';
+	memcpy(spec, buf, out - buf + 1);
+}
+
+/* Format a record, as snprintf would have with the captured arguments */
+static void
+log_format(const struct log_record *rec, char *msg, size_t size)
+{
+	enum log_arg_class classes[3];
+	const char *fmt = rec->format;
+	char spec[LOG_SPEC_SIZE];
+	int i, n, nclasses, a = 0;
+	size_t len = 0;
+	const char *pct;
+	uint64_t arg;
+	int star[2];
+	double dbl;
+
+	msg[0] = '\0';
+	while (len < size - 1) {
+		pct = strchr(fmt, '%');
+		n = snprintf(msg + len, size - len, "%.*s",
+			     (int)(pct ? pct - fmt : (long)strlen(fmt)), fmt);
+		if (n > 0)
+			len += (size_t)n < size - len ? (size_t)n : size - len - 1;
+		if (!pct || len >= size - 1)
+			break;
+
+		fmt = log_parse_spec(pct + 1, spec, classes, &nclasses);
+		if (!nclasses) {
+			msg[len++] = '%';
+			msg[len] = '\0';
+			continue;
+		}
+
+		/* The '*' width and precision come first */
+		for (i = 0; i < nclasses - 1; i++)
+			star[i] = (int)rec->args[a++];
+		if (nclasses > 1)
+			log_expand_stars(spec, star);
+		arg = rec->args[a++];
+
+		switch (classes[nclasses - 1]) {
+		case LOG_ARG_INT:
+			n = snprintf(msg + len, size - len, spec, (int)arg);
+			break;
+		case LOG_ARG_UINT:
+			n = snprintf(msg + len, size - len, spec, (unsigned int)arg);
+			break;
+		case LOG_ARG_LONG:
+		case LOG_ARG_ULONG:
+			n = snprintf(msg + len, size - len, spec, (unsigned long)arg);
+			break;
+		case LOG_ARG_LLONG:
+		case LOG_ARG_ULLONG:
+			n = snprintf(msg + len, size - len, spec, (unsigned long long)arg);
+			break;
+		case LOG_ARG_DOUBLE:
+			memcpy(&dbl, &arg, sizeof(dbl));
+			n = snprintf(msg + len, size - len, spec, dbl);
+			break;
+		case LOG_ARG_PTR:
+			n = snprintf(msg + len, size - len, spec, (void *)(uintptr_t)arg);
+			break;
+		case LOG_ARG_STR:
+			n = snprintf(msg + len, size - len, spec, rec->str + arg);
+			break;
+		default:
+			n = 0;
+			break;
+		}
+		if (n > 0)
+			len += (size_t)n < size - len ? (size_t)n : size - len - 1;
+	}
+}
+
+static void
+log_ring_release(void *ring)
+{
+	__atomic_store_n(&((struct log_ring *)ring)->owned, false, __ATOMIC_RELEASE);
+}
+
+/* Claim a ring for the calling thread, a drained one of an exited thread or a new one */
+static struct log_ring *
+log_ring_get(void)
+{
+	struct log_ring *ring = NULL;
+	int i;
+
+	if (log_ring_self)
+		return log_ring_self;
+
+	pthread_mutex_lock(&log_rings_lock);
+	for (i = 0; i < LOG_MAX_RINGS; i++) {
+		if (!log_rings[i]) {
+			log_rings[i] = calloc(1, sizeof(struct log_ring));
+			ring = log_rings[i];
+			break;
+		}
+		if (!__atomic_load_n(&log_rings[i]->owned, __ATOMIC_ACQUIRE) &&
+		    __atomic_load_n(&log_rings[i]->tail, __ATOMIC_ACQUIRE) ==
+		    __atomic_load_n(&log_rings[i]->head, __ATOMIC_ACQUIRE)) {
+			ring = log_rings[i];
+			break;
+		}
+	}
+	if (ring) {
+		ring->owned = true;
+		pthread_setspecific(log_key, ring);
+	}
+	pthread_mutex_unlock(&log_rings_lock);
+
+	log_ring_self = ring;
+
+	return ring;
+}
+
+static void
+log_flusher_wake(void)
+{
+	/* Pairs with the fence of the flusher going idle */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_exchange_n(&log_idle, false, __ATOMIC_ACQ_REL))
+		eventfd_write(log_efd, 1);
+}
+
+/* Format a message the record cannot hold the arguments of, in the caller */
+static void
+log_format_caller(struct log_record *rec, const char *format, va_list args)
+{
+	va_list copy;
+	int len;
+
+	va_copy(copy, args);
+	len = vsnprintf(rec->str, sizeof(rec->str), format, copy);
+	va_end(copy);
+	if (len < (int)sizeof(rec->str))
+		return;
+
+	/* As long as a message formatted by the flusher */
+	rec->truncated = len >= LOG_MSG_SIZE;
+	if (rec->truncated)
+		len = LOG_MSG_SIZE - 1;
+	rec->msg = malloc(len + 1);
+	if (!rec->msg) {
+		rec->truncated = true;
+		return;
+	}
+	vsnprintf(rec->msg, len + 1, format, args);
+}
+
 void
-log_write(int log_lvl, const char *format, ...)
+log_submit(int log_lvl, const char *format, ...)
 {
+	struct log_record *rec;
+	struct log_ring *ring;
 	va_list args;
+	uint32_t head;
+
+	if (log_lvl > __atomic_load_n(&log_level, __ATOMIC_RELAXED))
+		return;
+
+	if (!__atomic_load_n(&log_async, __ATOMIC_ACQUIRE)) {
+		va_start(args, format);
+		vsyslog(log_lvl, format, args);
+		va_end(args);
+		return;
+	}
 
+	ring = log_ring_get();
+	if (!ring) {
+		__atomic_fetch_add(&log_lost, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	head = ring->head;
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_RING_SIZE) {
+		__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	rec = &ring->rec[head & (LOG_RING_SIZE - 1)];
+	rec->ts_ns = log_now_ns();
+	rec->level = log_lvl;
+	rec->format = format;
+	rec->msg = NULL;
+	rec->truncated = false;
 	va_start(args, format);
-	vsyslog(log_lvl, format, args);
+	if (!log_capture(rec, format, args)) {
+		va_end(args);
+		va_start(args, format);
+		log_format_caller(rec, format, args);
+		rec->format = NULL;
+	}
 	va_end(args);
+
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	log_flusher_wake();
+}
+
+/* Ring holding the oldest record, NULL if all are drained */
+static struct log_ring *
+log_oldest(void)
+{
+	struct log_ring *ring, *oldest = NULL;
+	uint64_t ts = UINT64_MAX;
+	uint32_t tail;
+	int i;
+
+	for (i = 0; i < LOG_MAX_RINGS; i++) {
+		ring = __atomic_load_n(&log_rings[i], __ATOMIC_ACQUIRE);
+		if (!ring)
+			break;
+
+		tail = ring->tail;
+		if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail)
+			continue;
+		if (ring->rec[tail & (LOG_RING_SIZE - 1)].ts_ns < ts) {
+			ts = ring->rec[tail & (LOG_RING_SIZE - 1)].ts_ns;
+			oldest = ring;
+		}
+	}
+
+	return oldest;
+}
+
+static void
+log_report_drops(void)
+{
+	static uint64_t lost_seen;
+	uint64_t dropped = 0, lost, n;
+	struct log_ring *ring;
+	int i;
+
+	for (i = 0; i < LOG_MAX_RINGS; i++) {
+		ring = __atomic_load_n(&log_rings[i], __ATOMIC_ACQUIRE);
+		if (!ring)
+			break;
+		n = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+		dropped += n - ring->dropped_seen;
+		ring->dropped_seen = n;
+	}
+
+	lost = __atomic_load_n(&log_lost, __ATOMIC_RELAXED);
+	dropped += lost - lost_seen;
+	lost_seen = lost;
+	if (dropped)
+		syslog(LOG_WARNING, "%lu log messages dropped, the log rings were full\n", dropped);
+}
+
+static void *
+log_flusher_thread(void *arg)
+{
+	struct pollfd pfd = {.fd = log_efd, .events = POLLIN};
+	char msg[LOG_MSG_SIZE];
+	struct log_record *rec;
+	struct log_ring *ring;
+	eventfd_t val;
+
+	(void)arg;
+
+	for (;;) {
+		while ((ring = log_oldest())) {
+			rec = &ring->rec[ring->tail & (LOG_RING_SIZE - 1)];
+			if (rec->format)
+				log_format(rec, msg, sizeof(msg));
+			syslog(rec->level, "%s%s", rec->format ? msg : rec->msg ? rec->msg : rec->str,
+			       rec->truncated ? " [truncated]" : "");
+			free(rec->msg);
+			rec->msg = NULL;
+			__atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+		}
+		log_report_drops();
+
+		if (__atomic_load_n(&log_stop, __ATOMIC_ACQUIRE))
+			break;
+
+		/* Idle, unless a record came in before the producers could see it */
+		__atomic_store_n(&log_idle, true, __ATOMIC_RELEASE);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (!log_oldest() && !__atomic_load_n(&log_stop, __ATOMIC_ACQUIRE) &&
+		    poll(&pfd, 1, LOG_FLUSH_IDLE_MS) > 0)
+			eventfd_read(log_efd, &val);
+		__atomic_store_n(&log_idle, false, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+uint64_t
+log_dropped(void)
+{
+	struct log_ring *ring;
+	uint64_t dropped;
+	int i;
+
+	dropped = __atomic_load_n(&log_lost, __ATOMIC_RELAXED);
+	for (i = 0; i < LOG_MAX_RINGS; i++) {
+		ring = __atomic_load_n(&log_rings[i], __ATOMIC_ACQUIRE);
+		if (!ring)
+			break;
+		dropped += __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+	}
+
+	return dropped;
 }
 
 void
@@ -26,13 +588,51 @@ log_init(const char *id, int log_lvl, bool console_logging_enabled)
 	if (console_logging_enabled)
 		flags |= LOG_PERROR;
 
-	setlogmask(LOG_UPTO(log_lvl));
+	log_level_set(log_lvl);
 
 	openlog(id, flags, LOG_DAEMON);
+
+	/* Without the flusher the messages are written synchronously */
+	log_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (log_efd < 0)
+		return;
+
+	pthread_key_create(&log_key, log_ring_release);
+	log_stop = false;
+	if (pthread_create(&log_flusher, NULL, log_flusher_thread, NULL)) {
+		pthread_key_delete(log_key);
+		close(log_efd);
+		log_efd = -1;
+		return;
+	}
+	__atomic_store_n(&log_async, true, __ATOMIC_RELEASE);
+}
+
+void
+log_level_set(int log_lvl)
+{
+	__atomic_store_n(&log_level, log_lvl, __ATOMIC_RELAXED);
+	setlogmask(LOG_UPTO(log_lvl));
+}
+
+int
+log_level_get(void)
+{
+	return log_level;
 }
 
 void
 log_fini(void)
 {
+	if (__atomic_exchange_n(&log_async, false, __ATOMIC_ACQ_REL)) {
+		/* The flusher drains the rings before it exits */
+		__atomic_store_n(&log_stop, true, __ATOMIC_RELEASE);
+		eventfd_write(log_efd, 1);
+		pthread_join(log_flusher, NULL);
+		pthread_key_delete(log_key);
+		close(log_efd);
+		log_efd = -1;
+	}
+
 	closelog();
 }
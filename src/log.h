@@ -9,14 +9,25 @@
  *
  * APIs to log messages. The log messages can be written to syslog/console.
  * The log levels used are defined in syslog.h.
+ *
+ * Once log_init() is done, the messages are queued with their arguments in a
+ * ring of the calling thread and formatted and written by a flusher thread.
+ * Messages are dropped and counted when the ring is full. Messages above
+ * LOG_LEVEL_MAX are removed at compile time.
  */
 
 #ifndef __LOG_H__
 #define __LOG_H__
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <syslog.h>
 
+/* Highest log level compiled in, set with the log_level_max build option */
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX	LOG_DEBUG
+#endif
+
 /**
  * Initialize the logging library.
  *
@@ -30,12 +41,41 @@
 void log_init(const char *id, int log_lvl, bool console_logging_enabled);
 
 /**
- * Write a log message.
+ * Write a log message. The message is formatted later, string arguments are
+ * copied.
  *
  * @param	log_lvl	Log level of the message.
  * @param	format	Format string.
  */
-void log_write(int log_lvl, const char *format, ...);
+#define log_write(log_lvl, ...) \
+	do { \
+		if ((log_lvl) <= LOG_LEVEL_MAX) \
+			log_submit((log_lvl), __VA_ARGS__); \
+	} while (0)
+
+/* Queue a log message, use log_write() */
+void log_submit(int log_lvl, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Get the number of log messages dropped on a full ring.
+ *
+ * @return	Messages dropped since the start.
+ */
+uint64_t log_dropped(void);
+
+/**
+ * Change the log level.
+ *
+ * @param	log_lvl	Log level to be used, as for log_init().
+ */
+void log_level_set(int log_lvl);
+
+/**
+ * Get the log level in use.
+ *
+ * @return	Log level.
+ */
+int log_level_get(void);
 
 /**
  * Cleanup the logging library.
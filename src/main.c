@@ -4,8 +4,10 @@
 
 #include <errno.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -14,38 +16,116 @@
 #include "odm_pf.h"
 #include "odm_pf_selftest.h"
 #include "pmem.h"
+#include "reactor.h"
 #include "uuid.h"
 #include "vfio_pci.h"
 
-static volatile sig_atomic_t quit_signal;
+/* Signals received by the reactor, for the main thread */
+#define ODM_MAIN_QUIT		(1U << 0)
+#define ODM_MAIN_RELOAD		(1U << 1)
+#define ODM_MAIN_UPGRADE	(1U << 2)
+
+static pthread_mutex_t main_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t main_cond = PTHREAD_COND_INITIALIZER;
+static unsigned int main_events;
 
 enum {
 	OPT_LONG_MIN_NUM = 256,
 	OPT_VFIO_VF_TOKEN_NUM,
 	OPT_NUM_VFS,
+	OPT_BACKEND,
+	OPT_MBOX_WORKERS,
+	OPT_UTIL_INTERVAL,
+	OPT_SCLK_MHZ,
+	OPT_REBALANCE,
+	OPT_FIFO,
+	OPT_PROFILE,
+	OPT_MOLR,
+	OPT_TUNE,
+	OPT_TUNE_PATTERN,
+	OPT_TUNE_CFG,
+	OPT_PLACEMENT,
+	OPT_CFG,
+	OPT_WARM_RESTART,
+	OPT_TAKEOVER,
+	OPT_REACTOR,
+	OPT_MBOX_MODE,
+	OPT_MBOX_POLL_CPU,
+	OPT_MBOX_POLL_BACKOFF,
 	OPT_LONG_MAX_NUM
 };
 
 const struct option long_options[] = {
 	{"vfio-vf-token",     1, NULL, OPT_VFIO_VF_TOKEN_NUM},
 	{"num_vfs",           1, NULL, OPT_NUM_VFS},
+	{"backend",           1, NULL, OPT_BACKEND},
+	{"mbox_workers",      1, NULL, OPT_MBOX_WORKERS},
+	{"mbox_mode",         1, NULL, OPT_MBOX_MODE},
+	{"mbox_poll_cpu",     1, NULL, OPT_MBOX_POLL_CPU},
+	{"mbox_poll_backoff", 1, NULL, OPT_MBOX_POLL_BACKOFF},
+	{"util_interval",     1, NULL, OPT_UTIL_INTERVAL},
+	{"sclk_mhz",          1, NULL, OPT_SCLK_MHZ},
+	{"rebalance",         0, NULL, OPT_REBALANCE},
+	{"fifo",              1, NULL, OPT_FIFO},
+	{"profile",           1, NULL, OPT_PROFILE},
+	{"molr",              1, NULL, OPT_MOLR},
+	{"tune",              1, NULL, OPT_TUNE},
+	{"tune_pattern",      1, NULL, OPT_TUNE_PATTERN},
+	{"tune_cfg",          1, NULL, OPT_TUNE_CFG},
+	{"placement",         1, NULL, OPT_PLACEMENT},
+	{"cfg",               1, NULL, OPT_CFG},
+	{"warm_restart",      1, NULL, OPT_WARM_RESTART},
+	{"takeover",          1, NULL, OPT_TAKEOVER},
+	{"reactor",           1, NULL, OPT_REACTOR},
 	{0,                   0, NULL, 0                    }
 };
 
-void
-signal_handler(int sig_num)
+static void
+signal_handler(void *arg)
 {
+	int sig_num = (intptr_t)arg;
+	unsigned int event = 0;
+
 	if (sig_num == SIGTERM) {
 		log_write(LOG_WARNING, "Received SIGTERM, exiting...\n");
-		quit_signal = 1;
+		event = ODM_MAIN_QUIT;
+	} else if (sig_num == SIGHUP) {
+		event = ODM_MAIN_RELOAD;
+	} else if (sig_num == SIGUSR2) {
+		event = ODM_MAIN_UPGRADE;
 	}
+
+	pthread_mutex_lock(&main_lock);
+	main_events |= event;
+	pthread_cond_signal(&main_cond);
+	pthread_mutex_unlock(&main_lock);
+}
+
+static void
+util_timer_handler(void *arg)
+{
+	odm_util_sample(arg);
+}
+
+/* Sample the DMA utilization every interval, none if it is 0 */
+static void
+util_timer_set(struct reactor_timer *timer, struct odm_dev *odm_pf)
+{
+	uint64_t interval_ns = odm_pf->util.interval_ms * 1000000ULL;
+
+	reactor_timer_set(timer, interval_ns, interval_ns);
 }
 
 void
 print_usage(const char *prog_name)
 {
 	fprintf(stderr, "Usage: %s [-c] [-l log_level] [-s] [-e eng_sel] --vfio-vf-token uuid\n"
-		"--num_vfs n\n", prog_name);
+		"--num_vfs n [--backend name] [--mbox_workers n] [--util_interval ms]\n"
+		"[--sclk_mhz mhz] [--rebalance] [--fifo split] [--profile name] [--molr n]\n"
+		"[--tune cmd [--tune_pattern str] [--tune_cfg path]] [--placement policy]\n"
+		"[--cfg path] [--warm_restart 0|1] [--takeover fd] [--reactor name]\n"
+		"[--mbox_mode irq|poll [--mbox_poll_cpu n] [--mbox_poll_backoff us]]\n",
+		prog_name);
 	fprintf(stderr, "  -c             Enable console logging (default disabled)\n");
 	fprintf(stderr, "  -l log_level   Set global log level (0-7) (default LOG_INFO)\n");
 	fprintf(stderr, "  -s             Run self test\n");
@@ -54,6 +134,39 @@ print_usage(const char *prog_name)
 	fprintf(stderr, "  -e eng_sel     Set the internal DMA engine to queue mapping\n");
 	fprintf(stderr, "  --num_vfs n    Create n number of VFs. Valid values are: 2,4,8,16"
 		"Default value is 4\n");
+	fprintf(stderr, "  --backend name Device backend: vfio or sim (default vfio)\n");
+	fprintf(stderr, "  --mbox_workers n  Number of mailbox worker threads (1-16, default 1)\n");
+	fprintf(stderr, "  --mbox_mode irq|poll  Serve the mailbox on its interrupt or from a"
+		" polling thread (default irq)\n");
+	fprintf(stderr, "  --mbox_poll_cpu n  CPU the mailbox polling thread is pinned to, -1 for"
+		" none (default -1)\n");
+	fprintf(stderr, "  --mbox_poll_backoff us  Longest sleep of the idle mailbox polling"
+		" thread, 0 to always spin (default 0)\n");
+	fprintf(stderr, "  --util_interval ms  DMA utilization sample interval, 0 disables"
+		" (default %d)\n", ODM_UTIL_DEF_INTERVAL_MS);
+	fprintf(stderr, "  --sclk_mhz mhz SCLK rate for the DMA utilization (default %d)\n",
+		ODM_SCLK_DEF_MHZ);
+	fprintf(stderr, "  --rebalance    Move idle queues between the DMA engines to even the load\n");
+	fprintf(stderr, "  --fifo split   Engine FIFO split, auto or kb0,kb1 (default 64,64)\n");
+	fprintf(stderr, "  --profile name Tuning profile: default, throughput, latency or small-copy"
+		" (default default)\n");
+	fprintf(stderr, "  --molr n       Max outstanding loads (1-1023), 0 for the profile's (default 0)\n");
+	fprintf(stderr, "  --placement policy  Engine placement: mask (use eng_sel), interleave,"
+		" split-by-vf, pack or weights=w0,w1,... (default mask)\n");
+	fprintf(stderr, "  --cfg path     Config file reloaded on SIGHUP (default %s)\n",
+		ODM_PF_CFG_FILE);
+	fprintf(stderr, "  --warm_restart 0|1  Keep the device and its state on exit, for the next"
+		" run to resume (default 0)\n");
+	fprintf(stderr, "  --takeover fd  Take the device over from the running driver on the socket"
+		" fd, set on an upgrade\n");
+	fprintf(stderr, "  --reactor name Wait for the interrupts with epoll or io_uring"
+		" (default epoll)\n");
+	fprintf(stderr, "  --tune cmd     Tune the engine mapping, FIFO split and MOLR for the workload"
+		" cmd and exit\n");
+	fprintf(stderr, "  --tune_pattern str  Throughput is the number after str in the workload"
+		" output (default the last number)\n");
+	fprintf(stderr, "  --tune_cfg path  Config file to write the tuned values to (default %s)\n",
+		ODM_PF_CFG_FILE);
 	exit(EXIT_FAILURE);
 }
 
@@ -67,11 +180,30 @@ main(int argc, char *argv[])
 	int option_index;
 	int opt, rc = 0;
 	char **argvopt;
-	int num_vfs;
+	int num_vfs, nb_workers;
+	enum reactor_backend reactor_backend = REACTOR_EPOLL;
+	struct reactor_timer *util_timer = NULL;
+	unsigned int events;
+	sigset_t sigset;
+	int util_interval, sclk_mhz, molr, poll_cpu, poll_backoff;
 
 	/* Initialize the config with default values */
+	memset(&dev_cfg, 0, sizeof(dev_cfg));
+	dev_cfg.backend = &odm_pf_vfio_backend;
+	dev_cfg.profile = odm_profile_get("default");
 	dev_cfg.eng_sel = 0xAAAAAAAA;
 	dev_cfg.num_vfs = 4;
+	dev_cfg.mbox_workers = ODM_MBOX_DEF_WORKERS;
+	dev_cfg.mbox_mode = ODM_MBOX_MODE_IRQ;
+	dev_cfg.mbox_poll_cpu = -1;
+	dev_cfg.util_interval_ms = ODM_UTIL_DEF_INTERVAL_MS;
+	dev_cfg.sclk_mhz = ODM_SCLK_DEF_MHZ;
+	dev_cfg.rebalance = false;
+	dev_cfg.fifo_auto = false;
+	dev_cfg.fifo_kb[0] = ODM_ENG_MAX_FIFO / ODM_MAX_ENGINES;
+	dev_cfg.fifo_kb[1] = ODM_ENG_MAX_FIFO / ODM_MAX_ENGINES;
+	dev_cfg.tune_cfg = ODM_PF_CFG_FILE;
+	dev_cfg.cfg_file = ODM_PF_CFG_FILE;
 
 	argvopt = argv;
 	while ((opt = getopt_long(argc, argvopt, "csl:e:",
@@ -107,14 +239,158 @@ main(int argc, char *argv[])
 			}
 			dev_cfg.num_vfs = num_vfs;
 			break;
+		case OPT_MBOX_WORKERS:
+			nb_workers = atoi(optarg);
+			if (nb_workers < 1 || nb_workers > ODM_MAX_VFS) {
+				fprintf(stderr, "Invalid number of mbox workers: %d\n", nb_workers);
+				print_usage(argv[0]);
+			}
+			dev_cfg.mbox_workers = nb_workers;
+			break;
+		case OPT_MBOX_MODE:
+			if (!strcmp(optarg, "irq")) {
+				dev_cfg.mbox_mode = ODM_MBOX_MODE_IRQ;
+			} else if (!strcmp(optarg, "poll")) {
+				dev_cfg.mbox_mode = ODM_MBOX_MODE_POLL;
+			} else {
+				fprintf(stderr, "Invalid mbox mode: %s\n", optarg);
+				print_usage(argv[0]);
+			}
+			break;
+		case OPT_MBOX_POLL_CPU:
+			poll_cpu = atoi(optarg);
+			if (poll_cpu < -1) {
+				fprintf(stderr, "Invalid mbox poll CPU: %d\n", poll_cpu);
+				print_usage(argv[0]);
+			}
+			dev_cfg.mbox_poll_cpu = poll_cpu;
+			break;
+		case OPT_MBOX_POLL_BACKOFF:
+			poll_backoff = atoi(optarg);
+			if (poll_backoff < 0) {
+				fprintf(stderr, "Invalid mbox poll backoff: %d\n", poll_backoff);
+				print_usage(argv[0]);
+			}
+			dev_cfg.mbox_poll_backoff_us = poll_backoff;
+			break;
+		case OPT_UTIL_INTERVAL:
+			util_interval = atoi(optarg);
+			if (util_interval < 0) {
+				fprintf(stderr, "Invalid utilization interval: %d\n", util_interval);
+				print_usage(argv[0]);
+			}
+			dev_cfg.util_interval_ms = util_interval;
+			break;
+		case OPT_SCLK_MHZ:
+			sclk_mhz = atoi(optarg);
+			if (sclk_mhz <= 0) {
+				fprintf(stderr, "Invalid SCLK rate: %d\n", sclk_mhz);
+				print_usage(argv[0]);
+			}
+			dev_cfg.sclk_mhz = sclk_mhz;
+			break;
+		case OPT_REBALANCE:
+			dev_cfg.rebalance = true;
+			break;
+		case OPT_FIFO:
+			if (odm_fifo_parse(optarg, &dev_cfg.fifo_auto, dev_cfg.fifo_kb)) {
+				fprintf(stderr, "Invalid FIFO split: %s\n", optarg);
+				print_usage(argv[0]);
+			}
+			break;
+		case OPT_PROFILE:
+			dev_cfg.profile = odm_profile_get(optarg);
+			if (!dev_cfg.profile) {
+				fprintf(stderr, "Invalid profile: %s\n", optarg);
+				print_usage(argv[0]);
+			}
+			break;
+		case OPT_MOLR:
+			molr = atoi(optarg);
+			if (molr < 0 || molr > (int)ODM_NCB_CFG_MOLR_MASK) {
+				fprintf(stderr, "Invalid MOLR: %d\n", molr);
+				print_usage(argv[0]);
+			}
+			dev_cfg.molr = molr;
+			break;
+		case OPT_TUNE:
+			dev_cfg.tune_cmd = optarg;
+			break;
+		case OPT_TUNE_PATTERN:
+			dev_cfg.tune_pattern = optarg;
+			break;
+		case OPT_TUNE_CFG:
+			dev_cfg.tune_cfg = optarg;
+			break;
+		case OPT_WARM_RESTART:
+			if (strcmp(optarg, "0") && strcmp(optarg, "1")) {
+				fprintf(stderr, "Invalid warm restart: %s\n", optarg);
+				print_usage(argv[0]);
+			}
+			dev_cfg.warm_restart = optarg[0] == '1';
+			break;
+		case OPT_CFG:
+			dev_cfg.cfg_file = optarg;
+			break;
+		case OPT_TAKEOVER:
+			dev_cfg.takeover_fd = atoi(optarg);
+			if (dev_cfg.takeover_fd <= STDERR_FILENO) {
+				fprintf(stderr, "Invalid takeover fd: %s\n", optarg);
+				print_usage(argv[0]);
+			}
+			break;
+		case OPT_REACTOR:
+			if (reactor_backend_parse(optarg, &reactor_backend)) {
+				fprintf(stderr, "Invalid reactor: %s\n", optarg);
+				print_usage(argv[0]);
+			}
+			break;
+		case OPT_PLACEMENT:
+			if (odm_placement_parse(optarg, &dev_cfg.placement)) {
+				fprintf(stderr, "Invalid placement: %s\n", optarg);
+				print_usage(argv[0]);
+			}
+			break;
+		case OPT_BACKEND:
+			dev_cfg.backend = odm_pf_backend_get(optarg);
+			if (!dev_cfg.backend) {
+				fprintf(stderr, "Invalid backend: %s\n", optarg);
+				print_usage(argv[0]);
+			}
+			break;
 		default:
 			print_usage(argv[0]);
 		}
 	}
 
+	if (dev_cfg.placement.policy == ODM_PLACEMENT_WEIGHTS &&
+	    dev_cfg.placement.nb_weights != dev_cfg.num_vfs) {
+		fprintf(stderr, "Placement has %d weights for %d VFs\n",
+			dev_cfg.placement.nb_weights, dev_cfg.num_vfs);
+		print_usage(argv[0]);
+	}
+
+	/*
+	 * The signals are received by the reactor, they are blocked before the
+	 * first thread is created for all the threads to inherit it. The tuning
+	 * workload would inherit it too, the signals are left alone then.
+	 */
+	sigemptyset(&sigset);
+	sigaddset(&sigset, SIGTERM);
+	sigaddset(&sigset, SIGHUP);
+	sigaddset(&sigset, SIGUSR2);
+	if (!dev_cfg.tune_cmd)
+		pthread_sigmask(SIG_BLOCK, &sigset, NULL);
+
 	log_init("odm_pf", log_lvl, console_logging_enabled);
+	reactor_backend_set(reactor_backend);
+
+	/* The rebalancer runs on the utilization samples */
+	if (dev_cfg.rebalance && !dev_cfg.util_interval_ms)
+		log_write(LOG_WARNING, "Rebalancer disabled, utilization sampling is off\n");
 
-	if (do_self_test)
+	/* The device is in use by the process it is taken over from */
+	if (do_self_test && !dev_cfg.takeover_fd)
 		odm_pf_selftest(&dev_cfg);
 
 	odm_pf = odm_pf_probe(&dev_cfg);
@@ -124,13 +400,60 @@ main(int argc, char *argv[])
 		goto exit;
 	}
 
-	signal(SIGTERM, signal_handler);
+	if (dev_cfg.tune_cmd) {
+		rc = odm_tune(odm_pf, &dev_cfg);
+		goto exit;
+	}
+
+	if (reactor_signal_add(SIGTERM, signal_handler, (void *)(intptr_t)SIGTERM) ||
+	    reactor_signal_add(SIGHUP, signal_handler, (void *)(intptr_t)SIGHUP) ||
+	    reactor_signal_add(SIGUSR2, signal_handler, (void *)(intptr_t)SIGUSR2)) {
+		log_write(LOG_ERR, "Failed to set up the signals\n");
+		rc = -1;
+		goto exit;
+	}
 
-	while (!quit_signal)
-		sleep(10);
+	/*
+	 * The reactor thread handles the interrupts, the timers of the
+	 * utilization sampling and of the interrupt storms, and the signals.
+	 * The main thread sleeps until a signal asks it to exit, to reload the
+	 * cfg or to hand the device over on an upgrade. The sampling is stopped
+	 * meanwhile, these change or release the device.
+	 */
+	util_timer = reactor_timer_add(util_timer_handler, odm_pf);
+	if (!util_timer) {
+		rc = -1;
+		goto exit;
+	}
+	util_timer_set(util_timer, odm_pf);
+
+	while (1) {
+		pthread_mutex_lock(&main_lock);
+		while (!main_events)
+			pthread_cond_wait(&main_cond, &main_lock);
+		events = main_events;
+		main_events = 0;
+		pthread_mutex_unlock(&main_lock);
+
+		if (events & ODM_MAIN_QUIT)
+			break;
+
+		reactor_timer_set(util_timer, 0, 0);
+		if (events & ODM_MAIN_RELOAD)
+			odm_pf_reload(odm_pf, dev_cfg.cfg_file);
+
+		/* The device is handed over, the new process runs it */
+		if ((events & ODM_MAIN_UPGRADE) && !odm_pf_upgrade(odm_pf, argv)) {
+			odm_pf = NULL;
+			break;
+		}
+		util_timer_set(util_timer, odm_pf);
+	}
 
 exit:
+	reactor_timer_del(util_timer);
 	odm_pf_release(odm_pf);
+	reactor_fini();
 	log_fini();
 
 	return rc;
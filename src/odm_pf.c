@@ -1,54 +1,19 @@
 /* SPDX-License-Identifier: Marvell-MIT
  * Copyright (c) 2024 Marvell.
  */
+#include <unistd.h>
+
 #include "odm_pf.h"
+#include "odm_pf_cmd.h"
+#include "odm_pf_stats.h"
+#include "odm_pf_trace.h"
 #include "pmem.h"
+#include "reactor.h"
 #include "vfio_pci_irq.h"
 
-static void
-odm_queue_reset(struct odm_dev *odm_pf, uint8_t qid)
-{
-	int wait_cnt;
-
-	odm_reg_write(odm_pf, ODM_DMAX_QRST(qid), 0x1ULL);
-	wait_cnt = 0xFFFFFF;
-	while (wait_cnt--) {
-		uint64_t regval = odm_reg_read(odm_pf, ODM_DMAX_QRST(qid));
-
-		if (!(regval & 0x1))
-			break;
-	}
-	odm_reg_write(odm_pf, ODM_DMAX_IDS(qid), 0ULL);
-}
-
-static void
-odm_queue_init(struct odm_dev *odm_pf, uint8_t vf_id, uint8_t qid)
-{
-	uint8_t hw_qid = vf_id * odm_pf->pmem->maxq_per_vf + qid;
-	uint64_t reg;
-
-	odm_queue_reset(odm_pf, hw_qid);
-	reg = odm_reg_read(odm_pf, ODM_DMAX_IDS(hw_qid));
-	reg |= ODM_DMA_IDS_DMA_STRM(vf_id + 1);
-	reg |= ODM_DMA_IDS_INST_STRM(vf_id + 1);
-	odm_reg_write(odm_pf, ODM_DMAX_IDS(hw_qid), reg);
-	odm_pf->pmem->setup_done[vf_id] = true;
-}
-
-static void
-odm_queues_fini(struct odm_dev *odm_pf, uint8_t vf_id)
-{
-	int maxqs_per_vf = odm_pf->pmem->maxq_per_vf;
-	int qid, hw_qid_start;
-
-	hw_qid_start = vf_id * maxqs_per_vf;
-	for (qid = hw_qid_start; qid < hw_qid_start + maxqs_per_vf; qid++)
-		odm_queue_reset(odm_pf, qid);
-	odm_pf->pmem->setup_done[vf_id] = false;
-}
-
 static int
-odm_pf_create_vfs(struct odm_dev_config *dev_cfg)
+odm_pf_create_vfs(__attribute__((unused)) struct odm_dev *odm_pf,
+		  struct odm_dev_config *dev_cfg)
 {
 	char sysfs_path[256];
 	char str[3];
@@ -104,128 +69,233 @@ close_fd:
 	return -1;
 }
 
-void *
-odm_vfpf_mbox_thread(void *mbox_work)
+/* Vectors with an error interrupt source, the mailbox vector is set up separately */
+static const uint64_t odm_irq_vec_mask[VFIO_PCI_MSIX_MASK_WORDS(ODM_IRQ_NUM_VECS)] = {
+	[0] = ((1ULL << ODM_MAX_REQQ_INT) - 1) | BIT_ULL(ODM_PF_RAS_IRQ) | BIT_ULL(ODM_NCBO_ERR_IRQ),
+};
+
+static inline bool
+odm_irq_vec_used(uint16_t vec)
 {
-	struct odm_mbox_work *work = mbox_work;
-	struct odm_dev *odm_pf = work->odm_pf;
-	uint8_t vf_id, q_idx;
+	return odm_irq_vec_mask[vec / 64] & (1ULL << (vec % 64));
+}
 
-	while (1) {
-		pthread_mutex_lock(&work->lock);
-		pthread_cond_wait(&work->cond, &work->lock);
+/* Enable the REQQ interrupts of all the queues, or clear them and their enables */
+static void
+odm_reqq_irq_config(struct odm_dev *odm_pf, bool enable)
+{
+	struct odm_reg_op ops[2 * ODM_MAX_REQQ_INT];
+	int i, nb_ops = 0;
 
-		if (work->msg.q.cmd == ODM_MBOX_THREAD_QUIT) {
-			pthread_mutex_unlock(&work->lock);
-			break;
+	for (i = 0; i < ODM_MAX_REQQ_INT; i++) {
+		if (enable) {
+			ops[nb_ops].offset = ODM_REQQX_INT_ENA_W1S(i);
+			ops[nb_ops++].val = ODM_REQQ_INT;
+			continue;
 		}
+		ops[nb_ops].offset = ODM_REQQX_INT(i);
+		ops[nb_ops++].val = ODM_REQQ_INT;
+		ops[nb_ops].offset = ODM_REQQX_INT_ENA_W1C(i);
+		ops[nb_ops++].val = ODM_REQQ_INT;
+	}
 
-		vf_id = work->msg.q.vf_id;
-		q_idx = work->msg.q.q_idx;
-		switch (work->msg.q.cmd) {
-			case ODM_QUEUE_OPEN:
-				odm_queue_init(odm_pf, vf_id, q_idx);
-				break;
-			case ODM_DEV_CLOSE:
-				odm_queues_fini(odm_pf, vf_id);
-				break;
-			default:
-				work->msg.d.err = 0;
-		}
+	odm_reg_write_batch(odm_pf, ops, nb_ops);
+}
 
-		work->msg.d.nvfs = (odm_reg_read(odm_pf, ODM_CTL) >> 4) & 0x3;
-		work->msg.d.rsp = work->msg.q.cmd;
-		odm_reg_write(odm_pf, ODM_MBOX_PF_VFX_DATAX(vf_id, 0), work->msg.u[0]);
-		odm_reg_write(odm_pf, ODM_MBOX_PF_VFX_DATAX(vf_id, 1), work->msg.u[1]);
+static void
+odm_irq_name(uint16_t vec, char *name, size_t len)
+{
+	if (vec < ODM_MAX_REQQ_INT)
+		snprintf(name, len, "REQQ %u", vec);
+	else
+		snprintf(name, len, "%s", vec == ODM_PF_RAS_IRQ ? "RAS" : "NCBO");
+}
 
-		pthread_mutex_unlock(&work->lock);
-	}
-	pthread_exit(NULL);
+/* Log the events of the window which were not logged, under the irq lock */
+static void
+odm_irq_summary(struct odm_irq_mem *irq_mem)
+{
+	char name[16];
+
+	if (!irq_mem->suppressed)
+		return;
+
+	odm_irq_name(irq_mem->index, name, sizeof(name));
+	log_write(LOG_ERR, "%s: %u more interrupts not logged, last cause 0x%016lx\n", name,
+		  irq_mem->suppressed, irq_mem->last_cause);
+	irq_mem->suppressed = 0;
 }
 
 static void
-odm_pf_mbox_handler(void *odm_irq)
+odm_irq_free(struct odm_dev *odm_pf)
 {
-	struct odm_dev *odm_pf = ((struct odm_irq_mem *)odm_irq)->odm_pf;
-	struct odm_mbox_work *mbox;
-	union odm_mbox_msg_t msg;
-	uint64_t reg;
 	int i = 0;
 
-	reg = odm_reg_read(odm_pf, ODM_MBOX_VF_PF_INT);
+	/* A storm can no longer pause a vector while the vectors are released */
+	pthread_mutex_lock(&odm_pf->irq_lock);
+	odm_pf->irq_stop = true;
+	for (i = 0; i < ODM_IRQ_NUM_VECS; i++) {
+		if (odm_irq_vec_used(i))
+			odm_irq_summary(&odm_pf->irq_mem[i]);
+	}
+	pthread_mutex_unlock(&odm_pf->irq_lock);
+
+	/* Clear All Enables */
+	odm_reg_write(odm_pf, ODM_PF_RAS_ENA_W1C, ODM_PF_RAS_INT);
 
-	for (i = 0; i < ODM_MAX_VFS; i++) {
-		if (reg & (0x1ULL << i)) {
-			msg.u[0] = odm_reg_read(odm_pf, ODM_MBOX_PF_VFX_DATAX(i, 0));
-			msg.u[1] = odm_reg_read(odm_pf, ODM_MBOX_PF_VFX_DATAX(i, 1));
-			odm_reg_write(odm_pf, ODM_MBOX_VF_PF_INT, (0x1ULL << i));
-			msg.q.vf_id = i;
+	odm_reqq_irq_config(odm_pf, false);
 
-			mbox = &odm_pf->mbox_work[i];
-			pthread_mutex_lock(&mbox->lock);
-			mbox->msg = msg;
-			pthread_cond_signal(&mbox->cond);
-			pthread_mutex_unlock(&mbox->lock);
-		}
+	/* Mailbox vector is released along with the mailbox */
+	for (i = 0; i < ODM_IRQ_NUM_VECS; i++) {
+		if (odm_irq_vec_used(i))
+			vfio_pci_irq_unregister(&odm_pf->pdev, i);
 	}
+	vfio_pci_msix_disable_set(&odm_pf->pdev, odm_irq_vec_mask, ODM_IRQ_NUM_VECS);
+	/* No handler is left to arm it */
+	reactor_timer_del(odm_pf->irq_timer);
+	odm_pf->irq_timer = NULL;
+	free(odm_pf->irq_mem);
+	odm_pf->irq_mem = NULL;
+	odm_pf->num_vecs = 0;
+	pthread_mutex_destroy(&odm_pf->irq_lock);
 }
 
+/* Stop or restart the interrupts of an error vector */
 static int
-odm_setup_mbox(struct odm_dev *odm_pf)
+odm_irq_mask(struct odm_dev *odm_pf, uint16_t vec, bool mask)
 {
-	int ret, i = 0;
+	if (vec < ODM_MAX_REQQ_INT) {
+		odm_reg_write(odm_pf, mask ? ODM_REQQX_INT_ENA_W1C(vec) : ODM_REQQX_INT_ENA_W1S(vec),
+			      ODM_REQQ_INT);
+	} else if (vec == ODM_PF_RAS_IRQ) {
+		odm_reg_write(odm_pf, mask ? ODM_PF_RAS_ENA_W1C : ODM_PF_RAS_ENA_W1S,
+			      ODM_PF_RAS_INT);
+	} else {
+		/* NCBO_ERR_INFO has no enable, the vector is no longer waited for */
+		return vfio_pci_irq_pause(&odm_pf->pdev, vec, mask);
+	}
 
-	/* Disable the mbox interrupts and enable bits */
-	odm_reg_write(odm_pf, ODM_MBOX_VF_PF_INT_ENA_W1C, 0xffff);
-	odm_reg_write(odm_pf, ODM_MBOX_VF_PF_INT, 0xffff);
+	return 0;
+}
 
-	ret = vfio_pci_msix_enable(&odm_pf->pdev, ODM_MBOX_VF_PF_IRQ);
-	if (ret) {
-		log_write(LOG_ERR, "ODM_PF: MBOX IRQ enable failed\n");
-		return -1;
-	}
+/* Runs on the reactor thread, as the interrupt handlers */
+static void
+odm_irq_timer(void *arg)
+{
+	struct odm_dev *odm_pf = arg;
+	uint64_t next;
 
-	ret = vfio_pci_irq_register(&odm_pf->pdev, ODM_MBOX_VF_PF_IRQ, odm_pf_mbox_handler,
-				    (void *)&odm_pf->irq_mem[ODM_MBOX_VF_PF_IRQ]);
-	if (ret) {
-		vfio_pci_msix_disable(&odm_pf->pdev, ODM_MBOX_VF_PF_IRQ);
-		log_write(LOG_ERR, "ODM_PF: MBOX IRQ register failed\n");
-		return -1;
+	next = odm_irq_poll(odm_pf);
+	if (next)
+		reactor_timer_set(odm_pf->irq_timer, next, 0);
+}
+
+/*
+ * Account an error interrupt. Only the first events of a window are logged,
+ * and a vector raising more than the storm rate is masked, with a backoff
+ * doubling while the storm keeps coming back.
+ */
+static bool
+odm_irq_account(struct odm_irq_mem *irq_mem, uint64_t cause)
+{
+	struct odm_dev *odm_pf = irq_mem->odm_pf;
+	bool log = false, storm = false, arm;
+	uint64_t now = odm_now_ns();
+	char name[16];
+
+	pthread_mutex_lock(&odm_pf->irq_lock);
+	if (now - irq_mem->window_ns >= ODM_IRQ_WINDOW_NS) {
+		odm_irq_summary(irq_mem);
+		irq_mem->window_ns = now;
+		irq_mem->count = 0;
 	}
 
-	for (i = 0; i < ODM_MAX_VFS; i++) {
-		odm_pf->mbox_work[i].odm_pf = odm_pf;
-		pthread_mutex_init(&odm_pf->mbox_work[i].lock, NULL);
-		pthread_create(&odm_pf->thread[i], NULL, odm_vfpf_mbox_thread,
-			       (void *)&odm_pf->mbox_work[i]);
+	irq_mem->last_cause = cause;
+	if (++irq_mem->count <= ODM_IRQ_LOG_BURST)
+		log = true;
+	else
+		irq_mem->suppressed++;
+
+	if (irq_mem->count > ODM_IRQ_STORM_RATE && !irq_mem->masked && !odm_pf->irq_stop) {
+		if (irq_mem->backoff_ms && now - irq_mem->unmasked_ns < ODM_IRQ_BACKOFF_HOLD_NS)
+			irq_mem->backoff_ms *= 2;
+		else
+			irq_mem->backoff_ms = ODM_IRQ_BACKOFF_MIN_MS;
+		if (irq_mem->backoff_ms > ODM_IRQ_BACKOFF_MAX_MS)
+			irq_mem->backoff_ms = ODM_IRQ_BACKOFF_MAX_MS;
+
+		if (!odm_irq_mask(odm_pf, irq_mem->index, true)) {
+			irq_mem->masked = true;
+			irq_mem->unmask_ns = now + irq_mem->backoff_ms * 1000000ULL;
+			storm = true;
+			odm_irq_name(irq_mem->index, name, sizeof(name));
+			log_write(LOG_WARNING, "%s: interrupt storm, %u interrupts in %lu ms, "
+				  "masked for %u ms\n", name, irq_mem->count,
+				  (now - irq_mem->window_ns) / 1000000, irq_mem->backoff_ms);
+		}
 	}
+	/* A new deadline, to unmask the vector or to log the summary */
+	arm = storm || irq_mem->suppressed == 1;
+	pthread_mutex_unlock(&odm_pf->irq_lock);
 
-	/* Enable mbox interrupts */
-	odm_reg_write(odm_pf, ODM_MBOX_VF_PF_INT_ENA_W1S, 0xffff);
+	if (storm || !log)
+		odm_stats_irq(odm_pf, irq_mem->index, storm, !log);
+	if (arm)
+		odm_irq_timer(odm_pf);
 
-	return ret;
+	return log;
 }
 
-static void
-odm_irq_free(struct odm_dev *odm_pf)
+uint64_t
+odm_irq_poll(struct odm_dev *odm_pf)
 {
-	int i = 0;
+	struct odm_irq_mem *irq_mem;
+	uint64_t now, due, next = 0;
+	char name[16];
+	uint16_t vec;
+
+	if (!odm_pf->irq_mem)
+		return 0;
+
+	now = odm_now_ns();
+	pthread_mutex_lock(&odm_pf->irq_lock);
+	for (vec = 0; vec < ODM_IRQ_NUM_VECS; vec++) {
+		if (!odm_irq_vec_used(vec))
+			continue;
 
-	/* Clear All Enables */
-	odm_reg_write(odm_pf, ODM_PF_RAS_ENA_W1C, ODM_PF_RAS_INT);
+		irq_mem = &odm_pf->irq_mem[vec];
+		if (irq_mem->suppressed) {
+			due = irq_mem->window_ns + ODM_IRQ_WINDOW_NS;
+			if (now >= due)
+				odm_irq_summary(irq_mem);
+			else if (!next || due - now < next)
+				next = due - now;
+		}
 
-	for (i = 0; i < ODM_MAX_REQQ_INT; i++) {
-		odm_reg_write(odm_pf, ODM_REQQX_INT(i), ODM_REQQ_INT);
-		odm_reg_write(odm_pf, ODM_REQQX_INT_ENA_W1C(i), ODM_REQQ_INT);
-	}
+		if (!irq_mem->masked)
+			continue;
 
-	for (i = 0; i < odm_pf->num_vecs; i++) {
-		vfio_pci_irq_unregister(&odm_pf->pdev, i);
-		vfio_pci_msix_disable(&odm_pf->pdev, i);
+		if (now < irq_mem->unmask_ns) {
+			if (!next || irq_mem->unmask_ns - now < next)
+				next = irq_mem->unmask_ns - now;
+			continue;
+		}
+
+		if (odm_pf->irq_stop || odm_irq_mask(odm_pf, vec, false))
+			continue;
+
+		odm_irq_summary(irq_mem);
+		irq_mem->masked = false;
+		irq_mem->unmasked_ns = now;
+		irq_mem->window_ns = now;
+		irq_mem->count = 0;
+		odm_irq_name(vec, name, sizeof(name));
+		log_write(LOG_INFO, "%s: interrupts enabled again after %u ms\n", name,
+			  irq_mem->backoff_ms);
 	}
-	free(odm_pf->irq_mem);
-	odm_pf->irq_mem = NULL;
-	odm_pf->num_vecs = 0;
+	pthread_mutex_unlock(&odm_pf->irq_lock);
+
+	return next;
 }
 
 static
@@ -236,19 +306,28 @@ void odm_pf_irq_handler(void *odm_irq)
 
 	if (irq_mem->index < ODM_MAX_REQQ_INT) {
 		reg_val = odm_reg_read(irq_mem->odm_pf, ODM_REQQX_INT(irq_mem->index));
-		log_write(LOG_ERR, "q_index: %d, REQQX_INT: 0x%016lx\n", irq_mem->index, reg_val);
 		odm_reg_write(irq_mem->odm_pf, ODM_REQQX_INT(irq_mem->index), reg_val);
+		odm_stats_reqq_int(irq_mem->odm_pf, irq_mem->index, reg_val);
+		if (odm_irq_account(irq_mem, reg_val))
+			log_write(LOG_ERR, "q_index: %d, REQQX_INT: 0x%016lx\n", irq_mem->index,
+				  reg_val);
 	} else if (irq_mem->index == ODM_PF_RAS_IRQ) {
 		reg_val = odm_reg_read(irq_mem->odm_pf, ODM_PF_RAS);
-		log_write(LOG_ERR, "RAS_INT: 0x%016lx\n", reg_val);
 		odm_reg_write(irq_mem->odm_pf, ODM_PF_RAS, reg_val);
+		odm_stats_ras_int(irq_mem->odm_pf, reg_val);
+		if (odm_irq_account(irq_mem, reg_val))
+			log_write(LOG_ERR, "RAS_INT: 0x%016lx\n", reg_val);
 	} else if (irq_mem->index == ODM_NCBO_ERR_IRQ) {
 		reg_val = odm_reg_read(irq_mem->odm_pf, ODM_NCBO_ERR_INFO);
-		log_write(LOG_ERR, "NCB_ERR_INT: 0x%016lx\n", reg_val);
 		odm_reg_write(irq_mem->odm_pf, ODM_NCBO_ERR_INFO, reg_val);
+		odm_stats_ncbo_err(irq_mem->odm_pf);
+		if (odm_irq_account(irq_mem, reg_val))
+			log_write(LOG_ERR, "NCB_ERR_INT: 0x%016lx\n", reg_val);
 	} else {
 		log_write(LOG_ERR, "invalid intr index: 0x%x\n", irq_mem->index);
+		return;
 	}
+	odm_trace(irq_mem->odm_pf, ODM_TRACE_IRQ, irq_mem->index, 0, reg_val, 0);
 }
 
 static int
@@ -258,46 +337,58 @@ odm_irq_init(struct odm_dev *odm_pf)
 	int ret;
 
 	odm_pf->num_vecs = odm_pf->pdev.intr.count;
+	if (odm_pf->num_vecs < ODM_IRQ_NUM_VECS) {
+		log_write(LOG_ERR, "ODM_PF: %d MSI-X vectors, %d needed\n", odm_pf->num_vecs,
+			  ODM_IRQ_NUM_VECS);
+		odm_pf->num_vecs = 0;
+		return -EINVAL;
+	}
 
 	odm_pf->irq_mem = calloc(odm_pf->num_vecs, sizeof(struct odm_irq_mem));
 	if (odm_pf->irq_mem == NULL) {
 		odm_pf->num_vecs = 0;
 		return -ENOMEM;
 	}
+	pthread_mutex_init(&odm_pf->irq_lock, NULL);
+	odm_pf->irq_stop = false;
+	odm_pf->irq_timer = reactor_timer_add(odm_irq_timer, odm_pf);
+	if (!odm_pf->irq_timer) {
+		log_write(LOG_ERR, "ODM_PF: IRQ timer creation failed\n");
+		goto free_irq_mem;
+	}
 
 	/* Clear all interrupts and interrupt enables*/
 	odm_reg_write(odm_pf, ODM_PF_RAS, ODM_PF_RAS_INT);
 	odm_reg_write(odm_pf, ODM_PF_RAS_ENA_W1C, ODM_PF_RAS_INT);
 
-	for (i = 0; i < ODM_MAX_REQQ_INT; i++) {
-		odm_reg_write(odm_pf, ODM_REQQX_INT(i), ODM_REQQ_INT);
-		odm_reg_write(odm_pf, ODM_REQQX_INT_ENA_W1C(i), ODM_REQQ_INT);
-	}
+	odm_reqq_irq_config(odm_pf, false);
 
 	for (irq = 0; irq < odm_pf->num_vecs; irq++) {
 		odm_pf->irq_mem[irq].odm_pf = odm_pf;
 		odm_pf->irq_mem[irq].index = irq;
-		if (irq == ODM_MBOX_VF_PF_IRQ)
-			continue;
+	}
 
-		ret = vfio_pci_msix_enable(&odm_pf->pdev, irq);
-		if (ret) {
-			log_write(LOG_ERR, "ODM_PF: IRQ(%d) enable failed\n", irq);
-			goto irq_unregister;
-		}
+	/* Only the vectors with an interrupt source are armed, all in one go */
+	ret = vfio_pci_msix_enable_set(&odm_pf->pdev, odm_irq_vec_mask, ODM_IRQ_NUM_VECS);
+	if (ret) {
+		log_write(LOG_ERR, "ODM_PF: IRQ enable failed\n");
+		goto free_irq_mem;
+	}
+
+	for (irq = 0; irq < ODM_IRQ_NUM_VECS; irq++) {
+		if (!odm_irq_vec_used(irq))
+			continue;
 
 		ret = vfio_pci_irq_register(&odm_pf->pdev, irq, odm_pf_irq_handler,
 					    (void *)&odm_pf->irq_mem[irq]);
 		if (ret) {
-			vfio_pci_msix_disable(&odm_pf->pdev, irq);
 			log_write(LOG_ERR, "ODM_PF: IRQ(%d) registration failed\n", irq);
 			goto irq_unregister;
 		}
 	}
 
 	/* Enable all interrupts */
-	for (i = 0; i < ODM_MAX_REQQ_INT; i++)
-		odm_reg_write(odm_pf, ODM_REQQX_INT_ENA_W1S(i), ODM_REQQ_INT);
+	odm_reqq_irq_config(odm_pf, true);
 
 	odm_reg_write(odm_pf, ODM_PF_RAS_ENA_W1S, ODM_PF_RAS_INT);
 
@@ -305,44 +396,97 @@ odm_irq_init(struct odm_dev *odm_pf)
 
 irq_unregister:
 	for (i = 0; i < irq; i++) {
-		if (irq == ODM_MBOX_VF_PF_IRQ)
-			continue;
-		vfio_pci_irq_unregister(&odm_pf->pdev, i);
-		vfio_pci_msix_disable(&odm_pf->pdev, i);
+		if (odm_irq_vec_used(i))
+			vfio_pci_irq_unregister(&odm_pf->pdev, i);
 	}
+	vfio_pci_msix_disable_set(&odm_pf->pdev, odm_irq_vec_mask, ODM_IRQ_NUM_VECS);
+free_irq_mem:
+	reactor_timer_del(odm_pf->irq_timer);
+	odm_pf->irq_timer = NULL;
 	free(odm_pf->irq_mem);
 	odm_pf->irq_mem = NULL;
 	odm_pf->num_vecs = 0;
+	pthread_mutex_destroy(&odm_pf->irq_lock);
 
 	return -1;
 }
 
-static int
-odm_init(struct odm_dev *odm_pf, struct odm_dev_config *dev_cfg)
+/*
+ * Tuning profiles. default is the setting the driver always used, MOLR at the
+ * max value of 512. throughput also sets LDWB, so source buffers read by the
+ * engines are not written back to the L2, which suits bulk copies that are
+ * not read again. latency and small-copy lower the outstanding loads, so the
+ * short transfers of one queue do not wait behind the long reads of another.
+ */
+static const struct odm_profile odm_profiles[] = {
+	{
+		.name = "default",
+		.molr = 512,
+		.dma_control = ODM_DMA_CONTROL_ZBWCSEN | ODM_DMA_CONTROL_DMA_ENB(0x3),
+	},
+	{
+		.name = "throughput",
+		.molr = 512,
+		.dma_control = ODM_DMA_CONTROL_ZBWCSEN | ODM_DMA_CONTROL_LDWB |
+			       ODM_DMA_CONTROL_DMA_ENB(0x3),
+	},
+	{
+		.name = "latency",
+		.molr = 128,
+		.dma_control = ODM_DMA_CONTROL_ZBWCSEN | ODM_DMA_CONTROL_DMA_ENB(0x3),
+	},
+	{
+		.name = "small-copy",
+		.molr = 256,
+		.dma_control = ODM_DMA_CONTROL_ZBWCSEN | ODM_DMA_CONTROL_DMA_ENB(0x3),
+	},
+};
+
+const struct odm_profile *
+odm_profile_get(const char *name)
 {
-	uint64_t reg = 0ULL;
-	int i;
+	unsigned int i;
 
-	for (i = 0; i < ODM_MAX_ENGINES; i++) {
-		/* For ODM it is recommended for 64KB FIFO for each engine */
-		reg = odm_reg_read(odm_pf, ODM_ENGX_BUF(i));
-		reg = (reg & ~0x7f) | (ODM_ENG_MAX_FIFO / ODM_MAX_ENGINES);
-		odm_reg_write(odm_pf, ODM_ENGX_BUF(i), reg);
-		reg = odm_reg_read(odm_pf, ODM_ENGX_BUF(i));
+	for (i = 0; i < sizeof(odm_profiles) / sizeof(odm_profiles[0]); i++) {
+		if (strcmp(odm_profiles[i].name, name) == 0)
+			return &odm_profiles[i];
 	}
 
-	reg = ODM_DMA_CONTROL_ZBWCSEN;
-	reg |= ODM_DMA_CONTROL_DMA_ENB(0x3);
-	odm_reg_write(odm_pf, ODM_DMA_CONTROL, reg);
-	odm_reg_write(odm_pf, ODM_REQQ_GENBUFF_TH_LIMIT, ODM_TH_VAL);
+	return NULL;
+}
 
-	/* Configure the MOLR to max value of 512 */
-	reg = odm_reg_read(odm_pf, ODM_NCB_CFG);
-	reg =  (reg & ~0x3ff) | (0x200 & 0x3ff);
-	odm_reg_write(odm_pf, ODM_NCB_CFG, reg);
-	odm_reg_write(odm_pf, ODM_DMA_INTL_SEL, dev_cfg->eng_sel);
+void
+odm_profile_apply(struct odm_dev *odm_pf, const struct odm_profile *profile, uint16_t molr)
+{
+	uint64_t reg;
+
+	odm_reg_write_relaxed(odm_pf, ODM_DMA_CONTROL, profile->dma_control);
 
-	if (odm_pf_create_vfs(dev_cfg))
+	reg = odm_reg_read_relaxed(odm_pf, ODM_NCB_CFG);
+	reg &= ~ODM_NCB_CFG_MOLR_MASK;
+	reg |= (molr ? molr : profile->molr) & ODM_NCB_CFG_MOLR_MASK;
+	odm_reg_write_relaxed(odm_pf, ODM_NCB_CFG, reg);
+	snprintf(odm_pf->pmem->profile, sizeof(odm_pf->pmem->profile), "%s", profile->name);
+	odm_pf->pmem->molr = molr;
+}
+
+static int
+odm_init(struct odm_dev *odm_pf, struct odm_dev_config *dev_cfg)
+{
+	uint64_t reg = 0ULL;
+	uint32_t eng_sel;
+
+	/* The engine FIFO split is programmed once the queue pool runs */
+	odm_profile_apply(odm_pf, dev_cfg->profile ? dev_cfg->profile : &odm_profiles[0],
+			  dev_cfg->molr);
+	odm_reg_write_relaxed(odm_pf, ODM_REQQ_GENBUFF_TH_LIMIT, ODM_TH_VAL);
+	eng_sel = odm_placement_eng_sel(&dev_cfg->placement, dev_cfg->num_vfs, dev_cfg->eng_sel);
+	odm_reg_write_relaxed(odm_pf, ODM_DMA_INTL_SEL, eng_sel);
+	odm_pf->pmem->eng_sel = eng_sel;
+	log_write(LOG_INFO, "ODM: engine placement %s\n", odm_placement_name(&dev_cfg->placement));
+	odm_placement_log(eng_sel, dev_cfg->num_vfs);
+
+	if (odm_pf->backend->create_vfs(odm_pf, dev_cfg))
 		return -1;
 
 	reg = (((__builtin_ffs(dev_cfg->num_vfs) - 2) & 0x3) << 4) | ODM_CTL_EN;
@@ -350,11 +494,42 @@ odm_init(struct odm_dev *odm_pf, struct odm_dev_config *dev_cfg)
 
 	odm_pf->pmem->vfs_in_use = dev_cfg->num_vfs;
 	odm_pf->pmem->maxq_per_vf = ODM_MAX_QUEUES / dev_cfg->num_vfs;
+	odm_pf->pmem->version = ODM_PMEM_VERSION;
 	odm_pf->pmem->dev_state = ODM_DEV_STATE_INIT_DONE;
 
 	return 0;
 }
 
+/*
+ * The device can be resumed from the state left by a previous process if the
+ * state has the current layout, the device was not reset since, as by a
+ * rebind to vfio-pci, and the number of VFs is the configured one.
+ */
+static bool
+odm_resumable(struct odm_dev *odm_pf, struct odm_dev_config *dev_cfg)
+{
+	struct pmem_data *pmem = odm_pf->pmem;
+
+	if (pmem->version != ODM_PMEM_VERSION) {
+		log_write(LOG_WARNING, "ODM: state version %u is not supported, initializing the "
+			  "device\n", pmem->version);
+		return false;
+	}
+
+	if (!(odm_reg_read(odm_pf, ODM_CTL) & ODM_CTL_EN)) {
+		log_write(LOG_WARNING, "ODM: device was reset, initializing it\n");
+		return false;
+	}
+
+	if (pmem->vfs_in_use != dev_cfg->num_vfs) {
+		log_write(LOG_WARNING, "ODM: state has %d VFs, %d configured, initializing the "
+			  "device\n", pmem->vfs_in_use, dev_cfg->num_vfs);
+		return false;
+	}
+
+	return true;
+}
+
 static void
 odm_fini(struct odm_dev *odm_pf)
 {
@@ -362,14 +537,14 @@ odm_fini(struct odm_dev *odm_pf)
 	int engine;
 
 	for (engine = 0; engine < ODM_MAX_ENGINES; engine++)
-		odm_reg_write(odm_pf, ODM_ENGX_BUF(engine), reg);
+		odm_reg_write_relaxed(odm_pf, ODM_ENGX_BUF(engine), reg);
 
-	odm_reg_write(odm_pf, ODM_DMA_CONTROL, reg);
+	odm_reg_write_relaxed(odm_pf, ODM_DMA_CONTROL, reg);
 	odm_reg_write(odm_pf, ODM_CTL, ~ODM_CTL_EN);
 }
 
-struct odm_dev *
-odm_pf_probe(struct odm_dev_config *dev_cfg)
+static struct odm_dev *
+odm_pf_dev_probe(struct odm_dev_config *dev_cfg, struct odm_handover *ho)
 {
 	struct odm_dev *odm_pf;
 	int err;
@@ -380,19 +555,66 @@ odm_pf_probe(struct odm_dev_config *dev_cfg)
 		return NULL;
 	}
 
+	odm_pf->backend = dev_cfg->backend ? dev_cfg->backend : &odm_pf_vfio_backend;
+	odm_pf_name(odm_pf, ODM_PF_PMEM_NAME, odm_pf->pmem_name);
+	odm_pf_name(odm_pf, ODM_PF_STATS_NAME, odm_pf->stats_name);
+	odm_pf_name(odm_pf, ODM_PF_TRACE_NAME, odm_pf->trace_name);
+	odm_pf_name(odm_pf, ODM_PF_CMD_SOCK, odm_pf->cmd_sock);
+	/* A device taken over is kept as it is if the probe fails */
+	odm_pf->warm = dev_cfg->warm_restart || ho;
+	odm_pf->takeover = ho;
+	odm_pf->nb_mbox_workers = dev_cfg->mbox_workers ? dev_cfg->mbox_workers :
+							  ODM_MBOX_DEF_WORKERS;
+	odm_pf->mbox_mode = dev_cfg->mbox_mode;
+	odm_pf->mbox_poll_cpu = dev_cfg->mbox_poll_cpu;
+	odm_pf->mbox_poll_backoff_us = dev_cfg->mbox_poll_backoff_us;
 	strncpy(odm_pf->pdev.name, ODM_PF_PCI_BDF, sizeof(odm_pf->pdev.name));
 	memcpy(odm_pf->pdev.uuid, dev_cfg->uuid_gbl, UUID_LEN);
-	if (vfio_pci_device_setup(&odm_pf->pdev)) {
-		log_write(LOG_ERR, "Failed to setup vfio pci device\n");
+	if (odm_pf->backend->setup(odm_pf)) {
+		log_write(LOG_ERR, "Failed to setup %s device\n", odm_pf->backend->name);
 		goto free_pf;
 	}
 
-	odm_pf->pmem = pmem_alloc("/odm_pmem", sizeof(*odm_pf->pmem));
+	if (odm_pf->pdev.mem[0].len < ODM_REG_SPACE_LEN) {
+		log_write(LOG_ERR, "BAR0 of %lu bytes does not cover the registers\n",
+			  odm_pf->pdev.mem[0].len);
+		goto free_vfio;
+	}
+
+	if (ho) {
+		/* The vectors enabled by the previous process keep their eventfds */
+		err = vfio_pci_msix_adopt(&odm_pf->pdev, ho->efds, ODM_IRQ_NUM_VECS);
+		memset(ho->efds, -1, sizeof(ho->efds));
+		if (err)
+			goto free_vfio;
+	}
+
+	if (ho && ho->pmem_fd >= 0) {
+		odm_pf->pmem = pmem_attach(odm_pf->pmem_name, ho->pmem_fd, sizeof(*odm_pf->pmem));
+		ho->pmem_fd = -1;
+	} else {
+		odm_pf->pmem = pmem_alloc(odm_pf->pmem_name, sizeof(*odm_pf->pmem));
+	}
 	if (!odm_pf->pmem)
 		goto free_vfio;
 
+	/* Statistics are optional, the driver runs without them */
+	if (odm_stats_init(odm_pf))
+		log_write(LOG_WARNING, "ODM: Failed to allocate statistics\n");
+	if (odm_trace_init(odm_pf))
+		log_write(LOG_WARNING, "ODM: Failed to allocate the flight recorder\n");
+
 	log_write(LOG_DEBUG, "%s: Probe successful\n", odm_pf->pdev.name);
 
+	/* Left by a previous process, the VFs and their open queues are kept */
+	if (odm_pf->pmem->dev_state != ODM_DEV_STATE_INIT) {
+		odm_pf->resumed = odm_resumable(odm_pf, dev_cfg);
+		if (!odm_pf->resumed)
+			memset(odm_pf->pmem, 0, sizeof(*odm_pf->pmem));
+	}
+
+	odm_trace(odm_pf, ODM_TRACE_START, 0, getpid(), odm_pf->resumed, 0);
+
 	if (odm_pf->pmem->dev_state == ODM_DEV_STATE_INIT) {
 		/* Initialize global PF registers */
 		err = odm_init(odm_pf, dev_cfg);
@@ -400,68 +622,207 @@ odm_pf_probe(struct odm_dev_config *dev_cfg)
 			log_write(LOG_ERR, "Failed to initialize ODM\n");
 			goto free_pmem;
 		}
+	} else {
+		log_write(LOG_INFO, "ODM: resumed the device with %d VFs\n",
+			  odm_pf->pmem->vfs_in_use);
+	}
+
+	log_write(LOG_INFO, "ODM: tuning profile %s: MOLR %lu, DMA_CONTROL 0x%lx\n",
+		  odm_pf->pmem->profile[0] ? odm_pf->pmem->profile : "unknown",
+		  (uint64_t)(odm_reg_read(odm_pf, ODM_NCB_CFG) & ODM_NCB_CFG_MOLR_MASK),
+		  odm_reg_read(odm_pf, ODM_DMA_CONTROL));
+	if (dev_cfg->profile && strcmp(dev_cfg->profile->name, odm_pf->pmem->profile))
+		log_write(LOG_WARNING, "ODM: profile %s not applied, the device is already "
+			  "initialized\n", dev_cfg->profile->name);
+
+	odm_util_init(odm_pf, dev_cfg->sclk_mhz, dev_cfg->util_interval_ms);
+	odm_rebal_init(odm_pf, dev_cfg->rebalance);
+
+	/* Reset the dirty queues in the background */
+	err = odm_qpool_start(odm_pf);
+	if (err) {
+		log_write(LOG_ERR, "ODM: Failed to start queue pool\n");
+		goto fini_odm;
 	}
+	odm_fifo_init(odm_pf, dev_cfg->fifo_auto, dev_cfg->fifo_kb);
 
 	/* Register interrupts */
 	err = odm_irq_init(odm_pf);
 	if (err) {
 		log_write(LOG_ERR, "ODM: Failed to initialize irq vectors\n");
-		goto fini_odm;
+		goto stop_qpool;
 	}
 
 	/* Setup mbox */
-	err = odm_setup_mbox(odm_pf);
+	err = odm_mbox_setup(odm_pf);
 	if (err) {
 		log_write(LOG_ERR, "ODM: Failed to setup mbox\n");
 		goto free_irq;
 	}
 
+	/* Control commands are optional, the driver runs without them */
+	if (odm_cmd_start(odm_pf, odm_pf->cmd_sock))
+		log_write(LOG_WARNING, "ODM: Failed to start the command server\n");
+
 	log_write(LOG_INFO, "ODM: PF probe is done\n");
 	odm_pf->pmem->dev_state = ODM_DEV_STATE_RUNNING;
+	odm_pf->warm = dev_cfg->warm_restart;
+	odm_pf->takeover = NULL;
 	return odm_pf;
 
 free_irq:
 	odm_irq_free(odm_pf);
+stop_qpool:
+	odm_qpool_stop(odm_pf);
 fini_odm:
-	odm_fini(odm_pf);
+	if (!odm_pf->warm)
+		odm_fini(odm_pf);
 free_pmem:
-	pmem_free("/odm_pmem");
+	odm_stats_fini(odm_pf);
+	odm_trace_fini(odm_pf);
+	if (odm_pf->warm)
+		pmem_detach(odm_pf->pmem_name);
+	else
+		pmem_free(odm_pf->pmem_name);
 free_vfio:
-	vfio_pci_device_free(&odm_pf->pdev);
+	odm_pf->backend->release(odm_pf);
 free_pf:
 	free(odm_pf);
 
 	return NULL;
 }
 
+struct odm_dev *
+odm_pf_probe(struct odm_dev_config *dev_cfg)
+{
+	struct odm_handover ho;
+	struct odm_dev *odm_pf;
+
+	if (dev_cfg->takeover_fd <= 0)
+		return odm_pf_dev_probe(dev_cfg, NULL);
+
+	/* An upgrade, the running process hands its device over */
+	if (odm_upgrade_recv(dev_cfg->takeover_fd, &ho)) {
+		odm_upgrade_done(dev_cfg->takeover_fd, -EPROTO);
+		dev_cfg->takeover_fd = 0;
+		return NULL;
+	}
+
+	odm_pf = odm_pf_dev_probe(dev_cfg, &ho);
+	odm_handover_close(&ho);
+	if (odm_pf)
+		log_write(LOG_INFO, "ODM: took the device over from the previous process\n");
+	odm_upgrade_done(dev_cfg->takeover_fd, odm_pf ? 0 : -ENODEV);
+	dev_cfg->takeover_fd = 0;
+
+	return odm_pf;
+}
+
 void
 odm_pf_release(struct odm_dev *odm_pf)
 {
-	int i;
-
 	if (odm_pf == NULL)
 		return;
 
-	for (i = 0; i < ODM_MAX_VFS; i++) {
-		struct odm_mbox_work *mbox = &odm_pf->mbox_work[i];
+	odm_cmd_stop(odm_pf);
+	odm_mbox_release(odm_pf);
+	odm_qpool_stop(odm_pf);
 
-		pthread_mutex_lock(&mbox->lock);
-		mbox->msg.q.cmd = ODM_MBOX_THREAD_QUIT;
-		pthread_cond_signal(&mbox->cond);
-		pthread_mutex_unlock(&mbox->lock);
-	}
+	odm_irq_free(odm_pf);
+	/* A warm restart resumes the device as it is left */
+	if (!odm_pf->warm)
+		odm_fini(odm_pf);
+	odm_stats_fini(odm_pf);
+	odm_trace_fini(odm_pf);
+	if (odm_pf->pmem && odm_pf->warm)
+		pmem_detach(odm_pf->pmem_name);
+	else if (odm_pf->pmem)
+		pmem_free(odm_pf->pmem_name);
+	odm_pf->backend->release(odm_pf);
+	log_write(LOG_DEBUG, "ODM: reg shadow hits %lu, mmio reads %lu, writes %lu\n",
+		  odm_pf->reg_stats.hits, odm_pf->reg_stats.mmio_reads,
+		  odm_pf->reg_stats.mmio_writes);
+	log_write(LOG_INFO, "ODM: PF release is done\n");
+	free(odm_pf);
+}
+
+static int
+odm_vfio_setup(struct odm_dev *odm_pf)
+{
+	struct odm_handover *ho = odm_pf->takeover;
+	int rc;
+
+	if (!ho)
+		return vfio_pci_device_setup(&odm_pf->pdev);
 
-	for (i = 0; i < ODM_MAX_VFS; i++) {
-		if (pthread_join(odm_pf->thread[i], NULL) != 0)
-			log_write(LOG_ERR, "mbox thread close failed for vf: %d\n", i);
+	if (ho->vfio.device_fd < 0) {
+		log_write(LOG_ERR, "%s: no VFIO device handed over\n", odm_pf->pdev.name);
+		return -1;
 	}
 
-	odm_irq_free(odm_pf);
-	odm_fini(odm_pf);
-	if (odm_pf->pmem)
-		pmem_free("/odm_pmem");
+	/* The fds belong to the device from then on, closed on failure */
+	rc = vfio_pci_device_attach(&odm_pf->pdev, &ho->vfio);
+	ho->vfio.container_fd = -1;
+	ho->vfio.group_fd = -1;
+	ho->vfio.device_fd = -1;
+
+	return rc;
+}
+
+static int
+odm_vfio_handover(struct odm_dev *odm_pf, struct odm_handover *ho)
+{
+	return vfio_pci_device_handover(&odm_pf->pdev, &ho->vfio);
+}
+
+static void
+odm_vfio_release(struct odm_dev *odm_pf)
+{
 	if (odm_pf->pdev.device_fd)
 		vfio_pci_device_free(&odm_pf->pdev);
-	log_write(LOG_INFO, "ODM: PF release is done\n");
-	free(odm_pf);
+}
+
+void
+odm_pf_name(struct odm_dev *odm_pf, const char *base, char *name)
+{
+	const char *suffix = odm_pf->backend->suffix;
+	const char *ext;
+	int len;
+
+	if (!suffix) {
+		snprintf(name, ODM_PF_NAME_LEN, "%s", base);
+		return;
+	}
+
+	ext = strrchr(base, '.');
+	if (!ext || strchr(ext, '/'))
+		ext = base + strlen(base);
+	len = ext - base;
+	snprintf(name, ODM_PF_NAME_LEN, "%.*s%s%s", len, base, suffix, ext);
+}
+
+const struct odm_pf_backend odm_pf_vfio_backend = {
+	.name = "vfio",
+	.setup = odm_vfio_setup,
+	.release = odm_vfio_release,
+	.create_vfs = odm_pf_create_vfs,
+	.handover = odm_vfio_handover,
+};
+
+static const struct odm_pf_backend *odm_pf_backends[] = {
+	&odm_pf_vfio_backend,
+	&odm_pf_sim_backend,
+};
+
+const struct odm_pf_backend *
+odm_pf_backend_get(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(odm_pf_backends) / sizeof(odm_pf_backends[0]); i++) {
+		if (strcmp(odm_pf_backends[i]->name, name) == 0)
+			return odm_pf_backends[i];
+	}
+
+	return NULL;
 }
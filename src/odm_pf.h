@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
 
 #include "errno.h"
 #include "log.h"
@@ -20,6 +21,14 @@
 #endif
 
 #define ODM_PF_PCI_BDF "0000:08:00.0"
+#define ODM_PF_CFG_FILE "/etc/odm_pf_driver.cfg"
+/* Device state kept across runs */
+#define ODM_PF_PMEM_NAME "/odm_pmem"
+/* Longest shared memory segment or socket name, with the backend suffix */
+#define ODM_PF_NAME_LEN 108
+
+/* Layout version of struct pmem_data, a warm restart resumes the same layout */
+#define ODM_PMEM_VERSION		1
 
 /* PCI BAR nos */
 #define PCI_ODM_PF_CFG_BAR		0
@@ -34,8 +43,48 @@
 #define ODM_MAX_VFS			16
 #define ODM_MAX_QUEUES			32
 
+/* Mailbox workers */
+#define ODM_MBOX_DEF_WORKERS		1
+#define ODM_MBOX_WORKER_STACK		(128 * 1024)
+/* Mailbox commands queued per VF, power of 2 */
+#define ODM_MBOX_RING_SIZE		16
+/* Idle polls of the mbox poll thread before it backs off to sleeping */
+#define ODM_MBOX_POLL_SPIN		4096
+/* First sleep of the mbox poll thread, doubled up to the backoff */
+#define ODM_MBOX_POLL_SLEEP_MIN_NS	(1000ULL)
+
+#define ODM_CACHE_LINE_SIZE		64
+
+/* Queue reset deadline */
+#define ODM_QRST_TIMEOUT_NS		(100 * 1000 * 1000ULL)
+/* QRST polls before the reset engine backs off to sleeping */
+#define ODM_QRST_SPIN_POLLS		64
+/* Reset engine sleep between polls, doubled up to the max */
+#define ODM_QRST_SLEEP_MIN_NS		(1000ULL)
+#define ODM_QRST_SLEEP_MAX_NS		(1000 * 1000ULL)
+
+/* DMA utilization sampler */
+#define ODM_UTIL_DEF_INTERVAL_MS	1000
+/* SCLK rate ODM_CSCLK_ACTIVE_PC counts at */
+#define ODM_SCLK_DEF_MHZ		1000
+
+/*
+ * Engine rebalancer. It starts when the DMA utilization is at least
+ * UTIL_MIN and the engines differ by IMBALANCE_HI open queues for HOLD
+ * samples, and stops once they are within IMBALANCE_LO.
+ */
+#define ODM_REBAL_UTIL_MIN		5000
+#define ODM_REBAL_IMBALANCE_HI		4
+#define ODM_REBAL_IMBALANCE_LO		1
+#define ODM_REBAL_HOLD_SAMPLES		3
+/* Queues moved per sample, and samples before a moved queue can move again */
+#define ODM_REBAL_MAX_MOVES		2
+#define ODM_REBAL_COOLDOWN_SAMPLES	10
+
 /* FIFO in terms of KB */
 #define ODM_ENG_MAX_FIFO		128
+/* Smallest FIFO share of an engine, in KB */
+#define ODM_ENG_MIN_FIFO		8
 
 /****************  Macros for register modification ************/
 #define ODM_DMA_IDS_INST_STRM(x)		((uint64_t)((x) & 0xff) << 40)
@@ -116,19 +165,22 @@
 #define ODM_REQQ_GENBUFF_TH_LIMIT		(0x17000ULL)
 #define ODM_NCBO_ERR_INFO			(0x17200ULL)
 #define ODM_NCBO_ERR_INT			(0x17300ULL)
+/* End of the register map, BAR0 covers at least this */
+#define ODM_REG_SPACE_LEN			(ODM_NCBO_ERR_INT + 0x8ULL)
 
 #define ODM_TH_VAL				(0x108030A020C01040ULL)
+#define ODM_NCB_CFG_MOLR_MASK			(0x3ffULL)
 
 #define ODM_PF_RAS_IRQ				(0x20)
 #define ODM_MBOX_VF_PF_IRQ			(0x21)
 #define ODM_NCBO_ERR_IRQ			(0x22)
+#define ODM_IRQ_NUM_VECS			(ODM_NCBO_ERR_IRQ + 1)
 
 #define ODM_DEV_INIT		0x1
 #define ODM_DEV_CLOSE		0x2
 #define ODM_QUEUE_OPEN		0x3
 #define ODM_QUEUE_CLOSE		0x4
 #define ODM_REG_DUMP		0x5
-#define ODM_MBOX_THREAD_QUIT	0x6
 
 struct odm_mbox_dev_msg_t {
 	/* Response code */
@@ -159,16 +211,142 @@ union odm_mbox_msg_t {
 	};
 };
 
-struct odm_mbox_work {
+/*
+ * Mailbox command ring of a VF. Single producer (mailbox interrupt handler)
+ * and single consumer (the worker serving the VF).
+ */
+struct odm_mbox_ring {
+	/* Producer index */
+	uint32_t head;
+	/* Highest ring depth seen */
+	uint32_t max_depth;
+	/* Commands dropped on a full ring */
+	uint64_t drops;
+	/* Keep the consumer index off the producer cache line */
+	uint8_t pad[ODM_CACHE_LINE_SIZE - 16];
+	/* Consumer index */
+	uint32_t tail;
+	union odm_mbox_msg_t msgs[ODM_MBOX_RING_SIZE];
+	/* Time each message was read from the mailbox */
+	uint64_t ts[ODM_MBOX_RING_SIZE];
+};
+
+/* Mailbox worker, processes the messages of the VFs mapped to it */
+struct odm_mbox_worker {
 	struct odm_dev *odm_pf;
-	union odm_mbox_msg_t msg;
-	pthread_mutex_t lock;
-	pthread_cond_t cond;
+	pthread_t thread;
+	/* Wakeup eventfd, counts the messages queued to the worker */
+	int efd;
+	bool quit;
+};
+
+/* Result of a queue reset */
+struct odm_qrst_result {
+	/* Queues whose reset completed */
+	uint32_t done;
+	/* Queues whose reset did not complete by the deadline */
+	uint32_t stuck;
+	/* Reset latency of the completed queues, in ns */
+	uint64_t lat_ns[ODM_MAX_QUEUES];
+};
+
+/*
+ * Shadow copies of the config registers. Hardware does not change these
+ * registers on its own, so reads are served from the shadow once it holds
+ * the register value and writes of an unchanged value are dropped. Status,
+ * W1C/W1S and other volatile registers always go to the device.
+ */
+enum odm_shadow_reg {
+	ODM_SHADOW_DMAX_IDS,
+	ODM_SHADOW_ENGX_BUF = ODM_SHADOW_DMAX_IDS + ODM_MAX_QUEUES,
+	ODM_SHADOW_DMA_ENGX_EN = ODM_SHADOW_ENGX_BUF + ODM_MAX_ENGINES,
+	ODM_SHADOW_CTL = ODM_SHADOW_DMA_ENGX_EN + ODM_MAX_ENGINES,
+	ODM_SHADOW_DMA_CONTROL,
+	ODM_SHADOW_DMA_INTL_SEL,
+	ODM_SHADOW_NCB_CFG,
+	ODM_SHADOW_GENBUFF_TH,
+	ODM_SHADOW_NUM_REGS
+};
+
+struct odm_reg_shadow {
+	uint64_t val[ODM_SHADOW_NUM_REGS];
+	/* Bitmap of the slots holding the register value */
+	uint64_t valid;
+};
+
+/* Register access counters */
+struct odm_reg_stats {
+	/* Reads served and writes dropped by the shadow */
+	uint64_t hits;
+	/* Register accesses that reached the device */
+	uint64_t mmio_reads;
+	uint64_t mmio_writes;
 };
 
+/* Register write for odm_reg_write_batch() */
+struct odm_reg_op {
+	uint64_t offset;
+	uint64_t val;
+};
+
+/* DMA utilization sampler state */
+struct odm_util {
+	uint64_t sclk_mhz;
+	/* Sample interval, 0 when sampling is off */
+	uint32_t interval_ms;
+	/* ODM_CSCLK_ACTIVE_PC and time of the last sample */
+	uint64_t last_pc;
+	uint64_t last_ns;
+	/* Utilization over the last interval, in 1/100 % */
+	uint32_t last;
+};
+
+/* Engine FIFO split, in KB per engine */
+struct odm_fifo {
+	/* Split follows the number of queues mapped to each engine */
+	bool auto_split;
+	uint8_t kb[ODM_MAX_ENGINES];
+	/* Split waiting for the engines to be quiesced */
+	bool pending;
+	uint8_t pending_kb[ODM_MAX_ENGINES];
+};
+
+/* Engine rebalancer state */
+struct odm_rebal {
+	bool enabled;
+	/* Rebalancing, and consecutive samples over the start threshold */
+	bool active;
+	uint32_t hold;
+	uint64_t samples;
+	/* Sample at which each queue was last moved */
+	uint64_t moved_at[ODM_MAX_QUEUES];
+	uint64_t moves;
+};
+
+/* Interrupt storm detection of the error vectors */
+#define ODM_IRQ_WINDOW_NS		(1000ULL * 1000 * 1000)
+/* Events in a window which mask the vector */
+#define ODM_IRQ_STORM_RATE		1000
+/* Events logged in a window, the others are counted and summarized */
+#define ODM_IRQ_LOG_BURST		5
+#define ODM_IRQ_BACKOFF_MIN_MS		100
+#define ODM_IRQ_BACKOFF_MAX_MS		30000
+/* A storm this soon after the vector was enabled again doubles the backoff */
+#define ODM_IRQ_BACKOFF_HOLD_NS		(60ULL * 1000 * 1000 * 1000)
+
 struct odm_irq_mem {
 	struct odm_dev *odm_pf;
 	uint16_t index;
+	/* Rate accounting, under the irq lock */
+	uint64_t window_ns;
+	uint32_t count;
+	uint32_t suppressed;
+	uint64_t last_cause;
+	/* A storming vector is masked until unmask_ns */
+	bool masked;
+	uint64_t unmask_ns;
+	uint64_t unmasked_ns;
+	uint32_t backoff_ms;
 };
 
 enum odm_state {
@@ -177,51 +355,667 @@ enum odm_state {
 	ODM_DEV_STATE_RUNNING
 };
 
+/* Queue state kept in pmem, a zeroed pmem has all the queues dirty */
+enum odm_queue_state {
+	/* Queue needs a reset before it can be opened */
+	ODM_QUEUE_STATE_DIRTY,
+	/* Queue is reset and ready to be opened */
+	ODM_QUEUE_STATE_CLEAN,
+	/* Queue is opened by a VF */
+	ODM_QUEUE_STATE_OPEN
+};
+
 struct pmem_data {
 	enum odm_state dev_state;
 	int maxq_per_vf;
 	int vfs_in_use;
 	bool setup_done[ODM_MAX_VFS];
+	uint8_t q_state[ODM_MAX_QUEUES];
+	/* Tuning profile the device was initialized with */
+	char profile[16];
+	/* Configured engine to queue mapping, without the rebalancer moves */
+	uint32_t eng_sel;
+	/* Configured MOLR override, 0 for the profile's */
+	uint16_t molr;
+	uint32_t version;
+};
+
+/*
+ * Pool of pre-reset queues. Queues released by the VFs are reset in the
+ * background so the queue open only has to program the stream IDs.
+ */
+struct odm_qpool {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+	/* Queues waiting for a background reset */
+	uint32_t pending;
+	/* Queues being reset by the background thread */
+	uint32_t busy;
+	/* Queues to move to their configured engine once released and reset */
+	uint32_t remap;
+	bool started;
+	bool quit;
+	/* Queue opens served from a clean queue and with a synchronous reset */
+	uint64_t open_clean;
+	uint64_t open_sync;
+};
+
+struct odm_dev;
+struct odm_dev_config;
+struct odm_pf_stats;
+struct odm_pf_trace;
+struct reactor_timer;
+struct odm_cmd_server;
+
+/* Events of the flight recorder */
+enum odm_trace_type {
+	/* Driver started, arg: pid, d0: resumed */
+	ODM_TRACE_START = 1,
+	/* id: VF, d0/d1: message */
+	ODM_TRACE_MBOX_RX,
+	/* id: VF, arg: latency in us, d0/d1: response */
+	ODM_TRACE_MBOX_RSP,
+	/* id: VF, d0/d1: message dropped on a full ring */
+	ODM_TRACE_MBOX_DROP,
+	/* id: hw queue, arg: VF, d0: VF queue, d1: DMAX_IDS */
+	ODM_TRACE_QUEUE_INIT,
+	/* arg: time taken in us, d0: queues reset, d1: queues stuck */
+	ODM_TRACE_QUEUE_RESET,
+	/* id: vector, d0: cause */
+	ODM_TRACE_IRQ,
+	/* d0: register offset, d1: value */
+	ODM_TRACE_CFG_WRITE,
+	ODM_TRACE_MAX,
+};
+
+/*
+ * Device handed over to a new process on an upgrade. The fds the backend
+ * does not use, and those of the vectors not enabled, are -1.
+ */
+struct odm_handover {
+	/* VFIO container, group and device of the vfio backend */
+	struct vfio_pci_fds vfio;
+	/* Register file of the sim backend */
+	int bar0_fd;
+	int pmem_fd;
+	int32_t efds[ODM_IRQ_NUM_VECS];
+};
+
+/**
+ * Device backend. The backend owns the device resources: BAR0 mapping,
+ * MSI-X eventfds and VF creation. Register hooks are optional; when NULL,
+ * registers are accessed through the BAR0 mapping directly.
+ */
+struct odm_pf_backend {
+	const char *name;
+	/*
+	 * Appended to the names of the shared memory segments and of the command
+	 * socket, so a device of this backend does not use the ones of the driver
+	 * of the real device. NULL for none.
+	 */
+	const char *suffix;
+	int (*setup)(struct odm_dev *odm_pf);
+	void (*release)(struct odm_dev *odm_pf);
+	int (*create_vfs)(struct odm_dev *odm_pf, struct odm_dev_config *dev_cfg);
+	uint64_t (*reg_read)(struct odm_dev *odm_pf, uint64_t offset);
+	void (*reg_write)(struct odm_dev *odm_pf, uint64_t offset, uint64_t val);
+	/* Duplicate the fds of the device for a new process, on an upgrade */
+	int (*handover)(struct odm_dev *odm_pf, struct odm_handover *ho);
+};
+
+extern const struct odm_pf_backend odm_pf_vfio_backend;
+extern const struct odm_pf_backend odm_pf_sim_backend;
+
+/* Engine placement policy, computing the engine to queue mapping */
+enum odm_placement_policy {
+	/* The mapping is given as the eng_sel mask */
+	ODM_PLACEMENT_MASK,
+	/* The queues of each VF alternate between the engines */
+	ODM_PLACEMENT_INTERLEAVE,
+	/* Even VFs on engine 0, odd VFs on engine 1 */
+	ODM_PLACEMENT_SPLIT_BY_VF,
+	/* First half of the VFs on engine 0, second half on engine 1 */
+	ODM_PLACEMENT_PACK,
+	/* Queues spread by the relative load of their VF */
+	ODM_PLACEMENT_WEIGHTS,
+};
+
+struct odm_placement {
+	enum odm_placement_policy policy;
+	int nb_weights;
+	uint32_t weights[ODM_MAX_VFS];
+};
+
+/*
+ * Tuning profile, the global DMA settings programmed together at init: the
+ * max outstanding loads (MOLR) of ODM_NCB_CFG and ODM_DMA_CONTROL. The general
+ * buffer thresholds are not part of it, they are always ODM_TH_VAL.
+ */
+struct odm_profile {
+	const char *name;
+	uint16_t molr;
+	uint64_t dma_control;
+};
+
+/* How the VF mailbox is served */
+enum odm_mbox_mode {
+	/* Mailbox interrupt, handed to the workers */
+	ODM_MBOX_MODE_IRQ,
+	/* Polled by a thread, pinned to a core */
+	ODM_MBOX_MODE_POLL,
 };
 
 struct odm_dev_config {
+	const struct odm_pf_backend *backend;
+	const struct odm_profile *profile;
+	struct odm_placement placement;
 	uint32_t eng_sel;
 	uint8_t uuid_gbl[UUID_LEN];
 	uint8_t num_vfs;
+	uint8_t mbox_workers;
+	enum odm_mbox_mode mbox_mode;
+	/* CPU of the mbox poll thread, -1 to leave it unpinned */
+	int mbox_poll_cpu;
+	/* Longest sleep of the idle mbox poll thread in us, 0 to always spin */
+	uint32_t mbox_poll_backoff_us;
+	uint32_t util_interval_ms;
+	uint32_t sclk_mhz;
+	bool rebalance;
+	bool fifo_auto;
+	uint8_t fifo_kb[ODM_MAX_ENGINES];
+	/* MOLR overriding the profile, 0 to use the profile's */
+	uint16_t molr;
+	/* Tuning mode: workload command, throughput pattern and cfg to update */
+	const char *tune_cmd;
+	const char *tune_pattern;
+	const char *tune_cfg;
+	/* Config file read again on SIGHUP */
+	const char *cfg_file;
+	/* Keep the device and its state on exit, for a warm restart */
+	bool warm_restart;
+	/* Socket to take the device over from the running process, 0 if none */
+	int takeover_fd;
 };
 
 struct odm_dev {
+	const struct odm_pf_backend *backend;
+	void *backend_priv;
 	struct vfio_pci_device pdev;
 	struct pmem_data *pmem;
+	/* Names of the shared memory segments and command socket, see odm_pf_name() */
+	char pmem_name[ODM_PF_NAME_LEN];
+	char stats_name[ODM_PF_NAME_LEN];
+	char trace_name[ODM_PF_NAME_LEN];
+	char cmd_sock[ODM_PF_NAME_LEN];
 	int num_vecs;
 	struct odm_irq_mem *irq_mem;
-	pthread_t thread[ODM_MAX_VFS];
-	struct odm_mbox_work mbox_work[ODM_MAX_VFS];
+	/* Storm state of the error vectors, no vector is masked once irq_stop is set */
+	pthread_mutex_t irq_lock;
+	bool irq_stop;
+	/* Armed for the next unmask or summary of the error vectors */
+	struct reactor_timer *irq_timer;
+	int nb_mbox_workers;
+	struct odm_mbox_worker *mbox_workers;
+	struct odm_mbox_ring mbox_ring[ODM_MAX_VFS];
+	/* Mailbox poll mode, instead of the interrupt and the workers */
+	enum odm_mbox_mode mbox_mode;
+	int mbox_poll_cpu;
+	uint32_t mbox_poll_backoff_us;
+	pthread_t mbox_poll_thread;
+	bool mbox_poll_quit;
+	bool mbox_polling;
+	/* Latency of the last completed reset of each queue, in ns */
+	uint64_t qrst_lat_ns[ODM_MAX_QUEUES];
+	/* Queues whose last reset did not complete */
+	uint32_t qrst_stuck;
+	struct odm_qpool qpool;
+	struct odm_reg_shadow reg_shadow;
+	struct odm_reg_stats reg_stats;
+	struct odm_util util;
+	struct odm_rebal rebal;
+	/* Engine FIFO split, under the queue pool lock */
+	struct odm_fifo fifo;
+	struct odm_cmd_server *cmd;
+	/* Shared memory statistics, serialized writers */
+	struct odm_pf_stats *stats;
+	pthread_mutex_t stats_lock;
+	/* Shared memory flight recorder, lock-free writers */
+	struct odm_pf_trace *trace;
+	/* Warm restart mode, and whether this process resumed a running device */
+	bool warm;
+	bool resumed;
+	/* Device handed over by the previous process, during the probe */
+	struct odm_handover *takeover;
 };
 
 /* ODM PF functions */
 struct odm_dev *odm_pf_probe(struct odm_dev_config *dev_cfg);
 void odm_pf_release(struct odm_dev *odm_pf);
+const struct odm_pf_backend *odm_pf_backend_get(const char *name);
+const struct odm_profile *odm_profile_get(const char *name);
+/**
+ * Program a tuning profile, with the MOLR override.
+ *
+ * @param	odm_pf	ODM PF device.
+ * @param	profile	Tuning profile.
+ * @param	molr	MOLR overriding the profile, 0 to use the profile's.
+ */
+void odm_profile_apply(struct odm_dev *odm_pf, const struct odm_profile *profile, uint16_t molr);
+
+/**
+ * Reload the cfg file. The settings which can change with the VFs in use,
+ * the engine mapping, FIFO split, tuning profile, log level, utilization
+ * sample interval and warm restart mode, are compared with the running state and only the changed
+ * ones are applied. A cfg changing the number of VFs or the VF token is
+ * rejected, the VFs have to be recreated for them.
+ *
+ * @param	odm_pf	ODM PF device.
+ * @param	path	Config file.
+ * @return		0 on success, -EINVAL if the cfg is rejected, -EBUSY if
+ *			the profile could not be changed with queues open.
+ */
+int odm_pf_reload(struct odm_dev *odm_pf, const char *path);
+
+/**
+ * Upgrade the driver without detaching the VFs. The binary at argv[0] is
+ * started with the arguments of this process and takes the device over: the
+ * VFIO fds, the MSI-X eventfds and the pmem are handed over on a Unix socket.
+ * Once the new process is ready, odm_pf is released as for a warm restart,
+ * without resetting the device, and the new process serves the mailbox.
+ *
+ * @param	odm_pf	ODM PF device.
+ * @param	argv	Arguments of this process, NULL terminated.
+ * @return		0 once odm_pf is released, the process exits then. A
+ *			negative errno if the upgrade failed before the
+ *			handover, odm_pf keeps running.
+ */
+int odm_pf_upgrade(struct odm_dev *odm_pf, char *const argv[]);
+
+/**
+ * Hand the device over to the process at the other end of a socket, see
+ * odm_pf_upgrade(). The new process probes with the socket as its takeover
+ * fd.
+ *
+ * @param	odm_pf	ODM PF device.
+ * @param	sock	SOCK_SEQPACKET Unix socket connected to the new process.
+ * @return		0 once odm_pf is released, a negative errno if the
+ *			handover failed before, odm_pf keeps running.
+ */
+int odm_pf_handover(struct odm_dev *odm_pf, int sock);
+
+/**
+ * Parse an engine placement policy: mask, interleave, split-by-vf, pack or
+ * weights=w0,w1,... with one weight per VF.
+ *
+ * @param	str	String to parse.
+ * @param	pl	Placement to fill.
+ * @return		0 on success, -EINVAL if the policy is not valid.
+ */
+int odm_placement_parse(const char *str, struct odm_placement *pl);
+/**
+ * Compute the engine to queue mapping of a placement policy.
+ *
+ * @param	pl	Placement policy.
+ * @param	num_vfs	Number of VFs, the queues are split evenly between them.
+ * @param	eng_sel	Mapping used by the mask policy.
+ * @return		Value for ODM_DMA_INTL_SEL, bit n set maps queue n to engine 1.
+ */
+uint32_t odm_placement_eng_sel(const struct odm_placement *pl, int num_vfs, uint32_t eng_sel);
+const char *odm_placement_name(const struct odm_placement *pl);
+void odm_placement_log(uint32_t eng_sel, int num_vfs);
+
+/**
+ * Tune the engine mapping, FIFO split and MOLR for a workload. The workload
+ * command is run for each point of the search space, and the best point by
+ * the throughput it reports is written to the cfg file.
+ *
+ * @param	odm_pf	ODM PF device.
+ * @param	dev_cfg	Device config, with the tuning mode parameters.
+ * @return		0 on success, -1 if no point could be measured or the cfg
+ *			could not be written.
+ */
+int odm_tune(struct odm_dev *odm_pf, struct odm_dev_config *dev_cfg);
+
+/**
+ * Sample the DMA utilization. The utilization over the time since the
+ * previous sample is derived from ODM_CSCLK_ACTIVE_PC and published in the
+ * statistics. Called periodically by a timer of the main loop.
+ *
+ * @param	odm_pf	ODM PF device.
+ * @return		Utilization in 1/100 %.
+ */
+uint32_t odm_util_sample(struct odm_dev *odm_pf);
+
+/**
+ * Enable again the error vectors masked for an interrupt storm once their
+ * backoff expired, and log the summary of the events which were not logged.
+ * Called by the irq timer, which the storm accounting arms for the first
+ * deadline.
+ *
+ * @param	odm_pf	ODM PF device.
+ * @return		ns until a vector is due again, 0 if none is pending.
+ */
+uint64_t odm_irq_poll(struct odm_dev *odm_pf);
+
+/* ODM PF internal functions */
+/**
+ * Reset a set of queues. QRST is issued to all the queues, which are then
+ * polled together until the resets complete or the deadline expires.
+ *
+ * @param	odm_pf		ODM PF device.
+ * @param	qmask		Bitmask of the hardware queues to reset.
+ * @param	timeout_ns	Deadline for the resets to complete.
+ * @param	res		Per-queue result, may be NULL.
+ * @return			0 on success, -ETIMEDOUT if any queue did not complete.
+ */
+int odm_queues_reset(struct odm_dev *odm_pf, uint32_t qmask, uint64_t timeout_ns,
+		     struct odm_qrst_result *res);
+/**
+ * Program a queue of a VF for its DMA and instruction streams.
+ *
+ * @param	odm_pf		ODM PF device.
+ * @param	vf_id		VF the queue belongs to.
+ * @param	qid		Queue index within the VF.
+ * @return			0 on success, -EINVAL if qid is not a queue of the VF.
+ */
+int odm_queue_init(struct odm_dev *odm_pf, uint8_t vf_id, uint8_t qid);
+void odm_queues_fini(struct odm_dev *odm_pf, uint8_t vf_id);
+void odm_util_init(struct odm_dev *odm_pf, uint32_t sclk_mhz, uint32_t interval_ms);
+void odm_rebal_init(struct odm_dev *odm_pf, bool enable);
+
+/**
+ * Parse an engine FIFO split, "auto" or the KB of each engine as "kb0,kb1".
+ *
+ * @param	str		String to parse.
+ * @param	auto_split	Set if the split follows the queue mapping.
+ * @param	kb		FIFO KB of each engine, if not auto.
+ * @return			0 on success, -EINVAL if the split is not valid.
+ */
+int odm_fifo_parse(const char *str, bool *auto_split, uint8_t *kb);
+void odm_fifo_init(struct odm_dev *odm_pf, bool auto_split, const uint8_t *kb);
+/**
+ * Change the engine FIFO split. The split is applied right away if no queue
+ * is open, else once the last open queue is closed and reset.
+ *
+ * @param	odm_pf		ODM PF device.
+ * @param	auto_split	Split the FIFO by the number of queues mapped to each
+ *				engine, kb is ignored.
+ * @param	kb		FIFO KB of each engine.
+ * @return			0 if applied, -EAGAIN if waiting for the engines to
+ *				be quiesced, -EINVAL if the split is not valid.
+ */
+int odm_fifo_set(struct odm_dev *odm_pf, bool auto_split, const uint8_t *kb);
+/* Queue pool lock held */
+void odm_fifo_auto_update(struct odm_dev *odm_pf, uint64_t intl_sel);
+void odm_fifo_apply(struct odm_dev *odm_pf);
+/**
+ * Rebalance the engines. Queues which are not open are moved from the engine
+ * carrying more open queues to the other, so the next queue opens even the
+ * load out. Open queues are never moved.
+ *
+ * @param	odm_pf	ODM PF device.
+ * @param	util	DMA utilization over the last sample interval, in 1/100 %.
+ * @return		Number of queues moved.
+ */
+int odm_rebal_sample(struct odm_dev *odm_pf, uint32_t util);
+int odm_qpool_start(struct odm_dev *odm_pf);
+/* Takeover side of an upgrade: receive the device, then report the probe result */
+int odm_upgrade_recv(int sock, struct odm_handover *ho);
+void odm_upgrade_done(int sock, int err);
+void odm_handover_close(struct odm_handover *ho);
+void odm_qpool_stop(struct odm_dev *odm_pf);
+/**
+ * Change the configured engine to queue mapping. Queues which are not open
+ * are remapped right away, open queues once they are released and reset.
+ *
+ * @param	odm_pf	ODM PF device.
+ * @param	eng_sel	Engine to queue mapping, bit n set maps queue n to engine 1.
+ * @return		Number of queues waiting to be remapped.
+ */
+int odm_eng_sel_set(struct odm_dev *odm_pf, uint32_t eng_sel);
+
+/**
+ * Write a set of registers. All the offsets are checked before any register
+ * is written, and the writes are then issued back to back as relaxed writes
+ * after a single write barrier.
+ *
+ * @param	odm_pf	ODM PF device.
+ * @param	ops	Registers and values to write, in order.
+ * @param	nb_ops	Number of writes.
+ * @return		0 on success, -EINVAL if an offset is out of range.
+ */
+int odm_reg_write_batch(struct odm_dev *odm_pf, const struct odm_reg_op *ops, int nb_ops);
+/**
+ * Record an event in the flight recorder, a no-op if it is not mapped.
+ *
+ * @param	odm_pf	ODM PF device.
+ * @param	type	Event, enum odm_trace_type.
+ * @param	id	VF, queue or vector of the event.
+ * @param	arg	Event argument.
+ * @param	d0	Event data.
+ * @param	d1	Event data.
+ */
+void odm_trace(struct odm_dev *odm_pf, uint16_t type, uint16_t id, uint32_t arg, uint64_t d0,
+	       uint64_t d1);
+int odm_mbox_setup(struct odm_dev *odm_pf);
+void odm_mbox_release(struct odm_dev *odm_pf);
+/**
+ * Name of a shared memory segment or socket of the device, with the suffix
+ * of its backend inserted before the extension, if any.
+ *
+ * @param	odm_pf	ODM PF device, with its backend set.
+ * @param	base	Name used with the real device.
+ * @param	name	Buffer of ODM_PF_NAME_LEN bytes to fill.
+ */
+void odm_pf_name(struct odm_dev *odm_pf, const char *base, char *name);
+
+static inline uint64_t
+odm_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
 static inline void
-odm_reg_write(struct odm_dev *odm_pf, uint64_t offset, uint64_t val)
+odm_cpu_relax(void)
 {
-	if (offset > odm_pf->pdev.mem[0].len) {
-		log_write(LOG_ERR, "reg offset is out of range\n");
+#if defined(__aarch64__)
+	__asm__ volatile("yield" ::: "memory");
+#elif defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#else
+	__asm__ volatile("" ::: "memory");
+#endif
+}
+
+/*
+ * Device memory barriers. The ordered register accessors use them to order
+ * the register access against the normal memory accesses before a write and
+ * after a read, like writeq()/readq() in Linux. The relaxed accessors have no
+ * barriers and are only ordered against other accesses to the device.
+ */
+#if defined(__aarch64__)
+#define odm_io_wmb()	__asm__ volatile("dmb oshst" ::: "memory")
+#define odm_io_rmb()	__asm__ volatile("dmb oshld" ::: "memory")
+#else
+#define odm_io_wmb()	__atomic_thread_fence(__ATOMIC_RELEASE)
+#define odm_io_rmb()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#endif
+
+/*
+ * Register counters are diagnostic, a plain increment avoids a locked
+ * read-modify-write per register access at the cost of an occasional lost
+ * count when two threads update the same counter.
+ */
+static inline void
+odm_reg_stat_inc(uint64_t *cnt)
+{
+	__atomic_store_n(cnt, __atomic_load_n(cnt, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+}
+
+/* Uncounted register write, for callers that account the writes themselves */
+static inline void
+__odm_mmio_write(struct odm_dev *odm_pf, uint64_t offset, uint64_t val)
+{
+	if (odm_pf->backend->reg_write) {
+		odm_pf->backend->reg_write(odm_pf, offset, val);
 		return;
 	}
 
 	*((volatile uint64_t *)(odm_pf->pdev.mem[0].addr + offset)) = val;
 }
 
+static inline void
+odm_mmio_write_relaxed(struct odm_dev *odm_pf, uint64_t offset, uint64_t val)
+{
+	odm_reg_stat_inc(&odm_pf->reg_stats.mmio_writes);
+	__odm_mmio_write(odm_pf, offset, val);
+}
+
 static inline uint64_t
-odm_reg_read(struct odm_dev *odm_pf, uint64_t offset)
+odm_mmio_read_relaxed(struct odm_dev *odm_pf, uint64_t offset)
 {
-	if (offset > odm_pf->pdev.mem[0].len) {
-		log_write(LOG_ERR, "reg offset is out of range\n");
-		return -ENOMEM;
-	}
+	odm_reg_stat_inc(&odm_pf->reg_stats.mmio_reads);
+	if (odm_pf->backend->reg_read)
+		return odm_pf->backend->reg_read(odm_pf, offset);
 
 	return *(volatile uint64_t *)(odm_pf->pdev.mem[0].addr + offset);
 }
+
+/* Shadow slot of a config register, -1 for registers that are not cached */
+static inline int
+odm_reg_shadow_slot(uint64_t offset)
+{
+	if (offset < ODM_CSCLK_ACTIVE_PC)
+		return (offset & 0x7ffULL) == ODM_DMAX_IDS(0) ?
+			ODM_SHADOW_DMAX_IDS + (int)(offset >> 11) : -1;
+
+	/* Interrupt and mailbox registers lie above the global config registers */
+	if (offset > ODM_ENGX_BUF(ODM_MAX_ENGINES - 1) && offset != ODM_REQQ_GENBUFF_TH_LIMIT)
+		return -1;
+
+	switch (offset) {
+	case ODM_ENGX_BUF(0):
+	case ODM_ENGX_BUF(1):
+		return ODM_SHADOW_ENGX_BUF + (int)((offset >> 3) & 0x1);
+	case ODM_DMA_ENGX_EN(0):
+	case ODM_DMA_ENGX_EN(1):
+		return ODM_SHADOW_DMA_ENGX_EN + (int)((offset >> 3) & 0x1);
+	case ODM_CTL:
+		return ODM_SHADOW_CTL;
+	case ODM_DMA_CONTROL:
+		return ODM_SHADOW_DMA_CONTROL;
+	case ODM_DMA_INTL_SEL:
+		return ODM_SHADOW_DMA_INTL_SEL;
+	case ODM_NCB_CFG:
+		return ODM_SHADOW_NCB_CFG;
+	case ODM_REQQ_GENBUFF_TH_LIMIT:
+		return ODM_SHADOW_GENBUFF_TH;
+	default:
+		return -1;
+	}
+}
+
+static inline bool
+odm_reg_shadow_hit(struct odm_dev *odm_pf, int slot)
+{
+	return __atomic_load_n(&odm_pf->reg_shadow.valid, __ATOMIC_ACQUIRE) & BIT_ULL(slot);
+}
+
+static inline void
+odm_reg_shadow_set(struct odm_dev *odm_pf, int slot, uint64_t val)
+{
+	odm_pf->reg_shadow.val[slot] = val;
+	__atomic_or_fetch(&odm_pf->reg_shadow.valid, BIT_ULL(slot), __ATOMIC_RELEASE);
+}
+
+/* Runtime check, for the offsets the compiler cannot check */
+static inline bool
+odm_reg_offset_valid(uint64_t offset)
+{
+	if (offset >= ODM_REG_SPACE_LEN) {
+		log_write(LOG_ERR, "reg offset 0x%lx is out of range\n", offset);
+		return false;
+	}
+
+	return true;
+}
+
+static inline void
+__odm_reg_write(struct odm_dev *odm_pf, uint64_t offset, uint64_t val, bool ordered)
+{
+	int slot;
+
+	if (!odm_reg_offset_valid(offset))
+		return;
+
+	slot = odm_reg_shadow_slot(offset);
+	/* The register already holds the value */
+	if (slot >= 0 && odm_reg_shadow_hit(odm_pf, slot) && odm_pf->reg_shadow.val[slot] == val) {
+		odm_reg_stat_inc(&odm_pf->reg_stats.hits);
+		return;
+	}
+
+	if (ordered)
+		odm_io_wmb();
+	odm_mmio_write_relaxed(odm_pf, offset, val);
+	/* The shadowed registers are the device configuration */
+	if (slot >= 0) {
+		odm_reg_shadow_set(odm_pf, slot, val);
+		odm_trace(odm_pf, ODM_TRACE_CFG_WRITE, 0, 0, offset, val);
+	}
+}
+
+static inline uint64_t
+__odm_reg_read(struct odm_dev *odm_pf, uint64_t offset, bool ordered)
+{
+	uint64_t val;
+	int slot;
+
+	/* All ones, as for a read the device does not complete */
+	if (!odm_reg_offset_valid(offset))
+		return ~0ULL;
+
+	slot = odm_reg_shadow_slot(offset);
+	if (slot >= 0 && odm_reg_shadow_hit(odm_pf, slot)) {
+		odm_reg_stat_inc(&odm_pf->reg_stats.hits);
+		return odm_pf->reg_shadow.val[slot];
+	}
+
+	val = odm_mmio_read_relaxed(odm_pf, offset);
+	if (ordered)
+		odm_io_rmb();
+	if (slot >= 0)
+		odm_reg_shadow_set(odm_pf, slot, val);
+
+	return val;
+}
+
+/* Called only for a constant offset out of range, fails the build */
+extern void odm_reg_offset_out_of_range(void)
+	__attribute__((error("ODM register offset is out of range")));
+
+#define ODM_REG_CHECK(offset) \
+	((void)((__builtin_constant_p(offset) && (offset) >= ODM_REG_SPACE_LEN) ? \
+		odm_reg_offset_out_of_range(), 0 : 0))
+
+/*
+ * Register accessors. Constant offsets are checked at build time, others at
+ * runtime. odm_reg_write()/odm_reg_read() are ordered against normal memory
+ * and are used for the mailbox, QRST and other sequences where the device
+ * and the driver exchange state. The relaxed variants are for register
+ * programming where only the order of the device accesses matters.
+ */
+#define odm_reg_write(odm_pf, offset, val) \
+	(ODM_REG_CHECK(offset), __odm_reg_write(odm_pf, offset, val, true))
+#define odm_reg_write_relaxed(odm_pf, offset, val) \
+	(ODM_REG_CHECK(offset), __odm_reg_write(odm_pf, offset, val, false))
+#define odm_reg_read(odm_pf, offset) \
+	(ODM_REG_CHECK(offset), __odm_reg_read(odm_pf, offset, true))
+#define odm_reg_read_relaxed(odm_pf, offset) \
+	(ODM_REG_CHECK(offset), __odm_reg_read(odm_pf, offset, false))
+
 #endif /* __ODM_PF_H__ */
@@ -0,0 +1,279 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "odm_pf.h"
+#include "odm_pf_cmd.h"
+
+struct odm_cmd_server {
+	struct odm_dev *odm_pf;
+	char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	int listen_fd;
+	/* Written to stop the server thread */
+	int stop_fd;
+	pthread_t thread;
+};
+
+struct odm_cmd {
+	const char *name;
+	const char *usage;
+	int (*fn)(struct odm_dev *odm_pf, int argc, char **argv, char *reply, size_t len);
+};
+
+static int odm_cmd_help(struct odm_dev *odm_pf, int argc, char **argv, char *reply, size_t len);
+
+static int
+odm_cmd_fifo(struct odm_dev *odm_pf, int argc, char **argv, char *reply, size_t len)
+{
+	struct odm_fifo *fifo = &odm_pf->fifo;
+	uint8_t kb[ODM_MAX_ENGINES];
+	bool auto_split;
+	int n, rc;
+
+	if (argc > 2)
+		return -EINVAL;
+
+	if (argc == 2) {
+		if (odm_fifo_parse(argv[1], &auto_split, kb)) {
+			snprintf(reply, len, "FIFO split must be auto or kb0,kb1 with at least %d KB "
+				 "per engine and at most %d KB in total\n", ODM_ENG_MIN_FIFO,
+				 ODM_ENG_MAX_FIFO);
+			return -EINVAL;
+		}
+
+		rc = odm_fifo_set(odm_pf, auto_split, kb);
+		if (rc && rc != -EAGAIN)
+			return rc;
+	}
+
+	pthread_mutex_lock(&odm_pf->qpool.lock);
+	n = snprintf(reply, len, "%u/%u KB%s\n", fifo->kb[0], fifo->kb[1],
+		     fifo->auto_split ? ", auto" : "");
+	if (fifo->pending && n < (int)len)
+		snprintf(reply + n, len - n, "%u/%u KB pending until no queue is open\n",
+			 fifo->pending_kb[0], fifo->pending_kb[1]);
+	pthread_mutex_unlock(&odm_pf->qpool.lock);
+
+	return 0;
+}
+
+static int
+odm_cmd_profile(struct odm_dev *odm_pf, int argc, __attribute__((unused)) char **argv,
+		char *reply, size_t len)
+{
+	if (argc > 1)
+		return -EINVAL;
+
+	snprintf(reply, len, "%s: MOLR %lu, DMA_CONTROL 0x%lx\n",
+		 odm_pf->pmem->profile[0] ? odm_pf->pmem->profile : "unknown",
+		 (uint64_t)(odm_reg_read(odm_pf, ODM_NCB_CFG) & ODM_NCB_CFG_MOLR_MASK),
+		 odm_reg_read(odm_pf, ODM_DMA_CONTROL));
+
+	return 0;
+}
+
+static const struct odm_cmd odm_cmds[] = {
+	{"help", "help", odm_cmd_help},
+	{"fifo", "fifo [auto | kb0,kb1]", odm_cmd_fifo},
+	{"profile", "profile", odm_cmd_profile},
+};
+
+#define ODM_NB_CMDS (sizeof(odm_cmds) / sizeof(odm_cmds[0]))
+
+static int
+odm_cmd_help(__attribute__((unused)) struct odm_dev *odm_pf,
+	     __attribute__((unused)) int argc, __attribute__((unused)) char **argv,
+	     char *reply, size_t len)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < ODM_NB_CMDS && n < len; i++)
+		n += snprintf(reply + n, len - n, "%s\n", odm_cmds[i].usage);
+
+	return 0;
+}
+
+int
+odm_cmd_exec(struct odm_dev *odm_pf, const char *line, char *reply, size_t len)
+{
+	char buf[ODM_CMD_MAX_LEN], *argv[ODM_CMD_MAX_ARGS], *save;
+	size_t i;
+	int argc = 0;
+
+	reply[0] = '\0';
+	snprintf(buf, sizeof(buf), "%s", line);
+	for (argv[argc] = strtok_r(buf, " \t\r\n", &save); argv[argc];
+	     argv[argc] = strtok_r(NULL, " \t\r\n", &save)) {
+		if (++argc == ODM_CMD_MAX_ARGS)
+			return -E2BIG;
+	}
+
+	if (!argc)
+		return -EINVAL;
+
+	for (i = 0; i < ODM_NB_CMDS; i++) {
+		if (strcmp(argv[0], odm_cmds[i].name) == 0)
+			return odm_cmds[i].fn(odm_pf, argc, argv, reply, len);
+	}
+
+	snprintf(reply, len, "Unknown command %s, see help\n", argv[0]);
+
+	return -EOPNOTSUPP;
+}
+
+static void
+odm_cmd_serve(struct odm_cmd_server *server, int fd)
+{
+	struct timeval tv = {ODM_CMD_TIMEOUT_MS / 1000, (ODM_CMD_TIMEOUT_MS % 1000) * 1000};
+	char line[ODM_CMD_MAX_LEN], *reply;
+	size_t n = 0;
+	ssize_t rc;
+	int err;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	while (n < sizeof(line) - 1) {
+		rc = read(fd, line + n, sizeof(line) - 1 - n);
+		if (rc <= 0)
+			break;
+		n += rc;
+		if (memchr(line, '\n', n))
+			break;
+	}
+	line[n] = '\0';
+
+	reply = malloc(ODM_CMD_REPLY_LEN);
+	if (!reply)
+		return;
+
+	err = odm_cmd_exec(server->odm_pf, line, reply, ODM_CMD_REPLY_LEN);
+	log_write(LOG_INFO, "ODM_PF: command \"%.*s\": %d\n", (int)strcspn(line, "\r\n"), line,
+		  err);
+	if (err)
+		dprintf(fd, "ERR %d\n%s", -err, reply);
+	else
+		dprintf(fd, "OK\n%s", reply);
+
+	free(reply);
+}
+
+static void *
+odm_cmd_thread(void *arg)
+{
+	struct odm_cmd_server *server = arg;
+	struct pollfd pfd[2];
+	int fd;
+
+	pfd[0].fd = server->listen_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = server->stop_fd;
+	pfd[1].events = POLLIN;
+
+	while (1) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			log_write(LOG_ERR, "ODM_PF: command socket poll failed\n");
+			break;
+		}
+
+		if (pfd[1].revents)
+			break;
+
+		if (!(pfd[0].revents & POLLIN))
+			continue;
+
+		fd = accept(server->listen_fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		odm_cmd_serve(server, fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+int
+odm_cmd_start(struct odm_dev *odm_pf, const char *path)
+{
+	struct odm_cmd_server *server;
+	struct sockaddr_un addr;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		log_write(LOG_ERR, "ODM_PF: command socket path %s is too long\n", path);
+		return -1;
+	}
+
+	server = calloc(1, sizeof(*server));
+	if (!server)
+		return -1;
+
+	server->odm_pf = odm_pf;
+	snprintf(server->path, sizeof(server->path), "%s", path);
+	server->stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (server->stop_fd < 0)
+		goto free_server;
+
+	server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (server->listen_fd < 0)
+		goto close_stop;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, path, strlen(path));
+	/* Left over from a previous run */
+	unlink(path);
+	if (bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    chmod(path, 0600) || listen(server->listen_fd, 4)) {
+		log_write(LOG_ERR, "ODM_PF: failed to listen on %s: %s\n", path, strerror(errno));
+		goto close_listen;
+	}
+
+	if (pthread_create(&server->thread, NULL, odm_cmd_thread, server)) {
+		log_write(LOG_ERR, "ODM_PF: failed to create command thread\n");
+		goto unlink_path;
+	}
+
+	odm_pf->cmd = server;
+
+	return 0;
+
+unlink_path:
+	unlink(path);
+close_listen:
+	close(server->listen_fd);
+close_stop:
+	close(server->stop_fd);
+free_server:
+	free(server);
+
+	return -1;
+}
+
+void
+odm_cmd_stop(struct odm_dev *odm_pf)
+{
+	struct odm_cmd_server *server = odm_pf->cmd;
+	uint64_t val = 1;
+
+	if (!server)
+		return;
+
+	if (write(server->stop_fd, &val, sizeof(val)) != sizeof(val) ||
+	    pthread_join(server->thread, NULL))
+		log_write(LOG_ERR, "ODM_PF: command thread close failed\n");
+
+	unlink(server->path);
+	close(server->listen_fd);
+	close(server->stop_fd);
+	free(server);
+	odm_pf->cmd = NULL;
+}
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+/**
+ * @file
+ *
+ * ODM PF control commands
+ *
+ * The PF driver serves control commands on a Unix stream socket, one command
+ * per connection. The client sends the command and its arguments separated by
+ * spaces on a single line. The driver answers with a status line, "OK" or
+ * "ERR <errno>", followed by the output of the command, then closes the
+ * connection. odm_pf_ctl is the client.
+ */
+
+#ifndef __ODM_PF_CMD_H__
+#define __ODM_PF_CMD_H__
+
+#include <stddef.h>
+
+#define ODM_PF_CMD_SOCK			"/var/run/odm_pf_driver.sock"
+/* Longest command line, arguments included */
+#define ODM_CMD_MAX_LEN			256
+#define ODM_CMD_MAX_ARGS		8
+#define ODM_CMD_REPLY_LEN		4096
+/* Time a client has to send its command */
+#define ODM_CMD_TIMEOUT_MS		1000
+
+struct odm_dev;
+
+/**
+ * Start serving control commands.
+ *
+ * @param	odm_pf	ODM PF device.
+ * @param	path	Socket path.
+ * @return		0 on success, -1 on failure.
+ */
+int odm_cmd_start(struct odm_dev *odm_pf, const char *path);
+void odm_cmd_stop(struct odm_dev *odm_pf);
+
+/**
+ * Run a control command, as if received on the socket.
+ *
+ * @param	odm_pf	ODM PF device.
+ * @param	line	Command line.
+ * @param	reply	Buffer for the command output.
+ * @param	len	Size of the buffer.
+ * @return		0 on success, negative errno on failure.
+ */
+int odm_cmd_exec(struct odm_dev *odm_pf, const char *line, char *reply, size_t len);
+
+#endif /* __ODM_PF_CMD_H__ */
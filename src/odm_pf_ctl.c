@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+/*
+ * odm_pf_ctl: send a control command to the ODM PF driver.
+ *
+ * Connects to the command socket of the running PF driver, sends the command
+ * given on the command line and prints the reply. The exit status is 0 if the
+ * driver ran the command successfully.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "odm_pf_cmd.h"
+
+static void
+print_usage(const char *prog_name)
+{
+	fprintf(stderr, "Usage: %s [-s socket] command [args...]\n", prog_name);
+	fprintf(stderr, "  -s socket      Command socket of the driver (default %s)\n",
+		ODM_PF_CMD_SOCK);
+	fprintf(stderr, "Run \"%s help\" for the commands of the driver\n", prog_name);
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *path = ODM_PF_CMD_SOCK;
+	char line[ODM_CMD_MAX_LEN], reply[ODM_CMD_REPLY_LEN + 32], *body;
+	struct sockaddr_un addr;
+	size_t n = 0;
+	ssize_t rc;
+	int fd, opt, i;
+
+	while ((opt = getopt(argc, argv, "+s:")) != EOF) {
+		switch (opt) {
+		case 's':
+			path = optarg;
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+
+	if (optind == argc || strlen(path) >= sizeof(addr.sun_path))
+		print_usage(argv[0]);
+
+	for (i = optind; i < argc; i++) {
+		rc = snprintf(line + n, sizeof(line) - n, "%s%s", argv[i], i + 1 < argc ? " " : "\n");
+		if (rc < 0 || (size_t)rc >= sizeof(line) - n) {
+			fprintf(stderr, "Command is too long\n");
+			return EXIT_FAILURE;
+		}
+		n += rc;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return EXIT_FAILURE;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, path, strlen(path));
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		fprintf(stderr, "Failed to connect to %s, is odm_pf_driver running?\n", path);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	if (write(fd, line, n) != (ssize_t)n) {
+		perror("write");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	n = 0;
+	while (n < sizeof(reply) - 1) {
+		rc = read(fd, reply + n, sizeof(reply) - 1 - n);
+		if (rc <= 0)
+			break;
+		n += rc;
+	}
+	reply[n] = '\0';
+	close(fd);
+
+	body = strchr(reply, '\n');
+	if (!body) {
+		fprintf(stderr, "No reply from odm_pf_driver\n");
+		return EXIT_FAILURE;
+	}
+	*body++ = '\0';
+
+	if (strcmp(reply, "OK") == 0) {
+		fputs(body, stdout);
+		return EXIT_SUCCESS;
+	}
+
+	if (strncmp(reply, "ERR ", 4) == 0)
+		fprintf(stderr, "%s%s", strerror(atoi(reply + 4)), *body ? ": " : "\n");
+	fputs(body, stderr);
+
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+#include "odm_pf.h"
+
+/*
+ * Engine FIFO split. The ODM_ENG_MAX_FIFO KB of buffer is shared by the two
+ * engines through the size field of ODM_ENGX_BUF. Resizing the buffer of an
+ * engine with DMA in flight is not safe, so a new split is only programmed
+ * while no queue is open. A split asked for while queues are open is kept
+ * pending, and the queue pool applies it once the last open queue has been
+ * closed and reset. The queue pool lock serializes the split with queue
+ * opens.
+ */
+
+#define ODM_ENG_BUF_SIZE_MASK		0x7fULL
+
+int
+odm_fifo_parse(const char *str, bool *auto_split, uint8_t *kb)
+{
+	unsigned int kb0, kb1;
+	char end;
+
+	if (strcmp(str, "auto") == 0) {
+		*auto_split = true;
+		return 0;
+	}
+
+	if (sscanf(str, "%u,%u%c", &kb0, &kb1, &end) != 2)
+		return -EINVAL;
+
+	/* Each bounded before the sum, which could wrap */
+	if (kb0 < ODM_ENG_MIN_FIFO || kb0 > ODM_ENG_MAX_FIFO - ODM_ENG_MIN_FIFO ||
+	    kb1 < ODM_ENG_MIN_FIFO || kb1 > ODM_ENG_MAX_FIFO - ODM_ENG_MIN_FIFO ||
+	    kb0 + kb1 > ODM_ENG_MAX_FIFO)
+		return -EINVAL;
+
+	*auto_split = false;
+	kb[0] = kb0;
+	kb[1] = kb1;
+
+	return 0;
+}
+
+/* Split the FIFO by the number of queues mapped to each engine */
+static void
+odm_fifo_auto_split(uint64_t intl_sel, uint8_t *kb)
+{
+	int nq1 = __builtin_popcount((uint32_t)intl_sel);
+	int kb1;
+
+	kb1 = ODM_ENG_MAX_FIFO * nq1 / ODM_MAX_QUEUES;
+	if (kb1 < ODM_ENG_MIN_FIFO)
+		kb1 = ODM_ENG_MIN_FIFO;
+	if (kb1 > ODM_ENG_MAX_FIFO - ODM_ENG_MIN_FIFO)
+		kb1 = ODM_ENG_MAX_FIFO - ODM_ENG_MIN_FIFO;
+
+	kb[0] = ODM_ENG_MAX_FIFO - kb1;
+	kb[1] = kb1;
+}
+
+static void
+odm_fifo_stage(struct odm_dev *odm_pf, const uint8_t *kb)
+{
+	struct odm_fifo *fifo = &odm_pf->fifo;
+
+	if (!memcmp(kb, fifo->kb, sizeof(fifo->kb))) {
+		fifo->pending = false;
+		return;
+	}
+
+	memcpy(fifo->pending_kb, kb, sizeof(fifo->pending_kb));
+	fifo->pending = true;
+	odm_fifo_apply(odm_pf);
+}
+
+void
+odm_fifo_apply(struct odm_dev *odm_pf)
+{
+	struct odm_fifo *fifo = &odm_pf->fifo;
+	uint64_t reg;
+	int i;
+
+	if (!fifo->pending)
+		return;
+
+	for (i = 0; i < ODM_MAX_QUEUES; i++) {
+		if (odm_pf->pmem->q_state[i] == ODM_QUEUE_STATE_OPEN)
+			return;
+	}
+
+	for (i = 0; i < ODM_MAX_ENGINES; i++) {
+		reg = odm_reg_read(odm_pf, ODM_ENGX_BUF(i));
+		reg = (reg & ~ODM_ENG_BUF_SIZE_MASK) | fifo->pending_kb[i];
+		odm_reg_write(odm_pf, ODM_ENGX_BUF(i), reg);
+	}
+
+	memcpy(fifo->kb, fifo->pending_kb, sizeof(fifo->kb));
+	fifo->pending = false;
+	log_write(LOG_INFO, "ODM_PF: engine FIFO split %u/%u KB\n", fifo->kb[0], fifo->kb[1]);
+}
+
+void
+odm_fifo_auto_update(struct odm_dev *odm_pf, uint64_t intl_sel)
+{
+	uint8_t kb[ODM_MAX_ENGINES];
+
+	if (!odm_pf->fifo.auto_split)
+		return;
+
+	odm_fifo_auto_split(intl_sel, kb);
+	odm_fifo_stage(odm_pf, kb);
+}
+
+int
+odm_fifo_set(struct odm_dev *odm_pf, bool auto_split, const uint8_t *kb)
+{
+	struct odm_fifo *fifo = &odm_pf->fifo;
+	uint8_t split[ODM_MAX_ENGINES];
+	int rc;
+
+	if (!auto_split) {
+		if (kb[0] < ODM_ENG_MIN_FIFO || kb[1] < ODM_ENG_MIN_FIFO ||
+		    kb[0] + kb[1] > ODM_ENG_MAX_FIFO)
+			return -EINVAL;
+		memcpy(split, kb, sizeof(split));
+	}
+
+	pthread_mutex_lock(&odm_pf->qpool.lock);
+	if (auto_split)
+		odm_fifo_auto_split(odm_reg_read(odm_pf, ODM_DMA_INTL_SEL), split);
+	fifo->auto_split = auto_split;
+	odm_fifo_stage(odm_pf, split);
+	rc = fifo->pending ? -EAGAIN : 0;
+	pthread_mutex_unlock(&odm_pf->qpool.lock);
+
+	return rc;
+}
+
+void
+odm_fifo_init(struct odm_dev *odm_pf, bool auto_split, const uint8_t *kb)
+{
+	/* For ODM it is recommended for 64KB FIFO for each engine */
+	static const uint8_t even_kb[ODM_MAX_ENGINES] = {
+		ODM_ENG_MAX_FIFO / ODM_MAX_ENGINES, ODM_ENG_MAX_FIFO / ODM_MAX_ENGINES,
+	};
+	struct odm_fifo *fifo = &odm_pf->fifo;
+	int i;
+
+	memset(fifo, 0, sizeof(*fifo));
+	for (i = 0; i < ODM_MAX_ENGINES; i++)
+		fifo->kb[i] = odm_reg_read(odm_pf, ODM_ENGX_BUF(i)) & ODM_ENG_BUF_SIZE_MASK;
+
+	if (!auto_split && !kb[0] && !kb[1])
+		kb = even_kb;
+
+	if (odm_fifo_set(odm_pf, auto_split, kb) == -EAGAIN)
+		log_write(LOG_INFO, "ODM_PF: engine FIFO split %u/%u KB until the queues close\n",
+			  fifo->kb[0], fifo->kb[1]);
+}
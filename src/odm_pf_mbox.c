@@ -0,0 +1,439 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "odm_pf.h"
+#include "odm_pf_stats.h"
+#include "vfio_pci_irq.h"
+
+/*
+ * VF mailbox handling. The mailbox interrupt handler reads the VF messages and
+ * queues them to the command ring of the VF. Each VF is served by a single
+ * worker, which keeps the commands of a VF in order, while VFs mapped to
+ * different workers are processed in parallel. A worker processes a message to
+ * completion, including the response to the VF, before it picks the next one.
+ *
+ * The handler is the only producer and the worker the only consumer of a ring,
+ * so the rings are lock-free. Workers sleep on an eventfd, which counts the
+ * queued messages and so cannot miss a wakeup.
+ *
+ * In poll mode the mailbox interrupt stays masked and a single thread, pinned
+ * to a core set aside for it, polls ODM_MBOX_VF_PF_INT and processes the
+ * messages itself, without the interrupt, reactor and worker wakeups. Once
+ * idle for ODM_MBOX_POLL_SPIN polls it can back off to sleeping, up to a
+ * configured time, trading the latency of the first message of a burst for
+ * the core.
+ */
+
+static inline struct odm_mbox_worker *
+odm_mbox_worker_get(struct odm_dev *odm_pf, int vf_id)
+{
+	return &odm_pf->mbox_workers[vf_id % odm_pf->nb_mbox_workers];
+}
+
+static void
+odm_mbox_process(struct odm_dev *odm_pf, union odm_mbox_msg_t *msg)
+{
+	uint8_t vf_id, q_idx;
+	int rc = 0;
+
+	vf_id = msg->q.vf_id;
+	q_idx = msg->q.q_idx;
+	switch (msg->q.cmd) {
+		case ODM_QUEUE_OPEN:
+			rc = odm_queue_init(odm_pf, vf_id, q_idx);
+			break;
+		case ODM_DEV_CLOSE:
+			odm_queues_fini(odm_pf, vf_id);
+			break;
+		default:
+			break;
+	}
+
+	/* The VF sees the errno of a failed command */
+	msg->d.err = -rc;
+
+	msg->d.nvfs = (odm_reg_read(odm_pf, ODM_CTL) >> 4) & 0x3;
+	msg->d.rsp = msg->q.cmd;
+	odm_reg_write(odm_pf, ODM_MBOX_PF_VFX_DATAX(vf_id, 0), msg->u[0]);
+	odm_reg_write(odm_pf, ODM_MBOX_PF_VFX_DATAX(vf_id, 1), msg->u[1]);
+}
+
+/* Read the message of a VF and clear its interrupt */
+static void
+odm_mbox_read(struct odm_dev *odm_pf, int vf_id, union odm_mbox_msg_t *msg)
+{
+	msg->u[0] = odm_reg_read(odm_pf, ODM_MBOX_PF_VFX_DATAX(vf_id, 0));
+	msg->u[1] = odm_reg_read(odm_pf, ODM_MBOX_PF_VFX_DATAX(vf_id, 1));
+	odm_reg_write(odm_pf, ODM_MBOX_VF_PF_INT, (0x1ULL << vf_id));
+	msg->q.vf_id = vf_id;
+	odm_trace(odm_pf, ODM_TRACE_MBOX_RX, vf_id, 0, msg->u[0], msg->u[1]);
+}
+
+/* Process a message read at ts and account for it */
+static void
+odm_mbox_serve(struct odm_dev *odm_pf, int vf_id, union odm_mbox_msg_t *msg, uint64_t ts)
+{
+	uint8_t cmd = msg->q.cmd;
+	uint64_t lat_ns;
+
+	odm_mbox_process(odm_pf, msg);
+	lat_ns = odm_now_ns() - ts;
+	odm_trace(odm_pf, ODM_TRACE_MBOX_RSP, vf_id, lat_ns / 1000, msg->u[0], msg->u[1]);
+	odm_stats_mbox(odm_pf, vf_id, cmd, lat_ns);
+}
+
+static bool
+odm_mbox_ring_enqueue(struct odm_mbox_ring *ring, union odm_mbox_msg_t *msg, uint64_t ts)
+{
+	uint32_t head = ring->head;
+	uint32_t depth;
+
+	depth = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (depth >= ODM_MBOX_RING_SIZE) {
+		ring->drops++;
+		return false;
+	}
+
+	ring->msgs[head & (ODM_MBOX_RING_SIZE - 1)] = *msg;
+	ring->ts[head & (ODM_MBOX_RING_SIZE - 1)] = ts;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	if (depth + 1 > ring->max_depth)
+		ring->max_depth = depth + 1;
+
+	return true;
+}
+
+static bool
+odm_mbox_ring_dequeue(struct odm_mbox_ring *ring, union odm_mbox_msg_t *msg, uint64_t *ts)
+{
+	uint32_t tail = ring->tail;
+
+	if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+		return false;
+
+	*msg = ring->msgs[tail & (ODM_MBOX_RING_SIZE - 1)];
+	*ts = ring->ts[tail & (ODM_MBOX_RING_SIZE - 1)];
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+static void *
+odm_mbox_worker_thread(void *arg)
+{
+	struct odm_mbox_worker *worker = arg;
+	struct odm_dev *odm_pf = worker->odm_pf;
+	int vf_id, first_vf, processed;
+	union odm_mbox_msg_t msg;
+	uint64_t cnt, ts;
+	bool quit;
+
+	first_vf = worker - odm_pf->mbox_workers;
+	while (1) {
+		if (read(worker->efd, &cnt, sizeof(cnt)) != sizeof(cnt)) {
+			if (errno == EINTR)
+				continue;
+			log_write(LOG_ERR, "mbox worker %d: wakeup read failed, %s\n", first_vf,
+				  strerror(errno));
+			break;
+		}
+
+		/* Commands already queued are completed before quitting */
+		quit = __atomic_load_n(&worker->quit, __ATOMIC_ACQUIRE);
+
+		/* One command per VF per round, so a busy VF does not starve the others */
+		do {
+			processed = 0;
+			for (vf_id = first_vf; vf_id < ODM_MAX_VFS;
+			     vf_id += odm_pf->nb_mbox_workers) {
+				if (odm_mbox_ring_dequeue(&odm_pf->mbox_ring[vf_id], &msg, &ts)) {
+					odm_mbox_serve(odm_pf, vf_id, &msg, ts);
+					processed++;
+				}
+			}
+		} while (processed);
+
+		if (quit)
+			break;
+	}
+
+	return NULL;
+}
+
+static void
+odm_pf_mbox_handler(void *odm_irq)
+{
+	struct odm_dev *odm_pf = ((struct odm_irq_mem *)odm_irq)->odm_pf;
+	struct odm_mbox_worker *worker;
+	union odm_mbox_msg_t msg;
+	uint64_t reg, ts, cnt = 1;
+	int i = 0;
+
+	reg = odm_reg_read(odm_pf, ODM_MBOX_VF_PF_INT);
+	odm_trace(odm_pf, ODM_TRACE_IRQ, ODM_MBOX_VF_PF_IRQ, 0, reg, 0);
+
+	for (i = 0; i < ODM_MAX_VFS; i++) {
+		if (reg & (0x1ULL << i)) {
+			ts = odm_now_ns();
+			odm_mbox_read(odm_pf, i, &msg);
+
+			if (!odm_mbox_ring_enqueue(&odm_pf->mbox_ring[i], &msg, ts)) {
+				odm_trace(odm_pf, ODM_TRACE_MBOX_DROP, i, 0, msg.u[0], msg.u[1]);
+				log_write(LOG_WARNING, "mbox ring full, vf: %d cmd: %d dropped\n", i,
+					  msg.q.cmd);
+				odm_stats_mbox_drop(odm_pf, i);
+				continue;
+			}
+
+			worker = odm_mbox_worker_get(odm_pf, i);
+			if (write(worker->efd, &cnt, sizeof(cnt)) != sizeof(cnt))
+				log_write(LOG_ERR, "mbox worker wakeup failed, %s\n",
+					  strerror(errno));
+		}
+	}
+}
+
+static void
+odm_mbox_poll_sleep(uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	nanosleep(&ts, NULL);
+}
+
+static void *
+odm_mbox_poll_thread(void *arg)
+{
+	struct odm_dev *odm_pf = arg;
+	uint64_t sleep_max_ns = odm_pf->mbox_poll_backoff_us * 1000ULL;
+	uint64_t reg, ts, sleep_ns = ODM_MBOX_POLL_SLEEP_MIN_NS;
+	union odm_mbox_msg_t msg;
+	uint32_t idle = 0;
+	int i;
+
+	while (!__atomic_load_n(&odm_pf->mbox_poll_quit, __ATOMIC_ACQUIRE)) {
+		/* The message registers are read with ordered accessors when a bit is set */
+		reg = odm_reg_read_relaxed(odm_pf, ODM_MBOX_VF_PF_INT) & 0xffff;
+		if (reg) {
+			ts = odm_now_ns();
+			for (i = 0; i < ODM_MAX_VFS; i++) {
+				if (reg & (0x1ULL << i)) {
+					odm_mbox_read(odm_pf, i, &msg);
+					odm_mbox_serve(odm_pf, i, &msg, ts);
+				}
+			}
+			idle = 0;
+			sleep_ns = ODM_MBOX_POLL_SLEEP_MIN_NS;
+			continue;
+		}
+
+		if (!sleep_max_ns || ++idle < ODM_MBOX_POLL_SPIN) {
+			odm_cpu_relax();
+			continue;
+		}
+
+		odm_mbox_poll_sleep(sleep_ns < sleep_max_ns ? sleep_ns : sleep_max_ns);
+		if (sleep_ns < sleep_max_ns)
+			sleep_ns <<= 1;
+	}
+
+	return NULL;
+}
+
+static int
+odm_mbox_poll_start(struct odm_dev *odm_pf)
+{
+	pthread_attr_t attr;
+	cpu_set_t cpuset;
+	int rc;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, ODM_MBOX_WORKER_STACK);
+	if (odm_pf->mbox_poll_cpu >= 0) {
+		CPU_ZERO(&cpuset);
+		CPU_SET(odm_pf->mbox_poll_cpu, &cpuset);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpuset), &cpuset);
+	}
+
+	odm_pf->mbox_poll_quit = false;
+	rc = pthread_create(&odm_pf->mbox_poll_thread, &attr, odm_mbox_poll_thread, odm_pf);
+	pthread_attr_destroy(&attr);
+	if (rc) {
+		log_write(LOG_ERR, "ODM_PF: failed to create mbox poll thread on cpu %d, %s\n",
+			  odm_pf->mbox_poll_cpu, strerror(rc));
+		return -1;
+	}
+	odm_pf->mbox_polling = true;
+
+	if (odm_pf->mbox_poll_cpu >= 0)
+		log_write(LOG_INFO, "ODM_PF: polling the mbox on cpu %d, backoff up to %u us\n",
+			  odm_pf->mbox_poll_cpu, odm_pf->mbox_poll_backoff_us);
+	else
+		log_write(LOG_INFO, "ODM_PF: polling the mbox, backoff up to %u us\n",
+			  odm_pf->mbox_poll_backoff_us);
+
+	return 0;
+}
+
+static void
+odm_mbox_poll_stop(struct odm_dev *odm_pf)
+{
+	__atomic_store_n(&odm_pf->mbox_poll_quit, true, __ATOMIC_RELEASE);
+	if (pthread_join(odm_pf->mbox_poll_thread, NULL) != 0)
+		log_write(LOG_ERR, "mbox poll thread close failed\n");
+	odm_pf->mbox_polling = false;
+}
+
+static void
+odm_mbox_workers_stop(struct odm_dev *odm_pf, int nb_workers)
+{
+	struct odm_mbox_worker *worker;
+	uint64_t cnt = 1;
+	int i;
+
+	for (i = 0; i < nb_workers; i++) {
+		worker = &odm_pf->mbox_workers[i];
+		__atomic_store_n(&worker->quit, true, __ATOMIC_RELEASE);
+		if (write(worker->efd, &cnt, sizeof(cnt)) != sizeof(cnt))
+			log_write(LOG_ERR, "mbox worker %d wakeup failed\n", i);
+	}
+
+	for (i = 0; i < nb_workers; i++) {
+		worker = &odm_pf->mbox_workers[i];
+		if (pthread_join(worker->thread, NULL) != 0)
+			log_write(LOG_ERR, "mbox worker %d close failed\n", i);
+		close(worker->efd);
+	}
+
+	for (i = 0; i < ODM_MAX_VFS; i++) {
+		if (odm_pf->mbox_ring[i].drops || odm_pf->mbox_ring[i].max_depth > 1)
+			log_write(LOG_DEBUG, "mbox vf %d: max depth %u, drops %lu\n", i,
+				  odm_pf->mbox_ring[i].max_depth, odm_pf->mbox_ring[i].drops);
+	}
+
+	free(odm_pf->mbox_workers);
+	odm_pf->mbox_workers = NULL;
+}
+
+static int
+odm_mbox_workers_start(struct odm_dev *odm_pf)
+{
+	struct odm_mbox_worker *worker;
+	pthread_attr_t attr;
+	int i, rc = 0;
+
+	odm_pf->mbox_workers = calloc(odm_pf->nb_mbox_workers, sizeof(struct odm_mbox_worker));
+	if (!odm_pf->mbox_workers)
+		return -ENOMEM;
+
+	for (i = 0; i < ODM_MAX_VFS; i++)
+		memset(&odm_pf->mbox_ring[i], 0, sizeof(struct odm_mbox_ring));
+
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, ODM_MBOX_WORKER_STACK);
+
+	for (i = 0; i < odm_pf->nb_mbox_workers; i++) {
+		worker = &odm_pf->mbox_workers[i];
+		worker->odm_pf = odm_pf;
+		worker->efd = eventfd(0, EFD_CLOEXEC);
+		if (worker->efd < 0) {
+			log_write(LOG_ERR, "ODM_PF: failed to create mbox worker %d eventfd\n", i);
+			rc = -1;
+			odm_mbox_workers_stop(odm_pf, i);
+			break;
+		}
+
+		rc = pthread_create(&worker->thread, &attr, odm_mbox_worker_thread, worker);
+		if (rc) {
+			log_write(LOG_ERR, "ODM_PF: failed to create mbox worker %d\n", i);
+			close(worker->efd);
+			odm_mbox_workers_stop(odm_pf, i);
+			break;
+		}
+	}
+	pthread_attr_destroy(&attr);
+
+	return rc;
+}
+
+int
+odm_mbox_setup(struct odm_dev *odm_pf)
+{
+	int ret;
+
+	/*
+	 * Disable the mbox interrupts and enable bits. A resumed device may have
+	 * messages the VFs sent while no PF driver was running, they are served
+	 * instead of dropped.
+	 */
+	odm_reg_write(odm_pf, ODM_MBOX_VF_PF_INT_ENA_W1C, 0xffff);
+	if (!odm_pf->resumed)
+		odm_reg_write(odm_pf, ODM_MBOX_VF_PF_INT, 0xffff);
+
+	/* The interrupt stays masked, the pending messages are the first polled */
+	if (odm_pf->mbox_mode == ODM_MBOX_MODE_POLL)
+		return odm_mbox_poll_start(odm_pf);
+
+	ret = odm_mbox_workers_start(odm_pf);
+	if (ret) {
+		log_write(LOG_ERR, "ODM_PF: MBOX workers start failed\n");
+		return -1;
+	}
+
+	/* The interrupt is not registered yet, the handler is the only producer */
+	if (odm_pf->resumed)
+		odm_pf_mbox_handler(&odm_pf->irq_mem[ODM_MBOX_VF_PF_IRQ]);
+
+	ret = vfio_pci_msix_enable(&odm_pf->pdev, ODM_MBOX_VF_PF_IRQ);
+	if (ret) {
+		log_write(LOG_ERR, "ODM_PF: MBOX IRQ enable failed\n");
+		goto stop_workers;
+	}
+
+	ret = vfio_pci_irq_register(&odm_pf->pdev, ODM_MBOX_VF_PF_IRQ, odm_pf_mbox_handler,
+				    (void *)&odm_pf->irq_mem[ODM_MBOX_VF_PF_IRQ]);
+	if (ret) {
+		vfio_pci_msix_disable(&odm_pf->pdev, ODM_MBOX_VF_PF_IRQ);
+		log_write(LOG_ERR, "ODM_PF: MBOX IRQ register failed\n");
+		goto stop_workers;
+	}
+
+	log_write(LOG_DEBUG, "ODM_PF: %d mbox workers started\n", odm_pf->nb_mbox_workers);
+
+	/* Enable mbox interrupts */
+	odm_reg_write(odm_pf, ODM_MBOX_VF_PF_INT_ENA_W1S, 0xffff);
+
+	return 0;
+
+stop_workers:
+	odm_mbox_workers_stop(odm_pf, odm_pf->nb_mbox_workers);
+	return -1;
+}
+
+void
+odm_mbox_release(struct odm_dev *odm_pf)
+{
+	if (odm_pf->mbox_polling) {
+		odm_mbox_poll_stop(odm_pf);
+		return;
+	}
+
+	if (!odm_pf->mbox_workers)
+		return;
+
+	/* Stop taking new messages before the workers are stopped */
+	odm_reg_write(odm_pf, ODM_MBOX_VF_PF_INT_ENA_W1C, 0xffff);
+	vfio_pci_irq_unregister(&odm_pf->pdev, ODM_MBOX_VF_PF_IRQ);
+	vfio_pci_msix_disable(&odm_pf->pdev, ODM_MBOX_VF_PF_IRQ);
+	odm_mbox_workers_stop(odm_pf, odm_pf->nb_mbox_workers);
+}
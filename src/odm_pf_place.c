@@ -0,0 +1,151 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+#include "odm_pf.h"
+
+/*
+ * Engine placement policies. The 32 queues are split evenly between the VFs,
+ * VF n owning queues n * maxq to (n + 1) * maxq - 1 with maxq = 32 / num_vfs,
+ * so a hand-written eng_sel only matches the intended layout for one VF
+ * count. The policies are computed for the configured VF count instead.
+ */
+
+static const char *const odm_placement_names[] = {
+	[ODM_PLACEMENT_MASK] = "mask",
+	[ODM_PLACEMENT_INTERLEAVE] = "interleave",
+	[ODM_PLACEMENT_SPLIT_BY_VF] = "split-by-vf",
+	[ODM_PLACEMENT_PACK] = "pack",
+	[ODM_PLACEMENT_WEIGHTS] = "weights",
+};
+
+int
+odm_placement_parse(const char *str, struct odm_placement *pl)
+{
+	const char *p;
+	char *end;
+	unsigned long w;
+	int policy;
+
+	memset(pl, 0, sizeof(*pl));
+	if (strncmp(str, "weights=", 8) == 0) {
+		pl->policy = ODM_PLACEMENT_WEIGHTS;
+		for (p = str + 8; *p; p = end + (*end == ',')) {
+			if (pl->nb_weights == ODM_MAX_VFS)
+				return -EINVAL;
+
+			w = strtoul(p, &end, 0);
+			if (end == p || (*end && *end != ',') || w > UINT16_MAX)
+				return -EINVAL;
+			pl->weights[pl->nb_weights++] = w;
+		}
+
+		return pl->nb_weights ? 0 : -EINVAL;
+	}
+
+	for (policy = ODM_PLACEMENT_MASK; policy < ODM_PLACEMENT_WEIGHTS; policy++) {
+		if (strcmp(str, odm_placement_names[policy]) == 0) {
+			pl->policy = policy;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+const char *
+odm_placement_name(const struct odm_placement *pl)
+{
+	return odm_placement_names[pl->policy];
+}
+
+/*
+ * Spread the queues by weight, heaviest first, each on the engine carrying
+ * the least weight so far. Each queue carries the weight of its VF, so the
+ * queues of a heavy VF end up split between the engines.
+ */
+static uint32_t
+odm_placement_weights(const struct odm_placement *pl, int num_vfs)
+{
+	uint64_t load[ODM_MAX_ENGINES] = {0}, qw[ODM_MAX_QUEUES];
+	int nq[ODM_MAX_ENGINES] = {0};
+	int maxq = ODM_MAX_QUEUES / num_vfs;
+	uint32_t eng_sel = 0, placed = 0;
+	int i, qid, heaviest, eng;
+
+	for (qid = 0; qid < ODM_MAX_QUEUES; qid++)
+		qw[qid] = qid / maxq < pl->nb_weights ? pl->weights[qid / maxq] : 0;
+
+	for (i = 0; i < ODM_MAX_QUEUES; i++) {
+		heaviest = -1;
+		for (qid = 0; qid < ODM_MAX_QUEUES; qid++) {
+			if (placed & (1U << qid))
+				continue;
+			if (heaviest < 0 || qw[qid] > qw[heaviest])
+				heaviest = qid;
+		}
+
+		/* Ties go to the engine with fewer queues, so idle VFs are spread too */
+		eng = load[1] < load[0] || (load[1] == load[0] && nq[1] < nq[0]);
+		load[eng] += qw[heaviest];
+		nq[eng]++;
+		placed |= 1U << heaviest;
+		if (eng)
+			eng_sel |= 1U << heaviest;
+	}
+
+	return eng_sel;
+}
+
+uint32_t
+odm_placement_eng_sel(const struct odm_placement *pl, int num_vfs, uint32_t eng_sel)
+{
+	uint32_t mask = 0;
+	int qid, vf, maxq;
+
+	if (num_vfs <= 0 || num_vfs > ODM_MAX_VFS)
+		return eng_sel;
+
+	maxq = ODM_MAX_QUEUES / num_vfs;
+	for (qid = 0; qid < ODM_MAX_QUEUES; qid++) {
+		vf = qid / maxq;
+		switch (pl->policy) {
+		case ODM_PLACEMENT_INTERLEAVE:
+			if ((qid % maxq) & 0x1)
+				mask |= 1U << qid;
+			break;
+		case ODM_PLACEMENT_SPLIT_BY_VF:
+			if (vf & 0x1)
+				mask |= 1U << qid;
+			break;
+		case ODM_PLACEMENT_PACK:
+			if (vf >= num_vfs / 2)
+				mask |= 1U << qid;
+			break;
+		case ODM_PLACEMENT_WEIGHTS:
+			return odm_placement_weights(pl, num_vfs);
+		case ODM_PLACEMENT_MASK:
+		default:
+			return eng_sel;
+		}
+	}
+
+	return mask;
+}
+
+void
+odm_placement_log(uint32_t eng_sel, int num_vfs)
+{
+	int maxq = ODM_MAX_QUEUES / num_vfs;
+	char map[ODM_MAX_QUEUES + 1];
+	int vf, q;
+
+	log_write(LOG_INFO, "ODM: engine to queue mapping 0x%08x\n", eng_sel);
+	for (vf = 0; vf < num_vfs; vf++) {
+		for (q = 0; q < maxq; q++)
+			map[q] = '0' + ((eng_sel >> (vf * maxq + q)) & 0x1);
+		map[maxq] = '\0';
+		log_write(LOG_INFO, "ODM: VF %d queues %d-%d on engines %s\n", vf, vf * maxq,
+			  (vf + 1) * maxq - 1, map);
+	}
+}
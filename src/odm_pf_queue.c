@@ -0,0 +1,344 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+#include <time.h>
+
+#include "odm_pf.h"
+#include "odm_pf_stats.h"
+
+/*
+ * Queue reset engine. QRST is written for all the target queues before any of
+ * them is polled, so the resets run in parallel in hardware and resetting a
+ * set of queues takes about one reset latency. The QRST bits are then polled
+ * together until they clear or the deadline expires. Polling starts with a
+ * short spin, as resets usually complete within microseconds, then backs off
+ * to sleeps of growing length so a queue that never completes does not keep a
+ * core busy until the deadline.
+ */
+
+static void
+odm_qrst_sleep(uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	nanosleep(&ts, NULL);
+}
+
+int
+odm_queues_reset(struct odm_dev *odm_pf, uint32_t qmask, uint64_t timeout_ns,
+		 struct odm_qrst_result *res)
+{
+	uint64_t start, now, deadline, sleep_ns;
+	struct odm_qrst_result local_res;
+	uint32_t pending = qmask;
+	int qid, polls = 0;
+
+	if (!res)
+		res = &local_res;
+	memset(res, 0, sizeof(*res));
+
+	start = odm_now_ns();
+	deadline = start + timeout_ns;
+	for (qid = 0; qid < ODM_MAX_QUEUES; qid++) {
+		if (qmask & (1U << qid))
+			odm_reg_write(odm_pf, ODM_DMAX_QRST(qid), 0x1ULL);
+	}
+
+	sleep_ns = ODM_QRST_SLEEP_MIN_NS;
+	while (1) {
+		for (qid = 0; qid < ODM_MAX_QUEUES; qid++) {
+			if (!(pending & (1U << qid)))
+				continue;
+
+			if (odm_reg_read(odm_pf, ODM_DMAX_QRST(qid)) & 0x1)
+				continue;
+
+			now = odm_now_ns();
+			pending &= ~(1U << qid);
+			odm_pf->qrst_lat_ns[qid] = now - start;
+			res->done |= 1U << qid;
+			res->lat_ns[qid] = now - start;
+		}
+
+		if (!pending)
+			break;
+
+		now = odm_now_ns();
+		if (now >= deadline)
+			break;
+
+		if (++polls < ODM_QRST_SPIN_POLLS) {
+			odm_cpu_relax();
+			continue;
+		}
+
+		odm_qrst_sleep(sleep_ns < deadline - now ? sleep_ns : deadline - now);
+		if (sleep_ns < ODM_QRST_SLEEP_MAX_NS)
+			sleep_ns <<= 1;
+	}
+
+	for (qid = 0; qid < ODM_MAX_QUEUES; qid++) {
+		if (qmask & (1U << qid))
+			odm_reg_write(odm_pf, ODM_DMAX_IDS(qid), 0ULL);
+	}
+
+	__atomic_and_fetch(&odm_pf->qrst_stuck, ~(qmask & ~pending), __ATOMIC_RELAXED);
+	if (pending) {
+		__atomic_or_fetch(&odm_pf->qrst_stuck, pending, __ATOMIC_RELAXED);
+		for (qid = 0; qid < ODM_MAX_QUEUES; qid++) {
+			if (pending & (1U << qid))
+				log_write(LOG_ERR, "ODM_PF: queue %d reset timed out after %lu us\n",
+					  qid, timeout_ns / 1000);
+		}
+	}
+
+	res->stuck = pending;
+	odm_stats_qrst(odm_pf, qmask, res);
+	odm_trace(odm_pf, ODM_TRACE_QUEUE_RESET, 0, (odm_now_ns() - start) / 1000, qmask, pending);
+
+	log_write(LOG_DEBUG, "ODM_PF: reset queues 0x%x in %lu ns, stuck 0x%x\n", qmask,
+		  odm_now_ns() - start, pending);
+
+	return pending ? -ETIMEDOUT : 0;
+}
+
+/*
+ * Queue pool. A queue is reset when it is released by DEV_CLOSE, or at probe
+ * if pmem has it dirty, by a background thread, so the queue open normally
+ * finds it clean and only programs the stream IDs. The queue state lives in
+ * pmem and survives a restart of the PF driver. A queue found dirty at open,
+ * because its background reset has not run yet or did not complete, is reset
+ * synchronously as before.
+ *
+ * A change of the configured engine mapping only remaps the queues which are
+ * not open, remapping a queue with instructions in flight is not safe. The
+ * open queues are remapped once they are released and reset.
+ */
+
+/* Move the released queues waiting for it to their configured engine */
+static void
+odm_qpool_remap(struct odm_dev *odm_pf, uint32_t qmask)
+{
+	struct odm_qpool *qpool = &odm_pf->qpool;
+	uint32_t move = qpool->remap & qmask;
+	uint64_t intl_sel;
+
+	if (!move)
+		return;
+
+	intl_sel = odm_reg_read(odm_pf, ODM_DMA_INTL_SEL);
+	intl_sel = (intl_sel & ~(uint64_t)move) | (odm_pf->pmem->eng_sel & move);
+	odm_reg_write(odm_pf, ODM_DMA_INTL_SEL, intl_sel);
+	qpool->remap &= ~move;
+	odm_stats_rebal(odm_pf, intl_sel, 0);
+	odm_fifo_auto_update(odm_pf, intl_sel);
+}
+
+static void *
+odm_qpool_thread(void *arg)
+{
+	struct odm_dev *odm_pf = arg;
+	struct odm_qpool *qpool = &odm_pf->qpool;
+	struct odm_qrst_result res;
+	int qid;
+
+	pthread_mutex_lock(&qpool->lock);
+	while (!qpool->quit) {
+		if (!qpool->pending) {
+			pthread_cond_wait(&qpool->cond, &qpool->lock);
+			continue;
+		}
+
+		qpool->busy = qpool->pending;
+		qpool->pending = 0;
+		pthread_mutex_unlock(&qpool->lock);
+
+		odm_queues_reset(odm_pf, qpool->busy, ODM_QRST_TIMEOUT_NS, &res);
+
+		pthread_mutex_lock(&qpool->lock);
+		for (qid = 0; qid < ODM_MAX_QUEUES; qid++) {
+			if (res.done & (1U << qid))
+				odm_pf->pmem->q_state[qid] = ODM_QUEUE_STATE_CLEAN;
+		}
+		qpool->busy = 0;
+		odm_qpool_remap(odm_pf, res.done);
+		/* The engines may be quiesced now, for a pending FIFO split */
+		odm_fifo_apply(odm_pf);
+		pthread_cond_broadcast(&qpool->cond);
+	}
+	pthread_mutex_unlock(&qpool->lock);
+
+	return NULL;
+}
+
+/* Queue the reset of released queues to the background thread */
+static void
+odm_qpool_release(struct odm_dev *odm_pf, uint32_t qmask)
+{
+	struct odm_qpool *qpool = &odm_pf->qpool;
+	int qid;
+
+	pthread_mutex_lock(&qpool->lock);
+	for (qid = 0; qid < ODM_MAX_QUEUES; qid++) {
+		if (qmask & (1U << qid))
+			odm_pf->pmem->q_state[qid] = ODM_QUEUE_STATE_DIRTY;
+	}
+	qpool->pending |= qmask;
+	pthread_cond_broadcast(&qpool->cond);
+	pthread_mutex_unlock(&qpool->lock);
+}
+
+/* Take a queue for opening, resetting it first unless it is clean */
+static void
+odm_qpool_acquire(struct odm_dev *odm_pf, uint8_t hw_qid)
+{
+	struct odm_qpool *qpool = &odm_pf->qpool;
+	uint32_t qbit = 1U << hw_qid;
+
+	pthread_mutex_lock(&qpool->lock);
+	while (qpool->busy & qbit)
+		pthread_cond_wait(&qpool->cond, &qpool->lock);
+
+	if (odm_pf->pmem->q_state[hw_qid] == ODM_QUEUE_STATE_CLEAN) {
+		odm_qpool_remap(odm_pf, qbit);
+		odm_pf->pmem->q_state[hw_qid] = ODM_QUEUE_STATE_OPEN;
+		qpool->open_clean++;
+		pthread_mutex_unlock(&qpool->lock);
+		return;
+	}
+	qpool->pending &= ~qbit;
+	pthread_mutex_unlock(&qpool->lock);
+
+	odm_queues_reset(odm_pf, qbit, ODM_QRST_TIMEOUT_NS, NULL);
+
+	pthread_mutex_lock(&qpool->lock);
+	odm_qpool_remap(odm_pf, qbit);
+	odm_pf->pmem->q_state[hw_qid] = ODM_QUEUE_STATE_OPEN;
+	qpool->open_sync++;
+	pthread_mutex_unlock(&qpool->lock);
+}
+
+int
+odm_qpool_start(struct odm_dev *odm_pf)
+{
+	struct odm_qpool *qpool = &odm_pf->qpool;
+	int qid, rc;
+
+	pthread_mutex_init(&qpool->lock, NULL);
+	pthread_cond_init(&qpool->cond, NULL);
+	qpool->pending = 0;
+	qpool->busy = 0;
+	qpool->remap = 0;
+	qpool->quit = false;
+
+	/* Open queues may be in use by VFs across a restart, leave them alone */
+	for (qid = 0; qid < ODM_MAX_QUEUES; qid++) {
+		if (odm_pf->pmem->q_state[qid] == ODM_QUEUE_STATE_DIRTY)
+			qpool->pending |= 1U << qid;
+	}
+
+	rc = pthread_create(&qpool->thread, NULL, odm_qpool_thread, odm_pf);
+	if (rc) {
+		log_write(LOG_ERR, "ODM_PF: failed to create queue reset thread\n");
+		pthread_cond_destroy(&qpool->cond);
+		pthread_mutex_destroy(&qpool->lock);
+		return -1;
+	}
+	qpool->started = true;
+
+	return 0;
+}
+
+void
+odm_qpool_stop(struct odm_dev *odm_pf)
+{
+	struct odm_qpool *qpool = &odm_pf->qpool;
+
+	if (!qpool->started)
+		return;
+
+	pthread_mutex_lock(&qpool->lock);
+	qpool->quit = true;
+	pthread_cond_broadcast(&qpool->cond);
+	pthread_mutex_unlock(&qpool->lock);
+
+	if (pthread_join(qpool->thread, NULL) != 0)
+		log_write(LOG_ERR, "ODM_PF: queue reset thread close failed\n");
+
+	log_write(LOG_DEBUG, "ODM_PF: queue opens clean %lu, with reset %lu\n",
+		  qpool->open_clean, qpool->open_sync);
+
+	pthread_cond_destroy(&qpool->cond);
+	pthread_mutex_destroy(&qpool->lock);
+	qpool->started = false;
+}
+
+int
+odm_eng_sel_set(struct odm_dev *odm_pf, uint32_t eng_sel)
+{
+	struct odm_qpool *qpool = &odm_pf->qpool;
+	uint32_t keep;
+	uint64_t intl_sel;
+	int qid, nb_remap;
+
+	pthread_mutex_lock(&qpool->lock);
+	keep = qpool->busy;
+	for (qid = 0; qid < ODM_MAX_QUEUES; qid++) {
+		if (odm_pf->pmem->q_state[qid] == ODM_QUEUE_STATE_OPEN)
+			keep |= 1U << qid;
+	}
+
+	odm_pf->pmem->eng_sel = eng_sel;
+	intl_sel = odm_reg_read(odm_pf, ODM_DMA_INTL_SEL);
+	intl_sel = (intl_sel & keep) | (eng_sel & ~keep);
+	odm_reg_write(odm_pf, ODM_DMA_INTL_SEL, intl_sel);
+	qpool->remap = keep & (uint32_t)(intl_sel ^ eng_sel);
+	nb_remap = __builtin_popcount(qpool->remap);
+	odm_stats_rebal(odm_pf, intl_sel, 0);
+	odm_fifo_auto_update(odm_pf, intl_sel);
+	pthread_mutex_unlock(&qpool->lock);
+
+	return nb_remap;
+}
+
+int
+odm_queue_init(struct odm_dev *odm_pf, uint8_t vf_id, uint8_t qid)
+{
+	int maxqs_per_vf = odm_pf->pmem->maxq_per_vf;
+	int hw_qid;
+	uint64_t reg;
+
+	/* A queue index past the range of the VF would be a queue of another VF */
+	hw_qid = vf_id * maxqs_per_vf + qid;
+	if (qid >= maxqs_per_vf || hw_qid >= ODM_MAX_QUEUES) {
+		log_write(LOG_ERR, "ODM_PF: vf %d queue %d out of range\n", vf_id, qid);
+		return -EINVAL;
+	}
+
+	odm_qpool_acquire(odm_pf, hw_qid);
+	reg = odm_reg_read(odm_pf, ODM_DMAX_IDS(hw_qid));
+	reg |= ODM_DMA_IDS_DMA_STRM(vf_id + 1);
+	reg |= ODM_DMA_IDS_INST_STRM(vf_id + 1);
+	odm_reg_write(odm_pf, ODM_DMAX_IDS(hw_qid), reg);
+	odm_trace(odm_pf, ODM_TRACE_QUEUE_INIT, hw_qid, vf_id, qid, reg);
+	odm_pf->pmem->setup_done[vf_id] = true;
+
+	return 0;
+}
+
+void
+odm_queues_fini(struct odm_dev *odm_pf, uint8_t vf_id)
+{
+	int maxqs_per_vf = odm_pf->pmem->maxq_per_vf;
+	int hw_qid_start = vf_id * maxqs_per_vf;
+	uint64_t qmask;
+
+	if (hw_qid_start < ODM_MAX_QUEUES) {
+		qmask = ((1ULL << maxqs_per_vf) - 1) << hw_qid_start;
+		odm_qpool_release(odm_pf, (uint32_t)qmask);
+	}
+	odm_pf->pmem->setup_done[vf_id] = false;
+}
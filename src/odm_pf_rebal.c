@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+#include "odm_pf.h"
+#include "odm_pf_stats.h"
+
+/*
+ * Engine rebalancer. ODM_DMA_INTL_SEL maps each queue to one of the two DMA
+ * engines. The PF sees neither per-queue nor per-engine activity, so the load
+ * of an engine is taken as the number of open queues mapped to it, and the
+ * block utilization decides whether the engines are busy enough for the
+ * mapping to matter.
+ *
+ * Remapping a queue with instructions in flight is not safe, so only queues
+ * which are clean, reset and not open, are moved. They are moved from the
+ * loaded engine to the other one, so the next queue opens land there. The
+ * queue pool lock keeps a moved queue from being opened during the move.
+ * Hysteresis keeps the mapping from flapping: rebalancing starts only after
+ * the imbalance held for a few samples, stops when the engines are close to
+ * even, moves a few queues per sample, and leaves a moved queue alone for a
+ * while.
+ */
+
+void
+odm_rebal_init(struct odm_dev *odm_pf, bool enable)
+{
+	struct odm_rebal *rebal = &odm_pf->rebal;
+
+	memset(rebal, 0, sizeof(*rebal));
+	rebal->enabled = enable;
+	odm_stats_rebal(odm_pf, odm_reg_read(odm_pf, ODM_DMA_INTL_SEL), 0);
+}
+
+int
+odm_rebal_sample(struct odm_dev *odm_pf, uint32_t util)
+{
+	struct odm_rebal *rebal = &odm_pf->rebal;
+	struct odm_qpool *qpool = &odm_pf->qpool;
+	int open[ODM_MAX_ENGINES] = {0}, clean[ODM_MAX_ENGINES] = {0};
+	int qid, eng, heavy, light, diff, want, moved = 0;
+	uint64_t intl_sel;
+
+	if (!rebal->enabled || !qpool->started)
+		return 0;
+
+	rebal->samples++;
+
+	pthread_mutex_lock(&qpool->lock);
+	intl_sel = odm_reg_read(odm_pf, ODM_DMA_INTL_SEL);
+	for (qid = 0; qid < ODM_MAX_QUEUES; qid++) {
+		eng = (intl_sel >> qid) & 0x1;
+		if (odm_pf->pmem->q_state[qid] == ODM_QUEUE_STATE_OPEN)
+			open[eng]++;
+		else if (odm_pf->pmem->q_state[qid] == ODM_QUEUE_STATE_CLEAN)
+			clean[eng]++;
+	}
+
+	heavy = open[1] > open[0];
+	light = !heavy;
+	diff = open[heavy] - open[light];
+
+	if (rebal->active) {
+		if (diff <= ODM_REBAL_IMBALANCE_LO) {
+			rebal->active = false;
+			rebal->hold = 0;
+			log_write(LOG_INFO, "ODM_PF: engines balanced, %d and %d open queues\n",
+				  open[0], open[1]);
+		}
+	} else if (util >= ODM_REBAL_UTIL_MIN && diff >= ODM_REBAL_IMBALANCE_HI) {
+		if (++rebal->hold >= ODM_REBAL_HOLD_SAMPLES) {
+			rebal->active = true;
+			log_write(LOG_INFO, "ODM_PF: rebalancing, %d and %d open queues\n",
+				  open[0], open[1]);
+		}
+	} else {
+		rebal->hold = 0;
+	}
+
+	if (!rebal->active)
+		goto unlock;
+
+	/* Enough clean queues on the light engine for the next opens to even the load */
+	want = diff - clean[light];
+	if (want > ODM_REBAL_MAX_MOVES)
+		want = ODM_REBAL_MAX_MOVES;
+
+	for (qid = 0; qid < ODM_MAX_QUEUES && moved < want; qid++) {
+		if (((intl_sel >> qid) & 0x1) != (uint64_t)heavy ||
+		    odm_pf->pmem->q_state[qid] != ODM_QUEUE_STATE_CLEAN ||
+		    ((qpool->pending | qpool->busy) & (1U << qid)))
+			continue;
+
+		if (rebal->moved_at[qid] &&
+		    rebal->samples - rebal->moved_at[qid] < ODM_REBAL_COOLDOWN_SAMPLES)
+			continue;
+
+		intl_sel ^= 1ULL << qid;
+		rebal->moved_at[qid] = rebal->samples;
+		moved++;
+		log_write(LOG_DEBUG, "ODM_PF: queue %d moved to engine %d\n", qid, light);
+	}
+
+	if (moved) {
+		odm_reg_write(odm_pf, ODM_DMA_INTL_SEL, intl_sel);
+		rebal->moves += moved;
+		odm_stats_rebal(odm_pf, intl_sel, moved);
+		odm_fifo_auto_update(odm_pf, intl_sel);
+	}
+
+unlock:
+	pthread_mutex_unlock(&qpool->lock);
+
+	return moved;
+}
@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+#include "odm_pf.h"
+
+_Static_assert(ODM_SHADOW_NUM_REGS <= 64, "shadow valid bitmap is 64 bits");
+
+int
+odm_reg_write_batch(struct odm_dev *odm_pf, const struct odm_reg_op *ops, int nb_ops)
+{
+	int i, slot, nb_writes = 0, nb_hits = 0;
+
+	for (i = 0; i < nb_ops; i++) {
+		if (!odm_reg_offset_valid(ops[i].offset))
+			return -EINVAL;
+	}
+
+	odm_io_wmb();
+	for (i = 0; i < nb_ops; i++) {
+		slot = odm_reg_shadow_slot(ops[i].offset);
+		if (slot >= 0 && odm_reg_shadow_hit(odm_pf, slot) &&
+		    odm_pf->reg_shadow.val[slot] == ops[i].val) {
+			nb_hits++;
+			continue;
+		}
+
+		__odm_mmio_write(odm_pf, ops[i].offset, ops[i].val);
+		nb_writes++;
+		if (slot >= 0) {
+			odm_reg_shadow_set(odm_pf, slot, ops[i].val);
+			odm_trace(odm_pf, ODM_TRACE_CFG_WRITE, 0, 0, ops[i].offset, ops[i].val);
+		}
+	}
+
+	__atomic_store_n(&odm_pf->reg_stats.mmio_writes,
+			 odm_pf->reg_stats.mmio_writes + nb_writes, __ATOMIC_RELAXED);
+	__atomic_store_n(&odm_pf->reg_stats.hits, odm_pf->reg_stats.hits + nb_hits,
+			 __ATOMIC_RELAXED);
+
+	return 0;
+}
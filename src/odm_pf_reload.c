@@ -0,0 +1,335 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+#include <ctype.h>
+#include <limits.h>
+
+#include "odm_pf.h"
+#include "reactor.h"
+
+/*
+ * Reload of the cfg file, on SIGHUP. The cfg has the shell KEY=value format
+ * systemd reads it in, values may be quoted. Keys missing from the cfg keep
+ * their running value and unknown keys are ignored.
+ *
+ * The whole cfg is parsed and checked before anything is applied, so a
+ * reload is rejected as a whole: for a value which does not parse, and for a
+ * change of NUM_VFS or UUID, as the VFs would have to be destroyed and
+ * created again. Settings only read at startup, REACTOR and the mailbox mode,
+ * are not changed and a change of them is warned about. The running state is taken from pmem and the device state,
+ * and only the settings which differ from it are applied. Writes of an
+ * unchanged register value are dropped by the register shadow.
+ *
+ * The engine mapping and FIFO split follow the rules of the rebalancer and
+ * the FIFO split: open queues keep their engine and FIFO until they are
+ * closed. The tuning profile is only changed while no queue is open, as for
+ * the tuning mode. A profile change with queues open is not applied, and is
+ * applied by the next reload after the queues are closed.
+ */
+
+#define ODM_RELOAD_MAX_LINE		256
+
+/* Settings of the cfg file, initialized to the running state */
+struct odm_reload_cfg {
+	int num_vfs;
+	uint8_t uuid[UUID_LEN];
+	uint32_t eng_sel;
+	struct odm_placement placement;
+	bool fifo_auto;
+	uint8_t fifo_kb[ODM_MAX_ENGINES];
+	const struct odm_profile *profile;
+	uint16_t molr;
+	int log_level;
+	uint32_t util_interval_ms;
+	bool warm_restart;
+	enum reactor_backend reactor;
+	enum odm_mbox_mode mbox_mode;
+	int mbox_poll_cpu;
+	uint32_t mbox_poll_backoff_us;
+};
+
+static void
+odm_reload_running(struct odm_dev *odm_pf, struct odm_reload_cfg *rc)
+{
+	struct odm_fifo *fifo = &odm_pf->fifo;
+
+	memset(rc, 0, sizeof(*rc));
+	rc->num_vfs = odm_pf->pmem->vfs_in_use;
+	memcpy(rc->uuid, odm_pf->pdev.uuid, UUID_LEN);
+	rc->eng_sel = odm_pf->pmem->eng_sel;
+	rc->placement.policy = ODM_PLACEMENT_MASK;
+
+	pthread_mutex_lock(&odm_pf->qpool.lock);
+	rc->fifo_auto = fifo->auto_split;
+	memcpy(rc->fifo_kb, fifo->pending ? fifo->pending_kb : fifo->kb, sizeof(rc->fifo_kb));
+	pthread_mutex_unlock(&odm_pf->qpool.lock);
+
+	rc->profile = odm_profile_get(odm_pf->pmem->profile);
+	if (!rc->profile)
+		rc->profile = odm_profile_get("default");
+	rc->molr = odm_pf->pmem->molr;
+	rc->log_level = log_level_get();
+	rc->util_interval_ms = odm_pf->util.interval_ms;
+	rc->warm_restart = odm_pf->warm;
+	rc->reactor = reactor_backend_get();
+	rc->mbox_mode = odm_pf->mbox_mode;
+	rc->mbox_poll_cpu = odm_pf->mbox_poll_cpu;
+	rc->mbox_poll_backoff_us = odm_pf->mbox_poll_backoff_us;
+}
+
+/* Parse a number, the whole value must be used */
+static int
+odm_reload_ulong(const char *val, int base, unsigned long max, unsigned long *num)
+{
+	char *end;
+
+	errno = 0;
+	*num = strtoul(val, &end, base);
+	if (errno || end == val || *end || *num > max)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int
+odm_reload_key(struct odm_reload_cfg *rc, const char *key, const char *val)
+{
+	unsigned long num;
+
+	if (!strcmp(key, "NUM_VFS")) {
+		if (odm_reload_ulong(val, 10, ODM_MAX_VFS, &num))
+			return -EINVAL;
+		rc->num_vfs = num;
+	} else if (!strcmp(key, "UUID")) {
+		return parse_uuid(val, rc->uuid) < 0 ? -EINVAL : 0;
+	} else if (!strcmp(key, "ENG_SEL")) {
+		if (odm_reload_ulong(val, 16, UINT32_MAX, &num))
+			return -EINVAL;
+		rc->eng_sel = num;
+	} else if (!strcmp(key, "PLACEMENT")) {
+		return odm_placement_parse(val, &rc->placement);
+	} else if (!strcmp(key, "FIFO_SPLIT")) {
+		return odm_fifo_parse(val, &rc->fifo_auto, rc->fifo_kb);
+	} else if (!strcmp(key, "PROFILE")) {
+		rc->profile = odm_profile_get(val);
+		if (!rc->profile)
+			return -EINVAL;
+	} else if (!strcmp(key, "MOLR")) {
+		if (odm_reload_ulong(val, 10, ODM_NCB_CFG_MOLR_MASK, &num))
+			return -EINVAL;
+		rc->molr = num;
+	} else if (!strcmp(key, "LOG_LEVEL")) {
+		if (odm_reload_ulong(val, 10, LOG_DEBUG, &num))
+			return -EINVAL;
+		rc->log_level = num;
+	} else if (!strcmp(key, "UTIL_INTERVAL")) {
+		if (odm_reload_ulong(val, 10, UINT32_MAX, &num))
+			return -EINVAL;
+		rc->util_interval_ms = num;
+	} else if (!strcmp(key, "WARM_RESTART")) {
+		if (odm_reload_ulong(val, 10, 1, &num))
+			return -EINVAL;
+		rc->warm_restart = num;
+	} else if (!strcmp(key, "REACTOR")) {
+		return reactor_backend_parse(val, &rc->reactor);
+	} else if (!strcmp(key, "MBOX_MODE")) {
+		if (!strcmp(val, "irq"))
+			rc->mbox_mode = ODM_MBOX_MODE_IRQ;
+		else if (!strcmp(val, "poll"))
+			rc->mbox_mode = ODM_MBOX_MODE_POLL;
+		else
+			return -EINVAL;
+	} else if (!strcmp(key, "MBOX_POLL_CPU")) {
+		if (!strcmp(val, "-1")) {
+			rc->mbox_poll_cpu = -1;
+			return 0;
+		}
+		if (odm_reload_ulong(val, 10, INT_MAX, &num))
+			return -EINVAL;
+		rc->mbox_poll_cpu = num;
+	} else if (!strcmp(key, "MBOX_POLL_BACKOFF")) {
+		if (odm_reload_ulong(val, 10, INT_MAX, &num))
+			return -EINVAL;
+		rc->mbox_poll_backoff_us = num;
+	} else {
+		log_write(LOG_DEBUG, "ODM_PF: cfg key %s is not reloaded\n", key);
+	}
+
+	return 0;
+}
+
+static int
+odm_reload_parse(const char *path, struct odm_reload_cfg *rc)
+{
+	char line[ODM_RELOAD_MAX_LINE];
+	char *key, *val, *end;
+	int lineno = 0, rc_err = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp) {
+		log_write(LOG_ERR, "ODM_PF: reload of %s failed: %s\n", path, strerror(errno));
+		return -EINVAL;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		lineno++;
+		for (key = line; isspace((unsigned char)*key); key++)
+			;
+		if (*key == '#' || *key == '\0')
+			continue;
+
+		val = strchr(key, '=');
+		if (!val) {
+			log_write(LOG_ERR, "ODM_PF: %s:%d: not a KEY=value line\n", path, lineno);
+			rc_err = -EINVAL;
+			break;
+		}
+		*val++ = '\0';
+
+		end = val + strlen(val);
+		while (end > val && isspace((unsigned char)end[-1]))
+			*--end = '\0';
+		if (end - val >= 2 && (*val == '"' || *val == '\'') && end[-1] == *val) {
+			end[-1] = '\0';
+			val++;
+		}
+
+		if (odm_reload_key(rc, key, val)) {
+			log_write(LOG_ERR, "ODM_PF: %s:%d: invalid %s \"%s\"\n", path, lineno, key,
+				  val);
+			rc_err = -EINVAL;
+			break;
+		}
+	}
+	fclose(fp);
+
+	return rc_err;
+}
+
+/* Settings which can only change with the VFs recreated */
+static int
+odm_reload_check(const struct odm_reload_cfg *run, const struct odm_reload_cfg *rc)
+{
+	if (rc->num_vfs != run->num_vfs) {
+		log_write(LOG_ERR, "ODM_PF: reload rejected, NUM_VFS %d to %d needs the VFs to be "
+			  "recreated, restart the service for it\n", run->num_vfs, rc->num_vfs);
+		return -EINVAL;
+	}
+
+	if (memcmp(rc->uuid, run->uuid, UUID_LEN)) {
+		log_write(LOG_ERR, "ODM_PF: reload rejected, a new UUID needs the VFs to be "
+			  "recreated, restart the service for it\n");
+		return -EINVAL;
+	}
+
+	if (rc->placement.policy == ODM_PLACEMENT_WEIGHTS &&
+	    rc->placement.nb_weights != rc->num_vfs) {
+		log_write(LOG_ERR, "ODM_PF: reload rejected, placement has %d weights for %d VFs\n",
+			  rc->placement.nb_weights, rc->num_vfs);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/* Settings only read at startup, kept until the service is restarted */
+static void
+odm_reload_restart(const struct odm_reload_cfg *run, const struct odm_reload_cfg *rc)
+{
+	if (rc->reactor != run->reactor)
+		log_write(LOG_WARNING, "ODM_PF: REACTOR not changed, restart the service for it\n");
+
+	if (rc->mbox_mode != run->mbox_mode || rc->mbox_poll_cpu != run->mbox_poll_cpu ||
+	    rc->mbox_poll_backoff_us != run->mbox_poll_backoff_us)
+		log_write(LOG_WARNING, "ODM_PF: MBOX_MODE, MBOX_POLL_CPU and MBOX_POLL_BACKOFF not "
+			  "changed, restart the service for them\n");
+}
+
+/* Change the tuning profile if no queue is open */
+static int
+odm_reload_profile(struct odm_dev *odm_pf, const struct odm_reload_cfg *rc)
+{
+	struct odm_qpool *qpool = &odm_pf->qpool;
+	int qid, nb_open = 0;
+	bool quiesced;
+
+	pthread_mutex_lock(&qpool->lock);
+	for (qid = 0; qid < ODM_MAX_QUEUES; qid++) {
+		if (odm_pf->pmem->q_state[qid] == ODM_QUEUE_STATE_OPEN)
+			nb_open++;
+	}
+
+	quiesced = !nb_open && !qpool->busy;
+	if (quiesced)
+		odm_profile_apply(odm_pf, rc->profile, rc->molr);
+	pthread_mutex_unlock(&qpool->lock);
+
+	if (!quiesced) {
+		log_write(LOG_WARNING, "ODM_PF: PROFILE and MOLR not changed, %d queues open, "
+			  "reload again once they are closed\n", nb_open);
+		return -EBUSY;
+	}
+
+	return 0;
+}
+
+int
+odm_pf_reload(struct odm_dev *odm_pf, const char *path)
+{
+	struct odm_reload_cfg run, rc;
+	char changed[128] = "";
+	uint32_t eng_sel;
+	int err = 0, n;
+
+	odm_reload_running(odm_pf, &run);
+	rc = run;
+	if (odm_reload_parse(path, &rc) || odm_reload_check(&run, &rc)) {
+		log_write(LOG_ERR, "ODM_PF: %s not reloaded, the running settings are kept\n", path);
+		return -EINVAL;
+	}
+	odm_reload_restart(&run, &rc);
+
+	if (rc.log_level != run.log_level) {
+		log_level_set(rc.log_level);
+		strcat(changed, " LOG_LEVEL");
+	}
+
+	if (rc.util_interval_ms != run.util_interval_ms) {
+		odm_pf->util.interval_ms = rc.util_interval_ms;
+		strcat(changed, " UTIL_INTERVAL");
+	}
+
+	if (rc.warm_restart != run.warm_restart) {
+		odm_pf->warm = rc.warm_restart;
+		strcat(changed, " WARM_RESTART");
+	}
+
+	eng_sel = odm_placement_eng_sel(&rc.placement, rc.num_vfs, rc.eng_sel);
+	if (eng_sel != run.eng_sel) {
+		n = odm_eng_sel_set(odm_pf, eng_sel);
+		strcat(changed, " ENG_SEL");
+		odm_placement_log(eng_sel, rc.num_vfs);
+		if (n)
+			log_write(LOG_INFO, "ODM_PF: %d open queues move engine once closed\n", n);
+	}
+
+	if (rc.fifo_auto != run.fifo_auto ||
+	    (!rc.fifo_auto && memcmp(rc.fifo_kb, run.fifo_kb, sizeof(rc.fifo_kb)))) {
+		if (odm_fifo_set(odm_pf, rc.fifo_auto, rc.fifo_kb) == -EAGAIN)
+			log_write(LOG_INFO, "ODM_PF: FIFO split applied once the queues close\n");
+		strcat(changed, " FIFO_SPLIT");
+	}
+
+	if (rc.profile != run.profile || rc.molr != run.molr) {
+		err = odm_reload_profile(odm_pf, &rc);
+		if (!err)
+			strcat(changed, " PROFILE");
+	}
+
+	log_write(LOG_INFO, "ODM_PF: %s reloaded, changed:%s\n", path,
+		  changed[0] ? changed : " none");
+
+	return err;
+}
@@ -5,13 +5,19 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "log.h"
 #include "odm_pf.h"
+#include "odm_pf_cmd.h"
 #include "odm_pf_selftest.h"
+#include "odm_pf_sim.h"
+#include "odm_pf_stats.h"
+#include "odm_pf_trace.h"
 #include "pmem.h"
+#include "reactor.h"
 #include "vfio_pci.h"
 #include "vfio_pci_irq.h"
 
@@ -42,9 +48,47 @@ test_pmem()
 	}
 }
 
+static void
+test_odm_placement(void)
+{
+	uint64_t load[ODM_MAX_ENGINES] = {0};
+	struct odm_placement pl;
+	uint32_t eng_sel;
+	int qid;
+
+	assert(odm_placement_parse("bogus", &pl) == -EINVAL);
+	assert(odm_placement_parse("weights=", &pl) == -EINVAL);
+	assert(odm_placement_parse("weights=1,,2", &pl) == -EINVAL);
+
+	assert(odm_placement_parse("mask", &pl) == 0);
+	assert(odm_placement_eng_sel(&pl, 8, 0x12345678) == 0x12345678);
+
+	assert(odm_placement_parse("interleave", &pl) == 0);
+	assert(odm_placement_eng_sel(&pl, 8, 0) == 0xAAAAAAAA);
+	assert(odm_placement_eng_sel(&pl, 16, 0) == 0xAAAAAAAA);
+
+	assert(odm_placement_parse("split-by-vf", &pl) == 0);
+	assert(odm_placement_eng_sel(&pl, 8, 0) == 0xF0F0F0F0);
+	assert(odm_placement_eng_sel(&pl, 16, 0) == 0xCCCCCCCC);
+
+	assert(odm_placement_parse("pack", &pl) == 0);
+	assert(odm_placement_eng_sel(&pl, 2, 0) == 0xFFFF0000);
+	assert(odm_placement_eng_sel(&pl, 16, 0) == 0xFFFF0000);
+
+	/* A VF as busy as the three others together is split across the engines */
+	assert(odm_placement_parse("weights=3,1,1,1", &pl) == 0);
+	assert(pl.nb_weights == 4);
+	eng_sel = odm_placement_eng_sel(&pl, 4, 0);
+	for (qid = 0; qid < ODM_MAX_QUEUES; qid++)
+		load[(eng_sel >> qid) & 0x1] += pl.weights[qid / 8];
+	assert(load[0] == load[1]);
+	assert(__builtin_popcount(eng_sel & 0xff) == 4);
+}
+
 static void
 test_odm_register_access(struct odm_dev_config *dev_cfg)
 {
+	uint64_t mmio_reads, mmio_writes, hits;
 	volatile uint64_t *odm_reg;
 	struct odm_dev *odm_pf;
 	uint64_t val;
@@ -63,9 +107,62 @@ test_odm_register_access(struct odm_dev_config *dev_cfg)
 	assert(*odm_reg == TEST_REG_VAL);
 
 	*odm_reg = val;
+
+	/* Config register reads are served from the shadow after the first one */
+	val = odm_reg_read(odm_pf, TEST_REG_OFF);
+	mmio_reads = odm_pf->reg_stats.mmio_reads;
+	hits = odm_pf->reg_stats.hits;
+	assert(odm_reg_read(odm_pf, TEST_REG_OFF) == val);
+	assert(odm_pf->reg_stats.mmio_reads == mmio_reads);
+	assert(odm_pf->reg_stats.hits == hits + 1);
+
+	/* Writing an unchanged value does not reach the device */
+	mmio_writes = odm_pf->reg_stats.mmio_writes;
+	odm_reg_write(odm_pf, TEST_REG_OFF, val);
+	assert(odm_pf->reg_stats.mmio_writes == mmio_writes);
+	odm_reg_write(odm_pf, TEST_REG_OFF, TEST_REG_VAL);
+	assert(odm_pf->reg_stats.mmio_writes == mmio_writes + 1);
+	assert(*odm_reg == TEST_REG_VAL);
+	odm_reg_write(odm_pf, TEST_REG_OFF, val);
+
 	odm_pf_release(odm_pf);
 }
 
+static void
+test_reactor_timer_handle(void *data)
+{
+	__atomic_add_fetch((int *)data, 1, __ATOMIC_RELAXED);
+}
+
+static void
+test_reactor(void)
+{
+	struct reactor_timer *timer;
+	int fired = 0, n, i;
+
+	timer = reactor_timer_add(test_reactor_timer_handle, &fired);
+	assert(timer != NULL);
+
+	/* One shot */
+	assert(reactor_timer_set(timer, 1000000, 0) == 0);
+	for (i = 0; i < 1000 && !__atomic_load_n(&fired, __ATOMIC_RELAXED); i++)
+		usleep(1000);
+	usleep(5000);
+	assert(__atomic_load_n(&fired, __ATOMIC_RELAXED) == 1);
+
+	/* Periodic, and no callback once disarmed */
+	assert(reactor_timer_set(timer, 1000000, 1000000) == 0);
+	for (i = 0; i < 1000 && __atomic_load_n(&fired, __ATOMIC_RELAXED) < 4; i++)
+		usleep(1000);
+	assert(reactor_timer_set(timer, 0, 0) == 0);
+	n = __atomic_load_n(&fired, __ATOMIC_RELAXED);
+	assert(n >= 4);
+	usleep(5000);
+	assert(__atomic_load_n(&fired, __ATOMIC_RELAXED) == n);
+
+	reactor_timer_del(timer);
+}
+
 static void
 test_odm_irq_handle(void *data)
 {
@@ -84,6 +181,12 @@ test_odm_vfio_pci_irq(struct odm_dev_config *dev_cfg)
 	assert(odm_pf != NULL);
 
 #define TEST_MSIX_VEC 10
+	/* The driver owns all vectors after probe, take over the test vector */
+	rc = vfio_pci_irq_unregister(&odm_pf->pdev, TEST_MSIX_VEC);
+	assert(rc == 0);
+	rc = vfio_pci_msix_disable(&odm_pf->pdev, TEST_MSIX_VEC);
+	assert(rc == 0);
+
 	rc = vfio_pci_msix_enable(&odm_pf->pdev, TEST_MSIX_VEC);
 	assert(rc == 0);
 	rc = vfio_pci_irq_register(&odm_pf->pdev, TEST_MSIX_VEC, test_odm_irq_handle, &interrupt);
@@ -103,12 +206,640 @@ test_odm_vfio_pci_irq(struct odm_dev_config *dev_cfg)
 	odm_pf_release(odm_pf);
 }
 
+static void
+test_odm_sim_mbox(struct odm_dev_config *dev_cfg)
+{
+	struct odm_pf_stats stats;
+	union odm_mbox_msg_t msg;
+	struct odm_trace_rec rec;
+	struct odm_dev *odm_pf;
+	uint64_t reg, open_clean, pos, head;
+	uint32_t seen = 0;
+	int rc, i;
+
+	odm_pf = odm_pf_probe(dev_cfg);
+	assert(odm_pf != NULL);
+	pos = odm_pf->trace->head;
+
+	/* Open queue 0 of VF 0 and verify the stream IDs are programmed */
+	msg.u[0] = 0;
+	msg.u[1] = 0;
+	msg.q.vf_id = 0;
+	msg.q.q_idx = 0;
+	msg.q.cmd = ODM_QUEUE_OPEN;
+	rc = odm_sim_vf_mbox_send(odm_pf, 0, &msg, 1000);
+	assert(rc == 0);
+	assert(msg.d.rsp == ODM_QUEUE_OPEN);
+	assert(msg.d.err == 0);
+
+	reg = odm_reg_read(odm_pf, ODM_DMAX_IDS(0));
+	assert(ODM_DMA_IDS_GET_DMA_STRM(reg) == 1);
+	assert(ODM_DMA_IDS_GET_INST_STRM(reg) == 1);
+
+	/* The command is counted once the response is sent */
+	for (i = 0; i < 1000; i++) {
+		assert(odm_stats_snapshot(odm_pf->stats, &stats) == 0);
+		if (stats.vf[0].mbox_cmds[ODM_QUEUE_OPEN] == 1)
+			break;
+		usleep(1000);
+	}
+	assert(stats.vf[0].mbox_cmds[ODM_QUEUE_OPEN] == 1);
+
+	/* The open is in the flight recorder, from the message to the response */
+	head = odm_pf->trace->head;
+	for (; pos < head; pos++) {
+		assert(odm_trace_read(odm_pf->trace, pos, &rec) == 0);
+		if (rec.id == 0 && rec.type != ODM_TRACE_CFG_WRITE)
+			seen |= 1U << rec.type;
+	}
+	assert(seen & (1U << ODM_TRACE_MBOX_RX));
+	assert(seen & (1U << ODM_TRACE_QUEUE_INIT));
+	assert(seen & (1U << ODM_TRACE_MBOX_RSP));
+
+	msg.u[0] = 0;
+	msg.u[1] = 0;
+	msg.q.cmd = ODM_DEV_CLOSE;
+	rc = odm_sim_vf_mbox_send(odm_pf, 0, &msg, 1000);
+	assert(rc == 0);
+	assert(msg.d.rsp == ODM_DEV_CLOSE);
+
+	/* The released queues are reset in the background */
+	for (i = 0; i < 1000 && odm_pf->pmem->q_state[0] != ODM_QUEUE_STATE_CLEAN; i++)
+		usleep(1000);
+	assert(odm_pf->pmem->q_state[0] == ODM_QUEUE_STATE_CLEAN);
+	assert(odm_reg_read(odm_pf, ODM_DMAX_IDS(0)) == 0);
+
+	/* Reopen is served from the clean queue */
+	open_clean = odm_pf->qpool.open_clean;
+	msg.u[0] = 0;
+	msg.u[1] = 0;
+	msg.q.cmd = ODM_QUEUE_OPEN;
+	rc = odm_sim_vf_mbox_send(odm_pf, 0, &msg, 1000);
+	assert(rc == 0);
+	assert(odm_pf->qpool.open_clean == open_clean + 1);
+	assert(odm_pf->pmem->q_state[0] == ODM_QUEUE_STATE_OPEN);
+
+	/* A queue index past the queues of VF 0 is not a queue of VF 1 */
+	msg.u[0] = 0;
+	msg.u[1] = 0;
+	msg.q.q_idx = odm_pf->pmem->maxq_per_vf;
+	msg.q.cmd = ODM_QUEUE_OPEN;
+	rc = odm_sim_vf_mbox_send(odm_pf, 0, &msg, 1000);
+	assert(rc == 0);
+	assert(msg.d.rsp == ODM_QUEUE_OPEN);
+	assert(msg.d.err == EINVAL);
+	assert(odm_pf->pmem->q_state[odm_pf->pmem->maxq_per_vf] != ODM_QUEUE_STATE_OPEN);
+	assert(odm_reg_read(odm_pf, ODM_DMAX_IDS(odm_pf->pmem->maxq_per_vf)) == 0);
+
+	odm_pf_release(odm_pf);
+}
+
+static void
+test_odm_sim_mbox_poll(struct odm_dev_config *dev_cfg)
+{
+	struct odm_dev_config cfg = *dev_cfg;
+	struct odm_pf_stats stats;
+	union odm_mbox_msg_t msg;
+	struct odm_dev *odm_pf;
+	int rc, i;
+
+	cfg.mbox_mode = ODM_MBOX_MODE_POLL;
+	cfg.mbox_poll_cpu = -1;
+	cfg.mbox_poll_backoff_us = 50;
+	odm_pf = odm_pf_probe(&cfg);
+	assert(odm_pf != NULL);
+
+	/* The interrupt stays masked, and no worker is started */
+	assert(odm_reg_read(odm_pf, ODM_MBOX_VF_PF_INT_ENA_W1S) == 0);
+	assert(odm_pf->mbox_workers == NULL);
+
+	/* Served by the poll thread, once it backed off to sleeping */
+	usleep(10000);
+	msg.u[0] = 0;
+	msg.u[1] = 0;
+	msg.q.vf_id = 1;
+	msg.q.q_idx = 0;
+	msg.q.cmd = ODM_QUEUE_OPEN;
+	rc = odm_sim_vf_mbox_send(odm_pf, 1, &msg, 1000);
+	assert(rc == 0);
+	assert(msg.d.rsp == ODM_QUEUE_OPEN);
+
+	for (i = 0; i < 1000; i++) {
+		assert(odm_stats_snapshot(odm_pf->stats, &stats) == 0);
+		if (stats.vf[1].mbox_cmds[ODM_QUEUE_OPEN] == 1)
+			break;
+		usleep(1000);
+	}
+	assert(stats.vf[1].mbox_cmds[ODM_QUEUE_OPEN] == 1);
+
+	msg.u[0] = 0;
+	msg.u[1] = 0;
+	msg.q.cmd = ODM_DEV_CLOSE;
+	rc = odm_sim_vf_mbox_send(odm_pf, 1, &msg, 1000);
+	assert(rc == 0);
+	assert(msg.d.rsp == ODM_DEV_CLOSE);
+
+	odm_pf_release(odm_pf);
+}
+
+/* Wait for the background reset of the queues done at probe */
+static void
+test_wait_queues_clean(struct odm_dev *odm_pf)
+{
+	int i;
+
+	for (i = 0; i < 1000 && odm_pf->pmem->q_state[ODM_MAX_QUEUES - 1] != ODM_QUEUE_STATE_CLEAN;
+	     i++)
+		usleep(1000);
+}
+
+static void
+test_odm_sim_qrst(struct odm_dev_config *dev_cfg)
+{
+	struct odm_qrst_result res;
+	struct odm_dev *odm_pf;
+	uint64_t start;
+	int rc, i;
+
+	odm_pf = odm_pf_probe(dev_cfg);
+	assert(odm_pf != NULL);
+
+	test_wait_queues_clean(odm_pf);
+
+	/* All the queues reset in parallel, well under 32 reset latencies */
+	odm_sim_set_qrst_latency(odm_pf, 1000000);
+	start = odm_now_ns();
+	rc = odm_queues_reset(odm_pf, 0xffffffff, ODM_QRST_TIMEOUT_NS, &res);
+	assert(rc == 0);
+	assert(res.done == 0xffffffff && res.stuck == 0);
+	assert(odm_now_ns() - start < 16 * 1000000);
+	for (i = 0; i < ODM_MAX_QUEUES; i++)
+		assert(res.lat_ns[i] >= 1000000);
+
+	/* A wedged queue is flagged once the deadline expires */
+	odm_sim_set_qrst_stuck(odm_pf, 5, true);
+	rc = odm_queues_reset(odm_pf, 0xf0, 5000000, &res);
+	assert(rc == -ETIMEDOUT);
+	assert(res.done == 0xd0 && res.stuck == 0x20);
+	assert(odm_pf->qrst_stuck == 0x20);
+
+	odm_sim_set_qrst_stuck(odm_pf, 5, false);
+	rc = odm_queues_reset(odm_pf, 0x20, ODM_QRST_TIMEOUT_NS, NULL);
+	assert(rc == 0);
+	assert(odm_pf->qrst_stuck == 0);
+
+	odm_sim_set_qrst_latency(odm_pf, ODM_SIM_QRST_NS);
+	odm_pf_release(odm_pf);
+}
+
+static void
+test_odm_sim_util(struct odm_dev_config *dev_cfg)
+{
+	struct odm_pf_stats snap;
+	struct odm_dev *odm_pf;
+	uint32_t util;
+
+	odm_pf = odm_pf_probe(dev_cfg);
+	assert(odm_pf != NULL);
+
+	/* Idle engines */
+	usleep(10000);
+	util = odm_util_sample(odm_pf);
+	assert(util == 0);
+
+	/* Half loaded, within 1 % for the clock read skew */
+	odm_sim_set_dma_load(odm_pf, 5000);
+	odm_util_sample(odm_pf);
+	usleep(20000);
+	util = odm_util_sample(odm_pf);
+	assert(util >= 4900 && util <= 5100);
+
+	odm_sim_set_dma_load(odm_pf, 10000);
+	usleep(20000);
+	util = odm_util_sample(odm_pf);
+	assert(util >= 9900);
+
+	assert(odm_stats_snapshot(odm_pf->stats, &snap) == 0);
+	assert(snap.util_count == 4);
+	assert(snap.util_min == 0 && snap.util_max == util);
+
+	odm_pf_release(odm_pf);
+}
+
+static void
+test_odm_sim_rebal(struct odm_dev_config *dev_cfg)
+{
+	struct odm_dev *odm_pf;
+	uint64_t intl_sel;
+	int i;
+
+	odm_pf = odm_pf_probe(dev_cfg);
+	assert(odm_pf != NULL);
+
+	test_wait_queues_clean(odm_pf);
+
+	/* Eight busy queues, all on engine 0 */
+	odm_rebal_init(odm_pf, true);
+	odm_reg_write(odm_pf, ODM_DMA_INTL_SEL, 0);
+	pthread_mutex_lock(&odm_pf->qpool.lock);
+	for (i = 0; i < 8; i++)
+		odm_pf->pmem->q_state[i] = ODM_QUEUE_STATE_OPEN;
+	pthread_mutex_unlock(&odm_pf->qpool.lock);
+
+	/* Nothing moves while the engines are lightly used */
+	for (i = 0; i < 2 * ODM_REBAL_HOLD_SAMPLES; i++)
+		assert(odm_rebal_sample(odm_pf, 1000) == 0);
+
+	/* Nor before the imbalance held long enough */
+	for (i = 0; i < ODM_REBAL_HOLD_SAMPLES - 1; i++)
+		assert(odm_rebal_sample(odm_pf, 10000) == 0);
+
+	/* Then idle queues move until engine 1 has one for each queue of imbalance */
+	for (i = 0; i < 8 / ODM_REBAL_MAX_MOVES; i++)
+		assert(odm_rebal_sample(odm_pf, 10000) == ODM_REBAL_MAX_MOVES);
+	assert(odm_rebal_sample(odm_pf, 10000) == 0);
+	intl_sel = odm_reg_read(odm_pf, ODM_DMA_INTL_SEL);
+	assert(__builtin_popcountll(intl_sel) == 8);
+	assert((intl_sel & 0xff) == 0);
+	assert(odm_pf->stats->rebal_moves == 8);
+
+	/* Opening the moved queues evens the load out */
+	pthread_mutex_lock(&odm_pf->qpool.lock);
+	for (i = 0; i < ODM_MAX_QUEUES; i++)
+		if (intl_sel & (1ULL << i))
+			odm_pf->pmem->q_state[i] = ODM_QUEUE_STATE_OPEN;
+	pthread_mutex_unlock(&odm_pf->qpool.lock);
+	assert(odm_rebal_sample(odm_pf, 10000) == 0);
+	assert(!odm_pf->rebal.active);
+
+	pthread_mutex_lock(&odm_pf->qpool.lock);
+	for (i = 0; i < ODM_MAX_QUEUES; i++)
+		odm_pf->pmem->q_state[i] = ODM_QUEUE_STATE_CLEAN;
+	pthread_mutex_unlock(&odm_pf->qpool.lock);
+	odm_pf_release(odm_pf);
+}
+
+static void
+test_odm_sim_fifo(struct odm_dev_config *dev_cfg)
+{
+	char reply[ODM_CMD_REPLY_LEN];
+	struct odm_dev *odm_pf;
+	int i;
+
+	odm_pf = odm_pf_probe(dev_cfg);
+	assert(odm_pf != NULL);
+
+	test_wait_queues_clean(odm_pf);
+
+	/* Applied right away with no queue open */
+	assert(odm_cmd_exec(odm_pf, "fifo 96,32", reply, sizeof(reply)) == 0);
+	assert((odm_reg_read(odm_pf, ODM_ENGX_BUF(0)) & 0x7f) == 96);
+	assert((odm_reg_read(odm_pf, ODM_ENGX_BUF(1)) & 0x7f) == 32);
+
+	assert(odm_cmd_exec(odm_pf, "fifo 100,32", reply, sizeof(reply)) == -EINVAL);
+	assert(odm_cmd_exec(odm_pf, "fifo 4,64", reply, sizeof(reply)) == -EINVAL);
+	/* The sum wraps to 32 in 32 bits */
+	assert(odm_cmd_exec(odm_pf, "fifo 4294967232,96", reply, sizeof(reply)) == -EINVAL);
+	assert((odm_reg_read(odm_pf, ODM_ENGX_BUF(0)) & 0x7f) == 96);
+	assert(odm_cmd_exec(odm_pf, "nosuchcmd", reply, sizeof(reply)) == -EOPNOTSUPP);
+
+	/* Deferred while a queue is open, applied once it is released and reset */
+	odm_queue_init(odm_pf, 0, 0);
+	assert(odm_fifo_set(odm_pf, false, (uint8_t[]){32, 96}) == -EAGAIN);
+	assert((odm_reg_read(odm_pf, ODM_ENGX_BUF(0)) & 0x7f) == 96);
+	odm_queues_fini(odm_pf, 0);
+	for (i = 0; i < 1000 && odm_pf->fifo.pending; i++)
+		usleep(1000);
+	assert((odm_reg_read(odm_pf, ODM_ENGX_BUF(0)) & 0x7f) == 32);
+	assert((odm_reg_read(odm_pf, ODM_ENGX_BUF(1)) & 0x7f) == 96);
+
+	/* Auto follows the queue mapping */
+	odm_reg_write(odm_pf, ODM_DMA_INTL_SEL, 0xff);
+	assert(odm_cmd_exec(odm_pf, "fifo auto", reply, sizeof(reply)) == 0);
+	assert(odm_pf->fifo.kb[0] == 96 && odm_pf->fifo.kb[1] == 32);
+
+	odm_pf_release(odm_pf);
+}
+
+static void
+test_odm_sim_profile(struct odm_dev_config *dev_cfg)
+{
+	struct odm_dev_config cfg = *dev_cfg;
+	char reply[ODM_CMD_REPLY_LEN];
+	struct odm_dev *odm_pf;
+
+	assert(odm_profile_get("nosuchprofile") == NULL);
+	cfg.profile = odm_profile_get("latency");
+	assert(cfg.profile != NULL);
+
+	odm_pf = odm_pf_probe(&cfg);
+	assert(odm_pf != NULL);
+	assert((odm_reg_read(odm_pf, ODM_NCB_CFG) & ODM_NCB_CFG_MOLR_MASK) == cfg.profile->molr);
+	assert(odm_reg_read(odm_pf, ODM_DMA_CONTROL) == cfg.profile->dma_control);
+	assert(odm_reg_read(odm_pf, ODM_REQQ_GENBUFF_TH_LIMIT) == ODM_TH_VAL);
+	assert(odm_cmd_exec(odm_pf, "profile", reply, sizeof(reply)) == 0);
+	assert(strncmp(reply, "latency:", 8) == 0);
+	odm_pf_release(odm_pf);
+}
+
+static void
+test_odm_sim_tune(struct odm_dev_config *dev_cfg)
+{
+	const char *cfg_path = "/tmp/odm_pf_selftest.cfg";
+	struct odm_dev_config cfg = *dev_cfg;
+	char line[64], cfg_str[256] = "";
+	struct odm_dev *odm_pf;
+	uint32_t eng_sel;
+	FILE *fp;
+
+	fp = fopen(cfg_path, "w");
+	assert(fp != NULL);
+	fputs("NUM_VFS=8\nMOLR=\"0\"\nMOLR=\"0\"\n", fp);
+	fclose(fp);
+
+	/* A workload which only runs fast with MOLR 256 */
+	cfg.tune_cmd = "echo warmup 1; test \"$ODM_TUNE_MOLR\" = 256 && echo rate: 9.5 || "
+		       "echo rate: 3";
+	cfg.tune_pattern = "rate:";
+	cfg.tune_cfg = cfg_path;
+	odm_pf = odm_pf_probe(&cfg);
+	assert(odm_pf != NULL);
+	eng_sel = odm_reg_read(odm_pf, ODM_DMA_INTL_SEL);
+	assert(odm_tune(odm_pf, &cfg) == 0);
+	assert((odm_reg_read(odm_pf, ODM_NCB_CFG) & ODM_NCB_CFG_MOLR_MASK) == 256);
+	odm_pf_release(odm_pf);
+
+	fp = fopen(cfg_path, "r");
+	assert(fp != NULL);
+	while (fgets(line, sizeof(line), fp))
+		strncat(cfg_str, line, sizeof(cfg_str) - strlen(cfg_str) - 1);
+	fclose(fp);
+	unlink(cfg_path);
+
+	/* Ties keep the configured values, duplicated keys are merged */
+	snprintf(line, sizeof(line), "ENG_SEL=\"0x%08X\"\n", eng_sel);
+	assert(strstr(cfg_str, "NUM_VFS=8\nMOLR=\"256\"\n") == cfg_str);
+	assert(strstr(cfg_str, line) != NULL);
+	assert(strstr(cfg_str, "PLACEMENT=\"mask\"\n") != NULL);
+	assert(strstr(cfg_str, "FIFO_SPLIT=\"64,64\"\n") != NULL);
+}
+
+static int
+test_reload(struct odm_dev *odm_pf, const char *path, const char *cfg)
+{
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	assert(fp != NULL);
+	fputs(cfg, fp);
+	fclose(fp);
+
+	return odm_pf_reload(odm_pf, path);
+}
+
+static void
+test_odm_sim_reload(struct odm_dev_config *dev_cfg)
+{
+	const char *cfg_path = "/tmp/odm_pf_selftest_reload.cfg";
+	int log_lvl = log_level_get();
+	enum reactor_backend backend;
+	uint32_t eng_sel, intl_sel;
+	struct odm_dev *odm_pf;
+	char cfg[128];
+	int i;
+
+	odm_pf = odm_pf_probe(dev_cfg);
+	assert(odm_pf != NULL);
+	test_wait_queues_clean(odm_pf);
+
+	/* Unchanged settings, unknown keys are ignored */
+	eng_sel = odm_pf->pmem->eng_sel;
+	snprintf(cfg, sizeof(cfg), "# cfg\nENG_SEL=\"0x%08X\"\nNUM_VFS=%d\nOTHER=1\n", eng_sel,
+		 dev_cfg->num_vfs);
+	assert(test_reload(odm_pf, cfg_path, cfg) == 0);
+	assert(odm_reg_read(odm_pf, ODM_DMA_INTL_SEL) == eng_sel);
+
+	/* An open queue keeps its engine until it is released */
+	odm_queue_init(odm_pf, 0, 0);
+	eng_sel = ~eng_sel;
+	snprintf(cfg, sizeof(cfg), "ENG_SEL=\"0x%08X\"\nLOG_LEVEL=4\nUTIL_INTERVAL=\"250\"\n",
+		 eng_sel);
+	assert(test_reload(odm_pf, cfg_path, cfg) == 0);
+	log_level_set(log_lvl);
+	intl_sel = odm_reg_read(odm_pf, ODM_DMA_INTL_SEL);
+	assert((intl_sel & ~0x1U) == (eng_sel & ~0x1U) && ((intl_sel ^ eng_sel) & 0x1));
+	assert(odm_pf->util.interval_ms == 250);
+	odm_queues_fini(odm_pf, 0);
+	for (i = 0; i < 1000 && odm_pf->qpool.remap; i++)
+		usleep(1000);
+	assert(odm_reg_read(odm_pf, ODM_DMA_INTL_SEL) == eng_sel);
+
+	/* The profile is only changed with no queue open */
+	odm_queue_init(odm_pf, 0, 0);
+	assert(test_reload(odm_pf, cfg_path, "PROFILE=\"latency\"\n") == -EBUSY);
+	assert((odm_reg_read(odm_pf, ODM_NCB_CFG) & ODM_NCB_CFG_MOLR_MASK) == 512);
+	odm_queues_fini(odm_pf, 0);
+	for (i = 0; i < 1000 && odm_pf->pmem->q_state[0] != ODM_QUEUE_STATE_CLEAN; i++)
+		usleep(1000);
+	assert(test_reload(odm_pf, cfg_path, "PROFILE=\"latency\"\n") == 0);
+	assert((odm_reg_read(odm_pf, ODM_NCB_CFG) & ODM_NCB_CFG_MOLR_MASK) == 128);
+
+	/* REACTOR and the mailbox mode are only read at startup */
+	backend = reactor_backend_get();
+	snprintf(cfg, sizeof(cfg), "REACTOR=\"%s\"\n",
+		 backend == REACTOR_EPOLL ? "io_uring" : "epoll");
+	assert(test_reload(odm_pf, cfg_path, cfg) == 0);
+	assert(reactor_backend_get() == backend);
+	assert(test_reload(odm_pf, cfg_path, "REACTOR=\"select\"\n") == -EINVAL);
+	assert(test_reload(odm_pf, cfg_path, "MBOX_MODE=\"poll\"\nMBOX_POLL_CPU=\"1\"\n") == 0);
+	assert(odm_pf->mbox_mode == dev_cfg->mbox_mode);
+	assert(odm_pf->mbox_poll_cpu == dev_cfg->mbox_poll_cpu);
+	assert(test_reload(odm_pf, cfg_path, "MBOX_POLL_CPU=\"-2\"\n") == -EINVAL);
+
+	/* Rejected as a whole, nothing is applied */
+	snprintf(cfg, sizeof(cfg), "ENG_SEL=\"0x0\"\nNUM_VFS=%d\n",
+		 dev_cfg->num_vfs == ODM_MAX_VFS ? 2 : ODM_MAX_VFS);
+	assert(test_reload(odm_pf, cfg_path, cfg) == -EINVAL);
+	assert(test_reload(odm_pf, cfg_path, "ENG_SEL=\"0x0\"\nFIFO_SPLIT=\"4,4\"\n") == -EINVAL);
+	assert(odm_reg_read(odm_pf, ODM_DMA_INTL_SEL) == eng_sel);
+
+	unlink(cfg_path);
+	odm_pf_release(odm_pf);
+}
+
+static void
+test_odm_sim_warm_restart(struct odm_dev_config *dev_cfg)
+{
+	struct odm_dev_config cfg = *dev_cfg;
+	union odm_mbox_msg_t msg;
+	struct odm_dev *odm_pf;
+	uint32_t intl_sel;
+	int i, hw_qid;
+
+	cfg.warm_restart = true;
+	odm_pf = odm_pf_probe(&cfg);
+	assert(odm_pf != NULL && !odm_pf->resumed);
+	test_wait_queues_clean(odm_pf);
+
+	odm_queue_init(odm_pf, 1, 0);
+	hw_qid = odm_pf->pmem->maxq_per_vf;
+	intl_sel = odm_reg_read(odm_pf, ODM_DMA_INTL_SEL);
+	odm_pf_release(odm_pf);
+
+	/* The next run resumes the device, the open queue is kept */
+	odm_pf = odm_pf_probe(&cfg);
+	assert(odm_pf != NULL && odm_pf->resumed);
+	assert(odm_pf->pmem->q_state[hw_qid] == ODM_QUEUE_STATE_OPEN);
+	assert(ODM_DMA_IDS_GET_DMA_STRM(odm_reg_read(odm_pf, ODM_DMAX_IDS(hw_qid))) == 2);
+	assert(odm_reg_read(odm_pf, ODM_DMA_INTL_SEL) == intl_sel);
+
+	/* The mailbox is served again, the VF can release its queue */
+	msg.u[0] = 0;
+	msg.u[1] = 0;
+	msg.q.vf_id = 1;
+	msg.q.cmd = ODM_DEV_CLOSE;
+	assert(odm_sim_vf_mbox_send(odm_pf, 1, &msg, 1000) == 0);
+	for (i = 0; i < 1000 && odm_pf->pmem->q_state[hw_qid] != ODM_QUEUE_STATE_CLEAN; i++)
+		usleep(1000);
+	assert(odm_pf->pmem->q_state[hw_qid] == ODM_QUEUE_STATE_CLEAN);
+
+	/* Another number of VFs is not resumed, the device is initialized for it */
+	odm_pf_release(odm_pf);
+	cfg.num_vfs = dev_cfg->num_vfs == ODM_MAX_VFS ? 2 : ODM_MAX_VFS;
+	odm_pf = odm_pf_probe(&cfg);
+	assert(odm_pf != NULL && !odm_pf->resumed);
+	assert(odm_pf->pmem->vfs_in_use == cfg.num_vfs);
+	assert(odm_pf->pmem->maxq_per_vf == ODM_MAX_QUEUES / cfg.num_vfs);
+
+	/* A cold exit drops the state, the next run initializes the device */
+	odm_pf->warm = false;
+	odm_pf_release(odm_pf);
+	cfg.num_vfs = dev_cfg->num_vfs;
+	odm_pf = odm_pf_probe(&cfg);
+	assert(odm_pf != NULL && !odm_pf->resumed);
+	odm_pf->warm = false;
+	odm_pf_release(odm_pf);
+}
+
+static void
+test_odm_sim_irq_storm(struct odm_dev_config *dev_cfg)
+{
+	struct odm_pf_stats stats;
+	struct odm_dev *odm_pf;
+	uint64_t start, wait_ns;
+	int i, j;
+
+	odm_pf = odm_pf_probe(dev_cfg);
+	assert(odm_pf != NULL);
+
+	/* A storm on queue 3 masks it once above the rate, most events not logged */
+	for (i = 0; i < 2 * ODM_IRQ_STORM_RATE; i++) {
+		if (!odm_reg_read(odm_pf, ODM_REQQX_INT_ENA_W1S(3)))
+			break;
+		assert(odm_sim_inject_irq(odm_pf, 3, ODM_REQQ_INT_INST_DBO) == 0);
+		start = odm_now_ns();
+		while (odm_reg_read(odm_pf, ODM_REQQX_INT(3)) && odm_now_ns() - start < 100000000)
+			;
+	}
+	assert(i > ODM_IRQ_STORM_RATE && i < 2 * ODM_IRQ_STORM_RATE);
+	assert(odm_reg_read(odm_pf, ODM_REQQX_INT_ENA_W1S(4)) == ODM_REQQ_INT);
+
+	for (j = 0; j < 1000; j++) {
+		assert(odm_stats_snapshot(odm_pf->stats, &stats) == 0);
+		if (stats.irq_storms[3])
+			break;
+		usleep(1000);
+	}
+	assert(stats.irq_storms[3] == 1);
+	assert(stats.irq_suppressed[3] >= ODM_IRQ_STORM_RATE - ODM_IRQ_LOG_BURST);
+
+	/* Enabled again by the irq timer once the backoff expired */
+	wait_ns = odm_irq_poll(odm_pf);
+	assert(wait_ns > 0 && wait_ns <= ODM_IRQ_BACKOFF_MIN_MS * 1000000ULL);
+	start = odm_now_ns();
+	while (odm_reg_read(odm_pf, ODM_REQQX_INT_ENA_W1S(3)) != ODM_REQQ_INT &&
+	       odm_now_ns() - start < wait_ns + 1000000000ULL)
+		usleep(1000);
+	assert(odm_now_ns() - start >= wait_ns - 1000000ULL);
+	assert(odm_reg_read(odm_pf, ODM_REQQX_INT_ENA_W1S(3)) == ODM_REQQ_INT);
+
+	odm_pf_release(odm_pf);
+}
+
+static void *
+test_takeover_thread(void *arg)
+{
+	return odm_pf_probe(arg);
+}
+
+static void
+test_odm_sim_upgrade(struct odm_dev_config *dev_cfg)
+{
+	struct odm_dev_config cfg = *dev_cfg, new_cfg;
+	union odm_mbox_msg_t msg;
+	struct odm_dev *odm_pf;
+	pthread_t thread;
+	int i, hw_qid, sv[2];
+	void *ret;
+
+	/* The sim register file is only handed over in warm restart mode */
+	cfg.warm_restart = true;
+	odm_pf = odm_pf_probe(&cfg);
+	assert(odm_pf != NULL && !odm_pf->resumed);
+	test_wait_queues_clean(odm_pf);
+
+	odm_queue_init(odm_pf, 1, 0);
+	hw_qid = odm_pf->pmem->maxq_per_vf;
+
+	/* The new process is a thread probing with the other end of the socket */
+	assert(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == 0);
+	new_cfg = cfg;
+	new_cfg.warm_restart = false;
+	new_cfg.takeover_fd = sv[1];
+	assert(pthread_create(&thread, NULL, test_takeover_thread, &new_cfg) == 0);
+	assert(odm_pf_handover(odm_pf, sv[0]) == 0);
+	assert(pthread_join(thread, &ret) == 0);
+	close(sv[0]);
+
+	odm_pf = ret;
+	assert(odm_pf != NULL && odm_pf->resumed && !odm_pf->warm);
+	assert(odm_pf->pmem->q_state[hw_qid] == ODM_QUEUE_STATE_OPEN);
+
+	/* The mailbox is served by the new process on the eventfd handed over */
+	msg.u[0] = 0;
+	msg.u[1] = 0;
+	msg.q.vf_id = 1;
+	msg.q.cmd = ODM_DEV_CLOSE;
+	assert(odm_sim_vf_mbox_send(odm_pf, 1, &msg, 1000) == 0);
+	for (i = 0; i < 1000 && odm_pf->pmem->q_state[hw_qid] != ODM_QUEUE_STATE_CLEAN; i++)
+		usleep(1000);
+	assert(odm_pf->pmem->q_state[hw_qid] == ODM_QUEUE_STATE_CLEAN);
+
+	odm_pf_release(odm_pf);
+}
+
 void
 odm_pf_selftest(struct odm_dev_config *dev_cfg)
 {
 	test_pmem();
+	test_odm_placement();
 	test_odm_register_access(dev_cfg);
+	test_reactor();
 	test_odm_vfio_pci_irq(dev_cfg);
+	if (dev_cfg->backend == &odm_pf_sim_backend) {
+		test_odm_sim_mbox(dev_cfg);
+		test_odm_sim_mbox_poll(dev_cfg);
+		test_odm_sim_qrst(dev_cfg);
+		test_odm_sim_util(dev_cfg);
+		test_odm_sim_rebal(dev_cfg);
+		test_odm_sim_fifo(dev_cfg);
+		test_odm_sim_profile(dev_cfg);
+		test_odm_sim_tune(dev_cfg);
+		test_odm_sim_reload(dev_cfg);
+		test_odm_sim_irq_storm(dev_cfg);
+		test_odm_sim_warm_restart(dev_cfg);
+		test_odm_sim_upgrade(dev_cfg);
+	}
 
 	log_write(LOG_INFO, "ODM PF selftest passed\n");
 }
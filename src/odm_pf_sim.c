@@ -0,0 +1,532 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "odm_pf.h"
+#include "odm_pf_sim.h"
+#include "pmem.h"
+
+enum odm_sim_irq_reg {
+	ODM_SIM_IRQ_INT,
+	ODM_SIM_IRQ_INT_W1S,
+	ODM_SIM_IRQ_ENA_W1C,
+	ODM_SIM_IRQ_ENA_W1S,
+	ODM_SIM_IRQ_REG_MAX
+};
+
+/* Interrupt source: W1C status register with W1S alias and enable registers */
+struct odm_sim_irq_src {
+	uint64_t reg[ODM_SIM_IRQ_REG_MAX];
+	uint16_t vec;
+};
+
+struct odm_sim_vf {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint64_t rsp_seq;
+};
+
+struct odm_sim {
+	struct odm_dev *odm_pf;
+	uint8_t *bar0;
+	/* Register file in shared memory, kept for a warm restart */
+	bool bar0_shm;
+	uint64_t qrst_ns;
+	uint64_t qrst_done[ODM_MAX_QUEUES];
+	uint32_t qrst_stuck;
+	/* ODM_CSCLK_ACTIVE_PC: value at pc_t0, advancing at dma_load of SCLK */
+	pthread_mutex_t pc_lock;
+	uint64_t pc_acc;
+	uint64_t pc_t0;
+	uint32_t dma_load;
+	struct odm_sim_irq_src irq_src[ODM_SIM_NUM_VECS];
+	struct odm_sim_vf vf[ODM_MAX_VFS];
+};
+
+static inline uint64_t *
+odm_sim_reg(struct odm_sim *sim, uint64_t offset)
+{
+	return (uint64_t *)(sim->bar0 + offset);
+}
+
+static void
+odm_sim_raise(struct odm_sim *sim, uint16_t vec)
+{
+	int efd = sim->odm_pf->pdev.intr.efds[vec];
+	uint64_t data = 1;
+
+	if (efd < 0)
+		return;
+
+	if (write(efd, &data, sizeof(data)) != sizeof(data))
+		log_write(LOG_ERR, "sim: failed to raise vector %u\n", vec);
+}
+
+static uint64_t
+odm_sim_irq_ena(struct odm_sim *sim, struct odm_sim_irq_src *src)
+{
+	/* Sources without enable registers are always enabled */
+	if (!src->reg[ODM_SIM_IRQ_ENA_W1S])
+		return ~0ULL;
+
+	return __atomic_load_n(odm_sim_reg(sim, src->reg[ODM_SIM_IRQ_ENA_W1S]), __ATOMIC_ACQUIRE);
+}
+
+static void
+odm_sim_irq_set(struct odm_sim *sim, struct odm_sim_irq_src *src, uint64_t bits)
+{
+	__atomic_fetch_or(odm_sim_reg(sim, src->reg[ODM_SIM_IRQ_INT]), bits, __ATOMIC_ACQ_REL);
+	if (bits & odm_sim_irq_ena(sim, src))
+		odm_sim_raise(sim, src->vec);
+}
+
+static struct odm_sim_irq_src *
+odm_sim_irq_src_get(struct odm_sim *sim, uint64_t offset, enum odm_sim_irq_reg *type)
+{
+	int i, r;
+
+	for (i = 0; i < ODM_SIM_NUM_VECS; i++) {
+		for (r = 0; r < ODM_SIM_IRQ_REG_MAX; r++) {
+			if (sim->irq_src[i].reg[r] && sim->irq_src[i].reg[r] == offset) {
+				*type = r;
+				return &sim->irq_src[i];
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static void
+odm_sim_irq_write(struct odm_sim *sim, struct odm_sim_irq_src *src, enum odm_sim_irq_reg type,
+		  uint64_t val)
+{
+	uint64_t *ena_w1c = odm_sim_reg(sim, src->reg[ODM_SIM_IRQ_ENA_W1C]);
+	uint64_t *ena_w1s = odm_sim_reg(sim, src->reg[ODM_SIM_IRQ_ENA_W1S]);
+
+	switch (type) {
+	case ODM_SIM_IRQ_INT:
+		__atomic_fetch_and(odm_sim_reg(sim, src->reg[ODM_SIM_IRQ_INT]), ~val,
+				   __ATOMIC_ACQ_REL);
+		break;
+	case ODM_SIM_IRQ_INT_W1S:
+		odm_sim_irq_set(sim, src, val);
+		break;
+	case ODM_SIM_IRQ_ENA_W1C:
+		/* Both enable registers read back the current enables */
+		__atomic_fetch_and(ena_w1c, ~val, __ATOMIC_ACQ_REL);
+		__atomic_fetch_and(ena_w1s, ~val, __ATOMIC_ACQ_REL);
+		break;
+	case ODM_SIM_IRQ_ENA_W1S:
+		__atomic_fetch_or(ena_w1c, val, __ATOMIC_ACQ_REL);
+		__atomic_fetch_or(ena_w1s, val, __ATOMIC_ACQ_REL);
+		/* Pending causes fire once they get enabled */
+		if (__atomic_load_n(odm_sim_reg(sim, src->reg[ODM_SIM_IRQ_INT]), __ATOMIC_ACQUIRE) &
+		    val)
+			odm_sim_raise(sim, src->vec);
+		break;
+	default:
+		break;
+	}
+}
+
+static inline bool
+odm_sim_is_qrst(uint64_t offset)
+{
+	return offset < ODM_CSCLK_ACTIVE_PC && (offset & 0x7ffULL) == ODM_DMAX_QRST(0);
+}
+
+static inline bool
+odm_sim_is_mbox_data(uint64_t offset)
+{
+	return offset >= ODM_MBOX_PF_VFX_DATAX(0, 0) &&
+	       offset <= ODM_MBOX_PF_VFX_DATAX(ODM_MAX_VFS - 1, 1);
+}
+
+/* Called with pc_lock held */
+static uint64_t
+odm_sim_active_pc(struct odm_sim *sim, uint64_t now)
+{
+	return sim->pc_acc + (now - sim->pc_t0) * ODM_SIM_SCLK_MHZ / 1000 * sim->dma_load / 10000;
+}
+
+static uint64_t
+odm_sim_reg_read(struct odm_dev *odm_pf, uint64_t offset)
+{
+	struct odm_sim *sim = odm_pf->backend_priv;
+	uint64_t *reg = odm_sim_reg(sim, offset);
+	uint64_t val;
+
+	if (offset == ODM_CSCLK_ACTIVE_PC) {
+		pthread_mutex_lock(&sim->pc_lock);
+		val = odm_sim_active_pc(sim, odm_now_ns());
+		pthread_mutex_unlock(&sim->pc_lock);
+		return val;
+	}
+
+	val = __atomic_load_n(reg, __ATOMIC_ACQUIRE);
+	if (odm_sim_is_qrst(offset) && (val & 0x1) &&
+	    !(__atomic_load_n(&sim->qrst_stuck, __ATOMIC_ACQUIRE) & (1U << (offset >> 11))) &&
+	    odm_now_ns() >= sim->qrst_done[offset >> 11]) {
+		/* QRST is self-clearing once the reset completes */
+		val &= ~0x1ULL;
+		__atomic_store_n(reg, val, __ATOMIC_RELEASE);
+	}
+
+	return val;
+}
+
+static void
+odm_sim_reg_write(struct odm_dev *odm_pf, uint64_t offset, uint64_t val)
+{
+	struct odm_sim *sim = odm_pf->backend_priv;
+	struct odm_sim_irq_src *src;
+	enum odm_sim_irq_reg type;
+	struct odm_sim_vf *vf;
+
+	src = odm_sim_irq_src_get(sim, offset, &type);
+	if (src) {
+		odm_sim_irq_write(sim, src, type, val);
+		return;
+	}
+
+	if (odm_sim_is_qrst(offset)) {
+		if (val & 0x1)
+			sim->qrst_done[offset >> 11] = odm_now_ns() + sim->qrst_ns;
+		__atomic_store_n(odm_sim_reg(sim, offset), val & 0x1, __ATOMIC_RELEASE);
+		return;
+	}
+
+	__atomic_store_n(odm_sim_reg(sim, offset), val, __ATOMIC_RELEASE);
+
+	/* The response is complete once the PF writes the second data word */
+	if (odm_sim_is_mbox_data(offset) && (offset & 0x8)) {
+		vf = &sim->vf[(offset >> 4) & 0xf];
+		pthread_mutex_lock(&vf->lock);
+		vf->rsp_seq++;
+		pthread_cond_signal(&vf->cond);
+		pthread_mutex_unlock(&vf->lock);
+	}
+}
+
+int
+odm_sim_vf_mbox_send(struct odm_dev *odm_pf, uint8_t vf_id, union odm_mbox_msg_t *msg,
+		     int timeout_ms)
+{
+	struct odm_sim *sim = odm_pf->backend_priv;
+	struct odm_sim_vf *vf;
+	struct timespec ts;
+	uint64_t seq;
+	int rc = 0;
+
+	if (vf_id >= ODM_MAX_VFS)
+		return -EINVAL;
+
+	vf = &sim->vf[vf_id];
+	pthread_mutex_lock(&vf->lock);
+	seq = vf->rsp_seq;
+	pthread_mutex_unlock(&vf->lock);
+
+	__atomic_store_n(odm_sim_reg(sim, ODM_MBOX_PF_VFX_DATAX(vf_id, 1)), msg->u[1],
+			 __ATOMIC_RELEASE);
+	__atomic_store_n(odm_sim_reg(sim, ODM_MBOX_PF_VFX_DATAX(vf_id, 0)), msg->u[0],
+			 __ATOMIC_RELEASE);
+	odm_sim_irq_set(sim, &sim->irq_src[ODM_MBOX_VF_PF_IRQ], BIT_ULL(vf_id));
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&vf->lock);
+	while (vf->rsp_seq == seq && rc == 0)
+		rc = pthread_cond_timedwait(&vf->cond, &vf->lock, &ts);
+	if (vf->rsp_seq != seq)
+		rc = 0;
+	pthread_mutex_unlock(&vf->lock);
+
+	if (rc)
+		return -ETIMEDOUT;
+
+	msg->u[0] = __atomic_load_n(odm_sim_reg(sim, ODM_MBOX_PF_VFX_DATAX(vf_id, 0)),
+				    __ATOMIC_ACQUIRE);
+	msg->u[1] = __atomic_load_n(odm_sim_reg(sim, ODM_MBOX_PF_VFX_DATAX(vf_id, 1)),
+				    __ATOMIC_ACQUIRE);
+
+	return 0;
+}
+
+int
+odm_sim_inject_irq(struct odm_dev *odm_pf, uint16_t vec, uint64_t bits)
+{
+	struct odm_sim *sim = odm_pf->backend_priv;
+
+	if (vec >= ODM_SIM_NUM_VECS || vec == ODM_MBOX_VF_PF_IRQ)
+		return -EINVAL;
+
+	odm_sim_irq_set(sim, &sim->irq_src[vec], bits);
+
+	return 0;
+}
+
+void
+odm_sim_set_qrst_latency(struct odm_dev *odm_pf, uint64_t ns)
+{
+	struct odm_sim *sim = odm_pf->backend_priv;
+
+	sim->qrst_ns = ns;
+}
+
+void
+odm_sim_set_dma_load(struct odm_dev *odm_pf, uint32_t load)
+{
+	struct odm_sim *sim = odm_pf->backend_priv;
+	uint64_t now = odm_now_ns();
+
+	pthread_mutex_lock(&sim->pc_lock);
+	sim->pc_acc = odm_sim_active_pc(sim, now);
+	sim->pc_t0 = now;
+	sim->dma_load = load < 10000 ? load : 10000;
+	pthread_mutex_unlock(&sim->pc_lock);
+}
+
+void
+odm_sim_set_qrst_stuck(struct odm_dev *odm_pf, uint8_t qid, bool stuck)
+{
+	struct odm_sim *sim = odm_pf->backend_priv;
+
+	if (qid >= ODM_MAX_QUEUES)
+		return;
+
+	if (stuck)
+		__atomic_or_fetch(&sim->qrst_stuck, 1U << qid, __ATOMIC_RELEASE);
+	else
+		__atomic_and_fetch(&sim->qrst_stuck, ~(1U << qid), __ATOMIC_RELEASE);
+}
+
+static void
+odm_sim_irq_src_init(struct odm_sim *sim)
+{
+	struct odm_sim_irq_src *src;
+	int i;
+
+	for (i = 0; i < ODM_MAX_REQQ_INT; i++) {
+		src = &sim->irq_src[i];
+		src->reg[ODM_SIM_IRQ_INT] = ODM_REQQX_INT(i);
+		src->reg[ODM_SIM_IRQ_INT_W1S] = ODM_REQQX_INT_W1S(i);
+		src->reg[ODM_SIM_IRQ_ENA_W1C] = ODM_REQQX_INT_ENA_W1C(i);
+		src->reg[ODM_SIM_IRQ_ENA_W1S] = ODM_REQQX_INT_ENA_W1S(i);
+		src->vec = i;
+	}
+
+	src = &sim->irq_src[ODM_PF_RAS_IRQ];
+	src->reg[ODM_SIM_IRQ_INT] = ODM_PF_RAS;
+	src->reg[ODM_SIM_IRQ_INT_W1S] = ODM_PF_RAS_W1S;
+	src->reg[ODM_SIM_IRQ_ENA_W1C] = ODM_PF_RAS_ENA_W1C;
+	src->reg[ODM_SIM_IRQ_ENA_W1S] = ODM_PF_RAS_ENA_W1S;
+	src->vec = ODM_PF_RAS_IRQ;
+
+	src = &sim->irq_src[ODM_MBOX_VF_PF_IRQ];
+	src->reg[ODM_SIM_IRQ_INT] = ODM_MBOX_VF_PF_INT;
+	src->reg[ODM_SIM_IRQ_INT_W1S] = ODM_MBOX_VF_PF_INT_W1S;
+	src->reg[ODM_SIM_IRQ_ENA_W1C] = ODM_MBOX_VF_PF_INT_ENA_W1C;
+	src->reg[ODM_SIM_IRQ_ENA_W1S] = ODM_MBOX_VF_PF_INT_ENA_W1S;
+	src->vec = ODM_MBOX_VF_PF_IRQ;
+
+	/* NCBO error info is W1C with no enable registers */
+	src = &sim->irq_src[ODM_NCBO_ERR_IRQ];
+	src->reg[ODM_SIM_IRQ_INT] = ODM_NCBO_ERR_INFO;
+	src->vec = ODM_NCBO_ERR_IRQ;
+}
+
+static uint8_t *
+odm_sim_bar0_alloc(struct odm_dev *odm_pf, struct odm_sim *sim)
+{
+	struct odm_handover *ho = odm_pf->takeover;
+	uint8_t *bar0;
+
+	/* The register file of the previous process, on an upgrade */
+	if (ho) {
+		if (ho->bar0_fd < 0) {
+			log_write(LOG_ERR, "sim: no register file handed over\n");
+			return NULL;
+		}
+		sim->bar0_shm = true;
+		bar0 = pmem_attach(ODM_SIM_BAR0_NAME, ho->bar0_fd, ODM_SIM_BAR0_LEN);
+		ho->bar0_fd = -1;
+		return bar0;
+	}
+
+	sim->bar0_shm = odm_pf->warm;
+	if (sim->bar0_shm)
+		return pmem_alloc(ODM_SIM_BAR0_NAME, ODM_SIM_BAR0_LEN);
+
+	bar0 = aligned_alloc(sysconf(_SC_PAGESIZE), ODM_SIM_BAR0_LEN);
+	if (bar0)
+		memset(bar0, 0, ODM_SIM_BAR0_LEN);
+
+	return bar0;
+}
+
+/* The register file is dropped along with the device state on a cold exit */
+static void
+odm_sim_bar0_free(struct odm_dev *odm_pf, struct odm_sim *sim)
+{
+	if (!sim->bar0)
+		return;
+
+	if (!sim->bar0_shm)
+		free(sim->bar0);
+	else if (odm_pf->warm)
+		pmem_detach(ODM_SIM_BAR0_NAME);
+	else
+		pmem_free(ODM_SIM_BAR0_NAME);
+}
+
+static int
+odm_sim_setup(struct odm_dev *odm_pf)
+{
+	struct vfio_pci_device *pdev = &odm_pf->pdev;
+	pthread_condattr_t attr;
+	struct odm_sim *sim;
+	int i;
+
+	sim = calloc(1, sizeof(*sim));
+	if (!sim) {
+		log_write(LOG_ERR, "sim: failed to allocate device\n");
+		return -1;
+	}
+
+	sim->bar0 = odm_sim_bar0_alloc(odm_pf, sim);
+	pdev->mem = calloc(1, sizeof(*pdev->mem));
+	pdev->intr.efds = malloc(ODM_SIM_NUM_VECS * sizeof(int32_t));
+	if (!sim->bar0 || !pdev->mem || !pdev->intr.efds) {
+		log_write(LOG_ERR, "sim: failed to allocate device resources\n");
+		goto free_sim;
+	}
+
+	sim->odm_pf = odm_pf;
+	sim->qrst_ns = ODM_SIM_QRST_NS;
+	sim->pc_t0 = odm_now_ns();
+	pthread_mutex_init(&sim->pc_lock, NULL);
+	odm_sim_irq_src_init(sim);
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	for (i = 0; i < ODM_MAX_VFS; i++) {
+		pthread_mutex_init(&sim->vf[i].lock, NULL);
+		pthread_cond_init(&sim->vf[i].cond, &attr);
+	}
+	pthread_condattr_destroy(&attr);
+
+	pdev->mem[0].index = PCI_ODM_PF_CFG_BAR;
+	pdev->mem[0].addr = sim->bar0;
+	pdev->mem[0].len = ODM_SIM_BAR0_LEN;
+	pdev->num_resource = 1;
+
+	/* All interrupts are disabled by default */
+	memset(pdev->intr.efds, -1, ODM_SIM_NUM_VECS * sizeof(int32_t));
+	pdev->intr.count = ODM_SIM_NUM_VECS;
+	pthread_mutex_init(&pdev->intr.lock, NULL);
+
+	pdev->device_fd = -1;
+	pdev->group_fd = -1;
+	pdev->emulated = true;
+	odm_pf->backend_priv = sim;
+
+	log_write(LOG_INFO, "%s: Using simulated ODM device\n", pdev->name);
+
+	return 0;
+
+free_sim:
+	free(pdev->intr.efds);
+	free(pdev->mem);
+	odm_sim_bar0_free(odm_pf, sim);
+	free(sim);
+	pdev->intr.efds = NULL;
+	pdev->mem = NULL;
+	return -1;
+}
+
+static void
+odm_sim_release(struct odm_dev *odm_pf)
+{
+	struct vfio_pci_device *pdev = &odm_pf->pdev;
+	struct odm_sim *sim = odm_pf->backend_priv;
+	uint32_t i;
+
+	if (!sim)
+		return;
+
+	for (i = 0; i < pdev->intr.count; i++) {
+		if (pdev->intr.efds[i] != -1)
+			close(pdev->intr.efds[i]);
+		if (pdev->intr.adopted && pdev->intr.adopted[i] != -1)
+			close(pdev->intr.adopted[i]);
+	}
+
+	for (i = 0; i < ODM_MAX_VFS; i++) {
+		pthread_mutex_destroy(&sim->vf[i].lock);
+		pthread_cond_destroy(&sim->vf[i].cond);
+	}
+	pthread_mutex_destroy(&sim->pc_lock);
+
+	free(pdev->intr.adopted);
+	free(pdev->intr.efds);
+	free(pdev->mem);
+	odm_sim_bar0_free(odm_pf, sim);
+	free(sim);
+	pdev->intr.adopted = NULL;
+	pdev->intr.efds = NULL;
+	pdev->intr.count = 0;
+	pdev->mem = NULL;
+	pdev->num_resource = 0;
+	odm_pf->backend_priv = NULL;
+}
+
+/* The register file is handed over, it has to be in shared memory */
+static int
+odm_sim_handover(struct odm_dev *odm_pf, struct odm_handover *ho)
+{
+	struct odm_sim *sim = odm_pf->backend_priv;
+
+	if (!sim->bar0_shm) {
+		log_write(LOG_ERR, "sim: the register file is only handed over in warm restart "
+			  "mode\n");
+		return -ENOTSUP;
+	}
+
+	ho->bar0_fd = pmem_export(ODM_SIM_BAR0_NAME);
+
+	return ho->bar0_fd < 0 ? -EIO : 0;
+}
+
+static int
+odm_sim_create_vfs(struct odm_dev *odm_pf, struct odm_dev_config *dev_cfg)
+{
+	log_write(LOG_INFO, "%s: sim: created %d VFs\n", odm_pf->pdev.name, dev_cfg->num_vfs);
+
+	return 0;
+}
+
+const struct odm_pf_backend odm_pf_sim_backend = {
+	.name = "sim",
+	.suffix = "_sim",
+	.setup = odm_sim_setup,
+	.release = odm_sim_release,
+	.create_vfs = odm_sim_create_vfs,
+	.reg_read = odm_sim_reg_read,
+	.reg_write = odm_sim_reg_write,
+	.handover = odm_sim_handover,
+};
@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+/**
+ * @file
+ *
+ * Simulated ODM device backend
+ *
+ * Software model of the ODM PF BAR0 used to run the PF driver without
+ * Odyssey hardware. The model implements QRST self-clearing after a
+ * configurable latency (never for a queue marked stuck), ODM_CTL, the
+ * mailbox DATAX/INT registers, the REQQ/RAS/NCBO interrupt status and
+ * enable registers, and ODM_CSCLK_ACTIVE_PC counting at a set DMA load. MSI-X vectors are
+ * delivered by writing to the vector eventfds.
+ *
+ * The VF side of the mailbox is driven with odm_sim_vf_mbox_send(), which
+ * behaves like the VF driver: it writes the message to the DATAX registers,
+ * raises the VF->PF interrupt and waits for the PF response.
+ *
+ * With the PF driver in warm restart mode, the register file is kept in a
+ * shared memory segment, so it outlives the driver process like the device
+ * does. The interrupt status of the model is not kept.
+ */
+
+#ifndef __ODM_PF_SIM_H__
+#define __ODM_PF_SIM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "odm_pf.h"
+
+/* Size of the simulated BAR0 */
+#define ODM_SIM_BAR0_LEN		(0x20000ULL)
+/* Register file kept across a warm restart */
+#define ODM_SIM_BAR0_NAME		"/odm_pf_sim"
+/* Number of simulated MSI-X vectors */
+#define ODM_SIM_NUM_VECS		ODM_IRQ_NUM_VECS
+/* Default QRST completion latency in ns */
+#define ODM_SIM_QRST_NS			(2000ULL)
+/* SCLK rate driving the simulated ODM_CSCLK_ACTIVE_PC */
+#define ODM_SIM_SCLK_MHZ		ODM_SCLK_DEF_MHZ
+
+/**
+ * Send a mailbox message from a simulated VF and wait for the PF response.
+ *
+ * @param	odm_pf		ODM PF device using the sim backend.
+ * @param	vf_id		VF sending the message.
+ * @param	msg		Message to send, updated with the PF response.
+ * @param	timeout_ms	Time to wait for the response.
+ * @return			0 on success, -ETIMEDOUT if the PF did not respond.
+ */
+int odm_sim_vf_mbox_send(struct odm_dev *odm_pf, uint8_t vf_id, union odm_mbox_msg_t *msg,
+			 int timeout_ms);
+
+/**
+ * Inject an interrupt cause. The cause bits are set in the status register of
+ * the source and the MSI-X vector is raised if the cause is enabled.
+ *
+ * @param	odm_pf	ODM PF device using the sim backend.
+ * @param	vec	REQQ queue (0-31), ODM_PF_RAS_IRQ or ODM_NCBO_ERR_IRQ.
+ * @param	bits	Cause bits to set.
+ * @return		0 on success, -EINVAL for an invalid vector.
+ */
+int odm_sim_inject_irq(struct odm_dev *odm_pf, uint16_t vec, uint64_t bits);
+
+/**
+ * Set the time a queue reset takes to complete.
+ *
+ * @param	odm_pf	ODM PF device using the sim backend.
+ * @param	ns	QRST completion latency in ns.
+ */
+void odm_sim_set_qrst_latency(struct odm_dev *odm_pf, uint64_t ns);
+
+/**
+ * Set the DMA load, the fraction of SCLK cycles ODM_CSCLK_ACTIVE_PC counts.
+ *
+ * @param	odm_pf	ODM PF device using the sim backend.
+ * @param	load	Load in 1/100 %, 0 to 10000.
+ */
+void odm_sim_set_dma_load(struct odm_dev *odm_pf, uint32_t load);
+
+/**
+ * Make the reset of a queue never complete, as with a wedged queue.
+ *
+ * @param	odm_pf	ODM PF device using the sim backend.
+ * @param	qid	Hardware queue.
+ * @param	stuck	true to wedge the queue, false to let its resets complete.
+ */
+void odm_sim_set_qrst_stuck(struct odm_dev *odm_pf, uint8_t qid, bool stuck);
+
+#endif /* __ODM_PF_SIM_H__ */
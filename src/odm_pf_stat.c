@@ -0,0 +1,266 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+/*
+ * odm_pf_stat: print the ODM PF driver statistics.
+ *
+ * Maps the statistics segment of the running PF driver read-only and prints a
+ * snapshot, once or periodically. Reading never blocks the driver.
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "odm_pf_stats.h"
+
+static volatile sig_atomic_t quit_signal;
+
+static const char *const mbox_cmd_names[ODM_STATS_MBOX_CMDS] = {
+	[ODM_DEV_INIT] = "DEV_INIT",
+	[ODM_DEV_CLOSE] = "DEV_CLOSE",
+	[ODM_QUEUE_OPEN] = "QUEUE_OPEN",
+	[ODM_QUEUE_CLOSE] = "QUEUE_CLOSE",
+	[ODM_REG_DUMP] = "REG_DUMP",
+};
+
+static const char *const reqq_cause_names[ODM_STATS_REQQ_CAUSES] = {
+	[0] = "INSTRFLT",
+	[1] = "RDFLT",
+	[2] = "WRFLT",
+	[3] = "CSFLT",
+	[4] = "INST_DBO",
+	[6] = "FILL_INVAL",
+	[7] = "INSTR_PSN",
+	[9] = "INSTR_TMO",
+};
+
+static const char *const ras_cause_names[ODM_STATS_RAS_CAUSES] = {
+	"EBI_DAT_PSN", "NCB_DAT_PSN", "NCB_CMD_PSN",
+};
+
+static void
+signal_handler(__attribute__((unused)) int sig_num)
+{
+	quit_signal = 1;
+}
+
+/* Upper bound in us of the bucket holding the given percentile */
+static uint64_t
+lat_percentile(const uint64_t *hist, double pct)
+{
+	uint64_t total = 0, sum = 0;
+	int b;
+
+	for (b = 0; b < ODM_STATS_LAT_BUCKETS; b++)
+		total += hist[b];
+	if (!total)
+		return 0;
+
+	for (b = 0; b < ODM_STATS_LAT_BUCKETS; b++) {
+		sum += hist[b];
+		if (sum * 100.0 >= total * pct)
+			break;
+	}
+
+	return 1ULL << (b < ODM_STATS_LAT_BUCKETS ? b : ODM_STATS_LAT_BUCKETS - 1);
+}
+
+static uint64_t
+mbox_total(const struct odm_pf_stats *st)
+{
+	uint64_t total = 0;
+	int vf, c;
+
+	for (vf = 0; vf < ODM_MAX_VFS; vf++)
+		for (c = 0; c < ODM_STATS_MBOX_CMDS; c++)
+			total += st->vf[vf].mbox_cmds[c];
+
+	return total;
+}
+
+static void
+print_stats(const struct odm_pf_stats *st, bool all)
+{
+	const struct odm_pf_stats_queue *q;
+	const struct odm_pf_stats_vf *vf;
+	struct timespec ts;
+	uint64_t total;
+	int i, c;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	printf("odm_pf_driver pid %d, up %lu s, reactor wakeups %lu\n", st->pid,
+	       (uint64_t)ts.tv_sec - st->start_time, st->irq_wakeups);
+
+	printf("RAS:");
+	for (c = 0; c < ODM_STATS_RAS_CAUSES; c++)
+		printf(" %s %lu", ras_cause_names[c], st->ras_int[c]);
+	printf(", NCBO errors %lu\n", st->ncbo_err);
+
+	printf("\n%-4s", "VF");
+	for (c = 0; c < ODM_STATS_MBOX_CMDS; c++)
+		if (mbox_cmd_names[c])
+			printf(" %11s", mbox_cmd_names[c]);
+	printf(" %8s %10s %10s\n", "drops", "p50(us)", "p99(us)");
+	for (i = 0; i < ODM_MAX_VFS; i++) {
+		vf = &st->vf[i];
+		total = vf->mbox_drops;
+		for (c = 0; c < ODM_STATS_MBOX_CMDS; c++)
+			total += vf->mbox_cmds[c];
+		if (!total && !all)
+			continue;
+
+		printf("%-4d", i);
+		for (c = 0; c < ODM_STATS_MBOX_CMDS; c++)
+			if (mbox_cmd_names[c])
+				printf(" %11lu", vf->mbox_cmds[c]);
+		printf(" %8lu %10lu %10lu\n", vf->mbox_drops, lat_percentile(vf->mbox_lat, 50),
+		       lat_percentile(vf->mbox_lat, 99));
+	}
+
+	printf("\n%-4s %8s %8s %10s %10s", "Q", "resets", "timeouts", "last(us)", "max(us)");
+	for (c = 0; c < ODM_STATS_REQQ_CAUSES; c++)
+		if (reqq_cause_names[c])
+			printf(" %10s", reqq_cause_names[c]);
+	printf("\n");
+	for (i = 0; i < ODM_MAX_QUEUES; i++) {
+		q = &st->q[i];
+		total = q->resets + q->reset_timeouts;
+		for (c = 0; c < ODM_STATS_REQQ_CAUSES; c++)
+			total += q->reqq_int[c];
+		if (!total && !all)
+			continue;
+
+		printf("%-4d %8lu %8lu %10lu %10lu", i, q->resets, q->reset_timeouts,
+		       q->reset_last_ns / 1000, q->reset_max_ns / 1000);
+		for (c = 0; c < ODM_STATS_REQQ_CAUSES; c++)
+			if (reqq_cause_names[c])
+				printf(" %10lu", q->reqq_int[c]);
+		printf("\n");
+	}
+	printf("Queue reset latency p50 %lu us, p99 %lu us\n", lat_percentile(st->qrst_lat, 50),
+	       lat_percentile(st->qrst_lat, 99));
+
+	printf("Engine to queue mapping 0x%08x, queues moved by the rebalancer %lu\n", st->eng_sel,
+	       st->rebal_moves);
+
+	for (i = 0; i < ODM_IRQ_NUM_VECS; i++) {
+		if (!st->irq_storms[i] && !st->irq_suppressed[i])
+			continue;
+		if (i < ODM_MAX_REQQ_INT)
+			printf("REQQ %d", i);
+		else
+			printf("%s", i == ODM_PF_RAS_IRQ ? "RAS" : "NCBO");
+		printf(" interrupt storms %lu, interrupts not logged %lu\n", st->irq_storms[i],
+		       st->irq_suppressed[i]);
+	}
+
+	if (!st->util_count)
+		return;
+
+	printf("DMA utilization %.2f %% (%u ms interval), min %.2f %%, avg %.2f %%, max %.2f %%\n",
+	       st->util[(st->util_count - 1) % ODM_STATS_UTIL_SAMPLES] / 100.0,
+	       st->util_interval_ms, st->util_min / 100.0, st->util_avg / 100.0,
+	       st->util_max / 100.0);
+}
+
+static void
+print_usage(const char *prog_name)
+{
+	fprintf(stderr, "Usage: %s [-a] [-w seconds] [-n name]\n", prog_name);
+	fprintf(stderr, "  -a             Print all VFs and queues, not only the active ones\n");
+	fprintf(stderr, "  -w seconds     Watch, print the statistics every interval\n");
+	fprintf(stderr, "  -n name        Statistics segment (default %s)\n", ODM_PF_STATS_NAME);
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *name = ODM_PF_STATS_NAME;
+	struct odm_pf_stats *stats, snap;
+	struct stat st;
+	bool all = false, first = true;
+	uint64_t prev_total = 0;
+	int interval = 0;
+	int fd, opt, rc = 0;
+
+	while ((opt = getopt(argc, argv, "aw:n:")) != EOF) {
+		switch (opt) {
+		case 'a':
+			all = true;
+			break;
+		case 'w':
+			interval = atoi(optarg);
+			if (interval <= 0)
+				print_usage(argv[0]);
+			break;
+		case 'n':
+			name = optarg;
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "No statistics found, is odm_pf_driver running?\n");
+		return EXIT_FAILURE;
+	}
+
+	/* A segment of another layout version may be smaller */
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*stats)) {
+		fprintf(stderr, "Statistics segment is not supported\n");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	stats = mmap(NULL, sizeof(*stats), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (stats == MAP_FAILED) {
+		fprintf(stderr, "Failed to map the statistics\n");
+		return EXIT_FAILURE;
+	}
+
+	if (stats->magic != ODM_PF_STATS_MAGIC || stats->version != ODM_PF_STATS_VERSION) {
+		fprintf(stderr, "Statistics version %u is not supported\n", stats->version);
+		rc = EXIT_FAILURE;
+		goto unmap;
+	}
+
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+
+	do {
+		if (odm_stats_snapshot(stats, &snap)) {
+			fprintf(stderr, "Statistics busy\n");
+			rc = EXIT_FAILURE;
+		} else {
+			print_stats(&snap, all);
+			if (interval && !first)
+				printf("Mailbox commands/sec %.1f\n",
+				       (double)(mbox_total(&snap) - prev_total) / interval);
+			prev_total = mbox_total(&snap);
+			first = false;
+		}
+
+		if (interval) {
+			printf("\n");
+			fflush(stdout);
+			sleep(interval);
+		}
+	} while (interval && !quit_signal);
+
+unmap:
+	munmap(stats, sizeof(*stats));
+
+	return rc;
+}
@@ -0,0 +1,243 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+#include <stddef.h>
+#include <unistd.h>
+
+#include "odm_pf.h"
+#include "odm_pf_stats.h"
+#include "pmem.h"
+#include "reactor.h"
+
+/*
+ * Writers (interrupt thread, mailbox workers, queue reset thread) are
+ * serialized by stats_lock, the sequence counter only protects the readers.
+ */
+static inline struct odm_pf_stats *
+odm_stats_begin(struct odm_dev *odm_pf)
+{
+	struct odm_pf_stats *stats = odm_pf->stats;
+
+	pthread_mutex_lock(&odm_pf->stats_lock);
+	__atomic_store_n(&stats->seq, stats->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	return stats;
+}
+
+static inline void
+odm_stats_end(struct odm_dev *odm_pf)
+{
+	struct odm_pf_stats *stats = odm_pf->stats;
+
+	__atomic_store_n(&stats->seq, stats->seq + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&odm_pf->stats_lock);
+}
+
+int
+odm_stats_init(struct odm_dev *odm_pf)
+{
+	struct odm_pf_stats *stats;
+	struct timespec ts;
+
+	stats = pmem_alloc(odm_pf->stats_name, sizeof(*stats));
+	if (!stats)
+		return -1;
+
+	pthread_mutex_init(&odm_pf->stats_lock, NULL);
+	odm_pf->stats = stats;
+
+	/*
+	 * Left over from a previous run, which may have stopped in the middle of
+	 * an update. Readers see the reset as an update.
+	 */
+	__atomic_store_n(&stats->seq, stats->seq & ~0x1U, __ATOMIC_RELAXED);
+	odm_stats_begin(odm_pf);
+	memset((uint8_t *)stats + offsetof(struct odm_pf_stats, pid), 0,
+	       sizeof(*stats) - offsetof(struct odm_pf_stats, pid));
+	clock_gettime(CLOCK_REALTIME, &ts);
+	stats->pid = getpid();
+	stats->start_time = ts.tv_sec;
+	stats->version = ODM_PF_STATS_VERSION;
+	stats->magic = ODM_PF_STATS_MAGIC;
+	odm_stats_end(odm_pf);
+
+	reactor_wakeup_counter_set(&stats->irq_wakeups);
+
+	return 0;
+}
+
+void
+odm_stats_fini(struct odm_dev *odm_pf)
+{
+	if (!odm_pf->stats)
+		return;
+
+	reactor_wakeup_counter_set(NULL);
+	odm_pf->stats = NULL;
+	pthread_mutex_destroy(&odm_pf->stats_lock);
+	pmem_free(odm_pf->stats_name);
+}
+
+void
+odm_stats_mbox(struct odm_dev *odm_pf, uint8_t vf_id, uint8_t cmd, uint64_t lat_ns)
+{
+	struct odm_pf_stats *stats;
+
+	if (!odm_pf->stats || vf_id >= ODM_MAX_VFS)
+		return;
+
+	stats = odm_stats_begin(odm_pf);
+	if (cmd < ODM_STATS_MBOX_CMDS)
+		stats->vf[vf_id].mbox_cmds[cmd]++;
+	stats->vf[vf_id].mbox_lat[odm_stats_lat_bucket(lat_ns)]++;
+	odm_stats_end(odm_pf);
+}
+
+void
+odm_stats_mbox_drop(struct odm_dev *odm_pf, uint8_t vf_id)
+{
+	struct odm_pf_stats *stats;
+
+	if (!odm_pf->stats || vf_id >= ODM_MAX_VFS)
+		return;
+
+	stats = odm_stats_begin(odm_pf);
+	stats->vf[vf_id].mbox_drops++;
+	odm_stats_end(odm_pf);
+}
+
+void
+odm_stats_reqq_int(struct odm_dev *odm_pf, uint8_t qid, uint64_t cause)
+{
+	struct odm_pf_stats *stats;
+	int bit;
+
+	if (!odm_pf->stats || qid >= ODM_MAX_QUEUES)
+		return;
+
+	stats = odm_stats_begin(odm_pf);
+	for (bit = 0; bit < ODM_STATS_REQQ_CAUSES; bit++) {
+		if (cause & BIT_ULL(bit))
+			stats->q[qid].reqq_int[bit]++;
+	}
+	odm_stats_end(odm_pf);
+}
+
+void
+odm_stats_ras_int(struct odm_dev *odm_pf, uint64_t cause)
+{
+	struct odm_pf_stats *stats;
+	int bit;
+
+	if (!odm_pf->stats)
+		return;
+
+	stats = odm_stats_begin(odm_pf);
+	for (bit = 0; bit < ODM_STATS_RAS_CAUSES; bit++) {
+		if (cause & BIT_ULL(bit))
+			stats->ras_int[bit]++;
+	}
+	odm_stats_end(odm_pf);
+}
+
+void
+odm_stats_ncbo_err(struct odm_dev *odm_pf)
+{
+	struct odm_pf_stats *stats;
+
+	if (!odm_pf->stats)
+		return;
+
+	stats = odm_stats_begin(odm_pf);
+	stats->ncbo_err++;
+	odm_stats_end(odm_pf);
+}
+
+void
+odm_stats_qrst(struct odm_dev *odm_pf, uint32_t qmask, const struct odm_qrst_result *res)
+{
+	struct odm_pf_stats_queue *q;
+	struct odm_pf_stats *stats;
+	int qid;
+
+	if (!odm_pf->stats)
+		return;
+
+	stats = odm_stats_begin(odm_pf);
+	for (qid = 0; qid < ODM_MAX_QUEUES; qid++) {
+		if (!(qmask & (1U << qid)))
+			continue;
+
+		q = &stats->q[qid];
+		if (res->stuck & (1U << qid)) {
+			q->reset_timeouts++;
+			continue;
+		}
+
+		q->resets++;
+		q->reset_last_ns = res->lat_ns[qid];
+		if (res->lat_ns[qid] > q->reset_max_ns)
+			q->reset_max_ns = res->lat_ns[qid];
+		stats->qrst_lat[odm_stats_lat_bucket(res->lat_ns[qid])]++;
+	}
+	odm_stats_end(odm_pf);
+}
+
+void
+odm_stats_util(struct odm_dev *odm_pf, uint32_t util, uint32_t interval_ms)
+{
+	struct odm_pf_stats *stats;
+	uint32_t i, n, sum = 0;
+
+	if (!odm_pf->stats)
+		return;
+
+	stats = odm_stats_begin(odm_pf);
+	stats->util_interval_ms = interval_ms;
+	stats->util[stats->util_count % ODM_STATS_UTIL_SAMPLES] = util;
+	stats->util_count++;
+
+	n = stats->util_count < ODM_STATS_UTIL_SAMPLES ? stats->util_count :
+							  ODM_STATS_UTIL_SAMPLES;
+	stats->util_min = UINT16_MAX;
+	stats->util_max = 0;
+	for (i = 0; i < n; i++) {
+		if (stats->util[i] < stats->util_min)
+			stats->util_min = stats->util[i];
+		if (stats->util[i] > stats->util_max)
+			stats->util_max = stats->util[i];
+		sum += stats->util[i];
+	}
+	stats->util_avg = sum / n;
+	odm_stats_end(odm_pf);
+}
+
+void
+odm_stats_rebal(struct odm_dev *odm_pf, uint32_t eng_sel, uint32_t moved)
+{
+	struct odm_pf_stats *stats;
+
+	if (!odm_pf->stats)
+		return;
+
+	stats = odm_stats_begin(odm_pf);
+	stats->eng_sel = eng_sel;
+	stats->rebal_moves += moved;
+	odm_stats_end(odm_pf);
+}
+
+void
+odm_stats_irq(struct odm_dev *odm_pf, uint16_t vec, uint32_t storms, uint32_t suppressed)
+{
+	struct odm_pf_stats *stats;
+
+	if (!odm_pf->stats || vec >= ODM_IRQ_NUM_VECS)
+		return;
+
+	stats = odm_stats_begin(odm_pf);
+	stats->irq_storms[vec] += storms;
+	stats->irq_suppressed[vec] += suppressed;
+	odm_stats_end(odm_pf);
+}
@@ -0,0 +1,158 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+/**
+ * @file
+ *
+ * ODM PF statistics
+ *
+ * The PF driver publishes its counters in a shared memory segment, which
+ * odm_pf_stat and other tools map read-only. Updates are done under a
+ * sequence counter: the writer makes the counter odd before it changes the
+ * statistics and even again afterwards. Readers copy the segment and retry
+ * if the counter was odd or changed during the copy, so they never block the
+ * driver. irq_wakeups is the exception, it is a single counter updated by
+ * the reactor thread with atomic stores outside the sequence counter.
+ */
+
+#ifndef __ODM_PF_STATS_H__
+#define __ODM_PF_STATS_H__
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "odm_pf.h"
+
+#define ODM_PF_STATS_NAME		"/odm_pf_stats"
+#define ODM_PF_STATS_MAGIC		(0x5354415453444f4dULL) /* "ODMSTATS" */
+#define ODM_PF_STATS_VERSION		4
+
+/* Mailbox command codes counted, ODM_DEV_INIT to ODM_REG_DUMP */
+#define ODM_STATS_MBOX_CMDS		8
+/* REQQ interrupt cause bits counted, ODM_REQQ_INT_INSTRFLT to INSTR_TIMEOUT */
+#define ODM_STATS_REQQ_CAUSES		10
+#define ODM_STATS_RAS_CAUSES		3
+/*
+ * Latency histograms, bucket 0 counts latencies below 1 us and bucket i
+ * latencies in [2^(i-1), 2^i) us. The last bucket also counts all above.
+ */
+#define ODM_STATS_LAT_BUCKETS		24
+
+/* DMA utilization samples kept */
+#define ODM_STATS_UTIL_SAMPLES		64
+
+/* Reader retries before giving up on a busy writer */
+#define ODM_STATS_READ_RETRIES		1000
+
+struct odm_pf_stats_vf {
+	/* Mailbox commands processed, indexed by command code */
+	uint64_t mbox_cmds[ODM_STATS_MBOX_CMDS];
+	/* Mailbox commands dropped on a full command ring */
+	uint64_t mbox_drops;
+	/* Mailbox latency, from the interrupt to the response */
+	uint64_t mbox_lat[ODM_STATS_LAT_BUCKETS];
+};
+
+struct odm_pf_stats_queue {
+	/* REQQ interrupts, indexed by cause bit */
+	uint64_t reqq_int[ODM_STATS_REQQ_CAUSES];
+	/* Completed resets and resets which missed the deadline */
+	uint64_t resets;
+	uint64_t reset_timeouts;
+	uint64_t reset_last_ns;
+	uint64_t reset_max_ns;
+};
+
+struct odm_pf_stats {
+	uint64_t magic;
+	uint32_t version;
+	/* Sequence counter, odd while an update is in progress */
+	uint32_t seq;
+	/* PF driver process and its start time, CLOCK_REALTIME seconds */
+	pid_t pid;
+	uint64_t start_time;
+	/* Reactor thread wakeups, interrupts, timers and signals, not covered by seq */
+	uint64_t irq_wakeups;
+	uint64_t ras_int[ODM_STATS_RAS_CAUSES];
+	uint64_t ncbo_err;
+	/* Reset latency of all the queues */
+	uint64_t qrst_lat[ODM_STATS_LAT_BUCKETS];
+	struct odm_pf_stats_vf vf[ODM_MAX_VFS];
+	struct odm_pf_stats_queue q[ODM_MAX_QUEUES];
+	/*
+	 * DMA utilization in 1/100 %, util[util_count % ODM_STATS_UTIL_SAMPLES]
+	 * is the next sample. Min, avg and max are over the samples kept.
+	 */
+	uint32_t util_interval_ms;
+	uint64_t util_count;
+	uint16_t util[ODM_STATS_UTIL_SAMPLES];
+	uint16_t util_min;
+	uint16_t util_avg;
+	uint16_t util_max;
+	/* Engine to queue mapping and queues moved by the rebalancer */
+	uint32_t eng_sel;
+	uint64_t rebal_moves;
+	/* Times each vector was masked for a storm, and its events not logged */
+	uint64_t irq_storms[ODM_IRQ_NUM_VECS];
+	uint64_t irq_suppressed[ODM_IRQ_NUM_VECS];
+};
+
+static inline int
+odm_stats_lat_bucket(uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	int bucket;
+
+	if (!us)
+		return 0;
+
+	bucket = 64 - __builtin_clzll(us);
+	return bucket < ODM_STATS_LAT_BUCKETS ? bucket : ODM_STATS_LAT_BUCKETS - 1;
+}
+
+/**
+ * Take a consistent snapshot of the statistics.
+ *
+ * @param	stats	Statistics segment.
+ * @param	snap	Snapshot to fill.
+ * @return		0 on success, -EAGAIN if the writer kept the segment busy.
+ */
+static inline int
+odm_stats_snapshot(const struct odm_pf_stats *stats, struct odm_pf_stats *snap)
+{
+	uint32_t seq;
+	int retry;
+
+	for (retry = 0; retry < ODM_STATS_READ_RETRIES; retry++) {
+		seq = __atomic_load_n(&stats->seq, __ATOMIC_ACQUIRE);
+		if (seq & 0x1)
+			continue;
+
+		memcpy(snap, stats, sizeof(*snap));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&stats->seq, __ATOMIC_RELAXED) == seq) {
+			snap->irq_wakeups = __atomic_load_n(&stats->irq_wakeups, __ATOMIC_RELAXED);
+			return 0;
+		}
+	}
+
+	return -EAGAIN;
+}
+
+/* ODM PF statistics update functions, no-ops when the segment is not mapped */
+int odm_stats_init(struct odm_dev *odm_pf);
+void odm_stats_fini(struct odm_dev *odm_pf);
+void odm_stats_mbox(struct odm_dev *odm_pf, uint8_t vf_id, uint8_t cmd, uint64_t lat_ns);
+void odm_stats_mbox_drop(struct odm_dev *odm_pf, uint8_t vf_id);
+void odm_stats_reqq_int(struct odm_dev *odm_pf, uint8_t qid, uint64_t cause);
+void odm_stats_ras_int(struct odm_dev *odm_pf, uint64_t cause);
+void odm_stats_ncbo_err(struct odm_dev *odm_pf);
+void odm_stats_util(struct odm_dev *odm_pf, uint32_t util, uint32_t interval_ms);
+void odm_stats_rebal(struct odm_dev *odm_pf, uint32_t eng_sel, uint32_t moved);
+void odm_stats_irq(struct odm_dev *odm_pf, uint16_t vec, uint32_t storms, uint32_t suppressed);
+void odm_stats_qrst(struct odm_dev *odm_pf, uint32_t qmask, const struct odm_qrst_result *res);
+
+#endif /* __ODM_PF_STATS_H__ */
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+#include <unistd.h>
+
+#include "odm_pf.h"
+#include "odm_pf_trace.h"
+#include "pmem.h"
+
+int
+odm_trace_init(struct odm_dev *odm_pf)
+{
+	struct odm_pf_trace *trace;
+	struct timespec rt;
+
+	trace = pmem_alloc(odm_pf->trace_name, sizeof(*trace));
+	if (!trace)
+		return -1;
+
+	/* The records of the previous runs are kept, unless of another layout */
+	if (trace->magic != ODM_PF_TRACE_MAGIC || trace->version != ODM_PF_TRACE_VERSION ||
+	    trace->nb_entries != ODM_PF_TRACE_ENTRIES) {
+		memset(trace, 0, sizeof(*trace));
+		trace->version = ODM_PF_TRACE_VERSION;
+		trace->nb_entries = ODM_PF_TRACE_ENTRIES;
+		__atomic_store_n(&trace->magic, ODM_PF_TRACE_MAGIC, __ATOMIC_RELEASE);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &rt);
+	trace->realtime_off_ns = (int64_t)(rt.tv_sec * 1000000000ULL + rt.tv_nsec) -
+				 (int64_t)odm_now_ns();
+	trace->pid = getpid();
+	odm_pf->trace = trace;
+
+	return 0;
+}
+
+void
+odm_trace_fini(struct odm_dev *odm_pf)
+{
+	if (!odm_pf->trace)
+		return;
+
+	odm_pf->trace = NULL;
+	pmem_detach(odm_pf->trace_name);
+}
+
+void
+odm_trace(struct odm_dev *odm_pf, uint16_t type, uint16_t id, uint32_t arg, uint64_t d0,
+	  uint64_t d1)
+{
+	struct odm_pf_trace *trace = odm_pf->trace;
+	struct odm_trace_rec *rec;
+	uint64_t pos;
+
+	if (!trace)
+		return;
+
+	pos = __atomic_fetch_add(&trace->head, 1, __ATOMIC_RELAXED);
+	rec = &trace->rec[pos & (ODM_PF_TRACE_ENTRIES - 1)];
+
+	/* Readers skip the record until it is complete */
+	__atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	rec->ts_ns = odm_now_ns();
+	rec->type = type;
+	rec->id = id;
+	rec->arg = arg;
+	rec->d0 = d0;
+	rec->d1 = d1;
+	__atomic_store_n(&rec->seq, pos + 1, __ATOMIC_RELEASE);
+}
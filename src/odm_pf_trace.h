@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+/**
+ * @file
+ *
+ * ODM PF flight recorder
+ *
+ * The PF driver records the mailbox messages and responses, queue inits and
+ * resets, interrupts and configuration register writes in a circular buffer
+ * in a shared memory segment, which odm_pf_tracedump decodes. The segment
+ * is kept when the driver exits or crashes, and the next run appends to it.
+ *
+ * Writers claim a record by incrementing head and publish it by storing its
+ * sequence number, head + 1, last. Readers take a record only if its
+ * sequence number is the expected one before and after the copy, so a record
+ * being written, or left half written by a crash, is skipped.
+ */
+
+#ifndef __ODM_PF_TRACE_H__
+#define __ODM_PF_TRACE_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "odm_pf.h"
+
+#define ODM_PF_TRACE_NAME		"/odm_pf_trace"
+#define ODM_PF_TRACE_MAGIC		(0x4543415254444f4dULL) /* "ODMTRACE" */
+#define ODM_PF_TRACE_VERSION		1
+/* Records kept, a power of 2 */
+#define ODM_PF_TRACE_ENTRIES		32768
+
+struct odm_trace_rec {
+	/* Position of the record plus one, 0 while it is written */
+	uint64_t seq;
+	/* CLOCK_MONOTONIC */
+	uint64_t ts_ns;
+	uint16_t type;
+	uint16_t id;
+	uint32_t arg;
+	uint64_t d0;
+	uint64_t d1;
+	uint64_t pad;
+};
+
+struct odm_pf_trace {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t nb_entries;
+	/* Last driver process to start recording */
+	pid_t pid;
+	/* CLOCK_REALTIME - CLOCK_MONOTONIC when it started, in ns */
+	int64_t realtime_off_ns;
+	/* Records written, the next one goes to rec[head % nb_entries] */
+	uint64_t head __attribute__((aligned(64)));
+	struct odm_trace_rec rec[ODM_PF_TRACE_ENTRIES] __attribute__((aligned(64)));
+};
+
+/**
+ * Read a record of the trace.
+ *
+ * @param	trace	Trace segment.
+ * @param	pos	Position of the record, below head.
+ * @param	rec	Record to fill.
+ * @return		0 on success, -1 if the record was overwritten or is being
+ *			written.
+ */
+static inline int
+odm_trace_read(const struct odm_pf_trace *trace, uint64_t pos, struct odm_trace_rec *rec)
+{
+	const struct odm_trace_rec *src = &trace->rec[pos & (ODM_PF_TRACE_ENTRIES - 1)];
+
+	if (__atomic_load_n(&src->seq, __ATOMIC_ACQUIRE) != pos + 1)
+		return -1;
+
+	memcpy(rec, src, sizeof(*rec));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return __atomic_load_n(&src->seq, __ATOMIC_RELAXED) == pos + 1 ? 0 : -1;
+}
+
+/* ODM PF flight recorder, optional like the statistics */
+int odm_trace_init(struct odm_dev *odm_pf);
+void odm_trace_fini(struct odm_dev *odm_pf);
+
+#endif /* __ODM_PF_TRACE_H__ */
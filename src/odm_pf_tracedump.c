@@ -0,0 +1,255 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+/*
+ * odm_pf_tracedump: decode the ODM PF driver flight recorder.
+ *
+ * Maps the trace segment read-only, of the running driver or left by one
+ * which exited or crashed, or reads a copy of it saved to a file, and prints
+ * the records oldest first. Reading never blocks the driver.
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "odm_pf_trace.h"
+
+/* Poll interval when following the trace */
+#define TRACE_FOLLOW_US		100000
+
+static volatile sig_atomic_t quit_signal;
+
+static const char *const trace_type_names[ODM_TRACE_MAX] = {
+	[ODM_TRACE_START] = "START",
+	[ODM_TRACE_MBOX_RX] = "MBOX_RX",
+	[ODM_TRACE_MBOX_RSP] = "MBOX_RSP",
+	[ODM_TRACE_MBOX_DROP] = "MBOX_DROP",
+	[ODM_TRACE_QUEUE_INIT] = "QUEUE_INIT",
+	[ODM_TRACE_QUEUE_RESET] = "QUEUE_RESET",
+	[ODM_TRACE_IRQ] = "IRQ",
+	[ODM_TRACE_CFG_WRITE] = "CFG_WRITE",
+};
+
+static const char *const mbox_cmd_names[] = {
+	[ODM_DEV_INIT] = "DEV_INIT",
+	[ODM_DEV_CLOSE] = "DEV_CLOSE",
+	[ODM_QUEUE_OPEN] = "QUEUE_OPEN",
+	[ODM_QUEUE_CLOSE] = "QUEUE_CLOSE",
+	[ODM_REG_DUMP] = "REG_DUMP",
+};
+
+static void
+signal_handler(__attribute__((unused)) int sig_num)
+{
+	quit_signal = 1;
+}
+
+static const char *
+mbox_cmd_name(uint8_t cmd)
+{
+	if (cmd < sizeof(mbox_cmd_names) / sizeof(mbox_cmd_names[0]) && mbox_cmd_names[cmd])
+		return mbox_cmd_names[cmd];
+
+	return "unknown";
+}
+
+static void
+print_reg(uint64_t offset)
+{
+	if (offset < ODM_CSCLK_ACTIVE_PC && (offset & 0x7ffULL) == ODM_DMAX_IDS(0))
+		printf("DMAX_IDS(%lu)", offset >> 11);
+	else if (offset == ODM_ENGX_BUF(0) || offset == ODM_ENGX_BUF(1))
+		printf("ENGX_BUF(%lu)", (offset >> 3) & 0x1);
+	else if (offset == ODM_DMA_ENGX_EN(0) || offset == ODM_DMA_ENGX_EN(1))
+		printf("DMA_ENGX_EN(%lu)", (offset >> 3) & 0x1);
+	else if (offset == ODM_CTL)
+		printf("CTL");
+	else if (offset == ODM_DMA_CONTROL)
+		printf("DMA_CONTROL");
+	else if (offset == ODM_DMA_INTL_SEL)
+		printf("DMA_INTL_SEL");
+	else if (offset == ODM_NCB_CFG)
+		printf("NCB_CFG");
+	else if (offset == ODM_REQQ_GENBUFF_TH_LIMIT)
+		printf("REQQ_GENBUFF_TH_LIMIT");
+	else
+		printf("0x%lx", offset);
+}
+
+static void
+print_rec(const struct odm_pf_trace *trace, const struct odm_trace_rec *rec)
+{
+	union odm_mbox_msg_t msg;
+	char date[32];
+	struct tm tm;
+	uint64_t ns;
+	time_t sec;
+
+	ns = rec->ts_ns + trace->realtime_off_ns;
+	sec = ns / 1000000000UL;
+	localtime_r(&sec, &tm);
+	strftime(date, sizeof(date), "%F %T", &tm);
+	printf("%s.%09lu %-11s ", date, ns % 1000000000UL,
+	       rec->type < ODM_TRACE_MAX && trace_type_names[rec->type] ?
+	       trace_type_names[rec->type] : "UNKNOWN");
+
+	msg.u[0] = rec->d0;
+	msg.u[1] = rec->d1;
+	switch (rec->type) {
+	case ODM_TRACE_START:
+		printf("pid %u%s\n", rec->arg, rec->d0 ? ", resumed the device" : "");
+		break;
+	case ODM_TRACE_MBOX_RX:
+	case ODM_TRACE_MBOX_DROP:
+		printf("vf %u %s queue %u\n", rec->id, mbox_cmd_name(msg.q.cmd),
+		       (unsigned int)msg.q.q_idx);
+		break;
+	case ODM_TRACE_MBOX_RSP:
+		printf("vf %u %s rsp %u err %u nvfs %u, %u us\n", rec->id,
+		       mbox_cmd_name(msg.q.cmd), (unsigned int)msg.d.rsp, (unsigned int)msg.d.err,
+		       (unsigned int)msg.d.nvfs, rec->arg);
+		break;
+	case ODM_TRACE_QUEUE_INIT:
+		printf("queue %u vf %u queue %lu ids 0x%lx\n", rec->id, rec->arg, rec->d0, rec->d1);
+		break;
+	case ODM_TRACE_QUEUE_RESET:
+		printf("queues 0x%08lx stuck 0x%08lx, %u us\n", rec->d0, rec->d1, rec->arg);
+		break;
+	case ODM_TRACE_IRQ:
+		printf("vector %u cause 0x%016lx\n", rec->id, rec->d0);
+		break;
+	case ODM_TRACE_CFG_WRITE:
+		print_reg(rec->d0);
+		printf(" = 0x%016lx\n", rec->d1);
+		break;
+	default:
+		printf("id %u arg %u 0x%016lx 0x%016lx\n", rec->id, rec->arg, rec->d0, rec->d1);
+		break;
+	}
+}
+
+/* Print the records from pos up to head, returns the next position */
+static uint64_t
+print_from(const struct odm_pf_trace *trace, uint64_t pos, uint64_t *skipped)
+{
+	uint64_t head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+	struct odm_trace_rec rec;
+
+	/* Overwritten while we were away */
+	if (head - pos > ODM_PF_TRACE_ENTRIES) {
+		*skipped += head - pos - ODM_PF_TRACE_ENTRIES;
+		pos = head - ODM_PF_TRACE_ENTRIES;
+	}
+
+	for (; pos < head; pos++) {
+		if (odm_trace_read(trace, pos, &rec)) {
+			(*skipped)++;
+			continue;
+		}
+		print_rec(trace, &rec);
+	}
+
+	return pos;
+}
+
+static void
+print_usage(const char *prog_name)
+{
+	fprintf(stderr, "Usage: %s [-n count] [-f file] [-s name] [-F]\n", prog_name);
+	fprintf(stderr, "  -n count       Print the last count records (default all kept)\n");
+	fprintf(stderr, "  -f file        Read a copy of the trace segment instead of the segment\n");
+	fprintf(stderr, "  -s name        Trace segment (default %s)\n", ODM_PF_TRACE_NAME);
+	fprintf(stderr, "  -F             Follow, print the new records as they are written\n");
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	uint64_t count = ODM_PF_TRACE_ENTRIES, pos, head, skipped = 0;
+	const char *file = NULL, *name = ODM_PF_TRACE_NAME;
+	struct odm_pf_trace *trace;
+	bool follow = false;
+	struct stat st;
+	int fd, opt, rc = 0;
+
+	while ((opt = getopt(argc, argv, "n:f:s:F")) != EOF) {
+		switch (opt) {
+		case 'n':
+			count = strtoull(optarg, NULL, 0);
+			if (!count)
+				print_usage(argv[0]);
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		case 's':
+			name = optarg;
+			break;
+		case 'F':
+			follow = true;
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+
+	fd = file ? open(file, O_RDONLY) : shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		fprintf(stderr, "No trace found, has odm_pf_driver run since the last boot?\n");
+		return EXIT_FAILURE;
+	}
+
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*trace)) {
+		fprintf(stderr, "Trace segment is not supported\n");
+		close(fd);
+		return EXIT_FAILURE;
+	}
+
+	trace = mmap(NULL, sizeof(*trace), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (trace == MAP_FAILED) {
+		fprintf(stderr, "Failed to map the trace\n");
+		return EXIT_FAILURE;
+	}
+
+	if (trace->magic != ODM_PF_TRACE_MAGIC || trace->version != ODM_PF_TRACE_VERSION ||
+	    trace->nb_entries != ODM_PF_TRACE_ENTRIES) {
+		fprintf(stderr, "Trace version %u is not supported\n", trace->version);
+		rc = EXIT_FAILURE;
+		goto unmap;
+	}
+
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+
+	head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+	if (count > ODM_PF_TRACE_ENTRIES)
+		count = ODM_PF_TRACE_ENTRIES;
+	pos = head > count ? head - count : 0;
+	printf("Trace of pid %d, %lu records written\n", trace->pid, head);
+
+	do {
+		pos = print_from(trace, pos, &skipped);
+		if (follow) {
+			fflush(stdout);
+			usleep(TRACE_FOLLOW_US);
+		}
+	} while (follow && !quit_signal);
+
+	if (skipped)
+		printf("%lu records skipped, overwritten or being written\n", skipped);
+
+unmap:
+	munmap(trace, sizeof(*trace));
+
+	return rc;
+}
@@ -0,0 +1,352 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "odm_pf.h"
+
+/*
+ * Offline tuner. The workload command is run once for each point of the
+ * search space: engine to queue mapping, FIFO split and MOLR. Its throughput
+ * is read from its output, and the DMA utilization over the run from
+ * ODM_CSCLK_ACTIVE_PC. The three dimensions are searched one after the other,
+ * each time keeping the best value found so far for the others, which takes
+ * a dozen runs rather than the whole grid. The point is programmed while no
+ * queue is open, between two runs of the workload.
+ */
+
+#define ODM_TUNE_QUIESCE_TIMEOUT_MS	10000
+#define ODM_TUNE_MAX_OUTPUT		(1024 * 1024)
+#define ODM_TUNE_MAX_LINE		256
+#define ODM_TUNE_MAX_POINTS		16
+
+static const uint32_t odm_tune_eng_sels[] = {
+	0xAAAAAAAA, 0xCCCCCCCC, 0xF0F0F0F0, 0xFF00FF00, 0xFFFF0000,
+};
+
+static const uint8_t odm_tune_fifos[][ODM_MAX_ENGINES] = {
+	{64, 64}, {96, 32}, {32, 96},
+};
+
+static const uint16_t odm_tune_molrs[] = {
+	128, 256, 384, 512,
+};
+
+struct odm_tune_point {
+	uint32_t eng_sel;
+	bool fifo_auto;
+	uint8_t fifo_kb[ODM_MAX_ENGINES];
+	uint16_t molr;
+	/* Throughput reported by the workload, < 0 if the run failed */
+	double score;
+	uint32_t util;
+};
+
+static bool
+odm_tune_point_eq(const struct odm_tune_point *a, const struct odm_tune_point *b)
+{
+	return a->eng_sel == b->eng_sel && a->molr == b->molr && a->fifo_auto == b->fifo_auto &&
+	       (a->fifo_auto || !memcmp(a->fifo_kb, b->fifo_kb, sizeof(a->fifo_kb)));
+}
+
+static void
+odm_tune_fifo_str(const struct odm_tune_point *pt, char *buf, size_t len)
+{
+	if (pt->fifo_auto)
+		snprintf(buf, len, "auto");
+	else
+		snprintf(buf, len, "%u,%u", pt->fifo_kb[0], pt->fifo_kb[1]);
+}
+
+/* Wait for all the queues to be closed and reset, then program the point */
+static int
+odm_tune_apply(struct odm_dev *odm_pf, const struct odm_tune_point *pt)
+{
+	struct odm_qpool *qpool = &odm_pf->qpool;
+	bool quiesced = false;
+	uint64_t reg;
+	int i, ms;
+
+	for (ms = 0; ms < ODM_TUNE_QUIESCE_TIMEOUT_MS; ms++) {
+		pthread_mutex_lock(&qpool->lock);
+		quiesced = !qpool->pending && !qpool->busy;
+		for (i = 0; i < ODM_MAX_QUEUES && quiesced; i++)
+			quiesced = odm_pf->pmem->q_state[i] != ODM_QUEUE_STATE_OPEN;
+
+		if (quiesced) {
+			odm_reg_write(odm_pf, ODM_DMA_INTL_SEL, pt->eng_sel);
+			reg = odm_reg_read(odm_pf, ODM_NCB_CFG) & ~ODM_NCB_CFG_MOLR_MASK;
+			odm_reg_write(odm_pf, ODM_NCB_CFG, reg | pt->molr);
+			odm_pf->pmem->eng_sel = pt->eng_sel;
+			odm_pf->pmem->molr = pt->molr;
+			pthread_mutex_unlock(&qpool->lock);
+			break;
+		}
+		pthread_mutex_unlock(&qpool->lock);
+		usleep(1000);
+	}
+
+	if (!quiesced) {
+		log_write(LOG_ERR, "ODM_PF: queues still open %d ms after the workload exited\n",
+			  ODM_TUNE_QUIESCE_TIMEOUT_MS);
+		return -1;
+	}
+
+	return odm_fifo_set(odm_pf, pt->fifo_auto, pt->fifo_kb);
+}
+
+/*
+ * Throughput reported by the workload: the number following the last
+ * occurrence of the pattern, or the last number of the output without one.
+ */
+static int
+odm_tune_parse(const char *out, const char *pattern, double *val)
+{
+	const char *p, *last = NULL;
+	char *end;
+	double v;
+
+	if (pattern) {
+		for (p = strstr(out, pattern); p; p = strstr(p + 1, pattern))
+			last = p;
+		if (!last)
+			return -1;
+
+		for (p = last + strlen(pattern); *p && *p != '\n'; p++) {
+			if (isdigit((unsigned char)*p) || *p == '.') {
+				*val = strtod(p, NULL);
+				return 0;
+			}
+		}
+
+		return -1;
+	}
+
+	for (p = out; *p; p++) {
+		if (!isdigit((unsigned char)*p) || (p > out && (isalnum((unsigned char)p[-1]) ||
+								 p[-1] == '.')))
+			continue;
+
+		v = strtod(p, &end);
+		if (end == p)
+			continue;
+		*val = v;
+		last = p;
+		p = end - 1;
+	}
+
+	return last ? 0 : -1;
+}
+
+static void
+odm_tune_setenv(const struct odm_tune_point *pt)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "0x%08X", pt->eng_sel);
+	setenv("ODM_TUNE_ENG_SEL", buf, 1);
+	odm_tune_fifo_str(pt, buf, sizeof(buf));
+	setenv("ODM_TUNE_FIFO", buf, 1);
+	snprintf(buf, sizeof(buf), "%u", pt->molr);
+	setenv("ODM_TUNE_MOLR", buf, 1);
+}
+
+static void
+odm_tune_measure(struct odm_dev *odm_pf, struct odm_dev_config *dev_cfg,
+		 struct odm_tune_point *pt)
+{
+	char fifo[16], *out;
+	size_t len = 0;
+	FILE *fp;
+	int status;
+
+	pt->score = -1;
+	pt->util = 0;
+	odm_tune_fifo_str(pt, fifo, sizeof(fifo));
+
+	if (odm_tune_apply(odm_pf, pt) != 0) {
+		log_write(LOG_ERR, "ODM_PF: failed to program eng_sel 0x%08x fifo %s molr %u\n",
+			  pt->eng_sel, fifo, pt->molr);
+		return;
+	}
+
+	out = malloc(ODM_TUNE_MAX_OUTPUT);
+	if (!out)
+		return;
+
+	odm_tune_setenv(pt);
+	odm_util_sample(odm_pf);
+	fp = popen(dev_cfg->tune_cmd, "r");
+	if (!fp) {
+		log_write(LOG_ERR, "ODM_PF: failed to run %s\n", dev_cfg->tune_cmd);
+		goto free_out;
+	}
+
+	while (len < ODM_TUNE_MAX_OUTPUT - 1 && fgets(out + len, ODM_TUNE_MAX_OUTPUT - len, fp))
+		len += strlen(out + len);
+	/* Drain the rest, the workload may block on a full pipe */
+	while (fgetc(fp) != EOF)
+		;
+	status = pclose(fp);
+	pt->util = odm_util_sample(odm_pf);
+	out[len] = '\0';
+
+	if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+		log_write(LOG_ERR, "ODM_PF: workload failed with eng_sel 0x%08x fifo %s molr %u\n",
+			  pt->eng_sel, fifo, pt->molr);
+		goto free_out;
+	}
+
+	if (odm_tune_parse(out, dev_cfg->tune_pattern, &pt->score)) {
+		log_write(LOG_ERR, "ODM_PF: no throughput in the workload output\n");
+		pt->score = -1;
+	}
+
+free_out:
+	free(out);
+}
+
+/* Update or append the KEY="value" lines of the cfg file */
+static int
+odm_tune_cfg_write(const char *path, const char *const *keys, char vals[][32], int nb_keys)
+{
+	char line[ODM_TUNE_MAX_LINE], tmp[PATH_MAX];
+	bool done[8] = {false};
+	FILE *in, *out;
+	int k;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	out = fopen(tmp, "w");
+	if (!out)
+		return -1;
+
+	in = fopen(path, "r");
+	while (in && fgets(line, sizeof(line), in)) {
+		for (k = 0; k < nb_keys; k++) {
+			if (!strncmp(line, keys[k], strlen(keys[k])) && line[strlen(keys[k])] == '=')
+				break;
+		}
+
+		if (k < nb_keys && !done[k]) {
+			fprintf(out, "%s=\"%s\"\n", keys[k], vals[k]);
+			done[k] = true;
+		} else if (k == nb_keys) {
+			fputs(line, out);
+		}
+	}
+	if (in)
+		fclose(in);
+
+	for (k = 0; k < nb_keys; k++) {
+		if (!done[k])
+			fprintf(out, "%s=\"%s\"\n", keys[k], vals[k]);
+	}
+
+	if (fclose(out) || rename(tmp, path)) {
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+odm_tune_report(const struct odm_tune_point *pt)
+{
+	char fifo[16];
+
+	odm_tune_fifo_str(pt, fifo, sizeof(fifo));
+	if (pt->score < 0)
+		printf("0x%08X  %-8s %5u  %14s %8s\n", pt->eng_sel, fifo, pt->molr, "failed", "-");
+	else
+		printf("0x%08X  %-8s %5u  %14.3f %7.2f%%\n", pt->eng_sel, fifo, pt->molr,
+		       pt->score, pt->util / 100.0);
+	fflush(stdout);
+}
+
+int
+odm_tune(struct odm_dev *odm_pf, struct odm_dev_config *dev_cfg)
+{
+	static const char *const keys[] = {"ENG_SEL", "PLACEMENT", "FIFO_SPLIT", "MOLR"};
+	struct odm_tune_point done[ODM_TUNE_MAX_POINTS], best, pt;
+	int dim, nb_done = 0, j;
+	char vals[4][32];
+	unsigned int i;
+
+	/* The tuner owns the mapping while it runs */
+	odm_pf->rebal.enabled = false;
+
+	/* Start from the configured point */
+	memset(&best, 0, sizeof(best));
+	best.eng_sel = odm_reg_read(odm_pf, ODM_DMA_INTL_SEL);
+	best.fifo_auto = odm_pf->fifo.auto_split;
+	memcpy(best.fifo_kb, odm_pf->fifo.kb, sizeof(best.fifo_kb));
+	best.molr = odm_reg_read(odm_pf, ODM_NCB_CFG) & ODM_NCB_CFG_MOLR_MASK;
+
+	printf("%-10s  %-8s %5s  %14s %8s\n", "ENG_SEL", "FIFO", "MOLR", "throughput", "util");
+	odm_tune_measure(odm_pf, dev_cfg, &best);
+	odm_tune_report(&best);
+	done[nb_done++] = best;
+
+	for (dim = 0; dim < 3; dim++) {
+		unsigned int nb = dim == 0 ? sizeof(odm_tune_eng_sels) / sizeof(odm_tune_eng_sels[0]) :
+				  dim == 1 ? sizeof(odm_tune_fifos) / sizeof(odm_tune_fifos[0]) + 1 :
+				  sizeof(odm_tune_molrs) / sizeof(odm_tune_molrs[0]);
+
+		for (i = 0; i < nb; i++) {
+			pt = best;
+			if (dim == 0) {
+				pt.eng_sel = odm_tune_eng_sels[i];
+			} else if (dim == 1) {
+				/* The last FIFO point is the auto split */
+				pt.fifo_auto = i == nb - 1;
+				if (!pt.fifo_auto)
+					memcpy(pt.fifo_kb, odm_tune_fifos[i], sizeof(pt.fifo_kb));
+			} else {
+				pt.molr = odm_tune_molrs[i];
+			}
+
+			for (j = 0; j < nb_done && !odm_tune_point_eq(&pt, &done[j]); j++)
+				;
+			if (j < nb_done)
+				continue;
+
+			odm_tune_measure(odm_pf, dev_cfg, &pt);
+			odm_tune_report(&pt);
+			if (nb_done < ODM_TUNE_MAX_POINTS)
+				done[nb_done++] = pt;
+			if (pt.score > best.score)
+				best = pt;
+		}
+	}
+
+	if (best.score < 0) {
+		log_write(LOG_ERR, "ODM_PF: tuning failed, no run of the workload succeeded\n");
+		return -1;
+	}
+
+	printf("Best:\n");
+	odm_tune_report(&best);
+	if (odm_tune_apply(odm_pf, &best))
+		log_write(LOG_WARNING, "ODM_PF: failed to program the tuned values\n");
+
+	/* The tuned mapping is a mask, whatever placement policy was used */
+	snprintf(vals[0], sizeof(vals[0]), "0x%08X", best.eng_sel);
+	snprintf(vals[1], sizeof(vals[1]), "mask");
+	odm_tune_fifo_str(&best, vals[2], sizeof(vals[2]));
+	snprintf(vals[3], sizeof(vals[3]), "%u", best.molr);
+	if (odm_tune_cfg_write(dev_cfg->tune_cfg, keys, vals, 4)) {
+		log_write(LOG_ERR, "ODM_PF: failed to write %s\n", dev_cfg->tune_cfg);
+		return -1;
+	}
+
+	log_write(LOG_INFO, "ODM_PF: tuned ENG_SEL %s FIFO_SPLIT %s MOLR %s, written to %s\n",
+		  vals[0], vals[2], vals[3], dev_cfg->tune_cfg);
+
+	return 0;
+}
@@ -0,0 +1,420 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "odm_pf.h"
+#include "pmem.h"
+
+/*
+ * Upgrade of the driver binary with the VFs kept. The running process starts
+ * the new binary with one end of a SOCK_SEQPACKET socket pair and:
+ *
+ *	new				old
+ *	READY		->
+ *					stop the mailbox, queue pool and IRQs,
+ *					release as for a warm restart
+ *			<-	DEVICE + fds
+ *	probe, resuming the device
+ *	DONE		->		exit
+ *
+ * The device is never reset: the new process holds the VFIO fds before the
+ * old one closes its own, and the VFIO irqs keep their eventfds, so
+ * interrupts raised in between are seen by the new process. The mailbox is
+ * not served between the release of the old process and the probe of the new
+ * one, messages the VFs send in between are served once the probe is done.
+ */
+
+#define ODM_UPGRADE_MAGIC		0x4f444d55
+#define ODM_UPGRADE_VERSION		1
+/* Time for the new process to start, and to probe with the device */
+#define ODM_UPGRADE_READY_MS		10000
+#define ODM_UPGRADE_DEVICE_MS		10000
+#define ODM_UPGRADE_DONE_MS		10000
+
+/* fds of the handover, in the order they are sent */
+enum {
+	ODM_UPGRADE_SLOT_CONTAINER,
+	ODM_UPGRADE_SLOT_GROUP,
+	ODM_UPGRADE_SLOT_DEVICE,
+	ODM_UPGRADE_SLOT_BAR0,
+	ODM_UPGRADE_SLOT_PMEM,
+	ODM_UPGRADE_SLOT_EFD,
+	ODM_UPGRADE_NB_SLOTS = ODM_UPGRADE_SLOT_EFD + ODM_IRQ_NUM_VECS
+};
+
+_Static_assert(ODM_UPGRADE_NB_SLOTS <= 64, "handover slots do not fit the slot mask");
+
+enum odm_upgrade_msg_type {
+	ODM_UPGRADE_READY,
+	ODM_UPGRADE_DEVICE,
+	ODM_UPGRADE_DONE,
+};
+
+struct odm_upgrade_msg {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t type;
+	/* DONE: probe result of the new process */
+	int32_t err;
+	/* DEVICE: slots of the fds sent along, in the slot order */
+	uint64_t slots;
+};
+
+static int *
+odm_handover_slot(struct odm_handover *ho, int slot)
+{
+	switch (slot) {
+	case ODM_UPGRADE_SLOT_CONTAINER:
+		return &ho->vfio.container_fd;
+	case ODM_UPGRADE_SLOT_GROUP:
+		return &ho->vfio.group_fd;
+	case ODM_UPGRADE_SLOT_DEVICE:
+		return &ho->vfio.device_fd;
+	case ODM_UPGRADE_SLOT_BAR0:
+		return &ho->bar0_fd;
+	case ODM_UPGRADE_SLOT_PMEM:
+		return &ho->pmem_fd;
+	default:
+		return &ho->efds[slot - ODM_UPGRADE_SLOT_EFD];
+	}
+}
+
+static void
+odm_handover_init(struct odm_handover *ho)
+{
+	int slot;
+
+	for (slot = 0; slot < ODM_UPGRADE_NB_SLOTS; slot++)
+		*odm_handover_slot(ho, slot) = -1;
+}
+
+void
+odm_handover_close(struct odm_handover *ho)
+{
+	int slot, *fd;
+
+	for (slot = 0; slot < ODM_UPGRADE_NB_SLOTS; slot++) {
+		fd = odm_handover_slot(ho, slot);
+		if (*fd >= 0)
+			close(*fd);
+		*fd = -1;
+	}
+}
+
+static int
+odm_upgrade_send(int sock, uint16_t type, int32_t err, struct odm_handover *ho)
+{
+	char cbuf[CMSG_SPACE(sizeof(int) * ODM_UPGRADE_NB_SLOTS)];
+	struct odm_upgrade_msg msg = {
+		.magic = ODM_UPGRADE_MAGIC,
+		.version = ODM_UPGRADE_VERSION,
+		.type = type,
+		.err = err,
+	};
+	struct iovec iov = {.iov_base = &msg, .iov_len = sizeof(msg)};
+	struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1};
+	int fds[ODM_UPGRADE_NB_SLOTS];
+	struct cmsghdr *cmsg;
+	int slot, nb_fds = 0;
+
+	for (slot = 0; ho && slot < ODM_UPGRADE_NB_SLOTS; slot++) {
+		if (*odm_handover_slot(ho, slot) < 0)
+			continue;
+		fds[nb_fds++] = *odm_handover_slot(ho, slot);
+		msg.slots |= BIT_ULL(slot);
+	}
+
+	if (nb_fds) {
+		memset(cbuf, 0, sizeof(cbuf));
+		mh.msg_control = cbuf;
+		mh.msg_controllen = CMSG_SPACE(sizeof(int) * nb_fds);
+		cmsg = CMSG_FIRSTHDR(&mh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nb_fds);
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nb_fds);
+	}
+
+	if (sendmsg(sock, &mh, MSG_NOSIGNAL) != sizeof(msg))
+		return -errno;
+
+	return 0;
+}
+
+/* Receive a message of the given type, with its fds set in ho */
+static int
+odm_upgrade_recv_msg(int sock, uint16_t type, struct odm_upgrade_msg *msg,
+		     struct odm_handover *ho, int timeout_ms)
+{
+	char cbuf[CMSG_SPACE(sizeof(int) * ODM_UPGRADE_NB_SLOTS)];
+	struct iovec iov = {.iov_base = msg, .iov_len = sizeof(*msg)};
+	struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1};
+	struct pollfd pfd = {.fd = sock, .events = POLLIN};
+	int fds[ODM_UPGRADE_NB_SLOTS];
+	int slot, i, nb_fds = 0;
+	struct cmsghdr *cmsg;
+	ssize_t len;
+	int rc;
+
+	rc = poll(&pfd, 1, timeout_ms);
+	if (rc <= 0)
+		return rc ? -errno : -ETIMEDOUT;
+
+	mh.msg_control = cbuf;
+	mh.msg_controllen = sizeof(cbuf);
+	len = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+	if (len < 0)
+		return -errno;
+	if (!len)
+		return -EPIPE;
+
+	for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		nb_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * nb_fds);
+	}
+
+	if (len != sizeof(*msg) || msg->magic != ODM_UPGRADE_MAGIC ||
+	    msg->version != ODM_UPGRADE_VERSION || msg->type != type || !ho != !nb_fds ||
+	    (mh.msg_flags & MSG_CTRUNC) || __builtin_popcountll(msg->slots) != nb_fds ||
+	    msg->slots >> ODM_UPGRADE_NB_SLOTS) {
+		for (i = 0; i < nb_fds; i++)
+			close(fds[i]);
+		return -EPROTO;
+	}
+
+	for (slot = 0, i = 0; ho && slot < ODM_UPGRADE_NB_SLOTS; slot++) {
+		if (msg->slots & BIT_ULL(slot))
+			*odm_handover_slot(ho, slot) = fds[i++];
+	}
+
+	return 0;
+}
+
+/* Duplicate the fds of the device, the backend last as it then leaves the device */
+static int
+odm_handover_get(struct odm_dev *odm_pf, struct odm_handover *ho)
+{
+	struct vfio_pci_device *pdev = &odm_pf->pdev;
+	uint32_t vec;
+	int err;
+
+	odm_handover_init(ho);
+	if (!odm_pf->backend->handover) {
+		log_write(LOG_ERR, "ODM: the %s backend can not be handed over\n",
+			  odm_pf->backend->name);
+		return -ENOTSUP;
+	}
+
+	ho->pmem_fd = pmem_export(odm_pf->pmem_name);
+	if (ho->pmem_fd < 0)
+		return -EIO;
+
+	for (vec = 0; vec < pdev->intr.count && vec < ODM_IRQ_NUM_VECS; vec++) {
+		if (pdev->intr.efds[vec] == -1)
+			continue;
+		ho->efds[vec] = fcntl(pdev->intr.efds[vec], F_DUPFD_CLOEXEC, 0);
+		if (ho->efds[vec] < 0) {
+			err = -errno;
+			goto close_fds;
+		}
+	}
+
+	err = odm_pf->backend->handover(odm_pf, ho);
+	if (err)
+		goto close_fds;
+
+	return 0;
+
+close_fds:
+	odm_handover_close(ho);
+	return err;
+}
+
+int
+odm_pf_handover(struct odm_dev *odm_pf, int sock)
+{
+	struct odm_upgrade_msg msg;
+	struct odm_handover ho;
+	uint64_t t0;
+	int err;
+
+	/* Nothing is stopped until the new process is up */
+	err = odm_upgrade_recv_msg(sock, ODM_UPGRADE_READY, &msg, NULL, ODM_UPGRADE_READY_MS);
+	if (err) {
+		log_write(LOG_ERR, "ODM: upgrade aborted, the new process is not ready: %s\n",
+			  strerror(-err));
+		return err;
+	}
+
+	err = odm_handover_get(odm_pf, &ho);
+	if (err) {
+		log_write(LOG_ERR, "ODM: upgrade aborted, failed to get the device fds: %s\n",
+			  strerror(-err));
+		return err;
+	}
+
+	/* Released as for a warm restart, the device and its state are kept */
+	t0 = odm_now_ns();
+	odm_pf->warm = true;
+	odm_pf_release(odm_pf);
+
+	err = odm_upgrade_send(sock, ODM_UPGRADE_DEVICE, 0, &ho);
+	odm_handover_close(&ho);
+	if (err) {
+		log_write(LOG_ERR, "ODM: failed to hand the device over: %s, the next start "
+			  "resumes it\n", strerror(-err));
+		return 0;
+	}
+
+	err = odm_upgrade_recv_msg(sock, ODM_UPGRADE_DONE, &msg, NULL, ODM_UPGRADE_DONE_MS);
+	if (!err)
+		err = msg.err;
+	if (err)
+		log_write(LOG_ERR, "ODM: the new process failed to take the device over: %s\n",
+			  strerror(-err));
+	else
+		log_write(LOG_INFO, "ODM: device handed over, mailbox served again after %lu us\n",
+			  (odm_now_ns() - t0) / 1000);
+
+	return 0;
+}
+
+int
+odm_pf_upgrade(struct odm_dev *odm_pf, char *const argv[])
+{
+	char fd_arg[16];
+	int sv[2], argc, i, n = 0, child_fd, err;
+	char **args;
+	pid_t pid;
+
+	for (argc = 0; argv[argc]; argc++)
+		;
+	args = calloc(argc + 3, sizeof(*args));
+	if (!args)
+		return -ENOMEM;
+
+	/* The takeover socket of a previous upgrade is replaced */
+	for (i = 0; i < argc; i++) {
+		if (!strcmp(argv[i], "--takeover")) {
+			i++;
+			continue;
+		}
+		if (!strncmp(argv[i], "--takeover=", strlen("--takeover=")))
+			continue;
+		args[n++] = argv[i];
+	}
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv)) {
+		err = -errno;
+		log_write(LOG_ERR, "ODM: upgrade socket failed: %s\n", strerror(errno));
+		free(args);
+		return err;
+	}
+
+	/* The end of the new process is kept on exec, and is not one of the stdio fds */
+	child_fd = fcntl(sv[1], F_DUPFD, 3);
+	close(sv[1]);
+	if (child_fd < 0) {
+		err = -errno;
+		close(sv[0]);
+		free(args);
+		return err;
+	}
+
+	snprintf(fd_arg, sizeof(fd_arg), "%d", child_fd);
+	args[n++] = "--takeover";
+	args[n++] = fd_arg;
+
+	pid = fork();
+	if (!pid) {
+		execvp(args[0], args);
+		_exit(127);
+	}
+	err = pid < 0 ? -errno : 0;
+	close(child_fd);
+	free(args);
+	if (err) {
+		log_write(LOG_ERR, "ODM: failed to start %s: %s\n", argv[0], strerror(-err));
+		close(sv[0]);
+		return err;
+	}
+
+	log_write(LOG_INFO, "ODM: upgrading to %s, pid %d\n", argv[0], pid);
+	err = odm_pf_handover(odm_pf, sv[0]);
+	close(sv[0]);
+	if (err) {
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+
+	return err;
+}
+
+/* The new process becomes the main process of the service before the old one exits */
+static void
+odm_upgrade_notify_pid(void)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	const char *path = getenv("NOTIFY_SOCKET");
+	char buf[32];
+	size_t plen;
+	int fd, len;
+
+	if (!path || (path[0] != '/' && path[0] != '@'))
+		return;
+	plen = strlen(path);
+	if (plen >= sizeof(addr.sun_path))
+		return;
+
+	memcpy(addr.sun_path, path, plen);
+	if (addr.sun_path[0] == '@')
+		addr.sun_path[0] = '\0';
+
+	fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return;
+
+	len = snprintf(buf, sizeof(buf), "MAINPID=%d\n", getpid());
+	if (sendto(fd, buf, len, MSG_NOSIGNAL, (struct sockaddr *)&addr,
+		   offsetof(struct sockaddr_un, sun_path) + plen) != len)
+		log_write(LOG_WARNING, "ODM: failed to notify the service manager\n");
+	close(fd);
+}
+
+int
+odm_upgrade_recv(int sock, struct odm_handover *ho)
+{
+	struct odm_upgrade_msg msg;
+	int err;
+
+	odm_handover_init(ho);
+	err = odm_upgrade_send(sock, ODM_UPGRADE_READY, 0, NULL);
+	if (!err)
+		err = odm_upgrade_recv_msg(sock, ODM_UPGRADE_DEVICE, &msg, ho,
+					   ODM_UPGRADE_DEVICE_MS);
+	if (err)
+		log_write(LOG_ERR, "ODM: failed to take the device over: %s\n", strerror(-err));
+
+	return err;
+}
+
+void
+odm_upgrade_done(int sock, int err)
+{
+	if (!err)
+		odm_upgrade_notify_pid();
+
+	if (odm_upgrade_send(sock, ODM_UPGRADE_DONE, err, NULL))
+		log_write(LOG_WARNING, "ODM: the previous process is gone\n");
+	close(sock);
+}
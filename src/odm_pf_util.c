@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+#include "odm_pf.h"
+#include "odm_pf_stats.h"
+
+/*
+ * DMA utilization. ODM_CSCLK_ACTIVE_PC counts the SCLK cycles in which the
+ * ODM conditional clocks run, which is when the DMA engines have work. The
+ * utilization over an interval is the share of the SCLK cycles of the
+ * interval the counter advanced by. The counter covers the ODM block, there
+ * is no per-engine counter, so this is the utilization of both engines
+ * together.
+ */
+
+void
+odm_util_init(struct odm_dev *odm_pf, uint32_t sclk_mhz, uint32_t interval_ms)
+{
+	struct odm_util *util = &odm_pf->util;
+
+	util->sclk_mhz = sclk_mhz ? sclk_mhz : ODM_SCLK_DEF_MHZ;
+	util->interval_ms = interval_ms;
+	util->last_pc = odm_reg_read_relaxed(odm_pf, ODM_CSCLK_ACTIVE_PC);
+	util->last_ns = odm_now_ns();
+	util->last = 0;
+}
+
+uint32_t
+odm_util_sample(struct odm_dev *odm_pf)
+{
+	struct odm_util *util = &odm_pf->util;
+	uint64_t pc, now, cycles;
+
+	pc = odm_reg_read_relaxed(odm_pf, ODM_CSCLK_ACTIVE_PC);
+	now = odm_now_ns();
+	if (now == util->last_ns)
+		return util->last;
+
+	cycles = (now - util->last_ns) * util->sclk_mhz / 1000;
+	util->last = cycles ? (pc - util->last_pc) * 10000 / cycles : 0;
+	if (util->last > 10000)
+		util->last = 10000;
+
+	odm_stats_util(odm_pf, util->last, (now - util->last_ns) / 1000000);
+	util->last_pc = pc;
+	util->last_ns = now;
+
+	odm_rebal_sample(odm_pf, util->last);
+
+	return util->last;
+}
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "log.h"
@@ -84,6 +85,47 @@ exit:
 	return NULL;
 }
 
+void *
+pmem_attach(const char *name, int fd, size_t size)
+{
+	struct stat st;
+	void *addr;
+
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size < size) {
+		log_write(LOG_ERR, "Shared memory %s is smaller than %zu bytes\n", name, size);
+		close(fd);
+		return NULL;
+	}
+
+	addr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		log_write(LOG_ERR, "Failed to mmap shared memory file\n");
+		return NULL;
+	}
+
+	if (pmem_list_update(name, addr, size)) {
+		log_write(LOG_ERR, "Failed to update pmem_list\n");
+		munmap(addr, size);
+		return NULL;
+	}
+
+	log_write(LOG_DEBUG, "Attached shared memory %s\n", name);
+	return addr;
+}
+
+int
+pmem_export(const char *name)
+{
+	int fd;
+
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd == -1)
+		log_write(LOG_ERR, "Failed to open shared memory %s\n", name);
+
+	return fd;
+}
+
 static struct pmem_info *
 pmem_list_get(const char *name)
 {
@@ -121,8 +163,8 @@ pmem_list_remove(struct pmem_info *info)
 	}
 }
 
-int
-pmem_free(const char *name)
+static int
+pmem_unmap(const char *name, struct pmem_info **infop)
 {
 	struct pmem_info *info;
 
@@ -137,6 +179,32 @@ pmem_free(const char *name)
 		return -1;
 	}
 
+	*infop = info;
+	return 0;
+}
+
+int
+pmem_detach(const char *name)
+{
+	struct pmem_info *info;
+
+	if (pmem_unmap(name, &info))
+		return -1;
+
+	pmem_list_remove(info);
+
+	log_write(LOG_DEBUG, "Detached shared memory %s\n", name);
+	return 0;
+}
+
+int
+pmem_free(const char *name)
+{
+	struct pmem_info *info;
+
+	if (pmem_unmap(name, &info))
+		return -1;
+
 	if (shm_unlink(name) == -1) {
 		log_write(LOG_ERR, "Failed to unlink shared memory file\n");
 		return -1;
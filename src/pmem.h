@@ -32,4 +32,31 @@ void *pmem_alloc(const char *name, size_t size);
  */
 int pmem_free(const char *name);
 
+/**
+ * Unmap shared memory, keeping its content for the next pmem_alloc().
+ *
+ * @param	name	Name of the shared memory.
+ * @return		0 on success, -1 on failure.
+ */
+int pmem_detach(const char *name);
+
+/**
+ * Map shared memory from an fd, as handed over by another process. The
+ * shared memory is then freed or detached by name like an allocated one.
+ *
+ * @param	name	Name of the shared memory.
+ * @param	fd	Fd of the shared memory, closed once mapped or on failure.
+ * @param	size	Size of the shared memory.
+ * @return		Pointer to the shared memory.
+ */
+void *pmem_attach(const char *name, int fd, size_t size);
+
+/**
+ * Open an fd of shared memory, to hand it over to another process.
+ *
+ * @param	name	Name of the shared memory.
+ * @return		Fd of the shared memory, -1 on failure.
+ */
+int pmem_export(const char *name);
+
 #endif /* __PMEM_H__ */
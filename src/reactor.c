@@ -0,0 +1,978 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "reactor.h"
+
+/*
+ * The epoll data of a source is its fd and the generation of its slot, so an
+ * event of a source deleted by a callback earlier in the same batch is
+ * dropped, even if the fd was reused in between.
+ */
+#define REACTOR_MAX_EVENTS	64
+#define REACTOR_MIN_SRCS	64
+#define REACTOR_WAKE_KEY	UINT64_MAX
+
+/*
+ * io_uring backend. Each source has one request in flight: a multishot poll
+ * for the fds read by their callback, a read of the counter for the
+ * eventfds and timerfds, armed again once it completed. The re-arms of a
+ * batch are submitted with the wait for the next completions, in a single
+ * io_uring_enter(), so an interrupt costs no syscall of its own. The request
+ * of a deleted source is cancelled and its op freed with its last completion.
+ *
+ * The requests of a thread are cancelled when it exits, so they are all
+ * submitted by the reactor thread. The other threads queue their requests
+ * under the reactor lock and wake the reactor thread up.
+ */
+#define REACTOR_URING_ENTRIES	256
+/* Single mmap, no dropped completions, nonblocking reads polled, multishot poll */
+#define REACTOR_URING_FEATURES	(IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | \
+				 IORING_FEAT_FAST_POLL | IORING_FEAT_RSRC_TAGS)
+/* user_data of the requests which are not of a source */
+#define REACTOR_URING_NOP	0
+#define REACTOR_URING_WAKE	1
+
+struct reactor_op {
+	int fd;
+	bool efd;
+	/* A request is in flight, and a completion will come */
+	bool armed;
+	bool deleted;
+	uint64_t val;
+	/* Deleted ops waiting for their last completion */
+	struct reactor_op *next;
+};
+
+struct reactor_src {
+	reactor_cb_t callback;
+	void *cb_arg;
+	uint32_t gen;
+	/* Read the counter before the callback */
+	bool efd;
+	struct reactor_op *op;
+};
+
+struct reactor_timer {
+	int fd;
+};
+
+struct reactor_sig {
+	reactor_cb_t callback;
+	void *cb_arg;
+};
+
+struct reactor_uring {
+	int fd;
+	void *ring;
+	size_t ring_len;
+	struct io_uring_sqe *sqes;
+	size_t sqes_len;
+	uint32_t *sq_head;
+	uint32_t *sq_tail;
+	uint32_t *sq_array;
+	uint32_t sq_mask;
+	uint32_t sq_entries;
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t cq_mask;
+	struct io_uring_cqe *cqes;
+	/* Queued, not submitted yet */
+	uint32_t pending;
+	struct reactor_op *zombies;
+	/* Op whose completion is being handled */
+	struct reactor_op *cur;
+	uint64_t wake_val;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_t thread;
+	bool running;
+	bool stop;
+	/* Backend in use, and the one selected before a fallback to epoll */
+	enum reactor_backend backend;
+	enum reactor_backend selected;
+	int epoll_fd;
+	/* Written to wake the reactor thread up, to stop it or to submit */
+	int wake_fd;
+	int signal_fd;
+	sigset_t sigset;
+	struct reactor_sig sigs[NSIG];
+	/* Indexed by fd */
+	struct reactor_src *srcs;
+	int nb_srcs;
+	struct reactor_uring uring;
+	uint64_t *wakeup_cnt;
+} reactor = {
+	.epoll_fd = -1,
+	.wake_fd = -1,
+	.signal_fd = -1,
+	.uring.fd = -1,
+};
+
+static pthread_once_t reactor_once = PTHREAD_ONCE_INIT;
+
+static const char *const reactor_backend_names[] = {
+	[REACTOR_EPOLL] = "epoll",
+	[REACTOR_IO_URING] = "io_uring",
+};
+
+static void
+reactor_lock_init(void)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&reactor.lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+void
+reactor_lock(void)
+{
+	pthread_once(&reactor_once, reactor_lock_init);
+	pthread_mutex_lock(&reactor.lock);
+}
+
+void
+reactor_unlock(void)
+{
+	pthread_mutex_unlock(&reactor.lock);
+}
+
+void
+reactor_wakeup_counter_set(uint64_t *cnt)
+{
+	__atomic_store_n(&reactor.wakeup_cnt, cnt, __ATOMIC_RELEASE);
+}
+
+static void
+reactor_wakeup_count(void)
+{
+	uint64_t *cnt;
+
+	cnt = __atomic_load_n(&reactor.wakeup_cnt, __ATOMIC_ACQUIRE);
+	if (cnt)
+		__atomic_store_n(cnt, *cnt + 1, __ATOMIC_RELAXED);
+}
+
+int
+reactor_backend_parse(const char *name, enum reactor_backend *backend)
+{
+	int i;
+
+	for (i = 0; i < REACTOR_BACKEND_MAX; i++) {
+		if (!strcmp(name, reactor_backend_names[i])) {
+			*backend = i;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+int
+reactor_backend_set(enum reactor_backend backend)
+{
+	int rc = 0;
+
+	reactor_lock();
+	if (reactor.running)
+		rc = -EBUSY;
+	else
+		reactor.backend = reactor.selected = backend;
+	reactor_unlock();
+
+	return rc;
+}
+
+const char *
+reactor_backend_name(void)
+{
+	return reactor_backend_names[reactor.backend];
+}
+
+enum reactor_backend
+reactor_backend_get(void)
+{
+	return reactor.selected;
+}
+
+static int
+io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int
+reactor_uring_setup(void)
+{
+	struct reactor_uring *uring = &reactor.uring;
+	struct io_uring_params p;
+	size_t cq_len;
+
+	memset(&p, 0, sizeof(p));
+	uring->fd = io_uring_setup(REACTOR_URING_ENTRIES, &p);
+	if (uring->fd < 0) {
+		log_write(LOG_WARNING, "io_uring not available, %s, using epoll\n",
+			  strerror(errno));
+		return -1;
+	}
+
+	if ((p.features & REACTOR_URING_FEATURES) != REACTOR_URING_FEATURES) {
+		log_write(LOG_WARNING, "io_uring features 0x%x not supported, using epoll\n",
+			  REACTOR_URING_FEATURES & ~p.features);
+		goto close_fd;
+	}
+
+	uring->ring_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (cq_len > uring->ring_len)
+		uring->ring_len = cq_len;
+	uring->ring = mmap(NULL, uring->ring_len, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+	if (uring->ring == MAP_FAILED) {
+		log_write(LOG_ERR, "Failed to map the io_uring rings, %s\n", strerror(errno));
+		goto close_fd;
+	}
+
+	uring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	uring->sqes = mmap(NULL, uring->sqes_len, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+	if (uring->sqes == MAP_FAILED) {
+		log_write(LOG_ERR, "Failed to map the io_uring SQEs, %s\n", strerror(errno));
+		goto unmap_ring;
+	}
+
+	uring->sq_head = (uint32_t *)((char *)uring->ring + p.sq_off.head);
+	uring->sq_tail = (uint32_t *)((char *)uring->ring + p.sq_off.tail);
+	uring->sq_array = (uint32_t *)((char *)uring->ring + p.sq_off.array);
+	uring->sq_mask = *(uint32_t *)((char *)uring->ring + p.sq_off.ring_mask);
+	uring->sq_entries = p.sq_entries;
+	uring->cq_head = (uint32_t *)((char *)uring->ring + p.cq_off.head);
+	uring->cq_tail = (uint32_t *)((char *)uring->ring + p.cq_off.tail);
+	uring->cq_mask = *(uint32_t *)((char *)uring->ring + p.cq_off.ring_mask);
+	uring->cqes = (struct io_uring_cqe *)((char *)uring->ring + p.cq_off.cqes);
+	uring->pending = 0;
+	uring->zombies = NULL;
+	uring->cur = NULL;
+
+	return 0;
+
+unmap_ring:
+	munmap(uring->ring, uring->ring_len);
+close_fd:
+	close(uring->fd);
+	uring->fd = -1;
+
+	return -1;
+}
+
+static void
+reactor_uring_cleanup(void)
+{
+	struct reactor_uring *uring = &reactor.uring;
+	struct reactor_op *op;
+	int fd;
+
+	/* Closing the ring cancels the requests in flight */
+	munmap(uring->sqes, uring->sqes_len);
+	munmap(uring->ring, uring->ring_len);
+	close(uring->fd);
+	uring->fd = -1;
+
+	while (uring->zombies) {
+		op = uring->zombies;
+		uring->zombies = op->next;
+		free(op);
+	}
+	for (fd = 0; fd < reactor.nb_srcs; fd++) {
+		free(reactor.srcs[fd].op);
+		reactor.srcs[fd].op = NULL;
+	}
+}
+
+static bool
+reactor_thread_self(void)
+{
+	return reactor.running && pthread_equal(pthread_self(), reactor.thread);
+}
+
+/* Wake the reactor thread up, under the reactor lock */
+static void
+reactor_wake(void)
+{
+	uint64_t val = 1;
+
+	if (write(reactor.wake_fd, &val, sizeof(val)) != sizeof(val))
+		log_write(LOG_ERR, "Failed to wake the reactor thread up\n");
+}
+
+/* Submit the queued requests, on the reactor thread under the reactor lock */
+static int
+reactor_uring_submit(void)
+{
+	struct reactor_uring *uring = &reactor.uring;
+	int rc;
+
+	while (uring->pending) {
+		rc = io_uring_enter(uring->fd, uring->pending, 0, 0);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			log_write(LOG_ERR, "io_uring submit failed, %s\n", strerror(errno));
+			return -1;
+		}
+		uring->pending = (uint32_t)rc < uring->pending ? uring->pending - rc : 0;
+		if (!rc)
+			break;
+	}
+
+	return 0;
+}
+
+/* Next free SQE, filled by the caller and queued by reactor_uring_queue() */
+static struct io_uring_sqe *
+reactor_uring_sqe(void)
+{
+	struct reactor_uring *uring = &reactor.uring;
+	struct io_uring_sqe *sqe;
+	uint32_t tail = *uring->sq_tail;
+
+	if (tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >= uring->sq_entries) {
+		if (reactor_thread_self())
+			reactor_uring_submit();
+		if (tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >= uring->sq_entries) {
+			log_write(LOG_ERR, "io_uring submission queue full\n");
+			return NULL;
+		}
+	}
+
+	sqe = &uring->sqes[tail & uring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+
+	return sqe;
+}
+
+static void
+reactor_uring_queue(void)
+{
+	struct reactor_uring *uring = &reactor.uring;
+	uint32_t tail = *uring->sq_tail;
+
+	uring->sq_array[tail & uring->sq_mask] = tail & uring->sq_mask;
+	__atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	uring->pending++;
+}
+
+/* Queue the request of a source, submitted with the next wait */
+static int
+reactor_uring_arm(struct reactor_op *op)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = reactor_uring_sqe();
+	if (!sqe)
+		return -1;
+
+	sqe->fd = op->fd;
+	sqe->user_data = (uintptr_t)op;
+	if (op->efd) {
+		sqe->opcode = IORING_OP_READ;
+		sqe->addr = (uintptr_t)&op->val;
+		sqe->len = sizeof(op->val);
+	} else {
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll32_events = POLLIN;
+		sqe->len = IORING_POLL_ADD_MULTI;
+	}
+	reactor_uring_queue();
+	op->armed = true;
+
+	if (!reactor_thread_self())
+		reactor_wake();
+
+	return 0;
+}
+
+static void
+reactor_uring_cancel(struct reactor_op *op)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = reactor_uring_sqe();
+	if (!sqe)
+		return;
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = (uintptr_t)op;
+	sqe->user_data = REACTOR_URING_NOP;
+	reactor_uring_queue();
+
+	if (!reactor_thread_self())
+		reactor_wake();
+}
+
+static void
+reactor_uring_op_del(struct reactor_op *op)
+{
+	struct reactor_uring *uring = &reactor.uring;
+
+	op->deleted = true;
+	if (op == uring->cur)
+		return;
+
+	if (!op->armed) {
+		free(op);
+		return;
+	}
+
+	reactor_uring_cancel(op);
+	op->next = uring->zombies;
+	uring->zombies = op;
+}
+
+static void
+reactor_uring_op_free(struct reactor_op *op)
+{
+	struct reactor_op **prev;
+
+	for (prev = &reactor.uring.zombies; *prev; prev = &(*prev)->next) {
+		if (*prev == op) {
+			*prev = op->next;
+			break;
+		}
+	}
+	free(op);
+}
+
+/* Wait for the wake fd, under the reactor lock */
+static int
+reactor_wake_arm(void)
+{
+	struct io_uring_sqe *sqe;
+	struct epoll_event ev;
+
+	if (reactor.backend == REACTOR_EPOLL) {
+		ev.events = EPOLLIN;
+		ev.data.u64 = REACTOR_WAKE_KEY;
+		return epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, reactor.wake_fd, &ev);
+	}
+
+	sqe = reactor_uring_sqe();
+	if (!sqe)
+		return -1;
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = reactor.wake_fd;
+	sqe->addr = (uintptr_t)&reactor.uring.wake_val;
+	sqe->len = sizeof(reactor.uring.wake_val);
+	sqe->user_data = REACTOR_URING_WAKE;
+	reactor_uring_queue();
+
+	return 0;
+}
+
+static void
+reactor_uring_complete(const struct io_uring_cqe *cqe)
+{
+	struct reactor_uring *uring = &reactor.uring;
+	struct reactor_op *op;
+	struct reactor_src *src;
+
+	if (cqe->user_data == REACTOR_URING_NOP)
+		return;
+
+	if (cqe->user_data == REACTOR_URING_WAKE) {
+		reactor_wake_arm();
+		return;
+	}
+
+	op = (struct reactor_op *)(uintptr_t)cqe->user_data;
+	if (!(cqe->flags & IORING_CQE_F_MORE))
+		op->armed = false;
+
+	if (op->deleted) {
+		if (!op->armed)
+			reactor_uring_op_free(op);
+		return;
+	}
+
+	if (cqe->res < 0 && cqe->res != -EAGAIN && cqe->res != -EINTR) {
+		/* Not armed again, it would fail the same way */
+		log_write(LOG_ERR, "io_uring request of fd %d failed, %s\n", op->fd,
+			  strerror(-cqe->res));
+		return;
+	}
+
+	src = &reactor.srcs[op->fd];
+	uring->cur = op;
+	if (cqe->res > 0 && (!op->efd || cqe->res == sizeof(op->val)))
+		src->callback(src->cb_arg);
+	uring->cur = NULL;
+
+	/* The callback may have deleted the source */
+	if (op->deleted) {
+		if (op->armed)
+			reactor_uring_op_del(op);
+		else
+			free(op);
+		return;
+	}
+
+	if (!op->armed)
+		reactor_uring_arm(op);
+}
+
+static void *
+reactor_uring_thread(__attribute__((unused)) void *arg)
+{
+	struct reactor_uring *uring = &reactor.uring;
+	struct io_uring_cqe cqe;
+	uint32_t head, tail, to_submit;
+	int rc;
+
+	while (1) {
+		/* The re-arms of the last batch go with the wait */
+		pthread_mutex_lock(&reactor.lock);
+		to_submit = uring->pending;
+		uring->pending = 0;
+		pthread_mutex_unlock(&reactor.lock);
+
+		rc = io_uring_enter(uring->fd, to_submit, 1, IORING_ENTER_GETEVENTS);
+		if (rc < 0 && errno != EINTR && errno != EBUSY) {
+			log_write(LOG_ERR, "io_uring wait failed, %s\n", strerror(errno));
+			break;
+		}
+
+		reactor_wakeup_count();
+
+		pthread_mutex_lock(&reactor.lock);
+		if (reactor.stop) {
+			pthread_mutex_unlock(&reactor.lock);
+			break;
+		}
+		/* Left in the ring by a failed wait */
+		if (rc < (int)to_submit)
+			uring->pending += to_submit - (rc > 0 ? rc : 0);
+
+		head = *uring->cq_head;
+		tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			cqe = uring->cqes[head & uring->cq_mask];
+			__atomic_store_n(uring->cq_head, head + 1, __ATOMIC_RELEASE);
+			reactor_uring_complete(&cqe);
+		}
+		pthread_mutex_unlock(&reactor.lock);
+	}
+
+	log_write(LOG_DEBUG, "Reactor thread exiting\n");
+	return NULL;
+}
+
+static void
+reactor_dispatch(uint64_t key)
+{
+	struct reactor_src *src;
+	int fd = (int)(uint32_t)key;
+	uint64_t val;
+
+	if (key == REACTOR_WAKE_KEY || fd >= reactor.nb_srcs)
+		return;
+
+	src = &reactor.srcs[fd];
+	if (!src->callback || src->gen != (uint32_t)(key >> 32))
+		return;
+
+	if (src->efd && read(fd, &val, sizeof(val)) != sizeof(val)) {
+		/* Nothing to read if a timer was armed again since it expired */
+		if (errno != EAGAIN)
+			log_write(LOG_ERR, "Failure in reading efd %d, %s\n", fd, strerror(errno));
+		return;
+	}
+
+	src->callback(src->cb_arg);
+}
+
+static void *
+reactor_epoll_thread(__attribute__((unused)) void *arg)
+{
+	struct epoll_event ep_events[REACTOR_MAX_EVENTS];
+	int i, n;
+
+	while (1) {
+		n = epoll_wait(reactor.epoll_fd, ep_events, REACTOR_MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			log_write(LOG_ERR, "epoll_wait failed, %s\n", strerror(errno));
+			break;
+		}
+
+		reactor_wakeup_count();
+
+		pthread_mutex_lock(&reactor.lock);
+		if (reactor.stop) {
+			pthread_mutex_unlock(&reactor.lock);
+			break;
+		}
+		for (i = 0; i < n; i++)
+			reactor_dispatch(ep_events[i].data.u64);
+		pthread_mutex_unlock(&reactor.lock);
+	}
+
+	log_write(LOG_DEBUG, "Reactor thread exiting\n");
+	return NULL;
+}
+
+/* Start the reactor thread, under the reactor lock */
+static int
+reactor_start(void)
+{
+	if (reactor.running)
+		return 0;
+
+	if (reactor.backend == REACTOR_IO_URING && reactor_uring_setup())
+		reactor.backend = REACTOR_EPOLL;
+
+	if (reactor.backend == REACTOR_EPOLL) {
+		reactor.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (reactor.epoll_fd < 0) {
+			log_write(LOG_ERR, "Failed to create epoll fd, %s\n", strerror(errno));
+			return -1;
+		}
+	}
+
+	reactor.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (reactor.wake_fd < 0) {
+		log_write(LOG_ERR, "Failed to create reactor wake fd, %s\n", strerror(errno));
+		goto close_backend;
+	}
+
+	if (reactor_wake_arm()) {
+		log_write(LOG_ERR, "Failed to add reactor wake fd, %s\n", strerror(errno));
+		goto close_stop;
+	}
+
+	reactor.stop = false;
+	if (pthread_create(&reactor.thread, NULL, reactor.backend == REACTOR_EPOLL ?
+			   reactor_epoll_thread : reactor_uring_thread, NULL)) {
+		log_write(LOG_ERR, "Failed to create reactor thread\n");
+		goto close_stop;
+	}
+	reactor.running = true;
+	log_write(LOG_INFO, "Reactor running on %s\n", reactor_backend_name());
+
+	return 0;
+
+close_stop:
+	close(reactor.wake_fd);
+	reactor.wake_fd = -1;
+close_backend:
+	if (reactor.backend == REACTOR_EPOLL) {
+		close(reactor.epoll_fd);
+		reactor.epoll_fd = -1;
+	} else {
+		reactor_uring_cleanup();
+	}
+
+	return -1;
+}
+
+static int
+reactor_src_add(int fd, reactor_cb_t callback, void *cb_arg, bool efd)
+{
+	struct reactor_src *srcs, *src;
+	struct reactor_op *op = NULL;
+	struct epoll_event ev;
+	int nb_srcs, rc = -1;
+
+	if (fd < 0 || !callback) {
+		log_write(LOG_ERR, "Invalid reactor fd %d or callback\n", fd);
+		return -1;
+	}
+
+	reactor_lock();
+
+	if (reactor_start())
+		goto exit;
+
+	if (fd >= reactor.nb_srcs) {
+		nb_srcs = reactor.nb_srcs ? reactor.nb_srcs : REACTOR_MIN_SRCS;
+		while (nb_srcs <= fd)
+			nb_srcs *= 2;
+		srcs = realloc(reactor.srcs, nb_srcs * sizeof(*srcs));
+		if (!srcs) {
+			log_write(LOG_ERR, "Failed to allocate memory for reactor fds\n");
+			goto exit;
+		}
+		memset(&srcs[reactor.nb_srcs], 0, (nb_srcs - reactor.nb_srcs) * sizeof(*srcs));
+		reactor.srcs = srcs;
+		reactor.nb_srcs = nb_srcs;
+	}
+
+	src = &reactor.srcs[fd];
+	if (src->callback) {
+		log_write(LOG_ERR, "Reactor fd %d already added\n", fd);
+		goto exit;
+	}
+
+	src->gen++;
+	src->callback = callback;
+	src->cb_arg = cb_arg;
+	src->efd = efd;
+	if (reactor.backend == REACTOR_EPOLL) {
+		ev.events = EPOLLIN;
+		ev.data.u64 = ((uint64_t)src->gen << 32) | (uint32_t)fd;
+		rc = epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+		if (rc)
+			log_write(LOG_ERR, "Failed to add fd %d to epoll fd waitlist, %s\n", fd,
+				  strerror(errno));
+	} else {
+		op = calloc(1, sizeof(*op));
+		if (op) {
+			op->fd = fd;
+			op->efd = efd;
+			src->op = op;
+			rc = reactor_uring_arm(op);
+			if (rc) {
+				reactor_uring_op_del(op);
+				src->op = NULL;
+			}
+		}
+	}
+	if (rc) {
+		src->callback = NULL;
+		src->cb_arg = NULL;
+	}
+
+exit:
+	reactor_unlock();
+	return rc;
+}
+
+int
+reactor_fd_add(int fd, reactor_cb_t callback, void *cb_arg)
+{
+	return reactor_src_add(fd, callback, cb_arg, false);
+}
+
+int
+reactor_efd_add(int fd, reactor_cb_t callback, void *cb_arg)
+{
+	return reactor_src_add(fd, callback, cb_arg, true);
+}
+
+int
+reactor_fd_del(int fd)
+{
+	struct reactor_src *src;
+	int rc = -1;
+
+	reactor_lock();
+
+	if (fd < 0 || fd >= reactor.nb_srcs || !reactor.srcs[fd].callback) {
+		log_write(LOG_ERR, "Reactor fd %d not added\n", fd);
+		goto exit;
+	}
+
+	src = &reactor.srcs[fd];
+	src->callback = NULL;
+	src->cb_arg = NULL;
+	src->gen++;
+	if (reactor.backend == REACTOR_EPOLL) {
+		rc = epoll_ctl(reactor.epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+		if (rc)
+			log_write(LOG_ERR, "Failed to remove fd %d from epoll fd waitlist, %s\n",
+				  fd, strerror(errno));
+	} else {
+		reactor_uring_op_del(src->op);
+		src->op = NULL;
+		rc = 0;
+	}
+
+exit:
+	reactor_unlock();
+	return rc;
+}
+
+struct reactor_timer *
+reactor_timer_add(reactor_cb_t callback, void *cb_arg)
+{
+	struct reactor_timer *timer;
+
+	timer = calloc(1, sizeof(*timer));
+	if (!timer)
+		return NULL;
+
+	timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer->fd < 0) {
+		log_write(LOG_ERR, "Failed to create timer fd, %s\n", strerror(errno));
+		goto free_timer;
+	}
+
+	/* The expirations are read as an eventfd counter */
+	if (reactor_efd_add(timer->fd, callback, cb_arg))
+		goto close_fd;
+
+	return timer;
+
+close_fd:
+	close(timer->fd);
+free_timer:
+	free(timer);
+
+	return NULL;
+}
+
+int
+reactor_timer_set(struct reactor_timer *timer, uint64_t delay_ns, uint64_t period_ns)
+{
+	struct itimerspec its;
+	int rc;
+
+	its.it_value.tv_sec = delay_ns / 1000000000ULL;
+	its.it_value.tv_nsec = delay_ns % 1000000000ULL;
+	its.it_interval.tv_sec = period_ns / 1000000000ULL;
+	its.it_interval.tv_nsec = period_ns % 1000000000ULL;
+
+	/* Disarming waits for a running callback */
+	reactor_lock();
+	rc = timerfd_settime(timer->fd, 0, &its, NULL);
+	reactor_unlock();
+	if (rc)
+		log_write(LOG_ERR, "Failed to set timer, %s\n", strerror(errno));
+
+	return rc;
+}
+
+void
+reactor_timer_del(struct reactor_timer *timer)
+{
+	if (!timer)
+		return;
+
+	reactor_fd_del(timer->fd);
+	close(timer->fd);
+	free(timer);
+}
+
+static void
+reactor_signal_received(__attribute__((unused)) void *cb_arg)
+{
+	struct signalfd_siginfo info;
+	struct reactor_sig *sig;
+
+	while (read(reactor.signal_fd, &info, sizeof(info)) == sizeof(info)) {
+		if (info.ssi_signo >= NSIG)
+			continue;
+		sig = &reactor.sigs[info.ssi_signo];
+		if (sig->callback)
+			sig->callback(sig->cb_arg);
+	}
+}
+
+int
+reactor_signal_add(int signo, reactor_cb_t callback, void *cb_arg)
+{
+	sigset_t sigset;
+	int fd, rc = -1;
+
+	if (signo <= 0 || signo >= NSIG || !callback) {
+		log_write(LOG_ERR, "Invalid reactor signal %d or callback\n", signo);
+		return -1;
+	}
+
+	reactor_lock();
+
+	sigset = reactor.sigset;
+	sigaddset(&sigset, signo);
+	fd = signalfd(reactor.signal_fd, &sigset, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd < 0) {
+		log_write(LOG_ERR, "Failed to create signal fd, %s\n", strerror(errno));
+		goto exit;
+	}
+
+	if (reactor.signal_fd < 0) {
+		if (reactor_fd_add(fd, reactor_signal_received, NULL)) {
+			close(fd);
+			goto exit;
+		}
+		reactor.signal_fd = fd;
+	}
+
+	reactor.sigset = sigset;
+	reactor.sigs[signo].callback = callback;
+	reactor.sigs[signo].cb_arg = cb_arg;
+	rc = 0;
+
+exit:
+	reactor_unlock();
+	return rc;
+}
+
+void
+reactor_fini(void)
+{
+	uint64_t val = 1;
+
+	reactor_lock();
+	if (!reactor.running) {
+		reactor_unlock();
+		return;
+	}
+
+	reactor.stop = true;
+	if (write(reactor.wake_fd, &val, sizeof(val)) != sizeof(val))
+		log_write(LOG_ERR, "Failed to stop the reactor thread\n");
+	reactor_unlock();
+
+	if (pthread_join(reactor.thread, NULL))
+		log_write(LOG_ERR, "Failed to join reactor thread\n");
+
+	reactor_lock();
+	if (reactor.signal_fd >= 0) {
+		reactor_fd_del(reactor.signal_fd);
+		close(reactor.signal_fd);
+	}
+	reactor.signal_fd = -1;
+	sigemptyset(&reactor.sigset);
+	memset(reactor.sigs, 0, sizeof(reactor.sigs));
+	if (reactor.backend == REACTOR_EPOLL) {
+		close(reactor.epoll_fd);
+		reactor.epoll_fd = -1;
+	} else {
+		reactor_uring_cleanup();
+	}
+	close(reactor.wake_fd);
+	reactor.wake_fd = -1;
+	free(reactor.srcs);
+	reactor.srcs = NULL;
+	reactor.nb_srcs = 0;
+	reactor.running = false;
+	reactor_unlock();
+}
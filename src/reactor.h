@@ -0,0 +1,165 @@
+/* SPDX-License-Identifier: Marvell-MIT
+ * Copyright (c) 2024 Marvell.
+ */
+
+/**
+ * @file
+ *
+ * Event reactor.
+ *
+ * One thread waits on a single epoll set for all the events of the driver:
+ * the MSI-X eventfds of the interrupt library, the timers of the periodic
+ * tasks and the signals. A callback is registered for each event source and
+ * is called on the reactor thread, one at a time, so callbacks should be
+ * short and must not block.
+ *
+ * The callbacks run under the reactor lock. Once reactor_fd_del() or
+ * reactor_timer_del() returns, the callback of the source is not running and
+ * is not called again. A callback may add and delete sources, its own
+ * included. A library whose state is updated both by its callbacks and by
+ * other threads takes reactor_lock() before its own locks, as the callbacks
+ * do.
+ *
+ * The reactor thread is started when the first source is added and runs
+ * until reactor_fini(). It waits with epoll, or with io_uring if selected
+ * and supported: the eventfds are then read by io_uring requests, and a batch
+ * of interrupts costs a single syscall, the re-arms being submitted with the
+ * wait for the next batch.
+ */
+
+#ifndef __REACTOR_H__
+#define __REACTOR_H__
+
+#include <stdint.h>
+
+/* Callback function type for an event source */
+typedef void (*reactor_cb_t)(void *cb_arg);
+
+struct reactor_timer;
+
+enum reactor_backend {
+	REACTOR_EPOLL,
+	REACTOR_IO_URING,
+	REACTOR_BACKEND_MAX
+};
+
+/**
+ * Get a reactor backend by name.
+ *
+ * @param	name	epoll or io_uring.
+ * @param	backend	Backend to set.
+ * @return		0 on success, -EINVAL if the name is not known.
+ */
+int reactor_backend_parse(const char *name, enum reactor_backend *backend);
+
+/**
+ * Select the backend of the reactor, before it is started. io_uring falls
+ * back to epoll if the kernel does not support it.
+ *
+ * @param	backend	The backend.
+ * @return		0 on success, -EBUSY if the reactor is running.
+ */
+int reactor_backend_set(enum reactor_backend backend);
+
+/**
+ * Name of the backend of the reactor, the one in use once it is started.
+ */
+const char *reactor_backend_name(void);
+
+/**
+ * Backend selected for the reactor, io_uring even if it fell back to epoll.
+ */
+enum reactor_backend reactor_backend_get(void);
+
+/**
+ * Add an fd to the reactor. The callback is called while the fd is readable,
+ * it has to read it.
+ *
+ * @param	fd		The fd to wait for, nonblocking.
+ * @param	callback	The callback function to be called when the fd is readable.
+ * @param	cb_arg		The argument to be passed to the callback function.
+ * @return			0 on success, -1 on failure.
+ */
+int reactor_fd_add(int fd, reactor_cb_t callback, void *cb_arg);
+
+/**
+ * Add an eventfd, or another fd read as a 64-bit counter such as a timerfd,
+ * to the reactor. The reactor reads the counter and calls the callback.
+ *
+ * @param	fd		The fd to wait for, nonblocking.
+ * @param	callback	The callback function to be called when the counter was read.
+ * @param	cb_arg		The argument to be passed to the callback function.
+ * @return			0 on success, -1 on failure.
+ */
+int reactor_efd_add(int fd, reactor_cb_t callback, void *cb_arg);
+
+/**
+ * Remove an fd from the reactor. The fd is not closed.
+ *
+ * @param	fd	The fd added by reactor_fd_add() or reactor_efd_add().
+ * @return		0 on success, -1 on failure.
+ */
+int reactor_fd_del(int fd);
+
+/**
+ * Create a timer, disarmed.
+ *
+ * @param	callback	The callback function to be called when the timer expires.
+ * @param	cb_arg		The argument to be passed to the callback function.
+ * @return			The timer, NULL on failure.
+ */
+struct reactor_timer *reactor_timer_add(reactor_cb_t callback, void *cb_arg);
+
+/**
+ * Arm or disarm a timer. The callback is called once for the expirations
+ * missed by a busy reactor. Once the timer is disarmed, its callback is not
+ * running.
+ *
+ * @param	timer		The timer.
+ * @param	delay_ns	Time to the first expiration, 0 to disarm the timer.
+ * @param	period_ns	Time between the next expirations, 0 for a one shot timer.
+ * @return			0 on success, -1 on failure.
+ */
+int reactor_timer_set(struct reactor_timer *timer, uint64_t delay_ns, uint64_t period_ns);
+
+/**
+ * Delete a timer.
+ *
+ * @param	timer	The timer, NULL is ignored.
+ */
+void reactor_timer_del(struct reactor_timer *timer);
+
+/**
+ * Call a callback when a signal is received. The signal must be blocked in
+ * all the threads, so it is only received by the reactor: block it before the
+ * first thread is created, which all the threads inherit.
+ *
+ * @param	signo		The signal.
+ * @param	callback	The callback function to be called when the signal is received.
+ * @param	cb_arg		The argument to be passed to the callback function.
+ * @return			0 on success, -1 on failure.
+ */
+int reactor_signal_add(int signo, reactor_cb_t callback, void *cb_arg);
+
+/**
+ * Serialize with the reactor callbacks. The lock is recursive, and is held
+ * by the callbacks.
+ */
+void reactor_lock(void);
+void reactor_unlock(void);
+
+/**
+ * Set a counter incremented each time the reactor thread wakes up. The
+ * counter is only written by the reactor thread.
+ *
+ * @param	cnt	Counter to increment, NULL to stop counting.
+ */
+void reactor_wakeup_counter_set(uint64_t *cnt);
+
+/**
+ * Stop the reactor thread and remove the signals. The fds and timers are to
+ * be deleted before. Not to be called from a callback.
+ */
+void reactor_fini(void);
+
+#endif /* __REACTOR_H__ */
@@ -38,28 +38,55 @@ struct vfio_config {
 
 static struct vfio_config vfio_cfg = {.container_fd = -1};
 
+static void
+vfio_cfg_init(int container_fd)
+{
+	int i;
+
+	vfio_cfg.container_fd = container_fd;
+	vfio_cfg.active_groups = 0;
+	for (i = 0; i < VFIO_MAX_GROUPS; i++) {
+		vfio_cfg.groups[i].group_num = -1;
+		vfio_cfg.groups[i].group_fd = -1;
+		vfio_cfg.groups[i].devices = 0;
+	}
+}
+
 static int
 vfio_pci_init(void)
 {
-	int i;
+	int container_fd;
 
 	if (vfio_cfg.container_fd != -1)
 		return 0;
 
-	vfio_cfg.container_fd = open("/dev/vfio/vfio", O_RDWR);
-	if (vfio_cfg.container_fd < 0) {
+	container_fd = open("/dev/vfio/vfio", O_RDWR);
+	if (container_fd < 0) {
 		log_write(LOG_ERR, "Failed to open VFIO file descriptor\n");
 		return -1;
 	}
 
-	vfio_cfg.active_groups = 0;
+	vfio_cfg_init(container_fd);
+
+	return 0;
+}
+
+static int
+vfio_group_add(int group_num, int group_fd)
+{
+	int i;
+
 	for (i = 0; i < VFIO_MAX_GROUPS; i++) {
-		vfio_cfg.groups[i].group_num = -1;
-		vfio_cfg.groups[i].group_fd = -1;
-		vfio_cfg.groups[i].devices = 0;
+		if (vfio_cfg.groups[i].group_num == -1) {
+			vfio_cfg.groups[i].group_num = group_num;
+			vfio_cfg.groups[i].group_fd = group_fd;
+			vfio_cfg.groups[i].devices = 1;
+			vfio_cfg.active_groups++;
+			return 0;
+		}
 	}
 
-	return 0;
+	return -1;
 }
 
 static int
@@ -89,6 +116,15 @@ vfio_pci_interrupt_init(struct vfio_pci_device *pdev)
 		return -1;
 	}
 
+	pdev->intr.irq_set = calloc(1, sizeof(struct vfio_irq_set) +
+				       irq_info.count * sizeof(int32_t));
+	if (!pdev->intr.irq_set) {
+		log_write(LOG_ERR, "%s: failed to allocate memory for irq set\n", pdev->name);
+		free(pdev->intr.efds);
+		pdev->intr.efds = NULL;
+		return -1;
+	}
+
 	/* All interrupts are disabled by default */
 	memset(pdev->intr.efds, -1, irq_info.count * sizeof(int32_t));
 
@@ -157,15 +193,8 @@ vfio_get_group_fd(const char *dev_name)
 		return -1;
 	}
 
-	for (i = 0; i < VFIO_MAX_GROUPS; i++) {
-		if (vfio_cfg.groups[i].group_num == -1) {
-			vfio_cfg.groups[i].group_num = group_num;
-			vfio_cfg.groups[i].group_fd = group_fd;
-			vfio_cfg.groups[i].devices = 1;
-			vfio_cfg.active_groups++;
-			return group_fd;
-		}
-	}
+	if (!vfio_group_add(group_num, group_fd))
+		return group_fd;
 
 	log_write(LOG_ERR, "%s: Number of active groups surpasses the maximum supported limit\n",
 		  dev_name);
@@ -203,13 +232,79 @@ vfio_clear_group(int group_fd)
 	}
 }
 
+/* Map the regions and set up the interrupts of an open device */
+static int
+vfio_pci_device_map(struct vfio_pci_device *pdev, int group_fd, int device_fd)
+{
+	struct vfio_device_info device_info = {.argsz = sizeof(device_info)};
+	unsigned int i;
+	int rc;
+
+	rc = ioctl(device_fd, VFIO_DEVICE_GET_INFO, &device_info);
+	if (rc) {
+		log_write(LOG_ERR, "%s: failed to get device info, %s\n", pdev->name,
+			  strerror(errno));
+		return -1;
+	}
+
+	pdev->device_fd = device_fd;
+	pdev->group_fd = group_fd;
+	pdev->mem = calloc(device_info.num_regions, sizeof(*pdev->mem));
+	if (!pdev->mem) {
+		log_write(LOG_ERR, "%s: failed to allocate memory for region info\n", pdev->name);
+		return -1;
+	}
+
+	for (i = 0; i < device_info.num_regions; i++) {
+		struct vfio_region_info reg = {.argsz = sizeof(reg)};
+
+		if (i > MAX_REGION_INDEX)
+			break;
+
+		reg.index = i;
+		rc = ioctl(device_fd, VFIO_DEVICE_GET_REGION_INFO, &reg);
+		if (rc) {
+			log_write(LOG_ERR, "%s: failed to get region info, %s\n", pdev->name,
+				  strerror(errno));
+			goto device_mem_free;
+		}
+
+		if (!reg.size)
+			continue;
+
+		pdev->mem[pdev->num_resource].addr = mmap(NULL, reg.size, PROT_READ | PROT_WRITE,
+							  MAP_SHARED, device_fd, reg.offset);
+		if (pdev->mem[pdev->num_resource].addr == MAP_FAILED) {
+			log_write(LOG_ERR, "%s: failed to mmap region %d\n", pdev->name, i);
+			goto device_mem_free;
+		}
+
+		pdev->mem[pdev->num_resource].len = reg.size;
+		pdev->mem[pdev->num_resource].index = i;
+
+		log_write(LOG_DEBUG, "%s: Mapped region %d: addr=%p, len=%lu\n", pdev->name, i,
+			  pdev->mem[pdev->num_resource].addr, pdev->mem[pdev->num_resource].len);
+		pdev->num_resource++;
+	}
+
+	rc = vfio_pci_interrupt_init(pdev);
+	if (rc) {
+		log_write(LOG_ERR, "%s: failed to initialize interrupt\n", pdev->name);
+		goto device_mem_free;
+	}
+
+	return 0;
+
+device_mem_free:
+	vfio_pci_device_mem_free(pdev);
+	return -1;
+}
+
 int
 vfio_pci_device_setup(struct vfio_pci_device *pdev)
 {
 	struct vfio_group_status group_status = {.argsz = sizeof(group_status)};
-	struct vfio_device_info device_info = {.argsz = sizeof(device_info)};
 	int group_fd, device_fd, rc;
-	unsigned int i;
 
 	if (vfio_pci_init())
 		return -1;
@@ -272,159 +367,265 @@ vfio_pci_device_setup(struct vfio_pci_device *pdev)
 	}
 
 dev_get_info:
-	rc = ioctl(device_fd, VFIO_DEVICE_GET_INFO, &device_info);
-	if (rc) {
-		log_write(LOG_ERR, "%s: failed to get device info, %s\n", pdev->name,
-			  strerror(errno));
-		goto close_device_fd;
-	}
-
-	pdev->device_fd = device_fd;
-	pdev->group_fd = group_fd;
-	pdev->mem = calloc(device_info.num_regions, sizeof(*pdev->mem));
-	if (!pdev->mem) {
-		log_write(LOG_ERR, "%s: failed to allocate memory for region info\n", pdev->name);
+	rc = vfio_pci_device_map(pdev, group_fd, device_fd);
+	if (rc)
 		goto close_device_fd;
-	}
 
-	for (i = 0; i < device_info.num_regions; i++) {
-		struct vfio_region_info reg = {.argsz = sizeof(reg)};
+	return 0;
 
-		if (i > MAX_REGION_INDEX)
-			break;
+close_device_fd:
+	close(device_fd);
+clear_group:
+	vfio_clear_group(group_fd);
+	return -1;
+}
 
-		reg.index = i;
-		rc = ioctl(device_fd, VFIO_DEVICE_GET_REGION_INFO, &reg);
-		if (rc) {
-			log_write(LOG_ERR, "%s: failed to get region info, %s\n", pdev->name,
-				  strerror(errno));
-			goto device_mem_free;
-		}
+int
+vfio_pci_device_attach(struct vfio_pci_device *pdev, const struct vfio_pci_fds *fds)
+{
+	int group_num;
 
-		if (!reg.size)
-			continue;
+	/* The container is the one of the process handing the device over */
+	if (vfio_cfg.container_fd != -1) {
+		log_write(LOG_ERR, "%s: a VFIO container is already open\n", pdev->name);
+		goto close_fds;
+	}
 
-		pdev->mem[pdev->num_resource].addr = mmap(NULL, reg.size, PROT_READ | PROT_WRITE,
-							  MAP_SHARED, device_fd, reg.offset);
-		if (pdev->mem[pdev->num_resource].addr == MAP_FAILED) {
-			log_write(LOG_ERR, "%s: failed to mmap region %d\n", pdev->name, i);
-			goto device_mem_free;
-		}
+	if (vfio_get_group_num(pdev->name, &group_num) < 0) {
+		log_write(LOG_ERR, "%s: Failed to get group number\n", pdev->name);
+		goto close_fds;
+	}
 
-		pdev->mem[pdev->num_resource].len = reg.size;
-		pdev->mem[pdev->num_resource].index = i;
+	/* The group table is empty, the group is always added */
+	vfio_cfg_init(fds->container_fd);
+	vfio_group_add(group_num, fds->group_fd);
 
-		log_write(LOG_DEBUG, "%s: Mapped region %d: addr=%p, len=%lu\n", pdev->name, i,
-			  pdev->mem[pdev->num_resource].addr, pdev->mem[pdev->num_resource].len);
-		pdev->num_resource++;
+	if (vfio_pci_device_map(pdev, fds->group_fd, fds->device_fd)) {
+		close(fds->device_fd);
+		vfio_clear_group(fds->group_fd);
+		close(vfio_cfg.container_fd);
+		vfio_cfg.container_fd = -1;
+		return -1;
 	}
 
-	rc = vfio_pci_interrupt_init(pdev);
-	if (rc) {
-		log_write(LOG_ERR, "%s: failed to initialize interrupt\n", pdev->name);
-		goto device_mem_free;
-	}
+	log_write(LOG_DEBUG, "%s: Attached device fd %d\n", pdev->name, fds->device_fd);
 
 	return 0;
 
-device_mem_free:
-	vfio_pci_device_mem_free(pdev);
-close_device_fd:
-	close(device_fd);
-clear_group:
-	vfio_clear_group(group_fd);
+close_fds:
+	close(fds->device_fd);
+	close(fds->group_fd);
+	close(fds->container_fd);
 	return -1;
 }
 
 static int
-vfio_pci_set_irqs(struct vfio_pci_device *pdev)
+vfio_pci_set_irqs(struct vfio_pci_device *pdev, uint32_t start, uint32_t count)
 {
-	struct vfio_irq_set *irq_set;
-	size_t irq_set_size;
-	int rc, *irq_data;
-	uint32_t i;
+	struct vfio_irq_set *irq_set = pdev->intr.irq_set;
+	int rc;
 
-	irq_set_size = sizeof(struct vfio_irq_set) + pdev->intr.count * sizeof(int);
-	irq_set = calloc(1, irq_set_size);
+	/* Emulated devices have no VFIO irq to bind, the eventfds are raised directly */
+	if (pdev->emulated)
+		return 0;
+
+	/* The number of vectors is fixed by the first call which enables MSI-X */
+	if (!pdev->intr.msix_enabled) {
+		start = 0;
+		count = pdev->intr.count;
+	}
 
-	irq_set->argsz = irq_set_size;
+	irq_set->argsz = sizeof(struct vfio_irq_set) + count * sizeof(int32_t);
 	irq_set->flags = VFIO_IRQ_SET_DATA_EVENTFD | VFIO_IRQ_SET_ACTION_TRIGGER;
 	irq_set->index = VFIO_PCI_MSIX_IRQ_INDEX;
-	irq_set->start = 0;
-	irq_set->count = pdev->intr.count;
-
-	irq_data = (int *)(irq_set->data);
-	for (i = 0; i < pdev->intr.count; i++)
-		irq_data[i] = pdev->intr.efds[i];
+	irq_set->start = start;
+	irq_set->count = count;
+	memcpy(irq_set->data, &pdev->intr.efds[start], count * sizeof(int32_t));
 
 	rc = ioctl(pdev->device_fd, VFIO_DEVICE_SET_IRQS, irq_set);
 	if (rc)
 		log_write(LOG_ERR, "%s: failed to set IRQs, %s\n", pdev->name, strerror(errno));
+	else
+		pdev->intr.msix_enabled = true;
 
-	free(irq_set);
 	return rc;
 }
 
-int
-vfio_pci_msix_enable(struct vfio_pci_device *pdev, uint32_t vec)
+static inline bool
+vfio_pci_msix_selected(const uint64_t *mask, uint32_t vec)
+{
+	return !mask || (mask[vec / 64] & (1ULL << (vec % 64)));
+}
+
+/*
+ * Enable or disable the vectors in [start, start + count) which are selected in
+ * mask, or all of them if mask is NULL, with a single VFIO_DEVICE_SET_IRQS call
+ * covering the changed vectors.
+ */
+static int
+vfio_pci_msix_update(struct vfio_pci_device *pdev, const uint64_t *mask, uint32_t start,
+		     uint32_t count, bool enable)
 {
+	uint32_t vec, first = UINT32_MAX, last = 0;
+	bool set = false;
 	int rc = -1;
 
 	pthread_mutex_lock(&pdev->intr.lock);
 
-	if (vec >= pdev->intr.count) {
-		log_write(LOG_ERR, "%s: invalid vector %d\n", pdev->name, vec);
+	if (!count || start >= pdev->intr.count || count > pdev->intr.count - start) {
+		log_write(LOG_ERR, "%s: invalid vectors %u-%u\n", pdev->name, start,
+			  start + count - 1);
 		goto exit;
 	}
 
-	if (pdev->intr.efds[vec] != -1) {
-		log_write(LOG_ERR, "%s: vector %d already enabled\n", pdev->name, vec);
-		goto exit;
+	for (vec = start; vec < start + count; vec++) {
+		if (!vfio_pci_msix_selected(mask, vec))
+			continue;
+
+		if (enable && pdev->intr.efds[vec] != -1) {
+			log_write(LOG_ERR, "%s: vector %d already enabled\n", pdev->name, vec);
+			goto exit;
+		}
+
+		if (!enable && pdev->intr.efds[vec] == -1) {
+			/* Disabling a range or set skips the vectors already disabled */
+			if (count > 1)
+				continue;
+			log_write(LOG_ERR, "%s: vector %d already disabled\n", pdev->name, vec);
+			goto exit;
+		}
+
+		if (vec < first)
+			first = vec;
+		last = vec;
 	}
 
-	pdev->intr.efds[vec] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
-	if (pdev->intr.efds[vec] < 0) {
-		log_write(LOG_ERR, "%s: failed to create eventfd, %s\n", pdev->name,
-			  strerror(errno));
+	if (first == UINT32_MAX) {
+		rc = 0;
 		goto exit;
 	}
 
-	rc = vfio_pci_set_irqs(pdev);
+	for (vec = first; vec <= last; vec++) {
+		if (!vfio_pci_msix_selected(mask, vec))
+			continue;
+
+		if (!enable) {
+			if (pdev->intr.efds[vec] == -1)
+				continue;
+			if (close(pdev->intr.efds[vec]))
+				log_write(LOG_ERR, "%s: failed to close eventfd, %s\n", pdev->name,
+					  strerror(errno));
+			pdev->intr.efds[vec] = -1;
+			/* The VFIO irq is left to the process the device is handed over to */
+			set |= !pdev->intr.handed_over;
+			continue;
+		}
+
+		/* A vector enabled by the previous process keeps its eventfd and VFIO irq */
+		if (pdev->intr.adopted && pdev->intr.adopted[vec] != -1) {
+			pdev->intr.efds[vec] = pdev->intr.adopted[vec];
+			pdev->intr.adopted[vec] = -1;
+			continue;
+		}
+
+		set = true;
+		pdev->intr.efds[vec] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (pdev->intr.efds[vec] < 0) {
+			log_write(LOG_ERR, "%s: failed to create eventfd, %s\n", pdev->name,
+				  strerror(errno));
+			last = vec;
+			goto rollback;
+		}
+	}
+
+	rc = set ? vfio_pci_set_irqs(pdev, first, last - first + 1) : 0;
+	if (!rc || !enable)
+		goto exit;
+
+rollback:
+	for (vec = first; vec <= last; vec++) {
+		if (vfio_pci_msix_selected(mask, vec) && pdev->intr.efds[vec] >= 0) {
+			close(pdev->intr.efds[vec]);
+			pdev->intr.efds[vec] = -1;
+		}
+	}
+	rc = -1;
 exit:
 	pthread_mutex_unlock(&pdev->intr.lock);
 	return rc;
 }
 
+int
+vfio_pci_msix_enable(struct vfio_pci_device *pdev, uint32_t vec)
+{
+	return vfio_pci_msix_update(pdev, NULL, vec, 1, true);
+}
+
 int
 vfio_pci_msix_disable(struct vfio_pci_device *pdev, uint32_t vec)
 {
-	int rc = -1;
+	return vfio_pci_msix_update(pdev, NULL, vec, 1, false);
+}
 
-	pthread_mutex_lock(&pdev->intr.lock);
+int
+vfio_pci_msix_enable_range(struct vfio_pci_device *pdev, uint32_t start, uint32_t count)
+{
+	return vfio_pci_msix_update(pdev, NULL, start, count, true);
+}
 
-	if (vec >= pdev->intr.count) {
-		log_write(LOG_ERR, "%s: invalid vector %d\n", pdev->name, vec);
-		goto exit;
-	}
+int
+vfio_pci_msix_disable_range(struct vfio_pci_device *pdev, uint32_t start, uint32_t count)
+{
+	return vfio_pci_msix_update(pdev, NULL, start, count, false);
+}
 
-	if (pdev->intr.efds[vec] == -1) {
-		log_write(LOG_ERR, "%s: vector %d already disabled\n", pdev->name, vec);
-		goto exit;
-	}
+int
+vfio_pci_msix_enable_set(struct vfio_pci_device *pdev, const uint64_t *mask, uint32_t nb_vecs)
+{
+	return vfio_pci_msix_update(pdev, mask, 0, nb_vecs, true);
+}
 
-	rc = close(pdev->intr.efds[vec]);
-	if (rc) {
-		log_write(LOG_ERR, "%s: failed to close eventfd, %s\n", pdev->name,
-			  strerror(errno));
-		goto exit;
+int
+vfio_pci_msix_disable_set(struct vfio_pci_device *pdev, const uint64_t *mask, uint32_t nb_vecs)
+{
+	return vfio_pci_msix_update(pdev, mask, 0, nb_vecs, false);
+}
+
+int
+vfio_pci_msix_adopt(struct vfio_pci_device *pdev, const int32_t *efds, uint32_t count)
+{
+	uint32_t vec;
+
+	pthread_mutex_lock(&pdev->intr.lock);
+	if (!pdev->intr.adopted)
+		pdev->intr.adopted = malloc(pdev->intr.count * sizeof(int32_t));
+	if (!pdev->intr.adopted) {
+		pthread_mutex_unlock(&pdev->intr.lock);
+		log_write(LOG_ERR, "%s: failed to allocate memory for eventfds\n", pdev->name);
+		for (vec = 0; vec < count; vec++) {
+			if (efds[vec] != -1)
+				close(efds[vec]);
+		}
+		return -1;
 	}
 
-	pdev->intr.efds[vec] = -1;
+	memset(pdev->intr.adopted, -1, pdev->intr.count * sizeof(int32_t));
+	for (vec = 0; vec < count; vec++) {
+		if (efds[vec] == -1)
+			continue;
 
-	rc = vfio_pci_set_irqs(pdev);
-exit:
+		if (vec >= pdev->intr.count) {
+			close(efds[vec]);
+			continue;
+		}
+
+		/* MSI-X is enabled in the device with the vectors of the previous process */
+		pdev->intr.adopted[vec] = efds[vec];
+		pdev->intr.msix_enabled = true;
+	}
 	pthread_mutex_unlock(&pdev->intr.lock);
-	return rc;
+
+	return 0;
 }
 
 static void
@@ -441,17 +642,57 @@ vfio_pci_disable_interrupts(struct vfio_pci_device *pdev)
 	irq_set.flags = VFIO_IRQ_SET_DATA_NONE | VFIO_IRQ_SET_ACTION_TRIGGER;
 	irq_set.index = VFIO_PCI_MSIX_IRQ_INDEX;
 
-	ioctl(pdev->device_fd, VFIO_DEVICE_SET_IRQS, &irq_set);
+	if (!pdev->intr.handed_over)
+		ioctl(pdev->device_fd, VFIO_DEVICE_SET_IRQS, &irq_set);
 
 	for (i = 0; i < pdev->intr.count; i++) {
 		if (pdev->intr.efds[i] != -1)
 			close(pdev->intr.efds[i]);
+		if (pdev->intr.adopted && pdev->intr.adopted[i] != -1)
+			close(pdev->intr.adopted[i]);
 	}
 
+	free(pdev->intr.adopted);
+	pdev->intr.adopted = NULL;
 	free(pdev->intr.efds);
+	free(pdev->intr.irq_set);
+	pdev->intr.irq_set = NULL;
+	pdev->intr.msix_enabled = false;
 	pdev->intr.count = 0;
 }
 
+int
+vfio_pci_device_handover(struct vfio_pci_device *pdev, struct vfio_pci_fds *fds)
+{
+	fds->container_fd = dup(vfio_cfg.container_fd);
+	fds->group_fd = dup(pdev->group_fd);
+	fds->device_fd = dup(pdev->device_fd);
+	if (fds->container_fd < 0 || fds->group_fd < 0 || fds->device_fd < 0) {
+		log_write(LOG_ERR, "%s: failed to duplicate the VFIO fds, %s\n", pdev->name,
+			  strerror(errno));
+		vfio_pci_fds_close(fds);
+		return -1;
+	}
+
+	pdev->intr.handed_over = true;
+
+	return 0;
+}
+
+void
+vfio_pci_fds_close(struct vfio_pci_fds *fds)
+{
+	if (fds->device_fd >= 0)
+		close(fds->device_fd);
+	if (fds->group_fd >= 0)
+		close(fds->group_fd);
+	if (fds->container_fd >= 0)
+		close(fds->container_fd);
+	fds->device_fd = -1;
+	fds->group_fd = -1;
+	fds->container_fd = -1;
+}
+
 void
 vfio_pci_device_free(struct vfio_pci_device *pdev)
 {
@@ -16,6 +16,7 @@
 #define __VFIO_PCI_H__
 
 #include <pthread.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 #include "uuid.h"
@@ -30,8 +31,25 @@ struct vfio_intr_data {
 	uint32_t count;       /**< Number of MSI-X vectors. */
 	int32_t *efds;        /**< Eventfd file descriptors. */
 	pthread_mutex_t lock; /**< Lock for interrupt conf */
+	void *irq_set;        /**< Preallocated VFIO_DEVICE_SET_IRQS argument */
+	bool msix_enabled;    /**< MSI-X enabled in the device */
+	int32_t *adopted;     /**< Eventfds of the vectors enabled by the previous process */
+	bool handed_over;     /**< Device handed over, the VFIO irqs are left as they are */
 };
 
+/** VFIO fds of a device, handed over to another process */
+struct vfio_pci_fds {
+	int container_fd; /**< VFIO container fd */
+	int group_fd;     /**< VFIO group fd */
+	int device_fd;    /**< VFIO device fd */
+};
+
+/** Number of 64-bit words in a bitmap of n MSI-X vectors */
+#define VFIO_PCI_MSIX_MASK_WORDS(n) (((n) + 63) / 64)
+
+/** Set vector vec in an MSI-X vector bitmap */
+#define VFIO_PCI_MSIX_MASK_SET(mask, vec) ((mask)[(vec) / 64] |= 1ULL << ((vec) % 64))
+
 /** VFIO PCI device */
 struct vfio_pci_device {
 	char name[32];                    /**< PCI BDF */
@@ -41,6 +59,7 @@ struct vfio_pci_device {
 	unsigned int num_resource;        /**< Number of device resources */
 	struct vfio_pci_mem_resouce *mem; /**< Device resources */
 	struct vfio_intr_data intr;       /**< Interrupt data */
+	bool emulated;                    /**< No VFIO device, eventfds raised in software */
 };
 
 /* End of structure vfio_pci_device. */
@@ -54,6 +73,37 @@ struct vfio_pci_device {
  */
 int vfio_pci_device_setup(struct vfio_pci_device *pdev);
 
+/**
+ * Set up a VFIO pci device from the fds handed over by another process and map
+ * its regions. The device is neither reset nor reconfigured, MSI-X keeps the
+ * vectors of the other process, see vfio_pci_msix_adopt(). The fds are owned
+ * by the device, they are closed on failure.
+ *
+ * @param	pdev	Pointer to VFIO pci device structure, with the PCI BDF set.
+ * @param	fds	VFIO fds of the device.
+ * @return		Zero on success.
+ */
+int vfio_pci_device_attach(struct vfio_pci_device *pdev, const struct vfio_pci_fds *fds);
+
+/**
+ * Get duplicates of the VFIO fds of a device, to hand it over to another
+ * process. From then on, disabling a vector or releasing the device leaves
+ * the VFIO irqs as they are, and the device is not reset by the release while
+ * the other process keeps the fds open.
+ *
+ * @param	pdev	Pointer to VFIO pci device structure.
+ * @param	fds	Set to the duplicated fds, to close with vfio_pci_fds_close().
+ * @return		Zero on success.
+ */
+int vfio_pci_device_handover(struct vfio_pci_device *pdev, struct vfio_pci_fds *fds);
+
+/**
+ * Close the VFIO fds of a device and set them to -1.
+ *
+ * @param	fds	VFIO fds, the fds already set to -1 are skipped.
+ */
+void vfio_pci_fds_close(struct vfio_pci_fds *fds);
+
 /**
  * Release a VFIO pci device and free the associated memory.
  *
@@ -79,4 +129,63 @@ int vfio_pci_msix_enable(struct vfio_pci_device *pdev, uint32_t vector);
  */
 int vfio_pci_msix_disable(struct vfio_pci_device *pdev, uint32_t vector);
 
+/**
+ * Enable a range of MSI-X vectors with a single VFIO_DEVICE_SET_IRQS call.
+ * None of the vectors is enabled if the call fails.
+ *
+ * @param	pdev	Pointer to VFIO pci device structure.
+ * @param	start	First MSI-X vector to enable.
+ * @param	count	Number of vectors to enable.
+ * @return		Zero on success.
+ */
+int vfio_pci_msix_enable_range(struct vfio_pci_device *pdev, uint32_t start, uint32_t count);
+
+/**
+ * Disable a range of MSI-X vectors with a single VFIO_DEVICE_SET_IRQS call.
+ * Vectors which are already disabled are skipped.
+ *
+ * @param	pdev	Pointer to VFIO pci device structure.
+ * @param	start	First MSI-X vector to disable.
+ * @param	count	Number of vectors to disable.
+ * @return		Zero on success.
+ */
+int vfio_pci_msix_disable_range(struct vfio_pci_device *pdev, uint32_t start, uint32_t count);
+
+/**
+ * Enable a set of MSI-X vectors with a single VFIO_DEVICE_SET_IRQS call.
+ * None of the vectors is enabled if the call fails.
+ *
+ * @param	pdev	Pointer to VFIO pci device structure.
+ * @param	mask	Bitmap of the vectors to enable, see VFIO_PCI_MSIX_MASK_SET().
+ * @param	nb_vecs	Number of vectors covered by the bitmap.
+ * @return		Zero on success.
+ */
+int vfio_pci_msix_enable_set(struct vfio_pci_device *pdev, const uint64_t *mask,
+			     uint32_t nb_vecs);
+
+/**
+ * Disable a set of MSI-X vectors with a single VFIO_DEVICE_SET_IRQS call.
+ * Vectors which are already disabled are skipped.
+ *
+ * @param	pdev	Pointer to VFIO pci device structure.
+ * @param	mask	Bitmap of the vectors to disable, see VFIO_PCI_MSIX_MASK_SET().
+ * @param	nb_vecs	Number of vectors covered by the bitmap.
+ * @return		Zero on success.
+ */
+int vfio_pci_msix_disable_set(struct vfio_pci_device *pdev, const uint64_t *mask,
+			      uint32_t nb_vecs);
+
+/**
+ * Take the eventfds of the vectors the previous process of a handed over
+ * device enabled. Enabling one of those vectors uses its eventfd and leaves
+ * the VFIO irq as it is, so no interrupt is lost in between. The eventfds are
+ * owned by the device, those never enabled are closed on release.
+ *
+ * @param	pdev	Pointer to VFIO pci device structure.
+ * @param	efds	Eventfd of each vector, -1 for the vectors not enabled.
+ * @param	count	Number of vectors in efds.
+ * @return		Zero on success.
+ */
+int vfio_pci_msix_adopt(struct vfio_pci_device *pdev, const int32_t *efds, uint32_t count);
+
 #endif /* __VFIO_PCI_H__ */
@@ -11,8 +11,9 @@
  * vectors. The register requires a callback function to be provided. The
  * interrupt callback function will be called with the argument provided in
  * cb_arg when an interrupt is received. The callback function should be short
- * and non-blocking as it will be called in the interrupt handler. The interrupt
- * library is thread-safe.
+ * and non-blocking as it will be called on the reactor thread, see reactor.h.
+ * The interrupt library is thread-safe, and once a vector is unregistered its
+ * callback is no longer running.
  *
  * Enabling an interrupt is a two step process. First, the interrupt should be
  * enabled using the vfio_pci_msix_enable() function. Then, the interrupt should
@@ -61,4 +62,17 @@ int vfio_pci_irq_register(struct vfio_pci_device *pdev, uint16_t vec, vfio_pci_i
  */
 int vfio_pci_irq_unregister(struct vfio_pci_device *pdev, uint16_t vec);
 
+/**
+ * Stop or resume waiting for a registered interrupt vector, for a source
+ * without an enable register. The interrupts raised while the vector is
+ * paused add up in its eventfd, the callback is called once when it is
+ * resumed.
+ *
+ * @param	pdev		The PCI device of the interrupt.
+ * @param	vec		The interrupt vector.
+ * @param	pause		true to pause, false to resume.
+ * @return			0 on success, -1 on failure.
+ */
+int vfio_pci_irq_pause(struct vfio_pci_device *pdev, uint16_t vec, bool pause);
+
 #endif /* _VFIO_PCI_IRQ_H_ */